@@ -0,0 +1,227 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "../lib/utilities.h"
+#include "../lib/transfer.h"
+
+#define DISTRIBUTION_FIXED 0
+#define DISTRIBUTION_UNIFORM 1
+#define DISTRIBUTION_EXPONENTIAL 2
+#define DISTRIBUTION_LOGNORMAL 3
+
+typedef struct Link Link;
+typedef struct Distribution Distribution;
+
+struct Link {
+    int in;
+    int out;
+    double bytes_per_second;
+};
+
+struct Distribution {
+    int kind;
+    double a;
+    double b;
+};
+
+void connect_pair(int *a, int *b);
+void *relay(void *argv);
+char *generate_text(char *path, long size, unsigned int seed);
+bool parse_distribution(char *spec, Distribution *distribution);
+double sample_distribution(Distribution *distribution, unsigned int *seed);
+int compare_latency(const void *a, const void *b);
+double get_percentile(double *sorted, long count, double percentile);
+
+/**
+ * Creates a connected pair of loopback TCP sockets.
+ *
+ * @param a The connecting end.
+ * @param b The accepted end.
+ */
+void connect_pair(int *a, int *b) {
+    struct sockaddr_in address;
+    socklen_t len = sizeof address;
+
+    memset(&address, 0, sizeof address);
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+
+    if (listener == -1 || bind(listener, (struct sockaddr *)&address, sizeof address) == -1 || listen(listener, 1) == -1) {
+        perror("[X] bind");
+        exit(1);
+    }
+
+    getsockname(listener, (struct sockaddr *)&address, &len);
+
+    *a = socket(AF_INET, SOCK_STREAM, 0);
+
+    if (connect(*a, (struct sockaddr *)&address, sizeof address) == -1) {
+        perror("[X] connect");
+        exit(1);
+    }
+
+    *b = accept(listener, NULL, NULL);
+
+    close(listener);
+}
+
+/**
+ * Copies everything from one socket to another no faster than the link's bandwidth.
+ *
+ * A bandwidth of 0 copies as fast as possible. The output is shut down for
+ * writing once the input reaches end of file.
+ *
+ * @param argv The Link to emulate.
+ */
+void *relay(void *argv) {
+    Link *link = (Link *)argv;
+    char chunk[16 * 1024];
+    double started = now_seconds();
+    long total = 0;
+    ssize_t n;
+
+    while ((n = read(link->in, chunk, sizeof(chunk))) > 0) {
+        total += n;
+
+        if (link->bytes_per_second > 0) {
+            double due = started + total / link->bytes_per_second;
+            double now = now_seconds();
+
+            if (due > now)
+                usleep((useconds_t)((due - now) * 1e6));
+        }
+
+        if (!send_all(link->out, chunk, n, NULL))
+            break;
+    }
+
+    shutdown(link->out, SHUT_WR);
+
+    pthread_exit(NULL);
+}
+
+/**
+ * Writes a synthetic text file of words drawn from a skewed vocabulary.
+ *
+ * @param path The path of the file, or a mkstemp() template ending in "XXXXXX".
+ * @param size The size of the file.
+ * @param seed The seed of the word sequence.
+ *
+ * @return The path to the generated file.
+ */
+char *generate_text(char *path, long size, unsigned int seed) {
+    int fd = strstr(path, "XXXXXX") ? mkstemp(path) : open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    FILE *file = fdopen(fd, "w");
+    long written = 0;
+
+    srand(seed);
+
+    while (written < size) {
+        /* Squaring skews the distribution so that short, common words dominate like in prose. */
+        int r = rand() % 64;
+        int word = r * r;
+        int length = 2 + word % 9;
+
+        for (int i = 0; i < length && written < size; i++, written++)
+            fputc('a' + (word * 7 + i * 13) % 26, file);
+
+        if (written < size) {
+            fputc(rand() % 12 == 0 ? '\n' : ' ', file);
+            written++;
+        }
+    }
+
+    fclose(file);
+
+    return path;
+}
+
+/**
+ * Parses an execution-time distribution.
+ *
+ * @param spec "fixed:MS", "uniform:MIN:MAX", "exp:MEAN" or "lognormal:MEDIAN:SIGMA".
+ * @param distribution Receives the distribution, in seconds.
+ *
+ * @return Whether or not the spec was valid.
+ */
+bool parse_distribution(char *spec, Distribution *distribution) {
+    double a, b;
+
+    if (sscanf(spec, "fixed:%lf", &a) == 1 && a >= 0) {
+        *distribution = (Distribution){ DISTRIBUTION_FIXED, a / 1e3, 0 };
+    } else if (sscanf(spec, "uniform:%lf:%lf", &a, &b) == 2 && 0 <= a && a <= b) {
+        *distribution = (Distribution){ DISTRIBUTION_UNIFORM, a / 1e3, b / 1e3 };
+    } else if (sscanf(spec, "exp:%lf", &a) == 1 && a > 0) {
+        *distribution = (Distribution){ DISTRIBUTION_EXPONENTIAL, a / 1e3, 0 };
+    } else if (sscanf(spec, "lognormal:%lf:%lf", &a, &b) == 2 && a > 0 && b >= 0) {
+        *distribution = (Distribution){ DISTRIBUTION_LOGNORMAL, a / 1e3, b };
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Draws an execution time.
+ *
+ * @param distribution The distribution to draw from.
+ * @param seed The drawing slave's rand_r() state.
+ *
+ * @return The execution time in seconds.
+ */
+double sample_distribution(Distribution *distribution, unsigned int *seed) {
+    /* Both are in (0, 1], so their logarithms are finite. */
+    double u = 1.0 - (double)rand_r(seed) / ((double)RAND_MAX + 1);
+    double v = 1.0 - (double)rand_r(seed) / ((double)RAND_MAX + 1);
+
+    switch (distribution->kind) {
+        case DISTRIBUTION_UNIFORM:
+            return distribution->a + (distribution->b - distribution->a) * (1 - u);
+        case DISTRIBUTION_EXPONENTIAL:
+            return -log(u) * distribution->a;
+        case DISTRIBUTION_LOGNORMAL:
+            /* Box-Muller turns the two uniform draws into a standard normal one. */
+            return distribution->a * exp(distribution->b * sqrt(-2 * log(u)) * cos(2 * M_PI * v));
+        default:
+            return distribution->a;
+    }
+}
+
+int compare_latency(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+/**
+ * Reads a percentile off sorted values with the nearest-rank method.
+ *
+ * @param sorted The values, in ascending order.
+ * @param count The number of values.
+ * @param percentile The percentile, between 0 and 100.
+ *
+ * @return The percentile, or 0 when there are no values.
+ */
+double get_percentile(double *sorted, long count, double percentile) {
+    if (count == 0)
+        return 0;
+
+    long rank = (long)ceil(percentile / 100 * count);
+
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+#endif
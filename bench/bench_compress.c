@@ -0,0 +1,200 @@
+/**
+ * A C program used to benchmark the on-the-wire LZ codec.
+ *
+ * It first measures raw compression and decompression speed and the ratio on
+ * the input, then streams the input over loopback TCP through a relay that
+ * throttles the link to a given bandwidth, once uncompressed and once with the
+ * LZ codec, to show where compression stops paying for its CPU time.
+ *
+ * To properly compile this program see COMPILE:
+ *
+ * COMPILE: gcc bench/bench_compress.c -lpthread -lm -o bench_compress
+ *
+ * To properly use this program see USAGE:
+ *
+ * USAGE: ./bench_compress [INPUT_FILE]
+ * e.g. ./bench_compress jobs/count-words/in.txt
+ *
+ * Without an input file a 32 MB synthetic text file is generated. Every
+ * measurement prints one JSON line on stdout.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "../lib/utilities.h"
+#include "../lib/transfer.h"
+#include "../lib/compress.h"
+#include "bench.h"
+
+#define SYNTHETIC_SIZE (32 * 1024 * 1024)
+
+typedef struct Sender Sender;
+
+struct Sender {
+    int socket;
+    char *file_path;
+    long size;
+    int codec;
+};
+
+void *send_input(void *argv);
+void bench_codec(char *file_path, long size);
+double bench_link(char *file_path, long size, int codec, double bytes_per_second);
+
+/**
+ * Sends the input file with the sender's codec.
+ *
+ * @param argv The Sender describing the run.
+ */
+void *send_input(void *argv) {
+    Sender *sender = (Sender *)argv;
+
+    send_encoded_file(sender->socket, sender->file_path, sender->size, sender->codec, NULL);
+    close(sender->socket);
+
+    pthread_exit(NULL);
+}
+
+/**
+ * Measures compression and decompression speed and the compression ratio.
+ *
+ * @param file_path The input file.
+ * @param size The size of the input file.
+ */
+void bench_codec(char *file_path, long size) {
+    Buffer *input = read_file(file_path, "rb");
+    char *encoded = (char *)malloc(lz_compress_bound(LZ_BLOCK_SIZE));
+    char *decoded = (char *)malloc(LZ_BLOCK_SIZE);
+    long encoded_total = 0;
+
+    double started = now_seconds();
+
+    for (long offset = 0; offset < size; offset += LZ_BLOCK_SIZE) {
+        long n = size - offset < LZ_BLOCK_SIZE ? size - offset : LZ_BLOCK_SIZE;
+        long m = lz_compress(input->data + offset, n, encoded, lz_compress_bound(LZ_BLOCK_SIZE));
+
+        encoded_total += m;
+    }
+
+    double compress_seconds = now_seconds() - started;
+
+    started = now_seconds();
+
+    for (long offset = 0; offset < size; offset += LZ_BLOCK_SIZE) {
+        long n = size - offset < LZ_BLOCK_SIZE ? size - offset : LZ_BLOCK_SIZE;
+        long m = lz_compress(input->data + offset, n, encoded, lz_compress_bound(LZ_BLOCK_SIZE));
+
+        if (lz_decompress(encoded, m, decoded, LZ_BLOCK_SIZE) != n || memcmp(decoded, input->data + offset, n) != 0) {
+            fputs("[X] lz_decompress: round trip mismatch.\n", stderr);
+            exit(1);
+        }
+    }
+
+    /* The second pass compresses and decompresses, so subtract the compression time. */
+    double decompress_seconds = now_seconds() - started - compress_seconds;
+
+    printf("{\"bench\": \"codec\", \"codec\": \"lz\", \"bytes\": %ld, \"encoded_bytes\": %ld, \"ratio\": %.3f, "
+           "\"compress_mb_per_s\": %.2f, \"decompress_mb_per_s\": %.2f}\n",
+           size, encoded_total, (double)size / encoded_total,
+           size / compress_seconds / (1024 * 1024),
+           size / (decompress_seconds > 0 ? decompress_seconds : 1e-9) / (1024 * 1024));
+
+    free(input->data);
+    free(input);
+    free(encoded);
+    free(decoded);
+}
+
+/**
+ * Streams the input through a throttled loopback link and decodes it on the far side.
+ *
+ * @param file_path The input file.
+ * @param size The size of the input file.
+ * @param codec The codec to send the input with.
+ * @param bytes_per_second The bandwidth of the emulated link.
+ *
+ * @return The end-to-end time in seconds.
+ */
+double bench_link(char *file_path, long size, int codec, double bytes_per_second) {
+    int sender_end, relay_in, relay_out, receiver_end;
+
+    connect_pair(&sender_end, &relay_in);
+    connect_pair(&relay_out, &receiver_end);
+
+    Sender sender = { sender_end, file_path, size, codec };
+    Link link = { relay_in, relay_out, bytes_per_second };
+    pthread_t sender_thread, relay_thread;
+
+    double started = now_seconds();
+
+    pthread_create(&sender_thread, NULL, send_input, &sender);
+    pthread_create(&relay_thread, NULL, relay, &link);
+
+    int sink = open("/dev/null", O_WRONLY);
+    bool received = codec == CODEC_LZ
+        ? recv_decompressed(receiver_end, sink, size, NULL)
+        : copy_stream(receiver_end, sink, size, MIN_CHUNK_SIZE, NULL);
+
+    double elapsed = now_seconds() - started;
+
+    if (!received) {
+        fputs("[X] bench_link: short transfer.\n", stderr);
+        exit(1);
+    }
+
+    pthread_join(sender_thread, NULL);
+    pthread_join(relay_thread, NULL);
+
+    close(sink);
+    close(relay_in);
+    close(relay_out);
+    close(receiver_end);
+
+    return elapsed;
+}
+
+int main(int argc, char **argv) {
+    char template[] = "/tmp/bench_compress_XXXXXX";
+    char *file_path = argc > 1 ? argv[1] : generate_text(template, SYNTHETIC_SIZE, 42);
+    Buffer *input = stat_file(file_path);
+
+    if (!input)
+        return 1;
+
+    bench_codec(file_path, input->size);
+
+    double megabits[] = { 10, 100, 1000, 10000 };
+
+    for (int i = 0; i < (int)(sizeof(megabits) / sizeof(megabits[0])); i++) {
+        double bytes_per_second = megabits[i] * 1000 * 1000 / 8;
+
+        /* Keep slow links to a few seconds per run. */
+        long size = input->size;
+        double budget = bytes_per_second * 4;
+
+        if (size > budget)
+            size = (long)budget;
+
+        for (int codec = CODEC_NONE; codec <= CODEC_LZ; codec++) {
+            double seconds = bench_link(file_path, size, codec, bytes_per_second);
+
+            printf("{\"bench\": \"compress_link\", \"codec\": \"%s\", \"link_mbit_per_s\": %.0f, \"bytes\": %ld, "
+                   "\"seconds\": %.6f, \"effective_mb_per_s\": %.2f}\n",
+                   get_codec_name(codec), megabits[i], size, seconds, size / seconds / (1024 * 1024));
+        }
+    }
+
+    if (argc <= 1)
+        unlink(file_path);
+
+    free(input);
+
+    return 0;
+}
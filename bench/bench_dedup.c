@@ -0,0 +1,176 @@
+/**
+ * A C program used to benchmark chunk-level deduplication on an "edited file" workload.
+ *
+ * A synthetic text file is submitted, then an edited copy of it (a few small
+ * insertions, deletions and overwrites), each once uncompressed and once as a
+ * deduplicated manifest against a receiver-side chunk store. The link is
+ * throttled in the sender-to-receiver direction to emulate a shared network.
+ *
+ * To properly compile this program see COMPILE:
+ *
+ * COMPILE: gcc bench/bench_dedup.c -lpthread -lm -o bench_dedup
+ *
+ * To properly use this program see USAGE:
+ *
+ * USAGE: ./bench_dedup [MEGABYTES] [LINK_MBIT_PER_S]
+ * e.g. ./bench_dedup 32 200
+ *
+ * Every submission prints one JSON line on stdout.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "../lib/utilities.h"
+#include "../lib/transfer.h"
+#include "../lib/compress.h"
+#include "../lib/dedup.h"
+#include "bench.h"
+
+typedef struct Sender Sender;
+
+struct Sender {
+    int socket;
+    char *file_path;
+    long size;
+    int codec;
+    TransferStats stats;
+    long saved;
+};
+
+void edit_file(char *source, char *dest);
+void *send_input(void *argv);
+void submit(char *label, char *file_path, int codec, ChunkStore *store, double bytes_per_second);
+
+/**
+ * Copies a file while applying a handful of small edits spread across it.
+ *
+ * @param source The original file.
+ * @param dest The edited copy.
+ */
+void edit_file(char *source, char *dest) {
+    Buffer *original = read_file(source, "rb");
+    FILE *file = fopen(dest, "wb");
+    long quarter = original->size / 4;
+
+    /* An insertion, an overwrite and a deletion of about a kilobyte each. */
+    fwrite(original->data, 1, quarter, file);
+    fputs("an inserted paragraph that shifts every following byte ", file);
+    fwrite(original->data + quarter, 1, quarter, file);
+    fwrite("XXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXX", 1, 90, file);
+    fwrite(original->data + 2 * quarter + 90, 1, quarter - 90, file);
+    fwrite(original->data + 3 * quarter + 1024, 1, original->size - 3 * quarter - 1024, file);
+
+    fclose(file);
+
+    free(original->data);
+    free(original);
+}
+
+/**
+ * Sends the input file with the sender's codec.
+ *
+ * @param argv The Sender describing the submission.
+ */
+void *send_input(void *argv) {
+    Sender *sender = (Sender *)argv;
+
+    if (sender->codec == CODEC_CDC)
+        send_deduplicated_file(sender->socket, sender->file_path, sender->size, &sender->stats, &sender->saved);
+    else
+        send_file(sender->socket, sender->file_path, sender->size, &sender->stats);
+
+    shutdown(sender->socket, SHUT_WR);
+
+    pthread_exit(NULL);
+}
+
+/**
+ * Submits a file over a throttled loopback link and reports the bytes moved and the latency.
+ *
+ * @param label The name of the submission in the report.
+ * @param file_path The file to submit.
+ * @param codec CODEC_NONE or CODEC_CDC.
+ * @param store The receiver's chunk store.
+ * @param bytes_per_second The bandwidth of the link from sender to receiver.
+ */
+void submit(char *label, char *file_path, int codec, ChunkStore *store, double bytes_per_second) {
+    int sender_end, relay_in, relay_out, receiver_end;
+
+    connect_pair(&sender_end, &relay_in);
+    connect_pair(&relay_out, &receiver_end);
+
+    Buffer *input = stat_file(file_path);
+    Sender sender = { sender_end, file_path, input->size, codec, {0, 0}, 0 };
+    Link forward = { relay_in, relay_out, bytes_per_second };
+    Link backward = { relay_out, relay_in, 0 };
+    pthread_t sender_thread, forward_thread, backward_thread;
+
+    double started = now_seconds();
+
+    pthread_create(&sender_thread, NULL, send_input, &sender);
+    pthread_create(&forward_thread, NULL, relay, &forward);
+    pthread_create(&backward_thread, NULL, relay, &backward);
+
+    bool received = codec == CODEC_CDC
+        ? recv_deduplicated_file(receiver_end, store, "/dev/null", input->size, 0644, NULL, NULL)
+        : copy_stream(receiver_end, open("/dev/null", O_WRONLY), input->size, MIN_CHUNK_SIZE, NULL);
+
+    double elapsed = now_seconds() - started;
+
+    shutdown(receiver_end, SHUT_WR);
+
+    pthread_join(sender_thread, NULL);
+    pthread_join(forward_thread, NULL);
+    pthread_join(backward_thread, NULL);
+
+    if (!received) {
+        fputs("[X] submit: short transfer.\n", stderr);
+        exit(1);
+    }
+
+    printf("{\"bench\": \"dedup\", \"submission\": \"%s\", \"codec\": \"%s\", \"bytes\": %ld, \"wire_bytes\": %ld, "
+           "\"saved_bytes\": %ld, \"seconds\": %.6f}\n",
+           label, get_codec_name(codec), input->size, sender.stats.bytes, sender.saved, elapsed);
+
+    close(sender_end);
+    close(relay_in);
+    close(relay_out);
+    close(receiver_end);
+
+    free(input);
+}
+
+int main(int argc, char **argv) {
+    long megabytes = argc > 1 ? atol(argv[1]) : 32;
+    double megabits = argc > 2 ? atof(argv[2]) : 200;
+    double bytes_per_second = megabits * 1000 * 1000 / 8;
+
+    char original[] = "/tmp/bench_dedup_XXXXXX";
+    char edited[sizeof(original) + 7];
+    char store_path[sizeof(original) + 7];
+
+    generate_text(original, megabytes * 1024 * 1024, 7);
+    snprintf(edited, sizeof(edited), "%s.edited", original);
+    snprintf(store_path, sizeof(store_path), "%s.chunks", original);
+
+    edit_file(original, edited);
+
+    ChunkStore *store = createChunkStore(store_path, 0);
+
+    submit("original", original, CODEC_NONE, store, bytes_per_second);
+    submit("original", original, CODEC_CDC, store, bytes_per_second);
+    submit("edited", edited, CODEC_NONE, store, bytes_per_second);
+    submit("edited", edited, CODEC_CDC, store, bytes_per_second);
+
+    char command[MAX_BUFFER_SIZE];
+    snprintf(command, sizeof(command), "rm -rf %s %s %s", original, edited, store_path);
+    free(execute(command));
+
+    free(store);
+
+    return 0;
+}
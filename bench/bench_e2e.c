@@ -0,0 +1,239 @@
+/**
+ * A C program used to benchmark a whole cluster on one host.
+ *
+ * It starts a master and SLAVES real slaves from the directory it was built
+ * in, on ports from BASE_PORT so that it does not collide with a running
+ * cluster. Each node runs in its own scratch directory with its output logged
+ * there. Once every slave has registered, dlb-bench submits JOBS countwords
+ * jobs from CONCURRENCY clients, and everything is torn down again.
+ *
+ * To properly compile this program see COMPILE:
+ *
+ * COMPILE: gcc bench/bench_e2e.c -lpthread -lm -o bench_e2e
+ *
+ * To properly use this program see USAGE:
+ *
+ * USAGE: ./bench_e2e [SLAVES] [CONCURRENCY] [JOBS] [BASE_PORT]
+ * e.g. ./bench_e2e 4 8 500
+ *
+ * The run prints one JSON line on stdout, which embeds dlb-bench's result.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "../lib/utilities.h"
+#include "../lib/transfer.h"
+#include "../lib/scheduler.h"
+#include "bench.h"
+
+#define DEFAULT_BASE_PORT 18081
+#define REGISTRATION_TIMEOUT_SECONDS 10
+
+pid_t start_node(char *directory, char *name, char **arguments, char *log_path);
+int count_registered_slaves(int metrics_port);
+void set_port(char *variable, int port);
+
+/**
+ * Starts a node in its own directory, logging its output there.
+ *
+ * @param directory The directory to run the node in.
+ * @param name The path of the node's binary.
+ * @param arguments The node's arguments, starting with its name and ending with NULL.
+ * @param log_path Where to log the node's output, relative to its directory.
+ *
+ * @return The process id of the node.
+ */
+pid_t start_node(char *directory, char *name, char **arguments, char *log_path) {
+    pid_t pid = fork();
+
+    if (pid == -1) {
+        perror("[X] fork");
+        exit(1);
+    }
+
+    if (pid == 0) {
+        int fd;
+
+        if (chdir(directory) == -1 || (fd = open(log_path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1) {
+            perror("[X] chdir");
+            _exit(1);
+        }
+
+        dup2(fd, STDOUT_FILENO);
+        dup2(fd, STDERR_FILENO);
+        close(fd);
+
+        execv(name, arguments);
+        perror("[X] execv");
+        _exit(1);
+    }
+
+    return pid;
+}
+
+/**
+ * Counts the slaves a master lists on its metrics port.
+ *
+ * @param metrics_port The master's metrics port.
+ *
+ * @return The number of registered slaves, or -1 if the master did not answer.
+ */
+int count_registered_slaves(int metrics_port) {
+    struct sockaddr_in address;
+
+    memset(&address, 0, sizeof address);
+    address.sin_family = AF_INET;
+    address.sin_port = htons(metrics_port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+
+    if (sock == -1 || connect(sock, (struct sockaddr *)&address, sizeof address) == -1) {
+        if (sock != -1)
+            close(sock);
+
+        return -1;
+    }
+
+    char *request = "GET /metrics HTTP/1.0\r\n\r\n";
+    send_all(sock, request, strlen(request), NULL);
+
+    /* Every registered slave has one dispatch counter, even before its first job. */
+    char response[64 * 1024], *line;
+    long length = 0;
+    ssize_t n;
+    int slaves = 0;
+
+    while (length < (long)sizeof(response) - 1 && (n = read(sock, response + length, sizeof(response) - 1 - length)) > 0)
+        length += n;
+
+    response[length] = '\0';
+    close(sock);
+
+    for (line = response; (line = strstr(line, "dlb_slave_dispatches_total{")); line++)
+        slaves++;
+
+    return slaves;
+}
+
+/**
+ * Overrides a port for every node started after this.
+ *
+ * @param variable The environment variable naming the port.
+ * @param port The port.
+ */
+void set_port(char *variable, int port) {
+    char value[16];
+    snprintf(value, sizeof(value), "%d", port);
+    setenv(variable, value, 1);
+}
+
+int main(int argc, char **argv) {
+    int slaves = argc > 1 ? atoi(argv[1]) : 4;
+    int concurrency = argc > 2 ? atoi(argv[2]) : 8;
+    long jobs = argc > 3 ? atol(argv[3]) : 500;
+    int base_port = argc > 4 ? atoi(argv[4]) : DEFAULT_BASE_PORT;
+
+    if (slaves < 1 || concurrency < 1 || jobs < 1 || base_port < 1 || base_port + 20 + slaves > 65535) {
+        fprintf(stderr, "USAGE: %s [SLAVES] [CONCURRENCY] [JOBS] [BASE_PORT]\n", argv[0]);
+        return 1;
+    }
+
+    /* The cluster's binaries are built next to this one. */
+    char binaries[PATH_MAX], directory[] = "/tmp/bench-e2e-XXXXXX";
+    ssize_t length = readlink("/proc/self/exe", binaries, sizeof(binaries) - 1);
+
+    if (length == -1 || !mkdtemp(directory)) {
+        perror("[X] readlink");
+        return 1;
+    }
+
+    binaries[length] = '\0';
+    dirname(binaries);
+
+    char master[PATH_MAX + 16], slave[PATH_MAX + 16], countwords[PATH_MAX + 16], bench[PATH_MAX + 16];
+    snprintf(master, sizeof(master), "%s/master", binaries);
+    snprintf(slave, sizeof(slave), "%s/slave", binaries);
+    snprintf(countwords, sizeof(countwords), "%s/countwords", binaries);
+    snprintf(bench, sizeof(bench), "%s/dlb-bench", binaries);
+
+    set_port(LISTEN_FOR_SLAVES_PORT_ENV, base_port);
+    set_port(LISTEN_FOR_CLIENTS_PORT_ENV, base_port + 1);
+    set_port(SEND_CPU_UTILIZATION_PORT_ENV, base_port + 2);
+    set_port(METRICS_PORT_ENV, base_port + 4);
+    setenv(SLAVE_ADDRESS_ENV, "127.0.0.1", 1);
+
+    pid_t *pids = (pid_t *)malloc(sizeof(pid_t) * (slaves + 1));
+    char *master_arguments[] = { master, NULL };
+    char *slave_arguments[] = { slave, "127.0.0.1", NULL };
+    char path[PATH_MAX + 64];
+
+    pids[0] = start_node(directory, master, master_arguments, "master.log");
+
+    /* The master binds its ports in separate threads, so wait for the last to answer. */
+    for (int i = 0; i < REGISTRATION_TIMEOUT_SECONDS * 10 && count_registered_slaves(base_port + 4) == -1; i++)
+        usleep(100000);
+
+    for (int i = 0; i < slaves; i++) {
+        snprintf(path, sizeof(path), "%s/slave%d", directory, i);
+        mkdir(path, 0755);
+
+        /* Each slave writes its jobs' files into its own directory and takes jobs on its own port. */
+        set_port(SEND_JOB_PORT_ENV, base_port + 20 + i);
+        pids[i + 1] = start_node(path, slave, slave_arguments, "slave.log");
+    }
+
+    int registered = 0;
+
+    for (int i = 0; i < REGISTRATION_TIMEOUT_SECONDS * 10 && (registered = count_registered_slaves(base_port + 4)) < slaves; i++)
+        usleep(100000);
+
+    char *result = NULL;
+
+    if (registered == slaves) {
+        char command[PATH_MAX * 3];
+
+        snprintf(path, sizeof(path), "%s/in.txt", directory);
+        generate_text(path, 64 * 1024, 1);
+
+        snprintf(path, sizeof(path), "%s/jobs.txt", directory);
+        FILE *manifest = fopen(path, "w");
+        fprintf(manifest, "%s %s/in.txt\n", countwords, directory);
+        fclose(manifest);
+
+        snprintf(command, sizeof(command), "'%s' 127.0.0.1 '%s' -c %d -n %ld 2>'%s/dlb-bench.log'", bench, path, concurrency, jobs, directory);
+        result = execute(command);
+    } else {
+        fprintf(stderr, "[X] Only %d of %d slaves registered; see the logs in %s.\n", registered, slaves, directory);
+    }
+
+    for (int i = slaves; i >= 0; i--) {
+        kill(pids[i], SIGTERM);
+        waitpid(pids[i], NULL, 0);
+    }
+
+    free(pids);
+
+    if (!result || result[0] != '{') {
+        fprintf(stderr, "[X] dlb-bench failed; see the logs in %s.\n", directory);
+        free(result);
+        return 1;
+    }
+
+    char *policy = getenv(POLICY_ENV);
+
+    printf("{\"bench\": \"e2e\", \"slaves\": %d, \"policy\": \"%s\", \"result\": %s}\n",
+           slaves, get_policy_name(get_policy(policy)), result);
+
+    char command[PATH_MAX];
+    snprintf(command, sizeof(command), "rm -rf '%s'", directory);
+    free(execute(command));
+    free(result);
+
+    return 0;
+}
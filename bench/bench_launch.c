@@ -0,0 +1,212 @@
+/**
+ * A C program used to benchmark how fast a slave can launch jobs.
+ *
+ * Every launch repeats what the slave does around a job once its files have
+ * arrived: it writes the executable, runs the job's command, reads the job's
+ * output file and removes both. The command runs through execute(), as on
+ * the slave, which goes through popen() and a shell. As a baseline, it also
+ * runs directly with posix_spawn(). An executable that follows the
+ * persistent-job ABI also runs in a warm worker, as the slave runs it.
+ *
+ * The job is EXECUTABLE run on a small generated input, and must write
+ * "<EXECUTABLE>_output.txt" like jobs/count-words does. Without an
+ * executable, a shell script that does so is used.
+ *
+ * To properly compile this program see COMPILE:
+ *
+ * COMPILE: gcc bench/bench_launch.c -lpthread -lm -o bench_launch
+ *
+ * To properly use this program see USAGE:
+ *
+ * USAGE: ./bench_launch [EXECUTABLE] [LAUNCHES]
+ * e.g. ./bench_launch countwords 500
+ *
+ * Every mode prints one JSON line on stdout.
+ */
+
+/* For pipe2(), which the worker pool starts workers with. */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+#include "../lib/utilities.h"
+#include "../lib/transfer.h"
+#include "../lib/workerpool.h"
+#include "bench.h"
+
+#define MODE_POPEN 0
+#define MODE_SPAWN 1
+#define MODE_WORKER 2
+
+bool launch(int mode, char *name, Buffer *executable, WorkerPool *workers);
+bool run_in_worker(WorkerPool *workers, char *name, char *command);
+
+/**
+ * Writes a job's executable, runs the job and collects its output.
+ *
+ * @param mode The MODE_* to run the job with.
+ * @param name The name of the job's executable.
+ * @param executable The contents of the job's executable.
+ * @param workers The pool that MODE_WORKER takes workers from.
+ *
+ * @return Whether or not the job wrote its output.
+ */
+bool launch(int mode, char *name, Buffer *executable, WorkerPool *workers) {
+    char command[MAX_BUFFER_SIZE], path[MAX_BUFFER_SIZE], output_file_name[MAX_BUFFER_SIZE];
+
+    snprintf(path, sizeof(path), "./%s", name);
+    snprintf(command, sizeof(command), "%s in.txt", path);
+    snprintf(output_file_name, sizeof(output_file_name), "%s_output.txt", name);
+
+    int fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0755);
+
+    if (fd == -1 || !send_all(fd, executable->data, executable->size, NULL) || close(fd) == -1)
+        return false;
+
+    if (mode == MODE_POPEN) {
+        free(execute(command));
+    } else if (mode == MODE_WORKER) {
+        if (!run_in_worker(workers, name, command))
+            return false;
+    } else {
+        char *arguments[] = { path, "in.txt", NULL };
+        pid_t pid;
+        int status;
+
+        if (posix_spawn(&pid, path, NULL, NULL, arguments, environ) != 0 || waitpid(pid, &status, 0) == -1)
+            return false;
+    }
+
+    Buffer *output = stat_file(output_file_name);
+    bool launched = output != NULL;
+
+    free(output);
+
+    unlink(name);
+    unlink(output_file_name);
+
+    return launched;
+}
+
+/**
+ * Runs a job in a warm worker, as the slave does for executables that follow the persistent-job ABI.
+ *
+ * @param workers The pool.
+ * @param name The name of the job's executable, which was written.
+ * @param command The job's command.
+ *
+ * @return Whether or not the worker replied that the job succeeded.
+ */
+bool run_in_worker(WorkerPool *workers, char *name, char *command) {
+    char directory[PATH_MAX], reply[MAX_BUFFER_SIZE] = "";
+    unsigned char key[WORKER_KEY_SIZE];
+    bool warm;
+    Worker *worker = get_worker_key(workers, name, key) ? acquire_worker(workers, name, key, &warm) : NULL;
+
+    if (!worker)
+        return false;
+
+    /* The job writes nothing to stdout, so only its reply is waited for. */
+    bool replied = getcwd(directory, sizeof(directory)) && send_worker_request(worker, directory, command)
+        && read(worker->replies, reply, sizeof(reply) - 1) > 0 && strcmp(reply, "0\n") == 0;
+
+    if (replied)
+        release_worker(workers, worker);
+    else
+        stop_worker(worker);
+
+    return replied;
+}
+
+int main(int argc, char **argv) {
+    char *source = argc > 1 ? argv[1] : NULL;
+    int launches = argc > 2 ? atoi(argv[2]) : 500;
+    char *modes[] = { "popen", "spawn", "worker" };
+    char directory[] = "/tmp/bench-launch-XXXXXX", source_path[PATH_MAX];
+    char *script = "#!/bin/sh\nwc -w < \"$1\" > \"$(basename \"$0\")_output.txt\"\n";
+
+    if (launches < 1) {
+        fprintf(stderr, "USAGE: %s [EXECUTABLE] [LAUNCHES]\n", argv[0]);
+        return 1;
+    }
+
+    if (source && !realpath(source, source_path)) {
+        perror("[X] realpath");
+        return 1;
+    }
+
+    if (!mkdtemp(directory) || chdir(directory) == -1) {
+        perror("[X] mkdtemp");
+        return 1;
+    }
+
+    /* Without an executable, jobs run a shell script. */
+    Buffer *executable;
+
+    if (source) {
+        executable = read_file(source_path, "rb");
+    } else {
+        executable = createBuffer();
+        executable->data = strdup(script);
+        executable->size = strlen(script);
+    }
+
+    char *name = source ? basename(source_path) : "job";
+    double *latencies = (double *)malloc(sizeof(double) * launches);
+
+    generate_text("in.txt", 4096, 1);
+
+    /* Only executables that follow the persistent-job ABI run in workers. */
+    WorkerPool *workers = createWorkerPool(1);
+    unsigned char key[WORKER_KEY_SIZE];
+    int last_mode = source && get_worker_key(workers, source_path, key) ? MODE_WORKER : MODE_SPAWN;
+
+    for (int mode = MODE_POPEN; mode <= last_mode; mode++) {
+        double started = now_seconds();
+
+        for (int i = 0; i < launches; i++) {
+            double launched = now_seconds();
+
+            if (!launch(mode, name, executable, workers)) {
+                fprintf(stderr, "[X] %s did not write %s_output.txt.\n", name, name);
+                return 1;
+            }
+
+            latencies[i] = now_seconds() - launched;
+        }
+
+        double elapsed = now_seconds() - started;
+
+        qsort(latencies, launches, sizeof(double), compare_latency);
+
+        printf("{\"bench\": \"launch\", \"mode\": \"%s\", \"executable\": \"%s\", \"launches\": %d, \"launches_per_second\": %.1f, "
+               "\"p50_ms\": %.3f, \"p99_ms\": %.3f, \"max_ms\": %.3f}\n",
+               modes[mode], name, launches, launches / elapsed,
+               get_percentile(latencies, launches, 50) * 1e3,
+               get_percentile(latencies, launches, 99) * 1e3,
+               latencies[launches - 1] * 1e3);
+    }
+
+    unlink("in.txt");
+
+    if (last_mode == MODE_WORKER) {
+        char worker_path[MAX_BUFFER_SIZE];
+
+        stop_workers(workers);
+        get_worker_path(key, worker_path, sizeof(worker_path));
+        unlink(worker_path);
+        rmdir(WORKERS_DIRECTORY);
+    }
+
+    rmdir(directory);
+
+    free(latencies);
+    free(workers);
+
+    return 0;
+}
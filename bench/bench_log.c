@@ -0,0 +1,167 @@
+/**
+ * A C program used to benchmark the cost of logging on the request path.
+ *
+ * Worker threads run synthetic jobs shaped like the master's handle_client():
+ * a handful of fixed-size control message round trips over loopback TCP, each
+ * logged with the peer's address. The jobs are run three times: logging with a
+ * synchronous printf() and inet_ntoa() as the master used to, logging through
+ * the asynchronous logger, and with the logger's level set to off.
+ *
+ * To properly compile this program see COMPILE:
+ *
+ * COMPILE: gcc bench/bench_log.c -lpthread -lm -o bench_log
+ *
+ * To properly use this program see USAGE:
+ *
+ * USAGE: ./bench_log [THREADS] [JOBS_PER_THREAD]
+ * e.g. ./bench_log 8 2000
+ *
+ * Every mode prints one JSON line on stdout. Log output goes to /dev/null.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "../lib/utilities.h"
+#include "../lib/transfer.h"
+#include "../lib/log.h"
+#include "bench.h"
+
+#define MODE_PRINTF 0
+#define MODE_ASYNC 1
+#define MODE_OFF 2
+
+#define ROUND_TRIPS_PER_JOB 5
+
+typedef struct Worker Worker;
+
+struct Worker {
+    int mode;
+    int jobs;
+};
+
+FILE *sink;
+
+void *answer(void *argv);
+void *run_jobs(void *argv);
+double run(int mode, int threads, int jobs);
+
+/**
+ * Acknowledges every control message until the peer hangs up.
+ *
+ * @param argv A pointer to the socket to serve.
+ */
+void *answer(void *argv) {
+    int socket = *(int *)argv;
+    char request[MAX_BUFFER_SIZE];
+
+    while (recv_message(socket, request))
+        send_message(socket, "{SUCCESSFULLY_RECEIVED_BUFFER}");
+
+    pthread_exit(NULL);
+}
+
+/**
+ * Runs synthetic jobs, logging every control message the way the master does.
+ *
+ * @param argv The Worker describing the jobs.
+ */
+void *run_jobs(void *argv) {
+    Worker *worker = (Worker *)argv;
+    int near, far;
+    char response[MAX_BUFFER_SIZE];
+    char *request = "countwords 16424 in.txt 445 none ./countwords in.txt";
+    struct sockaddr_in address;
+    socklen_t address_len = sizeof address;
+    pthread_t answer_thread;
+
+    connect_pair(&near, &far);
+    getpeername(near, (struct sockaddr *)&address, &address_len);
+    pthread_create(&answer_thread, NULL, answer, &far);
+
+    for (int job = 0; job < worker->jobs; job++) {
+        for (int i = 0; i < ROUND_TRIPS_PER_JOB; i++) {
+            send_message(near, request);
+
+            if (worker->mode == MODE_PRINTF)
+                fprintf(sink, "[Master]: Sending: [%s] to Slave ('%s', %d).\n", request, inet_ntoa(address.sin_addr), ntohs(address.sin_port));
+            else
+                log_info("[Master]: Sending: [%s] to Slave (%I).\n", request, &address);
+
+            recv_message(near, response);
+
+            if (worker->mode == MODE_PRINTF)
+                fprintf(sink, "[Master]: Received: [%s] from Slave ('%s', %d).\n", response, inet_ntoa(address.sin_addr), ntohs(address.sin_port));
+            else
+                log_info("[Master]: Received: [%s] from Slave (%I).\n", response, &address);
+        }
+    }
+
+    shutdown(near, SHUT_WR);
+    pthread_join(answer_thread, NULL);
+
+    close(near);
+    close(far);
+
+    pthread_exit(NULL);
+}
+
+/**
+ * Runs the jobs of every worker thread in one logging mode.
+ *
+ * @param mode The MODE_* to log with.
+ * @param threads The number of worker threads.
+ * @param jobs The number of jobs per worker thread.
+ *
+ * @return The number of jobs completed per second.
+ */
+double run(int mode, int threads, int jobs) {
+    pthread_t *workers = (pthread_t *)malloc(sizeof(pthread_t) * threads);
+    Worker worker = { mode, jobs };
+
+    __atomic_store_n(&log_level, mode == MODE_OFF ? LOG_OFF : LOG_INFO, __ATOMIC_RELAXED);
+
+    double started = now_seconds();
+
+    for (int i = 0; i < threads; i++)
+        pthread_create(&workers[i], NULL, run_jobs, &worker);
+
+    for (int i = 0; i < threads; i++)
+        pthread_join(workers[i], NULL);
+
+    double elapsed = now_seconds() - started;
+
+    free(workers);
+
+    return threads * jobs / elapsed;
+}
+
+int main(int argc, char **argv) {
+    int threads = argc > 1 ? atoi(argv[1]) : 8;
+    int jobs = argc > 2 ? atoi(argv[2]) : 2000;
+    char *modes[] = { "printf", "async", "off" };
+
+    sink = fopen("/dev/null", "w");
+
+    if (!sink) {
+        perror("[X] fopen");
+        exit(1);
+    }
+
+    log_init(sink);
+
+    for (int mode = MODE_PRINTF; mode <= MODE_OFF; mode++) {
+        double jobs_per_second = run(mode, threads, jobs);
+
+        printf("{\"bench\": \"log\", \"mode\": \"%s\", \"threads\": %d, \"jobs\": %d, \"log_lines_per_job\": %d, \"jobs_per_second\": %.1f}\n",
+               modes[mode], threads, threads * jobs, 2 * ROUND_TRIPS_PER_JOB, jobs_per_second);
+    }
+
+    log_shutdown();
+    fclose(sink);
+
+    return 0;
+}
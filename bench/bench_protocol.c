@@ -0,0 +1,158 @@
+/**
+ * A C program used to benchmark the control protocol.
+ *
+ * The job request a master sends a slave is formatted with snprintf() and
+ * parsed with sscanf() on every dispatch, and every control message is one
+ * fixed-size frame. This measures both codecs on their own, then the round
+ * trip of a control frame over loopback TCP, which bounds how many control
+ * messages a connection can exchange per second.
+ *
+ * To properly compile this program see COMPILE:
+ *
+ * COMPILE: gcc bench/bench_protocol.c -lpthread -lm -o bench_protocol
+ *
+ * To properly use this program see USAGE:
+ *
+ * USAGE: ./bench_protocol [ITERATIONS]
+ * e.g. ./bench_protocol 1000000
+ *
+ * Every case prints one JSON line on stdout.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "../lib/utilities.h"
+#include "../lib/transfer.h"
+#include "bench.h"
+
+void *echo(void *argv);
+double encode_job_requests(long iterations);
+double decode_job_requests(long iterations);
+double round_trip_frames(long iterations);
+
+/**
+ * Echoes every control frame until the peer hangs up.
+ *
+ * @param argv A pointer to the socket to serve.
+ */
+void *echo(void *argv) {
+    int socket = *(int *)argv;
+    char message[MAX_BUFFER_SIZE];
+
+    while (recv_message(socket, message))
+        send_message(socket, message);
+
+    pthread_exit(NULL);
+}
+
+/**
+ * Formats job requests the way the master does before each dispatch.
+ *
+ * @param iterations The number of job requests.
+ *
+ * @return The wall time in seconds.
+ */
+double encode_job_requests(long iterations) {
+    char job_request[MAX_BUFFER_SIZE];
+    volatile size_t length = 0;
+
+    double started = now_seconds();
+
+    for (long i = 0; i < iterations; i++) {
+        snprintf(job_request, sizeof(job_request), "%s %ld %s %ld %s %s", "countwords", 16424 + (i & 255), "in.txt", 445L, "none", "./countwords in.txt");
+        length += job_request[0];
+    }
+
+    return now_seconds() - started;
+}
+
+/**
+ * Parses job requests the way the slave does on receipt.
+ *
+ * @param iterations The number of job requests.
+ *
+ * @return The wall time in seconds, or -1 if a request failed to parse.
+ */
+double decode_job_requests(long iterations) {
+    char *request = "countwords 16424 in.txt 445 none ./countwords in.txt";
+    char executable[MAX_BUFFER_SIZE], input_file[MAX_BUFFER_SIZE], codec_name[MAX_BUFFER_SIZE];
+    long executable_size, input_file_size;
+    int command_offset;
+
+    double started = now_seconds();
+
+    for (long i = 0; i < iterations; i++) {
+        if (sscanf(request, "%s %ld %s %ld %s %n", executable, &executable_size, input_file, &input_file_size, codec_name, &command_offset) != 5)
+            return -1;
+    }
+
+    return now_seconds() - started;
+}
+
+/**
+ * Sends control frames over loopback TCP and waits for each to be echoed.
+ *
+ * @param iterations The number of round trips.
+ *
+ * @return The wall time in seconds.
+ */
+double round_trip_frames(long iterations) {
+    int near, far;
+    char response[MAX_BUFFER_SIZE];
+    pthread_t echo_thread;
+
+    connect_pair(&near, &far);
+    tune_socket(near);
+    tune_socket(far);
+    pthread_create(&echo_thread, NULL, echo, &far);
+
+    double started = now_seconds();
+
+    for (long i = 0; i < iterations; i++) {
+        send_message(near, "{REQUEST_JOB_OUTPUT}");
+        recv_message(near, response);
+    }
+
+    double elapsed = now_seconds() - started;
+
+    shutdown(near, SHUT_WR);
+    pthread_join(echo_thread, NULL);
+
+    close(near);
+    close(far);
+
+    return elapsed;
+}
+
+int main(int argc, char **argv) {
+    long iterations = argc > 1 ? atol(argv[1]) : 1000000;
+
+    /* Round trips cost two context switches each, so fewer of them take as long. */
+    long round_trips = iterations / 20 > 0 ? iterations / 20 : 1;
+
+    struct {
+        char *name;
+        long ops;
+        double seconds;
+    } cases[] = {
+        { "encode_job_request", iterations, encode_job_requests(iterations) },
+        { "decode_job_request", iterations, decode_job_requests(iterations) },
+        { "frame_round_trip", round_trips, round_trip_frames(round_trips) }
+    };
+
+    for (int i = 0; i < (int)(sizeof(cases) / sizeof(cases[0])); i++) {
+        if (cases[i].seconds < 0) {
+            fprintf(stderr, "[X] %s failed.\n", cases[i].name);
+            return 1;
+        }
+
+        printf("{\"bench\": \"protocol\", \"case\": \"%s\", \"ops\": %ld, \"seconds\": %.6f, \"ns_per_op\": %.1f, \"ops_per_second\": %.0f}\n",
+               cases[i].name, cases[i].ops, cases[i].seconds, cases[i].seconds * 1e9 / cases[i].ops, cases[i].ops / cases[i].seconds);
+    }
+
+    return 0;
+}
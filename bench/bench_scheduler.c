@@ -0,0 +1,118 @@
+/**
+ * A C program used to benchmark the master's slave selection.
+ *
+ * Worker threads select a slave and release it again, as every dispatch does,
+ * with each placement policy against fleets of increasing size. Slaves are
+ * given random utilizations first, and jobs cycle through a set of executable
+ * names so that affinity hashes real keys.
+ *
+ * To properly compile this program see COMPILE:
+ *
+ * COMPILE: gcc bench/bench_scheduler.c -lpthread -lm -o bench_scheduler
+ *
+ * To properly use this program see USAGE:
+ *
+ * USAGE: ./bench_scheduler [THREADS] [SELECTIONS_PER_THREAD]
+ * e.g. ./bench_scheduler 4 200000
+ *
+ * Every policy and fleet size prints one JSON line on stdout.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "../lib/slavelist.h"
+#include "../lib/scheduler.h"
+#include "bench.h"
+
+#define KEYS 64
+
+typedef struct Selector Selector;
+
+struct Selector {
+    Scheduler *scheduler;
+    long selections;
+};
+
+char keys[KEYS][32];
+
+void *select_slaves(void *argv);
+double run(int policy, int slaves, int threads, long selections);
+
+/**
+ * Selects and releases slaves in a loop.
+ *
+ * @param argv The Selector describing the run.
+ */
+void *select_slaves(void *argv) {
+    Selector *selector = (Selector *)argv;
+
+    for (long i = 0; i < selector->selections; i++)
+        release_slave(select_slave(selector->scheduler, keys[i % KEYS]));
+
+    pthread_exit(NULL);
+}
+
+/**
+ * Runs the selections of every worker thread against one fleet.
+ *
+ * @param policy The POLICY_* to select with.
+ * @param slaves The number of slaves in the fleet.
+ * @param threads The number of worker threads.
+ * @param selections The number of selections per worker thread.
+ *
+ * @return The wall time in seconds.
+ */
+double run(int policy, int slaves, int threads, long selections) {
+    SlaveList *list = createSlaveList(slaves + 1);
+    Scheduler *scheduler = createScheduler(list, policy, 1);
+    pthread_t *workers = (pthread_t *)malloc(sizeof(pthread_t) * threads);
+    Selector selector = { scheduler, selections };
+    unsigned int seed = 1;
+
+    for (int i = 0; i < slaves; i++) {
+        add(list, "bench", i, false, false, false);
+        report_utilization(scheduler, list->slaves[i], (float)rand_r(&seed) / RAND_MAX);
+    }
+
+    double started = now_seconds();
+
+    for (int i = 0; i < threads; i++)
+        pthread_create(&workers[i], NULL, select_slaves, &selector);
+
+    for (int i = 0; i < threads; i++)
+        pthread_join(workers[i], NULL);
+
+    double elapsed = now_seconds() - started;
+
+    free(workers);
+    free(scheduler);
+    cleanupList(list);
+
+    return elapsed;
+}
+
+int main(int argc, char **argv) {
+    int threads = argc > 1 ? atoi(argv[1]) : 4;
+    long selections = argc > 2 ? atol(argv[2]) : 200000;
+    int fleets[] = { 16, 128, 1024 };
+
+    for (int i = 0; i < KEYS; i++)
+        snprintf(keys[i], sizeof(keys[i]), "job%d", i);
+
+    for (int policy = 0; policy < POLICY_COUNT; policy++) {
+        for (int i = 0; i < (int)(sizeof(fleets) / sizeof(fleets[0])); i++) {
+            double seconds = run(policy, fleets[i], threads, selections);
+            long total = threads * selections;
+
+            printf("{\"bench\": \"scheduler\", \"policy\": \"%s\", \"slaves\": %d, \"threads\": %d, \"selections\": %ld, "
+                   "\"seconds\": %.6f, \"ns_per_selection\": %.1f, \"selections_per_second\": %.0f}\n",
+                   get_policy_name(policy), fleets[i], threads, total, seconds, seconds * 1e9 / total, total / seconds);
+        }
+    }
+
+    return 0;
+}
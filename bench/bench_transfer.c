@@ -0,0 +1,294 @@
+/**
+ * A C program used to benchmark transfer throughput over loopback TCP across chunk sizes.
+ *
+ * A sender thread writes the payload with one send_all() per chunk while the
+ * receiver drains it with copy_stream() into /dev/null using the same chunk
+ * size, so every run costs roughly (size / chunk) syscalls on each side.
+ *
+ * It then hands job files of several sizes to a slave's file the two ways a
+ * master on the slave's host can: in a frame over loopback TCP, received with
+ * recv_file(), and through a shared memory object, read with
+ * recv_shared_file().
+ *
+ * To properly compile this program see COMPILE:
+ *
+ * COMPILE: gcc bench/bench_transfer.c -lpthread -o bench_transfer
+ *
+ * To properly use this program see USAGE:
+ *
+ * USAGE: ./bench_transfer [MEGABYTES]
+ * e.g. ./bench_transfer 256
+ *
+ * Each chunk size, and each way and size of handoff, prints one JSON line on stdout.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "../lib/utilities.h"
+#include "../lib/transfer.h"
+#include "../lib/shm.h"
+
+#define HANDOFF_TCP 0
+#define HANDOFF_SHARED_MEMORY 1
+
+/* Where handed off files are written, as a slave would write them. */
+#define HANDOFF_FILE "bench-transfer-handoff.bin"
+
+typedef struct Sender Sender;
+typedef struct Handoff Handoff;
+
+struct Sender {
+    int port;
+    long size;
+    long chunk_size;
+};
+
+struct Handoff {
+    int socket;
+    char *file;
+    long size;
+    int count;
+};
+
+void *send_payload(void *argv);
+double run(long size, long chunk_size);
+void *send_files(void *argv);
+double hand_off(int way, char *file, long size, int count);
+
+/**
+ * Connects to the benchmark's listener and sends the payload chunk by chunk.
+ *
+ * @param argv The Sender describing the run.
+ */
+void *send_payload(void *argv) {
+    Sender *sender = (Sender *)argv;
+    struct sockaddr_in address;
+
+    memset(&address, 0, sizeof address);
+    address.sin_family = AF_INET;
+    address.sin_port = htons(sender->port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+
+    if (sock == -1 || connect(sock, (struct sockaddr *)&address, sizeof address) == -1) {
+        perror("[X] connect");
+        exit(1);
+    }
+
+    tune_socket(sock);
+
+    char *chunk = (char *)malloc(sizeof(char) * sender->chunk_size);
+    memset(chunk, 'x', sender->chunk_size);
+
+    for (long offset = 0; offset < sender->size; offset += sender->chunk_size) {
+        long n = sender->size - offset < sender->chunk_size ? sender->size - offset : sender->chunk_size;
+
+        if (!send_all(sock, chunk, n, NULL))
+            exit(1);
+    }
+
+    free(chunk);
+    close(sock);
+
+    pthread_exit(NULL);
+}
+
+/**
+ * Transfers 'size' bytes over loopback with the given chunk size.
+ *
+ * @param size The number of bytes to transfer.
+ * @param chunk_size The number of bytes per read and write.
+ *
+ * @return The wall time of the transfer in seconds.
+ */
+double run(long size, long chunk_size) {
+    struct sockaddr_in address;
+    socklen_t len = sizeof address;
+
+    memset(&address, 0, sizeof address);
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+
+    if (listener == -1 || bind(listener, (struct sockaddr *)&address, sizeof address) == -1 || listen(listener, 1) == -1) {
+        perror("[X] bind");
+        exit(1);
+    }
+
+    getsockname(listener, (struct sockaddr *)&address, &len);
+
+    Sender sender = { ntohs(address.sin_port), size, chunk_size };
+    pthread_t thread;
+
+    double started = now_seconds();
+
+    pthread_create(&thread, NULL, send_payload, &sender);
+
+    int sock = accept(listener, NULL, NULL);
+    int sink = open("/dev/null", O_WRONLY);
+
+    if (!copy_stream(sock, sink, size, chunk_size, NULL)) {
+        fputs("[X] copy_stream: short transfer.\n", stderr);
+        exit(1);
+    }
+
+    pthread_join(thread, NULL);
+
+    double elapsed = now_seconds() - started;
+
+    close(sink);
+    close(sock);
+    close(listener);
+
+    return elapsed;
+}
+
+/**
+ * Sends files over a connection, each in one frame with the request that announces it, as the master does.
+ *
+ * @param argv The Handoff describing the run.
+ */
+void *send_files(void *argv) {
+    Handoff *handoff = (Handoff *)argv;
+
+    for (int i = 0; i < handoff->count; i++) {
+        struct iovec payload = { handoff->file, handoff->size };
+
+        if (!send_frame(handoff->socket, "{FILE}", &payload, 1, NULL))
+            exit(1);
+    }
+
+    pthread_exit(NULL);
+}
+
+/**
+ * Hands a file to a slave's file 'count' times, one of the ways a master on the slave's host can.
+ *
+ * @param way The HANDOFF_*.
+ * @param file The file's bytes.
+ * @param size The number of bytes.
+ * @param count The number of handoffs.
+ *
+ * @return The wall time of the handoffs in seconds.
+ */
+double hand_off(int way, char *file, long size, int count) {
+    char message[MAX_BUFFER_SIZE], name[MAX_BUFFER_SIZE];
+    double started = now_seconds();
+
+    if (way == HANDOFF_SHARED_MEMORY) {
+        for (int i = 0; i < count; i++) {
+            struct iovec payload = { file, size };
+            int written = create_payload(name, &payload, 1, NULL);
+            int payload_fd = written == -1 ? -1 : open_payload(name);
+
+            if (payload_fd == -1 || !recv_shared_file(payload_fd, HANDOFF_FILE, size, 0644, CODEC_NONE, NULL)) {
+                fputs("[X] recv_shared_file: short handoff.\n", stderr);
+                exit(1);
+            }
+
+            close(payload_fd);
+            close_payload(written, name);
+        }
+
+        return now_seconds() - started;
+    }
+
+    int sockets[2];
+
+    /* A connected pair of loopback TCP sockets, as between the master and a slave on its host. */
+    struct sockaddr_in address;
+    socklen_t len = sizeof address;
+
+    memset(&address, 0, sizeof address);
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+
+    if (listener == -1 || bind(listener, (struct sockaddr *)&address, sizeof address) == -1 || listen(listener, 1) == -1) {
+        perror("[X] bind");
+        exit(1);
+    }
+
+    getsockname(listener, (struct sockaddr *)&address, &len);
+
+    sockets[0] = socket(AF_INET, SOCK_STREAM, 0);
+
+    if (sockets[0] == -1 || connect(sockets[0], (struct sockaddr *)&address, sizeof address) == -1) {
+        perror("[X] connect");
+        exit(1);
+    }
+
+    sockets[1] = accept(listener, NULL, NULL);
+    tune_socket(sockets[0]);
+    tune_socket(sockets[1]);
+
+    Handoff handoff = { sockets[0], file, size, count };
+    pthread_t thread;
+
+    started = now_seconds();
+
+    pthread_create(&thread, NULL, send_files, &handoff);
+
+    for (int i = 0; i < count; i++) {
+        if (!recv_message(sockets[1], message) || !recv_file(sockets[1], HANDOFF_FILE, size, 0644, NULL)) {
+            fputs("[X] recv_file: short handoff.\n", stderr);
+            exit(1);
+        }
+    }
+
+    pthread_join(thread, NULL);
+
+    double elapsed = now_seconds() - started;
+
+    close(sockets[0]);
+    close(sockets[1]);
+    close(listener);
+
+    return elapsed;
+}
+
+int main(int argc, char **argv) {
+    long megabytes = argc > 1 ? atol(argv[1]) : 256;
+    long size = megabytes * 1024 * 1024;
+    long chunk_sizes[] = { 1000, 4 * 1024, 16 * 1024, MIN_CHUNK_SIZE, 256 * 1024, MAX_CHUNK_SIZE };
+
+    for (int i = 0; i < (int)(sizeof(chunk_sizes) / sizeof(chunk_sizes[0])); i++) {
+        double seconds = run(size, chunk_sizes[i]);
+
+        printf("{\"bench\": \"transfer\", \"chunk_size\": %ld, \"bytes\": %ld, \"seconds\": %.6f, \"mb_per_s\": %.2f}\n",
+               chunk_sizes[i], size, seconds, size / seconds / (1024 * 1024));
+    }
+
+    long file_sizes[] = { 64 * 1024, 1024 * 1024, 16 * 1024 * 1024 };
+    char *ways[] = { "tcp", "shared_memory" };
+
+    for (int i = 0; i < (int)(sizeof(file_sizes) / sizeof(file_sizes[0])); i++) {
+        char *file = (char *)malloc(sizeof(char) * file_sizes[i]);
+        int count = size / file_sizes[i] > 0 ? (int)(size / file_sizes[i]) : 1;
+
+        memset(file, 'x', file_sizes[i]);
+
+        for (int way = HANDOFF_TCP; way <= HANDOFF_SHARED_MEMORY; way++) {
+            double seconds = hand_off(way, file, file_sizes[i], count);
+
+            printf("{\"bench\": \"handoff\", \"way\": \"%s\", \"file_size\": %ld, \"files\": %d, \"seconds\": %.6f, \"mb_per_s\": %.2f, \"us_per_file\": %.1f}\n",
+                   ways[way], file_sizes[i], count, seconds, (double)file_sizes[i] * count / seconds / (1024 * 1024), seconds / count * 1e6);
+        }
+
+        free(file);
+    }
+
+    unlink(HANDOFF_FILE);
+
+    return 0;
+}
@@ -0,0 +1,404 @@
+/**
+ * A C program used to load test a Master node with jobs from a manifest.
+ *
+ * Jobs are submitted with the same protocol code as the client, either
+ * closed-loop (a fixed number of workers, each submitting its next job as
+ * soon as the previous one returns) or open-loop (Poisson arrivals at a
+ * target rate). Open-loop latency is measured from each job's scheduled
+ * arrival, so a saturated master shows up as queueing delay rather than as
+ * a lower submission rate.
+ *
+ * To properly compile this program see COMPILE:
+ *
+ * COMPILE: gcc bench/dlb_bench.c -lpthread -lm -o dlb-bench
+ *
+ * To properly use this program see USAGE:
+ *
+ * USAGE: ./dlb-bench <MASTER_IP_ADDRESS> <MANIFEST> [-c CONCURRENCY | -r JOBS_PER_SECOND]
+ *                    [-n JOBS | -d SECONDS] [-w MAX_IN_FLIGHT] [-z CODEC] [-o CSV_PATH] [-t DEADLINE_MS] [-p PRIORITY]
+ * e.g. ./dlb-bench "10.211.55.13" jobs.txt -c 8 -n 1000 -o closed.csv
+ * e.g. ./dlb-bench "10.211.55.13" jobs.txt -r 50 -d 60 -o open.csv
+ *
+ * Each line of the manifest is a job as typed into the client:
+ * <PATH_TO_BINARY_EXECUTABLE> <PATH_TO_INPUT_FILE_FOR_BINARY_EXECUTABLE>
+ * Jobs are taken from the manifest in turn. With -t, every job has a deadline
+ * of DEADLINE_MS, and the jobs that miss it count as errors. With -p, every
+ * job is submitted in the PRIORITY class "interactive", "normal" or "batch",
+ * so that runs in different classes can be compared side by side.
+ *
+ * A summary is printed as one JSON line on stdout; with -o every job is
+ * written as a row of CSV_PATH, with the trace id to find its spans by when
+ * DLB_TRACE_FILE is set.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+
+#include "../lib/utilities.h"
+#include "../lib/transfer.h"
+#include "../lib/log.h"
+#include "../lib/submit.h"
+#include "bench.h"
+
+#define DEFAULT_CONCURRENCY 1
+#define DEFAULT_JOBS 100
+#define DEFAULT_MAX_IN_FLIGHT 64
+
+typedef struct JobManifest JobManifest;
+typedef struct Sample Sample;
+typedef struct LoadTest LoadTest;
+typedef struct Worker Worker;
+
+struct JobManifest {
+    char **executables;
+    char **input_files;
+    int count;
+};
+
+struct Sample {
+    long job;
+    double started;
+    double latency;
+    char *status;
+    char trace_id[TRACE_ID_LENGTH + 1];
+};
+
+struct LoadTest {
+    struct sockaddr_in master_address;
+    JobManifest *manifest;
+    int codec;
+    long deadline;
+    int priority;
+
+    /* Open-loop when rate > 0; arrivals[i] is when job i is due, relative to started. */
+    double rate;
+    double *arrivals;
+
+    long jobs;
+    double duration;
+    double started;
+    long next_job;
+};
+
+struct Worker {
+    int id;
+    LoadTest *test;
+    Sample *samples;
+    long count;
+    long capacity;
+};
+
+JobManifest *read_manifest(char *path);
+double *schedule_arrivals(double rate, long *jobs, double duration);
+void *run_worker(void *argv);
+
+/**
+ * Reads the jobs of a manifest.
+ *
+ * WARNING: 'read_manifest' malloc()s memory to '*manifest' which must be freed by
+ * the caller.
+ *
+ * @param path The path to the manifest.
+ *
+ * @return The jobs of the manifest, or NULL if it could not be read or holds no job.
+ */
+JobManifest *read_manifest(char *path) {
+    FILE *file = fopen(path, "r");
+
+    if (!file) {
+        perror("[X] fopen");
+        return NULL;
+    }
+
+    JobManifest *manifest = (JobManifest *)calloc(1, sizeof(JobManifest));
+    char line[PATH_MAX * 2], executable[PATH_MAX], input_file[PATH_MAX];
+    int capacity = 0;
+
+    while (fgets(line, sizeof(line), file)) {
+        if (line[0] == '#' || sscanf(line, "%s %s", executable, input_file) != 2)
+            continue;
+
+        if (manifest->count == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            manifest->executables = (char **)realloc(manifest->executables, sizeof(char *) * capacity);
+            manifest->input_files = (char **)realloc(manifest->input_files, sizeof(char *) * capacity);
+        }
+
+        manifest->executables[manifest->count] = strdup(executable);
+        manifest->input_files[manifest->count] = strdup(input_file);
+        manifest->count++;
+    }
+
+    fclose(file);
+
+    if (manifest->count == 0) {
+        free(manifest);
+        return NULL;
+    }
+
+    return manifest;
+}
+
+/**
+ * Draws Poisson arrival times: exponentially distributed gaps with a mean of 1 / rate.
+ *
+ * WARNING: 'schedule_arrivals' malloc()s memory to '*arrivals' which must be freed by
+ * the caller.
+ *
+ * @param rate The mean number of arrivals per second.
+ * @param jobs The number of arrivals to draw; when duration is set, receives the number
+ * of arrivals that fall within it.
+ * @param duration The number of seconds to draw arrivals for, or 0 to draw *jobs of them.
+ *
+ * @return The arrival times in seconds from the start of the test.
+ */
+double *schedule_arrivals(double rate, long *jobs, double duration) {
+    long capacity = duration > 0 ? (long)(rate * duration * 1.5) + 16 : *jobs;
+    double *arrivals = (double *)malloc(sizeof(double) * capacity);
+    double now = 0;
+    long count = 0;
+
+    while (duration > 0 || count < *jobs) {
+        /* 1 - U is in (0, 1], so the logarithm is finite. */
+        now += -log(1.0 - (double)rand() / ((double)RAND_MAX + 1)) / rate;
+
+        if (duration > 0 && now >= duration)
+            break;
+
+        if (count == capacity) {
+            capacity *= 2;
+            arrivals = (double *)realloc(arrivals, sizeof(double) * capacity);
+        }
+
+        arrivals[count++] = now;
+    }
+
+    *jobs = count;
+
+    return arrivals;
+}
+
+/**
+ * Submits jobs until the test's job count or duration is used up.
+ *
+ * @param argv The Worker to run.
+ */
+void *run_worker(void *argv) {
+    Worker *worker = (Worker *)argv;
+    LoadTest *test = worker->test;
+
+    char output_path[PATH_MAX];
+    snprintf(output_path, sizeof(output_path), "/tmp/dlb-bench-%d-%d", getpid(), worker->id);
+
+    while (true) {
+        long job = __atomic_fetch_add(&test->next_job, 1, __ATOMIC_RELAXED);
+
+        if (job >= test->jobs)
+            break;
+
+        double started;
+
+        if (test->arrivals) {
+            /* Jobs are claimed in arrival order, so a late worker only delays later arrivals. */
+            started = test->started + test->arrivals[job];
+
+            double wait = started - now_seconds();
+
+            if (wait > 0) {
+                struct timespec interval = { (time_t)wait, (long)((wait - (time_t)wait) * 1e9) };
+                nanosleep(&interval, NULL);
+            }
+        } else {
+            started = now_seconds();
+
+            if (test->duration > 0 && started - test->started >= test->duration)
+                break;
+        }
+
+        int index = job % test->manifest->count;
+        char *status, trace_id[TRACE_ID_LENGTH + 1];
+        int master_socket = open_master_connection(&test->master_address);
+
+        mint_trace_id(trace_id);
+
+        if (master_socket == -1) {
+            status = "{FAILED_TO_CONNECT}";
+        } else {
+            status = submit_job(master_socket, &test->master_address,
+                                test->manifest->executables[index], test->manifest->input_files[index],
+                                test->codec, output_path, trace_id, test->deadline, test->priority);
+            close(master_socket);
+        }
+
+        if (worker->count == worker->capacity) {
+            worker->capacity = worker->capacity ? worker->capacity * 2 : 256;
+            worker->samples = (Sample *)realloc(worker->samples, sizeof(Sample) * worker->capacity);
+        }
+
+        Sample *sample = &worker->samples[worker->count++];
+        sample->job = job;
+        sample->started = started - test->started;
+        sample->latency = now_seconds() - started;
+        sample->status = status ? status : "{SUCCESSFULLY_RECEIVED_BUFFER}";
+        memcpy(sample->trace_id, trace_id, sizeof(trace_id));
+    }
+
+    unlink(output_path);
+
+    pthread_exit(NULL);
+}
+
+int main(int argc, char **argv) {
+    LoadTest test;
+    int concurrency = DEFAULT_CONCURRENCY, max_in_flight = DEFAULT_MAX_IN_FLIGHT, option;
+    char *codec_name = "none", *csv_path = NULL, *priority_name = NULL;
+
+    memset(&test, 0, sizeof(test));
+    test.jobs = -1;
+
+    while ((option = getopt(argc, argv, "c:r:n:d:w:z:o:t:p:")) != -1) {
+        switch (option) {
+            case 'c': concurrency = atoi(optarg); break;
+            case 'r': test.rate = atof(optarg); break;
+            case 'n': test.jobs = atol(optarg); break;
+            case 'd': test.duration = atof(optarg); break;
+            case 'w': max_in_flight = atoi(optarg); break;
+            case 'z': codec_name = optarg; break;
+            case 'o': csv_path = optarg; break;
+            case 't': test.deadline = atol(optarg); break;
+            case 'p': priority_name = optarg; break;
+            default:
+                fprintf(stderr, "USAGE: %s <MASTER_IP_ADDRESS> <MANIFEST> [-c CONCURRENCY | -r JOBS_PER_SECOND] "
+                                "[-n JOBS | -d SECONDS] [-w MAX_IN_FLIGHT] [-z CODEC] [-o CSV_PATH] [-t DEADLINE_MS] [-p PRIORITY]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if (argc - optind != 2 || concurrency < 1 || max_in_flight < 1 || test.rate < 0 || test.deadline < 0) {
+        fprintf(stderr, "USAGE: %s <MASTER_IP_ADDRESS> <MANIFEST> [-c CONCURRENCY | -r JOBS_PER_SECOND] "
+                        "[-n JOBS | -d SECONDS] [-w MAX_IN_FLIGHT] [-z CODEC] [-o CSV_PATH] [-t DEADLINE_MS] [-p PRIORITY]\n", argv[0]);
+        return 1;
+    }
+
+    /* A master that hangs up mid-transfer must fail the job, not kill the load test. */
+    signal(SIGPIPE, SIG_IGN);
+
+    /* The per-job client logging would dominate the measurement. */
+    __atomic_store_n(&log_level, LOG_WARN, __ATOMIC_RELAXED);
+
+    trace_init("dlb-bench");
+
+    if ((test.codec = get_codec(codec_name)) == -1) {
+        fprintf(stderr, "[X] Unsupported codec: %s.\n", codec_name);
+        return 1;
+    }
+
+    if ((test.priority = get_priority(priority_name)) == -1) {
+        fprintf(stderr, "[X] Unknown priority: %s.\n", priority_name);
+        return 1;
+    }
+
+    if (!resolve_master(argv[optind], get_port(LISTEN_FOR_CLIENTS_PORT_ENV, LISTEN_FOR_CLIENTS_PORT), &test.master_address)) {
+        fprintf(stderr, "[X] Unknown host: %s.\n", argv[optind]);
+        return 1;
+    }
+
+    if (!(test.manifest = read_manifest(argv[optind + 1]))) {
+        fprintf(stderr, "[X] No jobs in manifest: %s.\n", argv[optind + 1]);
+        return 1;
+    }
+
+    if (test.jobs < 0)
+        test.jobs = test.duration > 0 ? LONG_MAX : DEFAULT_JOBS;
+
+    if (test.rate > 0) {
+        srand(time(0));
+
+        test.arrivals = schedule_arrivals(test.rate, &test.jobs, test.duration);
+        concurrency = max_in_flight;
+    }
+
+    Worker *workers = (Worker *)calloc(concurrency, sizeof(Worker));
+    pthread_t *threads = (pthread_t *)malloc(sizeof(pthread_t) * concurrency);
+
+    test.started = now_seconds();
+
+    for (int i = 0; i < concurrency; i++) {
+        workers[i].id = i;
+        workers[i].test = &test;
+        pthread_create(&threads[i], NULL, run_worker, &workers[i]);
+    }
+
+    for (int i = 0; i < concurrency; i++)
+        pthread_join(threads[i], NULL);
+
+    double elapsed = now_seconds() - test.started;
+
+    long submitted = 0, completed = 0, rejected = 0;
+
+    for (int i = 0; i < concurrency; i++)
+        submitted += workers[i].count;
+
+    double *latencies = (double *)malloc(sizeof(double) * (submitted + 1));
+    FILE *csv = csv_path ? fopen(csv_path, "w") : NULL;
+
+    if (csv_path && !csv)
+        perror("[X] fopen");
+
+    if (csv)
+        fputs("job,executable,input_file,started_seconds,latency_seconds,status,trace_id\n", csv);
+
+    for (int i = 0; i < concurrency; i++) {
+        for (long j = 0; j < workers[i].count; j++) {
+            Sample *sample = &workers[i].samples[j];
+            int index = sample->job % test.manifest->count;
+
+            if (strcmp(sample->status, "{SUCCESSFULLY_RECEIVED_BUFFER}") == 0)
+                latencies[completed++] = sample->latency;
+            else if (strcmp(sample->status, "{REJECTED_JOB}") == 0)
+                rejected++;
+
+            if (csv)
+                fprintf(csv, "%ld,%s,%s,%.6f,%.6f,%s,%s\n", sample->job, test.manifest->executables[index],
+                        test.manifest->input_files[index], sample->started, sample->latency, sample->status, sample->trace_id);
+        }
+
+        free(workers[i].samples);
+    }
+
+    if (csv)
+        fclose(csv);
+
+    qsort(latencies, completed, sizeof(double), compare_latency);
+
+    printf("{\"bench\": \"dlb\", \"mode\": \"%s\", \"concurrency\": %d, \"rate\": %.2f, \"codec\": \"%s\", \"priority\": \"%s\", "
+           "\"submitted\": %ld, \"completed\": %ld, \"errors\": %ld, \"rejected\": %ld, \"seconds\": %.3f, \"jobs_per_second\": %.2f, "
+           "\"p50_ms\": %.3f, \"p99_ms\": %.3f, \"p999_ms\": %.3f, \"max_ms\": %.3f}\n",
+           test.arrivals ? "open" : "closed", concurrency, test.rate, get_codec_name(test.codec), PRIORITY_NAMES[test.priority],
+           submitted, completed, submitted - completed, rejected, elapsed, completed / elapsed,
+           get_percentile(latencies, completed, 50) * 1e3,
+           get_percentile(latencies, completed, 99) * 1e3,
+           get_percentile(latencies, completed, 99.9) * 1e3,
+           get_percentile(latencies, completed, 100) * 1e3);
+
+    for (int i = 0; i < test.manifest->count; i++) {
+        free(test.manifest->executables[i]);
+        free(test.manifest->input_files[i]);
+    }
+
+    free(test.manifest->executables);
+    free(test.manifest->input_files);
+    free(test.manifest);
+    free(test.arrivals);
+    free(latencies);
+    free(threads);
+    free(workers);
+
+    return submitted == completed ? 0 : 2;
+}
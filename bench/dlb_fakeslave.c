@@ -0,0 +1,533 @@
+/**
+ * A C program used to simulate a fleet of Slave nodes from a single process.
+ *
+ * Every virtual slave registers with the master like a real slave, listens for
+ * jobs on its own address and port, and reports a load to the master. Instead
+ * of running a job, it receives the job's files, sleeps for a time drawn from
+ * its execution-time distribution and returns a synthetic output. Its reported
+ * load is the fraction of the last report interval it spent busy.
+ *
+ * Virtual slaves either share 127.0.0.1 and listen on consecutive ports from
+ * BASE_PORT (-m ports), or listen on the job port at consecutive loopback
+ * addresses from 127.0.0.2 (-m addresses), which Linux routes without setup.
+ *
+ * To properly compile this program see COMPILE:
+ *
+ * COMPILE: gcc bench/dlb_fakeslave.c -lpthread -lm -o dlb-fakeslave
+ *
+ * To properly use this program see USAGE:
+ *
+ * USAGE: ./dlb-fakeslave <MASTER_IP_ADDRESS> [-n SLAVES] [-m ports|addresses] [-p BASE_PORT]
+ *                        [-e DISTRIBUTION]... [-u REPORT_INTERVAL_MS] [-s OUTPUT_BYTES] [-d SECONDS]
+ * e.g. ./dlb-fakeslave 127.0.0.1 -n 200 -e exp:20
+ * e.g. ./dlb-fakeslave 127.0.0.1 -n 100 -m addresses -e fixed:5 -e lognormal:50:1
+ *
+ * DISTRIBUTION is the execution time of a job in milliseconds: "fixed:MS",
+ * "uniform:MIN:MAX", "exp:MEAN" or "lognormal:MEDIAN:SIGMA". Given several
+ * times, the distributions are dealt out to the slaves in turn to build a
+ * heterogeneous fleet.
+ *
+ * The fleet runs until interrupted, or for SECONDS, then drains like real
+ * slaves shutting down and prints the jobs each slave ran as one JSON line on
+ * stdout. A slave the master evicted registers again with its next report.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "../lib/utilities.h"
+#include "../lib/transfer.h"
+#include "../lib/compress.h"
+#include "../lib/dedup.h"
+#include "../lib/log.h"
+#include "bench.h"
+
+#define MAX_DISTRIBUTIONS 16
+#define DEFAULT_SLAVES 10
+#define DEFAULT_BASE_PORT 9000
+#define DEFAULT_REPORT_INTERVAL_MS 1000
+
+typedef struct VirtualSlave VirtualSlave;
+typedef struct Fleet Fleet;
+
+struct VirtualSlave {
+    int id;
+    unsigned int generation;
+    bool drained;
+
+    /* Whether the master waits for the slave to greet each job before sending its files. */
+    bool ready;
+    char address[INET_ADDRSTRLEN];
+    int port;
+    int listener;
+    Distribution *distribution;
+    unsigned int seed;
+
+    /* Nanoseconds spent busy, not counting the current job, which started at busy_since. */
+    unsigned long busy;
+    unsigned long busy_since;
+    unsigned long jobs;
+
+    Fleet *fleet;
+};
+
+struct Fleet {
+    struct sockaddr_in master_address;
+    VirtualSlave *slaves;
+    int count;
+    int report_interval_ms;
+    char *output_path;
+    long output_size;
+    ChunkStore *store;
+};
+
+volatile sig_atomic_t terminated = 0;
+
+bool listen_as(VirtualSlave *slave);
+bool register_slave(VirtualSlave *slave);
+bool drain_slave(VirtualSlave *slave);
+void run_job(VirtualSlave *slave, int master_socket);
+void *serve_jobs(void *argv);
+void *report_load(void *argv);
+void terminate(int signal);
+
+/**
+ * Binds and listens on a virtual slave's address and port.
+ *
+ * @param slave The virtual slave.
+ *
+ * @return Whether or not the slave is listening.
+ */
+bool listen_as(VirtualSlave *slave) {
+    int opt = 1;
+    struct sockaddr_in slave_address;
+
+    if ((slave->listener = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
+        perror("[X] socket");
+        return false;
+    }
+
+    setsockopt(slave->listener, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    memset(&slave_address, 0, sizeof slave_address);
+    slave_address.sin_family = AF_INET;
+    slave_address.sin_port = htons(slave->port);
+    inet_pton(AF_INET, slave->address, &slave_address.sin_addr);
+
+    if (bind(slave->listener, (struct sockaddr *)&slave_address, sizeof slave_address) == -1
+        || listen(slave->listener, MAX_BACKLOG) == -1) {
+        perror("[X] bind");
+        close(slave->listener);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Registers a virtual slave with the master node, which assigns its id.
+ *
+ * @param slave The virtual slave.
+ *
+ * @return Whether or not the master added the slave.
+ */
+bool register_slave(VirtualSlave *slave) {
+    struct sockaddr_in master_address = slave->fleet->master_address;
+    int master_socket;
+
+    master_address.sin_port = htons(get_port(LISTEN_FOR_SLAVES_PORT_ENV, LISTEN_FOR_SLAVES_PORT));
+
+    if ((master_socket = socket(AF_INET, SOCK_STREAM, 0)) == -1
+        || connect(master_socket, (struct sockaddr *)&master_address, sizeof master_address) == -1) {
+        perror("[X] connect");
+        return false;
+    }
+
+    char registration[MAX_BUFFER_SIZE], response[MAX_BUFFER_SIZE], status[MAX_BUFFER_SIZE] = "", feature[MAX_BUFFER_SIZE] = "";
+    snprintf(registration, sizeof(registration), "%s %d ready", slave->address, slave->port);
+
+    send_message(master_socket, registration);
+    recv_message(master_socket, response);
+
+    close(master_socket);
+
+    log_debug("[Slave %s:%d]: Received: [%s] from Master (%I).\n", slave->address, slave->port, response, &master_address);
+
+    slave->generation = 0;
+
+    bool added = sscanf(response, "%s %d %u %s", status, &slave->id, &slave->generation, feature) >= 2 && strcmp(status, "{SUCCESSFULLY_ADDED_SLAVE}") == 0;
+
+    __atomic_store_n(&slave->ready, strcmp(feature, "ready") == 0, __ATOMIC_RELAXED);
+
+    return added;
+}
+
+/**
+ * Asks the master to drain a virtual slave.
+ *
+ * @param slave The virtual slave.
+ *
+ * @return Whether or not the slave is done, i.e. it has no outstanding jobs or the master is gone.
+ */
+bool drain_slave(VirtualSlave *slave) {
+    struct sockaddr_in master_address = slave->fleet->master_address;
+    int master_socket;
+
+    master_address.sin_port = htons(get_port(LISTEN_FOR_SLAVES_PORT_ENV, LISTEN_FOR_SLAVES_PORT));
+
+    if ((master_socket = socket(AF_INET, SOCK_STREAM, 0)) == -1
+        || connect(master_socket, (struct sockaddr *)&master_address, sizeof master_address) == -1) {
+        perror("[X] connect");
+
+        if (master_socket != -1)
+            close(master_socket);
+
+        return true;
+    }
+
+    char payload[MAX_BUFFER_SIZE], response[MAX_BUFFER_SIZE];
+    snprintf(payload, sizeof(payload), "{DRAIN_SLAVE} %d %u", slave->id, slave->generation);
+
+    send_message(master_socket, payload);
+    recv_message(master_socket, response);
+
+    close(master_socket);
+
+    log_debug("[Slave %s:%d]: Received: [%s] from Master (%I).\n", slave->address, slave->port, response, &master_address);
+
+    return strncmp(response, "{DRAINING_SLAVE}", 16) != 0;
+}
+
+/**
+ * Receives a job, pretends to execute it and sends back the synthetic output.
+ * A job the master cancels, with {CANCEL_JOB} or by closing the connection,
+ * stops straight away.
+ *
+ * @param slave The virtual slave running the job.
+ * @param master_socket The socket connected to the master node.
+ */
+void run_job(VirtualSlave *slave, int master_socket) {
+    Fleet *fleet = slave->fleet;
+    char request[MAX_BUFFER_SIZE], executable[MAX_BUFFER_SIZE], input_file[MAX_BUFFER_SIZE], codec_name[MAX_BUFFER_SIZE];
+    long executable_size, input_file_size;
+    int codec;
+
+    /* The job waited in the backlog while the slave ran the ones ahead of it, and may have been taken elsewhere meanwhile. */
+    if (__atomic_load_n(&slave->ready, __ATOMIC_RELAXED) && !send_message(master_socket, "{READY_FOR_JOB}"))
+        return;
+
+    if (!recv_message(master_socket, request))
+        return;
+
+    if (sscanf(request, "%s %ld %s %ld %s", executable, &executable_size, input_file, &input_file_size, codec_name) != 5
+        || executable_size < 0 || input_file_size < 0 || (codec = get_codec(codec_name)) == -1) {
+        send_message(master_socket, "{FAILED_TO_RECEIVE_JOB_REQUEST}");
+        return;
+    }
+
+    /* The files are consumed like a real slave would, then thrown away. */
+    bool received = codec == CODEC_CDC
+        ? recv_deduplicated_file(master_socket, fleet->store, "/dev/null", executable_size, 0644, NULL, NULL)
+            && recv_deduplicated_file(master_socket, fleet->store, "/dev/null", input_file_size, 0644, NULL, NULL)
+        : recv_decoded_file(master_socket, "/dev/null", executable_size, 0644, codec, NULL)
+            && recv_decoded_file(master_socket, "/dev/null", input_file_size, 0644, codec, NULL);
+
+    if (!received) {
+        send_message(master_socket, "{FAILED_TO_RECEIVE_BUFFER}");
+        return;
+    }
+
+    send_message(master_socket, "{SUCCESSFULLY_RECEIVED_BUFFER}");
+
+    unsigned long started = now_nanoseconds();
+    __atomic_store_n(&slave->busy_since, started, __ATOMIC_RELAXED);
+
+    double seconds = sample_distribution(slave->distribution, &slave->seed);
+    unsigned long finished = started + (unsigned long)(seconds * 1e9);
+
+    /* The master sends nothing while a job runs, so the connection only wakes us if the master cancelled it by hanging up. */
+    struct pollfd pfd = { master_socket, POLLIN, 0 };
+    bool cancelled = false;
+
+    for (unsigned long now = started; now < finished && !cancelled; now = now_nanoseconds()) {
+        int ready = poll(&pfd, 1, (int)((finished - now + 999999) / 1000000));
+        cancelled = ready > 0 || (ready == -1 && errno != EINTR);
+    }
+
+    __atomic_fetch_add(&slave->busy, now_nanoseconds() - started, __ATOMIC_RELAXED);
+    __atomic_store_n(&slave->busy_since, 0, __ATOMIC_RELAXED);
+
+    if (cancelled) {
+        log_debug("[Slave %s:%d]: Master cancelled job [%s].\n", slave->address, slave->port, request);
+        return;
+    }
+
+    __atomic_fetch_add(&slave->jobs, 1, __ATOMIC_RELAXED);
+
+    char output_request[MAX_BUFFER_SIZE];
+    snprintf(output_request, sizeof(output_request), "%s_output.txt %ld", basename(executable), fleet->output_size);
+
+    set_cork(master_socket, true);
+    bool sent = send_message(master_socket, output_request) && send_encoded_file(master_socket, fleet->output_path, fleet->output_size, codec, NULL);
+    set_cork(master_socket, false);
+
+    char response[MAX_BUFFER_SIZE];
+
+    if (sent && recv_message(master_socket, response))
+        log_debug("[Slave %s:%d]: Ran job [%s] in %.3f s.\n", slave->address, slave->port, request, seconds);
+}
+
+/**
+ * Runs the jobs the master sends a virtual slave, one at a time like a real slave.
+ *
+ * @param argv The VirtualSlave to serve.
+ */
+void *serve_jobs(void *argv) {
+    VirtualSlave *slave = (VirtualSlave *)argv;
+
+    /* Jobs keep being served while the fleet drains, until its listener is shut down. */
+    while (true) {
+        int master_socket = accept(slave->listener, NULL, NULL);
+
+        if (master_socket == -1) {
+            if (terminated)
+                break;
+
+            continue;
+        }
+
+        tune_socket(master_socket);
+        run_job(slave, master_socket);
+        close(master_socket);
+    }
+
+    pthread_exit(NULL);
+}
+
+/**
+ * Reports the load of every virtual slave once per report interval, spread over the interval.
+ *
+ * @param argv The Fleet to report for.
+ */
+void *report_load(void *argv) {
+    Fleet *fleet = (Fleet *)argv;
+    struct sockaddr_in master_address = fleet->master_address;
+    unsigned long *last_busy = (unsigned long *)calloc(fleet->count, sizeof(unsigned long));
+    unsigned long *last_report = (unsigned long *)calloc(fleet->count, sizeof(unsigned long));
+    long gap = fleet->report_interval_ms * 1000000L / fleet->count;
+    struct timespec interval = { gap / 1000000000L, gap % 1000000000L };
+
+    master_address.sin_port = htons(get_port(SEND_CPU_UTILIZATION_PORT_ENV, SEND_CPU_UTILIZATION_PORT));
+
+    for (int i = 0; i < fleet->count; i++)
+        last_report[i] = now_nanoseconds();
+
+    while (!terminated) {
+        for (int i = 0; i < fleet->count && !terminated; i++) {
+            VirtualSlave *slave = &fleet->slaves[i];
+            unsigned long now = now_nanoseconds();
+            unsigned long since = __atomic_load_n(&slave->busy_since, __ATOMIC_RELAXED);
+            unsigned long busy = __atomic_load_n(&slave->busy, __ATOMIC_RELAXED) + (since ? now - since : 0);
+
+            float utilization = now > last_report[i] ? (float)(busy - last_busy[i]) / (now - last_report[i]) : 0;
+            utilization = utilization > 1 ? 1 : utilization;
+
+            last_busy[i] = busy;
+            last_report[i] = now;
+
+            int master_socket = socket(AF_INET, SOCK_STREAM, 0);
+
+            bool evicted = false;
+
+            if (master_socket != -1 && connect(master_socket, (struct sockaddr *)&master_address, sizeof master_address) == 0) {
+                char payload[MAX_BUFFER_SIZE], response[MAX_BUFFER_SIZE];
+                snprintf(payload, sizeof(payload), "%d %f %u", slave->id, utilization, slave->generation);
+
+                send_message(master_socket, payload);
+                evicted = recv_message(master_socket, response) && strcmp(response, "{FAILED_TO_UPDATE_CPU_UTILIZATION}") == 0;
+            }
+
+            if (master_socket != -1)
+                close(master_socket);
+
+            if (evicted && register_slave(slave))
+                log_info("[Slave %s:%d]: Registered again as Slave %d.\n", slave->address, slave->port, slave->id);
+
+            nanosleep(&interval, NULL);
+        }
+    }
+
+    free(last_busy);
+    free(last_report);
+
+    pthread_exit(NULL);
+}
+
+void terminate(int signal) {
+    terminated = 1;
+}
+
+int main(int argc, char **argv) {
+    Fleet fleet;
+    Distribution distributions[MAX_DISTRIBUTIONS];
+    int distribution_count = 0, option, seconds = 0, base_port = DEFAULT_BASE_PORT;
+    bool by_address = false;
+
+    memset(&fleet, 0, sizeof(fleet));
+    fleet.count = DEFAULT_SLAVES;
+    fleet.report_interval_ms = DEFAULT_REPORT_INTERVAL_MS;
+    fleet.output_size = 3;
+
+    while ((option = getopt(argc, argv, "n:m:p:e:u:s:d:")) != -1) {
+        switch (option) {
+            case 'n': fleet.count = atoi(optarg); break;
+            case 'm': by_address = strcmp(optarg, "addresses") == 0; break;
+            case 'p': base_port = atoi(optarg); break;
+            case 'u': fleet.report_interval_ms = atoi(optarg); break;
+            case 's': fleet.output_size = atol(optarg); break;
+            case 'd': seconds = atoi(optarg); break;
+            case 'e':
+                if (distribution_count == MAX_DISTRIBUTIONS || !parse_distribution(optarg, &distributions[distribution_count++])) {
+                    fprintf(stderr, "[X] Invalid distribution: %s.\n", optarg);
+                    return 1;
+                }
+                break;
+            default:
+                optind = argc + 1;
+        }
+    }
+
+    if (argc - optind != 1 || fleet.count < 1 || fleet.report_interval_ms < 1 || fleet.output_size < 0) {
+        fprintf(stderr, "USAGE: %s <MASTER_IP_ADDRESS> [-n SLAVES] [-m ports|addresses] [-p BASE_PORT] "
+                        "[-e DISTRIBUTION]... [-u REPORT_INTERVAL_MS] [-s OUTPUT_BYTES] [-d SECONDS]\n", argv[0]);
+        return 1;
+    }
+
+    if (distribution_count == 0)
+        parse_distribution("exp:10", &distributions[distribution_count++]);
+
+    /* A master that hangs up mid-transfer must fail the job, not kill the fleet. */
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, terminate);
+    signal(SIGTERM, terminate);
+
+    log_init(stdout);
+
+    memset(&fleet.master_address, 0, sizeof(fleet.master_address));
+    fleet.master_address.sin_family = AF_INET;
+
+    if (inet_pton(AF_INET, argv[optind], &fleet.master_address.sin_addr) <= 0) {
+        fputs("\nInvalid address / Address not supported.\n", stderr);
+        return 1;
+    }
+
+    /* Every slave shares one synthetic output and one chunk store. */
+    char directory[] = "/tmp/dlb-fakeslave-XXXXXX";
+    char output_path[sizeof(directory) + 16], store_path[sizeof(directory) + 16];
+
+    if (!mkdtemp(directory)) {
+        perror("[X] mkdtemp");
+        return 1;
+    }
+
+    snprintf(output_path, sizeof(output_path), "%s/output.txt", directory);
+    snprintf(store_path, sizeof(store_path), "%s/chunks", directory);
+
+    FILE *output = fopen(output_path, "w");
+
+    for (long i = 0; i < fleet.output_size; i++)
+        fputc(i == fleet.output_size - 1 ? '\n' : '0' + i % 10, output);
+
+    fclose(output);
+
+    fleet.output_path = output_path;
+    fleet.store = createChunkStore(store_path, 0);
+    fleet.slaves = (VirtualSlave *)calloc(fleet.count, sizeof(VirtualSlave));
+
+    pthread_t *threads = (pthread_t *)malloc(sizeof(pthread_t) * fleet.count);
+    int registered = 0;
+
+    for (int i = 0; i < fleet.count; i++) {
+        VirtualSlave *slave = &fleet.slaves[i];
+        struct in_addr address = { htonl(INADDR_LOOPBACK + (by_address ? 1 + i : 0)) };
+
+        inet_ntop(AF_INET, &address, slave->address, sizeof(slave->address));
+        slave->port = by_address ? get_port(SEND_JOB_PORT_ENV, SEND_JOB_PORT) : base_port + i;
+        slave->distribution = &distributions[i % distribution_count];
+        slave->seed = i + 1;
+        slave->fleet = &fleet;
+
+        if (!listen_as(slave) || !register_slave(slave)) {
+            fprintf(stderr, "[X] Failed to start virtual slave %s:%d.\n", slave->address, slave->port);
+            break;
+        }
+
+        pthread_create(&threads[i], NULL, serve_jobs, slave);
+        registered++;
+    }
+
+    fleet.count = registered;
+
+    log_info("[*] %d virtual slaves registered with Master (%I).\n", registered, &fleet.master_address);
+
+    pthread_t report_thread;
+
+    if (registered > 0)
+        pthread_create(&report_thread, NULL, report_load, &fleet);
+
+    for (int elapsed = 0; !terminated && registered > 0 && (seconds == 0 || elapsed < seconds); elapsed++)
+        sleep(1);
+
+    terminated = 1;
+
+    /* Every slave stops taking jobs before any is waited on, so the last jobs are not shuffled between them. */
+    for (bool drained = false; !drained && registered > 0; ) {
+        drained = true;
+
+        for (int i = 0; i < registered; i++) {
+            if (!fleet.slaves[i].drained)
+                fleet.slaves[i].drained = drain_slave(&fleet.slaves[i]);
+
+            drained = drained && fleet.slaves[i].drained;
+        }
+
+        if (!drained)
+            usleep(100000);
+    }
+
+    /* Wake the listeners blocked in accept(). */
+    for (int i = 0; i < registered; i++)
+        shutdown(fleet.slaves[i].listener, SHUT_RDWR);
+
+    for (int i = 0; i < registered; i++) {
+        pthread_join(threads[i], NULL);
+        close(fleet.slaves[i].listener);
+    }
+
+    if (registered > 0)
+        pthread_join(report_thread, NULL);
+
+    printf("{\"bench\": \"fakeslave\", \"slaves\": %d, \"jobs\": [", registered);
+
+    for (int i = 0; i < registered; i++)
+        printf("%s%lu", i ? ", " : "", fleet.slaves[i].jobs);
+
+    printf("]}\n");
+
+    char command[MAX_BUFFER_SIZE];
+    snprintf(command, sizeof(command), "rm -rf %s", directory);
+    free(execute(command));
+
+    free(fleet.store);
+    free(fleet.slaves);
+    free(threads);
+
+    return registered > 0 ? 0 : 1;
+}
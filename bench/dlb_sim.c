@@ -0,0 +1,589 @@
+/**
+ * A C program used to compare the master's placement policies without sockets.
+ *
+ * A discrete-event simulation replays a trace of job arrivals against modeled
+ * slaves, placing every job with the scheduler the master uses. Each modeled
+ * slave runs its jobs one at a time in FIFO order, like a real slave, and
+ * reports the fraction of the last report interval it spent busy, which is
+ * what the min-utilization policy places on. A slave runs the first job for
+ * each key it sees COLD_MS slower, modeling a cold chunk store, so that the
+ * affinity policy has something to win.
+ *
+ * With -s, a slave that runs out of jobs steals the job queued last on the
+ * slave with the most jobs outstanding, like the master's work stealing, so
+ * that a slave stuck behind a long job does not hold up the ones after it.
+ *
+ * The trace is a CSV file of "arrival_seconds,service_seconds[,key]" lines,
+ * or the CSV written by dlb-bench -o, whose latencies stand in for service
+ * times. Without a trace, JOBS jobs arrive as a Poisson process at RATE jobs
+ * per second with service times drawn from DISTRIBUTION and one of KEYS
+ * executables each.
+ *
+ * To properly compile this program see COMPILE:
+ *
+ * COMPILE: gcc bench/dlb_sim.c -lpthread -lm -o dlb-sim
+ *
+ * To properly use this program see USAGE:
+ *
+ * USAGE: ./dlb-sim [TRACE] [-n SLAVES] [-p POLICY]... [-u REPORT_INTERVAL_MS] [-x SPEED]... [-k COLD_MS] [-s]
+ *                  [-g JOBS] [-r RATE] [-e DISTRIBUTION] [-a KEYS] [-S SEED]
+ * e.g. ./dlb-sim -n 100 -g 100000 -r 4000 -e exp:20 -x 1 -x 0.5
+ * e.g. ./dlb-sim open.csv -n 8 -p p2c -p affinity
+ * e.g. ./dlb-sim -n 16 -g 20000 -r 700 -e lognormal:20:1.5 -s
+ *
+ * Every policy, or each one given with -p, prints one JSON line on stdout with
+ * its makespan, mean slave utilization and latency percentiles, the jobs that
+ * were stolen, and the wall time the simulation took.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "../lib/slavelist.h"
+#include "../lib/scheduler.h"
+#include "bench.h"
+
+#define EVENT_ARRIVAL 0
+#define EVENT_COMPLETION 1
+#define EVENT_REPORT 2
+
+#define MAX_SPEEDS 16
+#define DEFAULT_SLAVES 16
+#define DEFAULT_REPORT_INTERVAL_MS 1000
+
+typedef struct Trace Trace;
+typedef struct Event Event;
+typedef struct EventQueue EventQueue;
+typedef struct Model Model;
+
+struct Trace {
+    double *arrivals;
+    double *services;
+    int *keys;
+    long count;
+    long capacity;
+
+    /* Distinct keys in order of appearance; a job's key indexes this. */
+    char **key_names;
+    int key_count;
+};
+
+struct Event {
+    double time;
+    int type;
+    long index;
+};
+
+struct EventQueue {
+    Event *events;
+    long count;
+    long capacity;
+};
+
+/* The simulated state of one slave, indexed like the scheduler's slaves. */
+struct Model {
+    double speed;
+    bool busy;
+    double busy_since;
+    double busy_total;
+
+    double reported_at;
+    double reported_busy;
+
+    /* The slave's FIFO of jobs, the running one first, linked through next_job and previous_job. */
+    long head;
+    long tail;
+
+    bool *warm;
+};
+
+Trace *createTrace();
+int intern_key(Trace *trace, char *name);
+void add_job(Trace *trace, double arrival, double service, char *key);
+Trace *read_trace(char *path);
+Trace *generate_trace(long jobs, double rate, Distribution *distribution, int keys, unsigned int seed);
+void push_event(EventQueue *queue, double time, int type, long index);
+Event pop_event(EventQueue *queue);
+double start_job(Model *model, Trace *trace, long job, double now, double cold, long *cold_starts);
+long steal_queued_job(Model *models, SlaveList *list, int thief, long *next_job, long *previous_job);
+void simulate(Trace *trace, int policy, int slaves, double *speeds, int speed_count, double interval, double cold, bool stealing, uint64_t seed);
+
+/**
+ * Creates an empty trace.
+ *
+ * WARNING: 'createTrace' malloc()s memory to '*trace' which must be freed by
+ * the caller.
+ *
+ * @return The trace.
+ */
+Trace *createTrace() {
+    Trace *trace = (Trace *)calloc(1, sizeof(Trace));
+
+    if (!trace) {
+        perror("[X] malloc");
+        exit(1);
+    }
+
+    return trace;
+}
+
+/**
+ * Looks up the index of a key, adding it if the trace has not seen it.
+ *
+ * @param trace The trace.
+ * @param name The key.
+ *
+ * @return The index of the key.
+ */
+int intern_key(Trace *trace, char *name) {
+    for (int i = 0; i < trace->key_count; i++) {
+        if (strcmp(trace->key_names[i], name) == 0)
+            return i;
+    }
+
+    trace->key_names = (char **)realloc(trace->key_names, sizeof(char *) * (trace->key_count + 1));
+    trace->key_names[trace->key_count] = strdup(name);
+
+    return trace->key_count++;
+}
+
+/**
+ * Appends a job to a trace.
+ *
+ * @param trace The trace.
+ * @param arrival When the job arrives, in seconds.
+ * @param service How long the job runs on a slave of speed 1, in seconds.
+ * @param key The job's affinity key.
+ */
+void add_job(Trace *trace, double arrival, double service, char *key) {
+    if (trace->count == trace->capacity) {
+        trace->capacity = trace->capacity ? trace->capacity * 2 : 1024;
+        trace->arrivals = (double *)realloc(trace->arrivals, sizeof(double) * trace->capacity);
+        trace->services = (double *)realloc(trace->services, sizeof(double) * trace->capacity);
+        trace->keys = (int *)realloc(trace->keys, sizeof(int) * trace->capacity);
+
+        if (!trace->arrivals || !trace->services || !trace->keys) {
+            perror("[X] realloc");
+            exit(1);
+        }
+    }
+
+    trace->arrivals[trace->count] = arrival;
+    trace->services[trace->count] = service;
+    trace->keys[trace->count] = intern_key(trace, key);
+    trace->count++;
+}
+
+/**
+ * Reads a trace, either "arrival_seconds,service_seconds[,key]" lines or the CSV written by dlb-bench -o.
+ *
+ * WARNING: 'read_trace' malloc()s memory to '*trace' which must be freed by
+ * the caller.
+ *
+ * @param path The path to the trace.
+ *
+ * @return The trace in order of arrival, or NULL if it could not be read.
+ */
+Trace *read_trace(char *path) {
+    FILE *file = fopen(path, "r");
+
+    if (!file) {
+        perror("[X] fopen");
+        return NULL;
+    }
+
+    Trace *trace = createTrace();
+    char line[MAX_BUFFER_SIZE * 4];
+    bool from_bench = false;
+
+    while (fgets(line, sizeof(line), file)) {
+        char key[MAX_BUFFER_SIZE] = "job", status[MAX_BUFFER_SIZE];
+        double arrival, service;
+        long job;
+
+        if (strncmp(line, "job,", 4) == 0) {
+            from_bench = true;
+            continue;
+        }
+
+        if (from_bench) {
+            /* job,executable,input_file,started_seconds,latency_seconds,status[,trace_id] */
+            if (sscanf(line, "%ld,%[^,],%*[^,],%lf,%lf,%[^,\n]", &job, key, &arrival, &service, status) == 5
+                && strcmp(status, "{SUCCESSFULLY_RECEIVED_BUFFER}") == 0)
+                add_job(trace, arrival, service, basename(key));
+        } else if (sscanf(line, "%lf,%lf,%s", &arrival, &service, key) >= 2 && service >= 0) {
+            add_job(trace, arrival, service, key);
+        }
+    }
+
+    fclose(file);
+
+    /* Arrivals are replayed in order, so a trace must already be sorted. */
+    for (long i = 1; i < trace->count; i++) {
+        if (trace->arrivals[i] < trace->arrivals[i - 1]) {
+            fprintf(stderr, "[X] %s: arrival on line %ld is out of order.\n", path, i + 1);
+            return NULL;
+        }
+    }
+
+    return trace;
+}
+
+/**
+ * Generates a trace of Poisson arrivals.
+ *
+ * WARNING: 'generate_trace' malloc()s memory to '*trace' which must be freed by
+ * the caller.
+ *
+ * @param jobs The number of jobs.
+ * @param rate The mean number of arrivals per second.
+ * @param distribution The distribution of service times.
+ * @param keys The number of distinct keys, drawn uniformly.
+ * @param seed The seed of the trace.
+ *
+ * @return The trace.
+ */
+Trace *generate_trace(long jobs, double rate, Distribution *distribution, int keys, unsigned int seed) {
+    Trace *trace = createTrace();
+    double arrival = 0;
+
+    for (long i = 0; i < jobs; i++) {
+        char key[32];
+        snprintf(key, sizeof(key), "job%d", rand_r(&seed) % keys);
+
+        add_job(trace, arrival, sample_distribution(distribution, &seed), key);
+        arrival += -log(1.0 - (double)rand_r(&seed) / ((double)RAND_MAX + 1)) / rate;
+    }
+
+    return trace;
+}
+
+/**
+ * Schedules an event.
+ *
+ * Events are kept in a binary min-heap on their time.
+ *
+ * @param queue The event queue.
+ * @param time When the event happens.
+ * @param type The EVENT_*.
+ * @param index The job of an arrival, or the slave of a completion or report.
+ */
+void push_event(EventQueue *queue, double time, int type, long index) {
+    if (queue->count == queue->capacity) {
+        queue->capacity = queue->capacity ? queue->capacity * 2 : 1024;
+        queue->events = (Event *)realloc(queue->events, sizeof(Event) * queue->capacity);
+
+        if (!queue->events) {
+            perror("[X] realloc");
+            exit(1);
+        }
+    }
+
+    long i = queue->count++;
+
+    for (; i > 0 && queue->events[(i - 1) / 2].time > time; i = (i - 1) / 2)
+        queue->events[i] = queue->events[(i - 1) / 2];
+
+    queue->events[i] = (Event){ time, type, index };
+}
+
+/**
+ * Removes the earliest event.
+ *
+ * @param queue The event queue, which must not be empty.
+ *
+ * @return The earliest event.
+ */
+Event pop_event(EventQueue *queue) {
+    Event first = queue->events[0];
+    Event last = queue->events[--queue->count];
+    long i = 0;
+
+    for (;;) {
+        long child = 2 * i + 1;
+
+        if (child >= queue->count)
+            break;
+
+        if (child + 1 < queue->count && queue->events[child + 1].time < queue->events[child].time)
+            child++;
+
+        if (queue->events[child].time >= last.time)
+            break;
+
+        queue->events[i] = queue->events[child];
+        i = child;
+    }
+
+    queue->events[i] = last;
+
+    return first;
+}
+
+/**
+ * Starts running a job on a modeled slave.
+ *
+ * @param model The slave.
+ * @param trace The trace the job belongs to.
+ * @param job The job.
+ * @param now The current time.
+ * @param cold The extra seconds the first job of a key runs for.
+ * @param cold_starts Counts the jobs that ran cold.
+ *
+ * @return When the job completes.
+ */
+double start_job(Model *model, Trace *trace, long job, double now, double cold, long *cold_starts) {
+    double service = trace->services[job] / model->speed;
+
+    if (!model->warm[trace->keys[job]]) {
+        model->warm[trace->keys[job]] = true;
+        service += cold;
+        (*cold_starts)++;
+    }
+
+    model->busy = true;
+    model->busy_since = now;
+
+    return now + service;
+}
+
+/**
+ * Lets an idle modeled slave steal the job queued last on the slave with the most jobs outstanding.
+ *
+ * @param models The slaves.
+ * @param list The scheduler's slaves, whose outstanding jobs move along with the job.
+ * @param thief The idle slave.
+ * @param next_job Links each job to the one queued after it.
+ * @param previous_job Links each job to the one queued before it.
+ *
+ * @return The stolen job, now the thief's only one, or -1 if no slave had a job waiting.
+ */
+long steal_queued_job(Model *models, SlaveList *list, int thief, long *next_job, long *previous_job) {
+    int victim = -1;
+
+    /* A slave's first job is already running, so only a slave with more than one has something to steal. */
+    for (int i = 0; i < list->size; i++) {
+        if (i != thief && models[i].head != models[i].tail
+            && (victim == -1 || list->slaves[i]->outstanding > list->slaves[victim]->outstanding))
+            victim = i;
+    }
+
+    if (victim == -1 || !claim_idle_slave(list->slaves[thief]))
+        return -1;
+
+    long job = models[victim].tail;
+
+    models[victim].tail = previous_job[job];
+    next_job[models[victim].tail] = -1;
+    release_slave(list->slaves[victim]);
+
+    models[thief].head = models[thief].tail = job;
+    previous_job[job] = -1;
+
+    return job;
+}
+
+/**
+ * Replays a trace against modeled slaves with one placement policy and prints the results.
+ *
+ * @param trace The trace.
+ * @param policy The POLICY_* to place jobs with.
+ * @param slaves The number of slaves.
+ * @param speeds The speeds of the slaves, dealt out in turn.
+ * @param speed_count The number of speeds.
+ * @param interval The seconds between a slave's utilization reports.
+ * @param cold The extra seconds the first job of a key runs for on each slave.
+ * @param stealing Whether or not idle slaves steal queued jobs.
+ * @param seed Seeds the scheduler's random draws.
+ */
+void simulate(Trace *trace, int policy, int slaves, double *speeds, int speed_count, double interval, double cold, bool stealing, uint64_t seed) {
+    double wall_started = now_seconds();
+
+    /* add() keeps the last entry of a list free. */
+    SlaveList *list = createSlaveList(slaves + 1);
+    Scheduler *scheduler = createScheduler(list, policy, seed);
+    Model *models = (Model *)calloc(slaves, sizeof(Model));
+    long *next_job = (long *)malloc(sizeof(long) * trace->count);
+    long *previous_job = (long *)malloc(sizeof(long) * trace->count);
+    double *latencies = (double *)malloc(sizeof(double) * trace->count);
+    EventQueue queue = { NULL, 0, 0 };
+    long completed = 0, cold_starts = 0, steals = 0;
+    double first_arrival = trace->count ? trace->arrivals[0] : 0, now = first_arrival;
+
+    for (int i = 0; i < slaves; i++) {
+        add(list, "sim", i, false, false, false);
+
+        models[i].speed = speeds[i % speed_count];
+        models[i].head = models[i].tail = -1;
+        models[i].warm = (bool *)calloc(trace->key_count, sizeof(bool));
+        models[i].reported_at = first_arrival;
+
+        /* Reports are spread over the interval like the staggered reports of real slaves. */
+        push_event(&queue, first_arrival + interval * (i + 1) / slaves, EVENT_REPORT, i);
+    }
+
+    for (long i = 0; i < trace->count; i++)
+        push_event(&queue, trace->arrivals[i], EVENT_ARRIVAL, i);
+
+    while (completed < trace->count) {
+        Event event = pop_event(&queue);
+        now = event.time;
+
+        if (event.type == EVENT_ARRIVAL) {
+            Slave *slave = select_slave(scheduler, trace->key_names[trace->keys[event.index]]);
+            Model *model = &models[slave->id];
+
+            next_job[event.index] = -1;
+            previous_job[event.index] = model->tail;
+
+            if (model->tail == -1)
+                model->head = event.index;
+            else
+                next_job[model->tail] = event.index;
+
+            model->tail = event.index;
+
+            if (!model->busy)
+                push_event(&queue, start_job(model, trace, event.index, now, cold, &cold_starts), EVENT_COMPLETION, slave->id);
+        } else if (event.type == EVENT_COMPLETION) {
+            Model *model = &models[event.index];
+            long job = model->head;
+
+            latencies[completed++] = now - trace->arrivals[job];
+            release_slave(list->slaves[event.index]);
+
+            model->busy = false;
+            model->busy_total += now - model->busy_since;
+            model->head = next_job[job];
+
+            if (model->head == -1)
+                model->tail = -1;
+            else
+                previous_job[model->head] = -1;
+
+            if (model->head == -1 && stealing && steal_queued_job(models, list, (int)event.index, next_job, previous_job) != -1)
+                steals++;
+
+            if (model->head != -1)
+                push_event(&queue, start_job(model, trace, model->head, now, cold, &cold_starts), EVENT_COMPLETION, event.index);
+        } else {
+            Model *model = &models[event.index];
+            double busy = model->busy_total + (model->busy ? now - model->busy_since : 0);
+            double utilization = now > model->reported_at ? (busy - model->reported_busy) / (now - model->reported_at) : 0;
+
+            report_utilization(scheduler, list->slaves[event.index], (float)utilization);
+
+            model->reported_at = now;
+            model->reported_busy = busy;
+
+            push_event(&queue, now + interval, EVENT_REPORT, event.index);
+        }
+    }
+
+    double makespan = now - first_arrival, busy = 0;
+    double mean = 0;
+
+    for (int i = 0; i < slaves; i++)
+        busy += models[i].busy_total;
+
+    for (long i = 0; i < completed; i++)
+        mean += latencies[i] / completed;
+
+    qsort(latencies, completed, sizeof(double), compare_latency);
+
+    printf("{\"bench\": \"sim\", \"policy\": \"%s\", \"slaves\": %d, \"jobs\": %ld, \"keys\": %d, \"makespan_seconds\": %.3f, "
+           "\"utilization\": %.3f, \"cold_starts\": %ld, \"stealing\": %s, \"steals\": %ld, \"mean_ms\": %.3f, \"p50_ms\": %.3f, \"p99_ms\": %.3f, \"p999_ms\": %.3f, "
+           "\"max_ms\": %.3f, \"wall_seconds\": %.3f}\n",
+           get_policy_name(policy), slaves, completed, trace->key_count, makespan,
+           makespan > 0 ? busy / (slaves * makespan) : 0, cold_starts, stealing ? "true" : "false", steals, mean * 1e3,
+           get_percentile(latencies, completed, 50) * 1e3,
+           get_percentile(latencies, completed, 99) * 1e3,
+           get_percentile(latencies, completed, 99.9) * 1e3,
+           completed ? latencies[completed - 1] * 1e3 : 0,
+           now_seconds() - wall_started);
+
+    fflush(stdout);
+
+    for (int i = 0; i < slaves; i++)
+        free(models[i].warm);
+
+    free(models);
+    free(next_job);
+    free(previous_job);
+    free(latencies);
+    free(queue.events);
+    free(scheduler);
+    cleanupList(list);
+}
+
+int main(int argc, char **argv) {
+    int slaves = DEFAULT_SLAVES, interval_ms = DEFAULT_REPORT_INTERVAL_MS, keys = 16, option;
+    int policies[POLICY_COUNT], policy_count = 0, speed_count = 0;
+    double speeds[MAX_SPEEDS], rate = 100, cold_ms = 0;
+    bool stealing = false;
+    long jobs = 10000;
+    unsigned int seed = 1;
+    Distribution distribution;
+
+    parse_distribution("exp:10", &distribution);
+
+    while ((option = getopt(argc, argv, "n:p:u:x:k:sg:r:e:a:S:")) != -1) {
+        switch (option) {
+            case 'n': slaves = atoi(optarg); break;
+            case 'u': interval_ms = atoi(optarg); break;
+            case 'k': cold_ms = atof(optarg); break;
+            case 's': stealing = true; break;
+            case 'g': jobs = atol(optarg); break;
+            case 'r': rate = atof(optarg); break;
+            case 'a': keys = atoi(optarg); break;
+            case 'S': seed = (unsigned int)atol(optarg); break;
+            case 'p':
+                if (policy_count == POLICY_COUNT || (policies[policy_count++] = get_policy(optarg)) == -1) {
+                    fprintf(stderr, "[X] Unknown policy: %s.\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'x':
+                if (speed_count == MAX_SPEEDS || (speeds[speed_count++] = atof(optarg)) <= 0) {
+                    fprintf(stderr, "[X] Invalid speed: %s.\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'e':
+                if (!parse_distribution(optarg, &distribution)) {
+                    fprintf(stderr, "[X] Invalid distribution: %s.\n", optarg);
+                    return 1;
+                }
+                break;
+            default:
+                optind = argc + 1;
+        }
+    }
+
+    if (argc - optind > 1 || slaves < 1 || interval_ms < 1 || jobs < 1 || rate <= 0 || keys < 1 || cold_ms < 0) {
+        fprintf(stderr, "USAGE: %s [TRACE] [-n SLAVES] [-p POLICY]... [-u REPORT_INTERVAL_MS] [-x SPEED]... [-k COLD_MS] [-s] "
+                        "[-g JOBS] [-r RATE] [-e DISTRIBUTION] [-a KEYS] [-S SEED]\n", argv[0]);
+        return 1;
+    }
+
+    Trace *trace = optind < argc ? read_trace(argv[optind]) : generate_trace(jobs, rate, &distribution, keys, seed);
+
+    if (!trace)
+        return 1;
+
+    if (speed_count == 0)
+        speeds[speed_count++] = 1;
+
+    if (policy_count == 0) {
+        for (int policy = 0; policy < POLICY_COUNT; policy++)
+            policies[policy_count++] = policy;
+    }
+
+    for (int i = 0; i < policy_count; i++)
+        simulate(trace, policies[i], slaves, speeds, speed_count, interval_ms / 1e3, cold_ms / 1e3, stealing, seed);
+
+    return 0;
+}
@@ -0,0 +1,65 @@
+# Runs every benchmark and appends its JSON lines to RESULTS, each tagged with
+# the commit and time of the run, so that results can be compared across commits.
+#
+# USAGE: cmake -DBENCH_DIR=<BUILD_DIR> -DSOURCE_DIR=<SOURCE_DIR> -DRESULTS=<FILE> -P bench/run_benches.cmake
+#
+# The bench target of the build runs this with RESULTS in the build directory.
+
+execute_process(
+    COMMAND git rev-parse --short HEAD
+    WORKING_DIRECTORY ${SOURCE_DIR}
+    OUTPUT_VARIABLE commit
+    OUTPUT_STRIP_TRAILING_WHITESPACE
+    ERROR_QUIET
+)
+
+if(NOT commit)
+    set(commit unknown)
+endif()
+
+string(TIMESTAMP timestamp "%Y-%m-%dT%H:%M:%SZ" UTC)
+
+set(benches
+    "bench_protocol 1000000"
+    "bench_transfer 64"
+    "bench_compress"
+    "bench_dedup"
+    "bench_log 8 2000"
+    "bench_scheduler 4 200000"
+    "bench_launch ${BENCH_DIR}/countwords 300"
+    "dlb-sim -n 100 -g 100000 -r 3000 -e exp:20 -x 1 -x 0.5"
+    "bench_e2e 4 8 500"
+)
+
+set(failed 0)
+
+foreach(bench IN LISTS benches)
+    separate_arguments(arguments UNIX_COMMAND "${bench}")
+    list(GET arguments 0 name)
+    list(REMOVE_AT arguments 0)
+
+    message(STATUS "Running ${name}")
+
+    execute_process(
+        COMMAND ${BENCH_DIR}/${name} ${arguments}
+        WORKING_DIRECTORY ${BENCH_DIR}
+        OUTPUT_VARIABLE output
+        RESULT_VARIABLE result
+    )
+
+    if(NOT result EQUAL 0)
+        message(WARNING "${name} failed: ${result}")
+        math(EXPR failed "${failed} + 1")
+        continue()
+    endif()
+
+    string(REGEX REPLACE "(^|\n){" "\\1{\"commit\": \"${commit}\", \"timestamp\": \"${timestamp}\", " output "${output}")
+    file(APPEND ${RESULTS} "${output}")
+    message("${output}")
+endforeach()
+
+if(failed)
+    message(FATAL_ERROR "${failed} benchmarks failed.")
+endif()
+
+message(STATUS "Appended the results to ${RESULTS}")
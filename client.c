@@ -3,12 +3,30 @@
  *
  * To properly compile this program see COMPILE:
  *
- * COMPILE: gcc client.c -o client
+ * COMPILE: gcc client.c -lpthread -o client
  *
  * To properly use this program see USAGE:
  *
- * USAGE: ./client <MASTER_IP_ADDRESS>
+ * USAGE: ./client <MASTER_IP_ADDRESS> [CODEC] [-f JOBS_FILE] [-j JOBS_IN_FLIGHT] [-t DEADLINE_MS] [-p PRIORITY]
  * e.g. ./client "10.211.55.13"
+ * e.g. ./client "10.211.55.13" lz
+ * e.g. ./client "10.211.55.13" lz -f jobs.txt -j 32
+ *
+ * CODEC proposes an encoding for the job's files: "none", "lz" to compress them
+ * on the wire or "cdc" to only send the chunks the master has not seen before.
+ * The master answers with the codec it accepted.
+ *
+ * With -f, the client runs every job listed in JOBS_FILE ("-" for stdin), one
+ * per line as typed at the prompt, instead of prompting for one. The jobs are
+ * pipelined over a single session with up to JOBS_IN_FLIGHT of them in flight,
+ * and their outputs are printed as they complete.
+ *
+ * With -t, every job fails with {FAILED_TO_MEET_DEADLINE} once it has taken
+ * DEADLINE_MS, and the slave running it stops it.
+ *
+ * With -p, every job is submitted in the PRIORITY class "interactive",
+ * "normal" (the default) or "batch". While jobs wait for a slave, interactive
+ * ones get most turns and batch ones the fewest.
  *
  * @author Nicholas Adamou
  * @author Jillian Shew
@@ -25,212 +43,103 @@
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <libgen.h>
+#include <signal.h>
+#include <getopt.h>
 
 #include "lib/utilities.h"
+#include "lib/transfer.h"
+#include "lib/compress.h"
+#include "lib/dedup.h"
+#include "lib/log.h"
+#include "lib/submit.h"
+#include "lib/dlb.h"
+
+bool print_output(char *output_path);
+void send_job_to_master(int master_socket, struct sockaddr_in *master_address, int codec, long deadline, int priority);
+void connect_to_master(char *address, int codec, long deadline, int priority);
+bool print_job_output(DLBJob *job, struct sockaddr_in *master_address);
+int run_jobs(char *address, int codec, char *jobs_path, int window, long deadline, int priority);
+
+/**
+ * Copies a job's output to stdout in chunks, however large it is.
+ *
+ * @param output_path The file the output was received into.
+ *
+ * @return Whether or not the whole output was printed.
+ */
+bool print_output(char *output_path) {
+    int fd = open(output_path, O_RDONLY);
+    struct stat st;
+
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        perror("[X] open");
+
+        if (fd != -1)
+            close(fd);
+
+        return false;
+    }
 
-void send_job_to_master(int master_socket, struct sockaddr_in *master_address);
-void connect_to_master(char *address);
+    fflush(stdout);
+
+    bool printed = copy_stream(fd, STDOUT_FILENO, st.st_size, LZ_BLOCK_SIZE, NULL);
+
+    close(fd);
+
+    return printed;
+}
 
 /**
  * Sends a job to the master node.
  *
  * @param master_socket The master socket for accepting client requests.
  * @param master_address The master host address.
+ * @param codec The codec to propose for the job.
+ * @param deadline The milliseconds the job may take, or 0 if it has no deadline.
+ * @param priority The PRIORITY_* class of the job.
  */
-void send_job_to_master(int master_socket, struct sockaddr_in *master_address) {
-    int bytes;
-    char *payload = NULL;
-    char *request = NULL;
-    FILE *file;
-
-    request = get_user_input("[?] Enter a job > ");
+void send_job_to_master(int master_socket, struct sockaddr_in *master_address, int codec, long deadline, int priority) {
+    char *request = get_user_input("[?] Enter a job > ");
     char **data = split(request, ' ');
 
-    Buffer *b1 = read_file(data[0], "rb");
-    Buffer *b2 = read_file(data[1], "r");
+    if (!data[0] || !data[1]) {
+        fputs("{FAILED_TO_READ_JOB}\n", stderr);
+        exit(1);
+    }
 
-    char job_request[MAX_BUFFER_SIZE];
-    sprintf(job_request, "%s %d %s %d", basename(b1->file_name), b1->size, basename(b2->file_name), b2->size);
+    char output_path[] = "/tmp/client_output_XXXXXX";
+    int fd = mkstemp(output_path);
 
-    bytes = send(master_socket, job_request, sizeof(job_request), 0);
-    printf("[Client]: Sending Job Request: [%s] to Master ('%s', %d).\n",
-           job_request,
-           inet_ntoa((*master_address).sin_addr),
-           htons((*master_address).sin_port)
-    );
+    if (fd == -1) {
+        perror("[X] mkstemp");
+        exit(1);
+    }
 
-    char response[MAX_BUFFER_SIZE];
-    bytes = recv(master_socket, response, sizeof(response), 0);
-    printf("[Client]: Received: [%s] from Master ('%s', %d).\n",
-           response,
-           inet_ntoa((*master_address).sin_addr),
-           ntohs((*master_address).sin_port)
-    );
+    close(fd);
 
-    if (bytes > 0 && strcmp(response, "{SUCCESSFULLY_RECEIVED_JOB_REQUEST}\0") == 0) {
-        payload = (char *)malloc(sizeof(char) * MAX_FILE_BUFFER_SIZE);
+    char trace_id[TRACE_ID_LENGTH + 1];
+    mint_trace_id(trace_id);
 
-        file = fopen(data[0], "rb");
+    log_info("[Client]: Submitting job with Trace ID: [%s].\n", trace_id);
 
-        if (!file) {
-            perror("[X] fopen");
-            exit(1);
-        }
+    char *status = submit_job(master_socket, master_address, data[0], data[1], codec, output_path, trace_id, deadline, priority);
+
+    if (status) {
+        fprintf(stderr, "%s\n", status);
+    } else {
+        printf("[Client]: Job Output: [");
+        print_output(output_path);
 
-        printf("[Client]: Sending: [%s] to Master ('%s', %d).\n",
-               b1->file_name,
+        printf("] from Master('%s', %d).\n",
                inet_ntoa((*master_address).sin_addr),
                htons((*master_address).sin_port)
         );
+    }
 
-        for (int i = 0; i < b1->size; i += MAX_FILE_BUFFER_SIZE) {
-            fread(payload, sizeof(char), MAX_FILE_BUFFER_SIZE, file);
-            send(master_socket, payload, MAX_FILE_BUFFER_SIZE, 0);
-        }
-
-        if (b1->size % MAX_FILE_BUFFER_SIZE != 0) {
-            fread(payload, sizeof(char), b1->size % MAX_FILE_BUFFER_SIZE, file);
-            send(master_socket, payload, b1->size % MAX_FILE_BUFFER_SIZE , 0);
-        }
-
-        fclose(file);
+    unlink(output_path);
 
-        free(payload);
-
-        bytes = recv(master_socket, response, sizeof(response), 0);
-        printf("[Client]: Received: [%s] from Master ('%s', %d).\n",
-               response,
-               inet_ntoa((*master_address).sin_addr),
-               ntohs((*master_address).sin_port)
-        );
-
-        if (bytes > 0 && strcmp(response, "{SUCCESSFULLY_RECEIVED_BUFFER}\0") == 0) {
-            payload = (char *)malloc(sizeof(char) * MAX_FILE_BUFFER_SIZE);
-
-            file = fopen(data[1], "r");
-
-            if (!file) {
-                perror("[X] fopen");
-
-                exit(1);
-            }
-
-            printf("[Client]: Sending: [%s] to Master ('%s', %d).\n",
-                   b2->file_name,
-                   inet_ntoa((*master_address).sin_addr),
-                   htons((*master_address).sin_port)
-            );
-
-            for (int i = 0; i < b2->size; i += MAX_FILE_BUFFER_SIZE) {
-                fread(payload, sizeof(char), MAX_FILE_BUFFER_SIZE, file);
-                send(master_socket, payload, MAX_FILE_BUFFER_SIZE, 0);
-            }
-
-            if (b2->size % MAX_FILE_BUFFER_SIZE != 0) {
-                fread(payload, sizeof(char), b2->size % MAX_FILE_BUFFER_SIZE, file);
-                send(master_socket, payload, b2->size % MAX_FILE_BUFFER_SIZE , 0);
-            }
-
-            fclose(file);
-
-            free(payload);
-
-            bytes = recv(master_socket, response, sizeof(response), 0);
-            printf("[Client]: Received: [%s] from Master ('%s', %d).\n",
-                   response,
-                   inet_ntoa((*master_address).sin_addr),
-                   ntohs((*master_address).sin_port)
-            );
-
-            if (bytes > 0 && strcmp(response, "{SUCCESSFULLY_RECEIVED_BUFFER}\0") == 0) {
-                bzero(response, sizeof(response));
-
-                payload = "{REQUEST_JOB_OUTPUT}";
-                bytes = send(master_socket, payload, strlen(payload), 0);
-                printf("[Client]: Sending: [%s] to Master ('%s', %d).\n",
-                       payload,
-                       inet_ntoa((*master_address).sin_addr),
-                       htons((*master_address).sin_port)
-                );
-
-                bytes = recv(master_socket, response, sizeof(response), 0);
-                printf("[Client]: Received: [%s] from Master ('%s', %d).\n",
-                       response,
-                       inet_ntoa((*master_address).sin_addr),
-                       ntohs((*master_address).sin_port)
-                );
-
-                if (bytes > 0) {
-                    Buffer *output = createBuffer();
-                    data = split(response, ' ');
-
-                    output->file_name = data[0];
-                    output->size = atoi(data[1]);
-
-                    free(data);
-
-                    payload = "{SUCCESSFULLY_RECEIVED_JOB_OUTPUT}";
-                    bytes = send(master_socket, payload, strlen(payload), 0);
-                    printf("[Client]: Sending: [%s] to Master ('%s', %d).\n",
-                           payload,
-                           inet_ntoa((*master_address).sin_addr),
-                           htons((*master_address).sin_port)
-                    );
-
-                    char output_file[output->size];
-                    char file_buffer[MAX_FILE_BUFFER_SIZE];
-
-                    for (int i = 0; i < output->size; i += MAX_FILE_BUFFER_SIZE) {
-                        bytes = recv(master_socket, file_buffer, MAX_FILE_BUFFER_SIZE, 0);
-                        strcat(output_file, file_buffer);
-                        printf("[Client]: Received %d bytes for file %s.\n", i, output->file_name);
-                    }
-
-                    if (output->size % MAX_FILE_BUFFER_SIZE != 0) {
-                        bytes = recv(master_socket, file_buffer, output->size % MAX_FILE_BUFFER_SIZE, 0);
-                        strcat(output_file, file_buffer);
-                        printf("[Client]: Received %d bytes for file %s.\n", bytes, output->file_name);
-                    }
-
-                    output->data = output_file;
-
-                    if (bytes > 0) {
-                        payload = "{SUCCESSFULLY_RECEIVED_BUFFER}";
-                        bytes = send(master_socket, payload, strlen(payload), 0);
-                        printf("[Client]: Sending: [%s] to Master ('%s', %d).\n",
-                               payload,
-                               inet_ntoa((*master_address).sin_addr),
-                               htons((*master_address).sin_port)
-                        );
-
-                        write_file(output->file_name, output, "w");
-
-                        printf("[Client]: Job Output: [%d] from Master('%s', %d).\n",
-                            atoi(output->data),
-                            inet_ntoa((*master_address).sin_addr),
-                            htons((*master_address).sin_port)
-                        );
-
-                        if (does_file_exist(output->file_name)) {
-                            char command[MAX_BUFFER_SIZE];
-                            snprintf(command, MAX_BUFFER_SIZE, "rm %s", output->file_name);
-                            execute(command);
-                        }
-                    } else {
-                        fputs("{FAILED_TO_RECEIVE_BUFFER}\n", stderr);
-                    }
-                } else {
-                    fputs("{FAILED_TO_RECEIVE_JOB_OUTPUT}\n", stderr);
-                }
-            } else {
-                fputs("{FAILED_TO_RECEIVE_BUFFER}\n", stderr);
-            }
-        } else {
-            fputs("{FAILED_TO_RECEIVE_BUFFER}\n", stderr);
-        }
-    } else {
-        fputs("{FAILED_TO_RECEIVE_JOB_REQUEST}\n", stderr);
-    }
+    for (int i = 0; data[i]; i++)
+        free(data[i]);
 
     free(data);
     free(request);
@@ -240,50 +149,217 @@ void send_job_to_master(int master_socket, struct sockaddr_in *master_address) {
  * Connects to the master node via a web socket connection.
  *
  * @param address The IPv4 address of the Master node.
+ * @param codec The codec to propose for the job.
+ * @param deadline The milliseconds the job may take, or 0 if it has no deadline.
+ * @param priority The PRIORITY_* class of the job.
  */
-void connect_to_master(char *address) {
-    int master_socket, bytes;
-    struct hostent *server_host;
+void connect_to_master(char *address, int codec, long deadline, int priority) {
+    int master_socket;
     struct sockaddr_in master_address;
 
-    /* Get master host from master name. */
-    server_host = gethostbyname(address);
-
-    /* Initialise IPv4 address. */
-    memset(&master_address, 0, sizeof address);
-    master_address.sin_family = AF_INET;
-    master_address.sin_port = htons(LISTEN_FOR_CLIENTS_PORT);
-    memcpy(&master_address.sin_addr.s_addr, server_host->h_addr, server_host->h_length);
-
-    /* Create TCP socket. */
-    if ((master_socket = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
-        perror("[X] socket");
+    if (!resolve_master(address, get_port(LISTEN_FOR_CLIENTS_PORT_ENV, LISTEN_FOR_CLIENTS_PORT), &master_address)) {
+        fprintf(stderr, "[X] Unknown host: %s.\n", address);
+        exit(1);
     }
 
     /* Connect to socket with master's address. */
-    while (connect(master_socket, (struct sockaddr *)&master_address, sizeof master_address) == -1) {
+    while ((master_socket = open_master_connection(&master_address)) == -1) {
         perror("[X] connect");
 
         sleep(rand() % 10);
     }
 
-    printf("[+] Client: has connected to the {LISTEN_FOR_CLIENT} socket on Master ('%s', %d).\n", inet_ntoa(master_address.sin_addr), htons(master_address.sin_port));
+    log_debug("[+] Client: has connected to the {LISTEN_FOR_CLIENT} socket on Master (%I).\n", &master_address);
 
-    send_job_to_master(master_socket, &master_address);
+    send_job_to_master(master_socket, &master_address, codec, deadline, priority);
 
     close(master_socket);
-    printf("[-] Client: has disconnected from the {LISTEN_FOR_CLIENT} socket on Master ('%s', %d).\n", inet_ntoa(master_address.sin_addr), htons(master_address.sin_port));
+    log_debug("[-] Client: has disconnected from the {LISTEN_FOR_CLIENT} socket on Master (%I).\n", &master_address);
+
+    log_debug("\n");
+}
+
+/**
+ * Prints the output of a completed job and removes its output file.
+ *
+ * @param job The completed job.
+ * @param master_address The master host address.
+ *
+ * @return Whether or not the job succeeded.
+ */
+bool print_job_output(DLBJob *job, struct sockaddr_in *master_address) {
+    if (job->status && job->retry_after > 0) {
+        fprintf(stderr, "%s %s: %s (retry after %ld ms)\n", job->executable, job->input_file, job->status, job->retry_after);
+    } else if (job->status) {
+        fprintf(stderr, "%s %s: %s\n", job->executable, job->input_file, job->status);
+    } else {
+        printf("[Client]: Job Output: [");
+        print_output(job->output_path);
+
+        printf("] for [%s %s] from Master('%s', %d).\n",
+               job->executable,
+               job->input_file,
+               inet_ntoa((*master_address).sin_addr),
+               htons((*master_address).sin_port)
+        );
+    }
+
+    unlink(job->output_path);
 
-    printf("\n");
+    return !job->status;
+}
+
+/**
+ * Runs every job listed in a file over a single session with the master node.
+ *
+ * @param address The IPv4 address of the Master node.
+ * @param codec The codec to propose for the jobs.
+ * @param jobs_path The file listing the jobs, one per line, or "-" for stdin.
+ * @param window The most jobs to keep in flight at a time.
+ * @param deadline The milliseconds each job may take, or 0 if they have no deadline.
+ * @param priority The PRIORITY_* class of the jobs.
+ *
+ * @return The number of jobs that failed, or -1 if the session could not be opened.
+ */
+int run_jobs(char *address, int codec, char *jobs_path, int window, long deadline, int priority) {
+    FILE *jobs = strcmp(jobs_path, "-") == 0 ? stdin : fopen(jobs_path, "r");
+
+    if (!jobs) {
+        perror("[X] fopen");
+        return -1;
+    }
+
+    DLBSession *session = dlb_connect(address, codec, window);
+
+    if (!session) {
+        if (jobs != stdin)
+            fclose(jobs);
+
+        return -1;
+    }
+
+    session->deadline = deadline;
+    session->priority = priority;
+
+    char *line = NULL;
+    size_t capacity = 0;
+    int failed = 0;
+    DLBJob *job;
+
+    while (getline(&line, &capacity, jobs) != -1) {
+        char executable[PATH_MAX], input_file[PATH_MAX], output_path[] = "/tmp/client_output_XXXXXX";
+
+        /* Blank lines and comments are skipped, like in dlb-bench manifests. */
+        if (sscanf(line, "%4095s %4095s", executable, input_file) != 2 || executable[0] == '#')
+            continue;
+
+        int fd = mkstemp(output_path);
+
+        if (fd == -1) {
+            perror("[X] mkstemp");
+            failed++;
+            break;
+        }
+
+        close(fd);
+
+        if (!dlb_submit(session, executable, input_file, output_path, NULL, NULL)) {
+            unlink(output_path);
+            failed++;
+            break;
+        }
+
+        /* Print whatever completed while this job was submitted, so outputs show up as they arrive. */
+        while ((job = dlb_poll(session))) {
+            failed += !print_job_output(job, &session->master_address);
+            dlb_free_job(job);
+        }
+    }
+
+    while ((job = dlb_wait(session))) {
+        failed += !print_job_output(job, &session->master_address);
+        dlb_free_job(job);
+    }
+
+    dlb_close(session);
+
+    free(line);
+
+    if (jobs != stdin)
+        fclose(jobs);
+
+    return failed;
 }
 
 int main(int argc, char **argv) {
+    char *jobs_path = NULL;
+    int window = DEFAULT_JOBS_IN_FLIGHT;
+    long deadline = 0;
+    char *priority_name = NULL;
+    int option;
+
+    /* A master that hangs up mid-transfer must fail the send, not kill the client. */
+    signal(SIGPIPE, SIG_IGN);
+
+    while ((option = getopt(argc, argv, "f:j:t:p:")) != -1) {
+        switch (option) {
+            case 'f': jobs_path = optarg; break;
+            case 'j': window = atoi(optarg); break;
+            case 't': deadline = atol(optarg); break;
+            case 'p': priority_name = optarg; break;
+            default:
+                fprintf(stderr, "USAGE: %s <MASTER_IP_ADDRESS> [CODEC] [-f JOBS_FILE] [-j JOBS_IN_FLIGHT] [-t DEADLINE_MS] [-p PRIORITY]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if (window < 1) {
+        fprintf(stderr, "[X] Invalid number of jobs in flight: %d.\n", window);
+        return 1;
+    }
+
+    if (deadline < 0) {
+        fprintf(stderr, "[X] Invalid deadline: %ld.\n", deadline);
+        return 1;
+    }
+
+    int priority = get_priority(priority_name);
+
+    if (priority == -1) {
+        fprintf(stderr, "[X] Unknown priority: %s.\n", priority_name);
+        return 1;
+    }
+
     /* Get Master's IP address from command line arguments or stdin. */
-    char *address = argc > 1 ? argv[1] : 0;
+    char *address = argc > optind ? argv[optind] : 0;
     if (!address) {
         printf("Enter Master's IP Address: ");
         scanf("%s", address);
     }
 
-    connect_to_master(address);
+    char *codec_name = argc > optind + 1 ? argv[optind + 1] : "none";
+    int codec = get_codec(codec_name);
+
+    if (codec == -1) {
+        fprintf(stderr, "[X] Unsupported codec: %s.\n", codec_name);
+        return 1;
+    }
+
+    trace_init("client");
+
+    if (jobs_path) {
+        /* Job outputs go to stdout; the log goes to stderr so that it does not interleave with them. */
+        log_init(stderr);
+
+        int failed = run_jobs(address, codec, jobs_path, window, deadline, priority);
+
+        log_shutdown();
+
+        if (failed > 0)
+            fprintf(stderr, "[X] %d jobs failed.\n", failed);
+
+        return failed != 0;
+    }
+
+    connect_to_master(address, codec, deadline, priority);
 }
\ No newline at end of file
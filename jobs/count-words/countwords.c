@@ -1,6 +1,9 @@
 /**
  * A C program used to count the number of words in a given text file.
  *
+ * It follows the persistent-job ABI (see lib/worker.h), so a slave may keep
+ * it running between jobs rather than start it for every one.
+ *
  * @author Nicholas Adamou
  * @author Jillian Shew
  * @author Bingzhen Li
@@ -9,25 +12,29 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
+
+#include "../../lib/worker.h"
 
 #define OUTPUT_FILE_NAME "countwords_output.txt"
 
 int countWords(char *file_path);
-void write_to_file(int word_count);
+bool write_to_file(int word_count);
+int run_job(int argc, char **argv);
 
 /**
  * Counts the number of words in a given file.
  *
  * @param file_path The path to the file.
  *
- * @return The number of words contained in the given file.
+ * @return The number of words contained in the given file, or -1 if it could not be opened.
  */
 int countWords(char *file_path) {
     FILE *file = fopen(file_path, "r");
 
     if (!file) {
         fputs("[X] fopen: failed to open file.", stderr);
-        exit(1);
+        return -1;
     }
 
     char c;
@@ -47,32 +54,61 @@ int countWords(char *file_path) {
  * Writes the number of words to a file.
  *
  * @param word_count The number of words found from countWords().
+ *
+ * @return Whether or not the file was written.
  */
-void write_to_file(int word_count) {
+bool write_to_file(int word_count) {
     FILE *file = fopen(OUTPUT_FILE_NAME, "w+");
 
     if (!file) {
         fputs("[X] fopen: failed to open file.", stderr);
-        exit(1);
+        return false;
     }
 
     fprintf(file, "%d", word_count);
 
     fclose(file);
+
+    return true;
 }
 
-int main(int argc, char **argv) {
-    char *file_path;
+/**
+ * Counts the words of one file, whether run on its own or as a worker.
+ *
+ * @param argc The number of arguments.
+ * @param argv The arguments, the path to the file after the program's name.
+ *
+ * @return The job's exit status.
+ */
+int run_job(int argc, char **argv) {
+    char path[4096];
+    char *file_path = argc > 1 ? argv[1] : NULL;
+
+    /* A worker's stdin carries the slave's requests, so only a program run on its own asks for the path. */
+    if (!file_path && is_worker()) {
+        fputs("[X] countwords: no file to count the words of.", stderr);
+        return 1;
+    }
 
-    /* Get file-path from command line arguments or stdin. */
-    file_path = argc > 1 ? argv[1] : 0;
+    /* Get file-path from stdin. */
     if (!file_path) {
         printf("Enter the path to the file: ");
-        scanf("%s", file_path);
+
+        if (scanf("%4095s", path) != 1)
+            return 1;
+
+        file_path = path;
     }
 
     int count = countWords(file_path);
-    write_to_file(count);
 
-    return 0;
+    return count != -1 && write_to_file(count) ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+    /* Started as a worker, it runs every job the slave sends it; a failed job does not take it down. */
+    if (is_worker())
+        return serve_jobs(run_job);
+
+    return run_job(argc, argv);
 }
\ No newline at end of file
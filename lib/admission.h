@@ -0,0 +1,241 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include "utilities.h"
+#include "metrics.h"
+#include "fairqueue.h"
+
+/*
+ * The master only takes on what it can hold. It handles at most MAX_CLIENTS
+ * connections at a time; the rest wait in the listen backlog. A job is judged
+ * on its request alone, before any of its files are sent: it is rejected if
+ * MAX_QUEUED_JOBS are already waiting for a turn, if its files would take the
+ * files in flight past the memory budget, or if the wait for a turn is
+ * estimated to be longer than MAX_QUEUE_WAIT or its deadline. A rejected
+ * client is told how long to wait before trying again.
+ *
+ * Files are reserved at the sizes their requests announce and released when
+ * their job is freed. A job whose files alone are larger than the budget is
+ * never admitted.
+ *
+ * The wait is estimated from the jobs queued ahead, the turns the slaves have
+ * and a moving average of how long jobs hold a turn, regardless of class.
+ */
+#define MAX_CLIENTS 1024
+#define MAX_CLIENTS_ENV "DLB_MAX_CLIENTS"
+
+#define MAX_QUEUED_JOBS 1024
+#define MAX_QUEUED_JOBS_ENV "DLB_MAX_QUEUED_JOBS"
+
+/* In MiB. */
+#define MEMORY_BUDGET 1024
+#define MEMORY_BUDGET_ENV "DLB_MEMORY_BUDGET_MB"
+
+/* In milliseconds. */
+#define MAX_QUEUE_WAIT 30000
+#define MAX_QUEUE_WAIT_ENV "DLB_MAX_QUEUE_WAIT_MS"
+
+/* The retry-after given when the wait cannot be estimated, and the bounds of any other, in milliseconds. */
+#define RETRY_AFTER 1000
+#define MIN_RETRY_AFTER 100
+#define MAX_RETRY_AFTER 60000
+
+/* The weight of the latest turn in the moving average, as a fraction 1 / TURN_TIME_WEIGHT. */
+#define TURN_TIME_WEIGHT 8
+
+/* What admit_job() returns for a job it admits; otherwise it returns the REJECT_* limit the job hit. */
+#define ADMITTED -1
+
+typedef struct Admission Admission;
+
+struct Admission {
+    int max_clients;
+    int max_queued;
+    long budget;
+    int max_wait;
+
+    /* Connections being handled, and a signal for when one of them ends. */
+    int clients;
+    pthread_mutex_t lock;
+    pthread_cond_t released;
+
+    /* Bytes reserved by admitted jobs. */
+    long in_flight;
+
+    /* The moving average of how long a job holds its turn, in nanoseconds, or 0 until one has. */
+    unsigned long turn_time;
+};
+
+Admission *createAdmission(int max_clients, int max_queued, long budget, int max_wait);
+void admit_client(Admission *admission);
+void release_client(Admission *admission);
+int estimate_wait(Admission *admission, FairQueue *queue);
+int get_retry_after(Admission *admission, int wait);
+int admit_job(Admission *admission, FairQueue *queue, long size, int time_left, int *retry_after);
+void release_job(Admission *admission, long size);
+void record_turn(Admission *admission, unsigned long duration);
+
+/**
+ * Creates the admission limits of a master.
+ *
+ * WARNING: 'createAdmission' malloc()s memory to '*admission' which must be freed by
+ * the caller.
+ *
+ * @param max_clients The connections handled at a time.
+ * @param max_queued The jobs that may wait for a turn.
+ * @param budget The bytes the files of admitted jobs may take.
+ * @param max_wait The longest estimated wait for a turn to admit a job to, in milliseconds.
+ *
+ * @return The limits, with nothing admitted.
+ */
+Admission *createAdmission(int max_clients, int max_queued, long budget, int max_wait) {
+    Admission *admission = (Admission *)calloc(1, sizeof(Admission));
+
+    if (!admission) {
+        perror("[X] calloc");
+        exit(1);
+    }
+
+    admission->max_clients = max_clients;
+    admission->max_queued = max_queued;
+    admission->budget = budget;
+    admission->max_wait = max_wait;
+    pthread_mutex_init(&admission->lock, NULL);
+    pthread_cond_init(&admission->released, NULL);
+
+    return admission;
+}
+
+/**
+ * Waits until another connection may be handled, and counts it.
+ *
+ * @param admission The limits.
+ */
+void admit_client(Admission *admission) {
+    pthread_mutex_lock(&admission->lock);
+
+    while (admission->clients >= admission->max_clients)
+        pthread_cond_wait(&admission->released, &admission->lock);
+
+    __atomic_store_n(&admission->clients, admission->clients + 1, __ATOMIC_RELAXED);
+
+    pthread_mutex_unlock(&admission->lock);
+}
+
+/**
+ * Counts a connection as ended, letting the next one in.
+ *
+ * @param admission The limits.
+ */
+void release_client(Admission *admission) {
+    pthread_mutex_lock(&admission->lock);
+
+    __atomic_store_n(&admission->clients, admission->clients - 1, __ATOMIC_RELAXED);
+    pthread_cond_signal(&admission->released);
+
+    pthread_mutex_unlock(&admission->lock);
+}
+
+/**
+ * Estimates how long a job queued now would wait for its turn.
+ *
+ * @param admission The limits.
+ * @param queue The queue the job would wait in.
+ *
+ * @return The wait in milliseconds, 0 if no job is waiting, or -1 if no turn has been
+ *         held yet or no slave is available to say how long it would be.
+ */
+int estimate_wait(Admission *admission, FairQueue *queue) {
+    unsigned long turn_time = __atomic_load_n(&admission->turn_time, __ATOMIC_RELAXED);
+    int waiting = count_waiting(queue), turns = count_turns(queue);
+
+    if (waiting == 0)
+        return 0;
+
+    if (turn_time == 0 || turns == 0)
+        return -1;
+
+    /* The job waits for every turn taken by the jobs ahead of it, and then for one more to end. */
+    unsigned long wait = ((unsigned long)(waiting / turns) + 1) * turn_time / 1000000UL;
+
+    return wait < INT_MAX ? (int)wait : INT_MAX;
+}
+
+/**
+ * Obtains how long a rejected client should wait before trying again.
+ *
+ * @param admission The limits.
+ * @param wait The estimated wait for a turn, as returned by estimate_wait().
+ *
+ * @return The delay in milliseconds, between MIN_RETRY_AFTER and MAX_RETRY_AFTER.
+ */
+int get_retry_after(Admission *admission, int wait) {
+    unsigned long turn_time = __atomic_load_n(&admission->turn_time, __ATOMIC_RELAXED);
+    long retry_after = wait > 0 ? wait : turn_time > 0 ? (long)(turn_time / 1000000UL) : RETRY_AFTER;
+
+    return retry_after < MIN_RETRY_AFTER ? MIN_RETRY_AFTER : retry_after > MAX_RETRY_AFTER ? MAX_RETRY_AFTER : (int)retry_after;
+}
+
+/**
+ * Decides whether to take on a job from its request, reserving its files' bytes if so.
+ *
+ * @param admission The limits.
+ * @param queue The queue the job would wait in.
+ * @param size The bytes of the job's files, as announced, at most the budget.
+ * @param time_left The milliseconds left until the job's deadline, or -1 if it has none.
+ * @param retry_after Set to how long the client should wait before trying again, if the job is rejected.
+ *
+ * @return ADMITTED, after which the bytes must be handed back with release_job(), or the REJECT_* limit the job hit.
+ */
+int admit_job(Admission *admission, FairQueue *queue, long size, int time_left, int *retry_after) {
+    int waiting = count_waiting(queue), wait = estimate_wait(admission, queue);
+
+    *retry_after = get_retry_after(admission, wait);
+
+    if (waiting >= admission->max_queued)
+        return REJECT_QUEUE;
+
+    if (wait > admission->max_wait || (time_left >= 0 && wait > time_left))
+        return REJECT_WAIT;
+
+    long in_flight = __atomic_add_fetch(&admission->in_flight, size, __ATOMIC_RELAXED);
+
+    if (in_flight > admission->budget) {
+        __atomic_sub_fetch(&admission->in_flight, size, __ATOMIC_RELAXED);
+        return REJECT_MEMORY;
+    }
+
+    return ADMITTED;
+}
+
+/**
+ * Hands back the bytes reserved by an admitted job.
+ *
+ * @param admission The limits.
+ * @param size The bytes reserved for the job.
+ */
+void release_job(Admission *admission, long size) {
+    __atomic_sub_fetch(&admission->in_flight, size, __ATOMIC_RELAXED);
+}
+
+/**
+ * Records how long a job held its turn on the slaves.
+ *
+ * @param admission The limits.
+ * @param duration The time from the job's turn being granted to it ending, in nanoseconds.
+ */
+void record_turn(Admission *admission, unsigned long duration) {
+    unsigned long turn_time = __atomic_load_n(&admission->turn_time, __ATOMIC_RELAXED), next;
+
+    do {
+        next = turn_time == 0 ? duration : turn_time - turn_time / TURN_TIME_WEIGHT + duration / TURN_TIME_WEIGHT;
+    } while (!__atomic_compare_exchange_n(&admission->turn_time, &turn_time, next, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+#endif
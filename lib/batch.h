@@ -0,0 +1,330 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "utilities.h"
+#include "transfer.h"
+#include "compress.h"
+
+/*
+ * Tiny jobs spend most of their time on the connection to their slave and the
+ * handshakes over it, not running. Jobs whose files take up no more than
+ * BATCH_MAX_SIZE together, and that were given the same executable, are
+ * therefore sent to a slave together, up to BATCH_SIZE of them at a time.
+ *
+ * The first job of a batch leads it. It picks a slave and waits for the
+ * slave's greeting, which takes longer the busier the slave is, and for at
+ * least BATCH_WINDOW from when the batch opened, while others join. It then
+ * sends the batch in one frame, the executable once and every job's input
+ * after it. The slave runs the jobs side by side, as
+ * many at a time as the master gives each slave turns, and sends back every
+ * result in one frame once they are done. Each job then passes its own
+ * output on. A job whose batch could not be run goes to a slave on its own.
+ *
+ * BATCH_SIZE 1 turns batching off.
+ */
+#define BATCH_SIZE 1
+#define BATCH_SIZE_ENV "DLB_BATCH_SIZE"
+
+/* In microseconds. */
+#define BATCH_WINDOW 500
+#define BATCH_WINDOW_ENV "DLB_BATCH_WINDOW_US"
+
+/* In KiB, of the files of a job as they go on the wire. */
+#define BATCH_MAX_SIZE 64
+#define BATCH_MAX_SIZE_ENV "DLB_BATCH_MAX_KB"
+
+/* The most jobs a batch may hold, whatever BATCH_SIZE says. */
+#define MAX_BATCH_SIZE 64
+
+typedef struct BatchEntry BatchEntry;
+typedef struct Batch Batch;
+typedef struct Batcher Batcher;
+
+/* A job in a batch, and what its slave sent back for it. */
+struct BatchEntry {
+    struct Job *job;
+
+    /* Set once the batch ran: whether the slave sent the job's result, its status, and its output as its blocks came off the wire. */
+    bool received;
+    char status[MAX_BUFFER_SIZE];
+    Buffer *output;
+    long capacity;
+};
+
+struct Batch {
+    /* What the jobs share: a hash of the executable's bytes, its name and the codec its files are in. */
+    uint64_t key;
+    char *executable;
+    int codec;
+
+    BatchEntry entries[MAX_BATCH_SIZE];
+    int count;
+
+    /* When the first job joined, as returned by now_nanoseconds(). */
+    unsigned long opened;
+
+    /* Closed once its leader stops taking jobs, and done once the results are in. */
+    bool closed;
+    bool done;
+    pthread_cond_t changed;
+
+    /* The jobs still to pick up their results; the last one frees the batch. */
+    int references;
+
+    Batch *next;
+};
+
+struct Batcher {
+    int size;
+    int window;
+    long max_size;
+
+    /* Batches still taking jobs. */
+    Batch *open;
+
+    pthread_mutex_t lock;
+};
+
+Batcher *createBatcher(int size, int window, long max_size);
+bool is_batchable(Batcher *batcher, struct Job *job);
+Batch *join_batch(Batcher *batcher, struct Job *job, uint64_t key, int *index);
+void close_batch(Batcher *batcher, Batch *batch, unsigned long until);
+void finish_batch(Batcher *batcher, Batch *batch);
+void await_batch(Batcher *batcher, Batch *batch);
+void leave_batch(Batcher *batcher, Batch *batch);
+bool append_output(BatchEntry *entry, const void *data, long size);
+
+/**
+ * Creates the batcher of a master.
+ *
+ * WARNING: 'createBatcher' malloc()s memory to '*batcher' which must be freed by
+ * the caller.
+ *
+ * @param size The most jobs a batch takes, at most MAX_BATCH_SIZE; 1 turns batching off.
+ * @param window The longest the first job of a batch waits for others, in microseconds.
+ * @param max_size The most bytes the files of a job may take on the wire for it to be batched.
+ *
+ * @return The batcher, with no batch open.
+ */
+Batcher *createBatcher(int size, int window, long max_size) {
+    Batcher *batcher = (Batcher *)calloc(1, sizeof(Batcher));
+
+    if (!batcher) {
+        perror("[X] calloc");
+        exit(1);
+    }
+
+    batcher->size = size < 1 ? 1 : size > MAX_BATCH_SIZE ? MAX_BATCH_SIZE : size;
+    batcher->window = window < 0 ? 0 : window;
+    batcher->max_size = max_size;
+    pthread_mutex_init(&batcher->lock, NULL);
+
+    return batcher;
+}
+
+/**
+ * Decides whether a job is small enough to be sent in a batch.
+ *
+ * @param batcher The batcher.
+ * @param job The job, whose files were received.
+ *
+ * @return Whether or not the job may be batched; deduplicated jobs never are, as their chunks are asked for one job at a time,
+ *         and nor are jobs whose files were passed by descriptor, as a batch is sent from memory.
+ */
+bool is_batchable(Batcher *batcher, struct Job *job) {
+    return batcher->size > 1 && job->codec != CODEC_CDC && job->fds[0] == -1
+        && get_wire_size(job->executable) + get_wire_size(job->input_file) <= batcher->max_size;
+}
+
+/**
+ * Adds a job to the open batch for its executable, opening one if there is none.
+ *
+ * @param batcher The batcher.
+ * @param job The job, which must stay in place until it leaves the batch.
+ * @param key The hash of the job's executable.
+ * @param index Receives the job's place in the batch; the job at 0 leads it.
+ *
+ * @return The batch, which the job must leave with leave_batch().
+ */
+Batch *join_batch(Batcher *batcher, struct Job *job, uint64_t key, int *index) {
+    pthread_mutex_lock(&batcher->lock);
+
+    Batch *batch = batcher->open;
+
+    while (batch && (batch->key != key || batch->codec != job->codec || strcmp(batch->executable, job->executable->file_name) != 0))
+        batch = batch->next;
+
+    if (!batch) {
+        batch = (Batch *)calloc(1, sizeof(Batch));
+
+        if (!batch) {
+            perror("[X] calloc");
+            exit(1);
+        }
+
+        pthread_condattr_t attributes;
+
+        pthread_condattr_init(&attributes);
+        pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+        pthread_cond_init(&batch->changed, &attributes);
+        pthread_condattr_destroy(&attributes);
+
+        batch->key = key;
+        batch->executable = job->executable->file_name;
+        batch->codec = job->codec;
+        batch->opened = now_nanoseconds();
+        batch->next = batcher->open;
+        batcher->open = batch;
+    }
+
+    *index = batch->count++;
+    batch->entries[*index].job = job;
+    batch->references++;
+
+    /* A full batch takes no more jobs, and its leader need not wait out the window. */
+    if (batch->count == batcher->size) {
+        Batch **link = &batcher->open;
+
+        while (*link != batch)
+            link = &(*link)->next;
+
+        *link = batch->next;
+        batch->closed = true;
+        pthread_cond_broadcast(&batch->changed);
+    }
+
+    pthread_mutex_unlock(&batcher->lock);
+
+    return batch;
+}
+
+/**
+ * Waits for a batch to fill up, then stops it taking jobs; called by its leader.
+ *
+ * @param batcher The batcher.
+ * @param batch The batch.
+ * @param until The latest to wait until, as returned by now_nanoseconds(); a time that passed closes the batch at once.
+ */
+void close_batch(Batcher *batcher, Batch *batch, unsigned long until) {
+    struct timespec deadline = { (time_t)(until / 1000000000UL), (long)(until % 1000000000UL) };
+
+    pthread_mutex_lock(&batcher->lock);
+
+    while (!batch->closed && pthread_cond_timedwait(&batch->changed, &batcher->lock, &deadline) != ETIMEDOUT);
+
+    if (!batch->closed) {
+        Batch **link = &batcher->open;
+
+        while (*link != batch)
+            link = &(*link)->next;
+
+        *link = batch->next;
+        batch->closed = true;
+    }
+
+    pthread_mutex_unlock(&batcher->lock);
+}
+
+/**
+ * Hands the results of a batch to its jobs; called by its leader once the batch ran, or could not.
+ *
+ * @param batcher The batcher.
+ * @param batch The batch, whose entries were filled in.
+ */
+void finish_batch(Batcher *batcher, Batch *batch) {
+    pthread_mutex_lock(&batcher->lock);
+
+    batch->done = true;
+    pthread_cond_broadcast(&batch->changed);
+
+    pthread_mutex_unlock(&batcher->lock);
+}
+
+/**
+ * Waits for the leader of a batch to hand its results out.
+ *
+ * @param batcher The batcher.
+ * @param batch The batch.
+ */
+void await_batch(Batcher *batcher, Batch *batch) {
+    pthread_mutex_lock(&batcher->lock);
+
+    while (!batch->done)
+        pthread_cond_wait(&batch->changed, &batcher->lock);
+
+    pthread_mutex_unlock(&batcher->lock);
+}
+
+/**
+ * Takes a job, done with its result, out of its batch, freeing the batch after its last job.
+ *
+ * @param batcher The batcher.
+ * @param batch The batch.
+ */
+void leave_batch(Batcher *batcher, Batch *batch) {
+    pthread_mutex_lock(&batcher->lock);
+    bool last = --batch->references == 0;
+    pthread_mutex_unlock(&batcher->lock);
+
+    if (!last)
+        return;
+
+    for (int i = 0; i < batch->count; i++) {
+        if (batch->entries[i].output) {
+            free(batch->entries[i].output->data);
+            free(batch->entries[i].output);
+        }
+    }
+
+    pthread_cond_destroy(&batch->changed);
+    free(batch);
+}
+
+/**
+ * Appends bytes of a job's output, as they came off the wire, to its entry.
+ *
+ * @param entry The job's entry.
+ * @param data The bytes.
+ * @param size The number of bytes.
+ *
+ * @return Whether or not there was room for them.
+ */
+bool append_output(BatchEntry *entry, const void *data, long size) {
+    if (!entry->output) {
+        entry->output = createBuffer();
+        entry->output->size = 0;
+    }
+
+    if (entry->output->size + size > entry->capacity) {
+        long capacity = entry->capacity > 0 ? entry->capacity : LZ_BLOCK_SIZE;
+
+        while (entry->output->size + size > capacity)
+            capacity *= 2;
+
+        char *grown = (char *)realloc(entry->output->data, capacity);
+
+        if (!grown) {
+            perror("[X] realloc");
+            return false;
+        }
+
+        entry->output->data = grown;
+        entry->capacity = capacity;
+    }
+
+    memcpy(entry->output->data + entry->output->size, data, size);
+    entry->output->size += size;
+
+    return true;
+}
+
+#endif
@@ -0,0 +1,562 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+
+#include "utilities.h"
+#include "transfer.h"
+
+/*
+ * An LZ77 block codec in the spirit of LZ4, streamed in independent blocks.
+ *
+ * A compressed stream is a sequence of blocks, each preceded by an 8 byte
+ * header holding the decoded and encoded lengths in network byte order.
+ * A block whose encoded length equals its decoded length is stored as is;
+ * a header of two zeros terminates the stream. Blocks never reference each
+ * other, so both ends only ever hold one block in memory.
+ */
+
+#define CODEC_NONE 0
+#define CODEC_LZ 1
+#define CODEC_CDC 2
+
+#define LZ_BLOCK_SIZE (64 * 1024)
+#define LZ_BLOCK_HEADER_SIZE 8
+#define LZ_HASH_BITS 13
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+
+int get_codec(char *name);
+char *get_codec_name(int codec);
+long get_wire_size(Buffer *buf);
+long lz_compress_bound(long size);
+long lz_compress(const char *source, long size, char *dest, long capacity);
+long lz_decompress(const char *source, long size, char *dest, long capacity);
+bool send_compressed(int socket, int fd, long size, TransferStats *stats);
+bool recv_compressed(int socket, Buffer *buf, TransferStats *stats);
+bool recv_decompressed(int socket, int fd, long size, TransferStats *stats);
+bool send_encoded_file(int socket, char *file_path, long size, int codec, TransferStats *stats);
+bool recv_decoded_file(int socket, char *file_path, long size, mode_t mode, int codec, TransferStats *stats);
+bool recv_encoded(int socket, Buffer *buf, int codec, TransferStats *stats);
+
+/**
+ * Looks up a codec by the name used on the wire.
+ *
+ * @param name The name of the codec, e.g. "lz", "cdc" or "none".
+ *
+ * @return The codec, or -1 if it is not supported.
+ */
+int get_codec(char *name) {
+    if (!name || strcmp(name, "none") == 0)
+        return CODEC_NONE;
+
+    if (strcmp(name, "lz") == 0)
+        return CODEC_LZ;
+
+    if (strcmp(name, "cdc") == 0)
+        return CODEC_CDC;
+
+    return -1;
+}
+
+/**
+ * Obtains the name used on the wire for a codec.
+ *
+ * @param codec The codec.
+ *
+ * @return The name of the codec.
+ */
+char *get_codec_name(int codec) {
+    if (codec == CODEC_LZ)
+        return "lz";
+
+    if (codec == CODEC_CDC)
+        return "cdc";
+
+    return "none";
+}
+
+/**
+ * Obtains the number of bytes a buffer occupies on the wire.
+ *
+ * @param buf The buffer, whose data may be an encoded stream.
+ *
+ * @return The length of the encoded stream if there is one, otherwise the size of the data.
+ */
+long get_wire_size(Buffer *buf) {
+    return buf->encoded_size >= 0 ? buf->encoded_size : buf->size;
+}
+
+/**
+ * Determines the worst case size of a block compressed by lz_compress().
+ *
+ * @param size The size of the block.
+ *
+ * @return The largest number of bytes lz_compress() can produce for the block.
+ */
+long lz_compress_bound(long size) {
+    return size + size / 255 + 16;
+}
+
+/**
+ * Writes an LZ length continuation: runs of 255 followed by the remainder.
+ *
+ * @param op The position to write at, advanced past the written bytes.
+ * @param end The end of the destination.
+ * @param length The length left over after the 4 bit token field.
+ *
+ * @return Whether or not the length fit into the destination.
+ */
+static bool lz_write_length(unsigned char **op, unsigned char *end, long length) {
+    while (length >= 255) {
+        if (*op >= end)
+            return false;
+
+        *(*op)++ = 255;
+        length -= 255;
+    }
+
+    if (*op >= end)
+        return false;
+
+    *(*op)++ = (unsigned char)length;
+
+    return true;
+}
+
+/**
+ * Compresses a block of at most LZ_BLOCK_SIZE bytes.
+ *
+ * Each sequence is a token (4 bits of literal length, 4 bits of match length
+ * minus LZ_MIN_MATCH), the literals, a 2 byte little endian offset and any
+ * length continuations. The last sequence carries literals only.
+ *
+ * @param source The bytes to compress.
+ * @param size The number of bytes to compress.
+ * @param dest The destination of the compressed bytes.
+ * @param capacity The size of the destination.
+ *
+ * @return The compressed size, or 0 if the result does not fit in 'capacity'.
+ */
+long lz_compress(const char *source, long size, char *dest, long capacity) {
+    const unsigned char *src = (const unsigned char *)source;
+    const unsigned char *ip = src, *anchor = src, *end = src + size;
+    unsigned char *op = (unsigned char *)dest, *op_end = op + capacity;
+    int32_t table[1 << LZ_HASH_BITS];
+
+    memset(table, -1, sizeof(table));
+
+    while (size >= LZ_MIN_MATCH && ip <= end - LZ_MIN_MATCH) {
+        uint32_t sequence;
+        memcpy(&sequence, ip, sizeof(sequence));
+
+        uint32_t hash = (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+        long candidate = table[hash];
+        table[hash] = (int32_t)(ip - src);
+
+        uint32_t previous;
+
+        if (candidate < 0 || (ip - src) - candidate > LZ_MAX_OFFSET
+            || (memcpy(&previous, src + candidate, sizeof(previous)), previous != sequence)) {
+            ip++;
+            continue;
+        }
+
+        const unsigned char *match = src + candidate;
+        long length = LZ_MIN_MATCH;
+
+        while (ip + length < end && match[length] == ip[length])
+            length++;
+
+        long literals = ip - anchor;
+        long extra = length - LZ_MIN_MATCH;
+
+        if (op + 1 + literals + 2 > op_end)
+            return 0;
+
+        unsigned char *token = op++;
+        *token = (unsigned char)(((literals < 15 ? literals : 15) << 4) | (extra < 15 ? extra : 15));
+
+        if (literals >= 15 && !lz_write_length(&op, op_end, literals - 15))
+            return 0;
+
+        if (op + literals + 2 > op_end)
+            return 0;
+
+        memcpy(op, anchor, literals);
+        op += literals;
+
+        long offset = ip - match;
+        *op++ = (unsigned char)(offset & 0xff);
+        *op++ = (unsigned char)(offset >> 8);
+
+        if (extra >= 15 && !lz_write_length(&op, op_end, extra - 15))
+            return 0;
+
+        ip += length;
+        anchor = ip;
+    }
+
+    long literals = end - anchor;
+
+    if (literals > 0) {
+        if (op >= op_end)
+            return 0;
+
+        *op++ = (unsigned char)((literals < 15 ? literals : 15) << 4);
+
+        if (literals >= 15 && !lz_write_length(&op, op_end, literals - 15))
+            return 0;
+
+        if (op + literals > op_end)
+            return 0;
+
+        memcpy(op, anchor, literals);
+        op += literals;
+    }
+
+    return op - (unsigned char *)dest;
+}
+
+/**
+ * Decompresses a block produced by lz_compress().
+ *
+ * Every length and offset is checked against both buffers, so a corrupt or
+ * hostile block fails instead of reading or writing out of bounds.
+ *
+ * @param source The compressed bytes.
+ * @param size The number of compressed bytes.
+ * @param dest The destination of the decompressed bytes.
+ * @param capacity The size of the destination.
+ *
+ * @return The decompressed size, or -1 if the block is corrupt or does not fit.
+ */
+long lz_decompress(const char *source, long size, char *dest, long capacity) {
+    const unsigned char *ip = (const unsigned char *)source, *ip_end = ip + size;
+    unsigned char *op = (unsigned char *)dest, *op_end = op + capacity;
+
+    while (ip < ip_end) {
+        unsigned char token = *ip++;
+        long literals = token >> 4;
+
+        if (literals == 15) {
+            unsigned char b;
+
+            do {
+                if (ip >= ip_end)
+                    return -1;
+
+                b = *ip++;
+                literals += b;
+            } while (b == 255);
+        }
+
+        if (literals > ip_end - ip || literals > op_end - op)
+            return -1;
+
+        memcpy(op, ip, literals);
+        ip += literals;
+        op += literals;
+
+        /* The last sequence has no match. */
+        if (ip == ip_end)
+            break;
+
+        if (ip_end - ip < 2)
+            return -1;
+
+        long offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+
+        if (offset == 0 || offset > op - (unsigned char *)dest)
+            return -1;
+
+        long length = token & 15;
+
+        if (length == 15) {
+            unsigned char b;
+
+            do {
+                if (ip >= ip_end)
+                    return -1;
+
+                b = *ip++;
+                length += b;
+            } while (b == 255);
+        }
+
+        length += LZ_MIN_MATCH;
+
+        if (length > op_end - op)
+            return -1;
+
+        const unsigned char *match = op - offset;
+
+        if (offset >= length) {
+            memcpy(op, match, length);
+            op += length;
+        } else {
+            /* The match overlaps the bytes it produces, e.g. a run. */
+            while (length--)
+                *op++ = *match++;
+        }
+    }
+
+    return op - (unsigned char *)dest;
+}
+
+/**
+ * Streams 'size' bytes from a file descriptor to a socket as compressed blocks.
+ *
+ * @param socket The socket to send the stream to.
+ * @param fd The file descriptor to read from.
+ * @param size The number of bytes to read and compress.
+ * @param stats The statistics to account the wire bytes against, may be NULL.
+ *
+ * @return Whether or not the whole stream, including its terminator, was sent.
+ */
+bool send_compressed(int socket, int fd, long size, TransferStats *stats) {
+    char *block = (char *)malloc(sizeof(char) * LZ_BLOCK_SIZE);
+    char *encoded = (char *)malloc(sizeof(char) * lz_compress_bound(LZ_BLOCK_SIZE));
+    bool sent = block && encoded;
+    long offset = 0;
+
+    while (sent && offset < size) {
+        long wanted = size - offset < LZ_BLOCK_SIZE ? size - offset : LZ_BLOCK_SIZE;
+
+        if (!recv_exact(fd, block, wanted, NULL)) {
+            sent = false;
+            break;
+        }
+
+        long encoded_size = lz_compress(block, wanted, encoded, wanted - 1);
+        uint32_t header[2] = { htonl(wanted), htonl(encoded_size > 0 ? encoded_size : wanted) };
+        struct iovec iov[2] = {
+            { header, LZ_BLOCK_HEADER_SIZE },
+            { encoded_size > 0 ? encoded : block, encoded_size > 0 ? encoded_size : wanted }
+        };
+
+        sent = send_allv(socket, iov, 2, stats);
+        offset += wanted;
+    }
+
+    uint32_t terminator[2] = { 0, 0 };
+    sent = sent && send_all(socket, terminator, LZ_BLOCK_HEADER_SIZE, stats);
+
+    free(block);
+    free(encoded);
+
+    return sent;
+}
+
+/**
+ * Receives a compressed stream into memory without decompressing it.
+ *
+ * Used by the master, which forwards the stream as is. The block headers are
+ * validated so that the stream is known to be well formed and to decode to
+ * exactly 'buf->size' bytes before it is passed on.
+ *
+ * @param socket The socket to receive the stream from.
+ * @param buf The buffer whose decoded size was announced; its data and encoded size are set here.
+ * @param stats The statistics to account the wire bytes against, may be NULL.
+ *
+ * @return Whether or not a complete, well formed stream was received.
+ */
+bool recv_compressed(int socket, Buffer *buf, TransferStats *stats) {
+    long capacity = LZ_BLOCK_SIZE, length = 0, decoded = 0;
+    char *data = (char *)malloc(sizeof(char) * capacity);
+
+    while (data) {
+        uint32_t header[2];
+
+        if (!recv_exact(socket, header, LZ_BLOCK_HEADER_SIZE, stats))
+            break;
+
+        long raw_size = ntohl(header[0]), encoded_size = ntohl(header[1]);
+
+        if (raw_size > LZ_BLOCK_SIZE || encoded_size > raw_size || decoded + raw_size > buf->size)
+            break;
+
+        if (length + LZ_BLOCK_HEADER_SIZE + encoded_size > capacity) {
+            while (length + LZ_BLOCK_HEADER_SIZE + encoded_size > capacity)
+                capacity *= 2;
+
+            char *grown = (char *)realloc(data, capacity);
+
+            if (!grown)
+                break;
+
+            data = grown;
+        }
+
+        memcpy(data + length, header, LZ_BLOCK_HEADER_SIZE);
+        length += LZ_BLOCK_HEADER_SIZE;
+
+        if (raw_size == 0) {
+            if (decoded != buf->size)
+                break;
+
+            buf->data = data;
+            buf->encoded_size = length;
+
+            return true;
+        }
+
+        if (!recv_exact(socket, data + length, encoded_size, stats))
+            break;
+
+        length += encoded_size;
+        decoded += raw_size;
+    }
+
+    free(data);
+
+    return false;
+}
+
+/**
+ * Receives a compressed stream and decompresses it block by block into a file descriptor.
+ *
+ * @param socket The socket to receive the stream from.
+ * @param fd The file descriptor to write the decompressed bytes to.
+ * @param size The number of decompressed bytes the stream must produce.
+ * @param stats The statistics to account the wire bytes against, may be NULL.
+ *
+ * @return Whether or not the stream decoded to exactly 'size' bytes.
+ */
+bool recv_decompressed(int socket, int fd, long size, TransferStats *stats) {
+    char *encoded = (char *)malloc(sizeof(char) * LZ_BLOCK_SIZE);
+    char *block = (char *)malloc(sizeof(char) * LZ_BLOCK_SIZE);
+    bool received = false;
+    long decoded = 0;
+
+    while (encoded && block) {
+        uint32_t header[2];
+
+        if (!recv_exact(socket, header, LZ_BLOCK_HEADER_SIZE, stats))
+            break;
+
+        long raw_size = ntohl(header[0]), encoded_size = ntohl(header[1]);
+
+        if (raw_size == 0) {
+            received = decoded == size;
+            break;
+        }
+
+        if (raw_size > LZ_BLOCK_SIZE || encoded_size > raw_size || decoded + raw_size > size)
+            break;
+
+        if (!recv_exact(socket, encoded, encoded_size, stats))
+            break;
+
+        if (encoded_size == raw_size) {
+            if (!send_all(fd, encoded, raw_size, NULL))
+                break;
+        } else {
+            if (lz_decompress(encoded, encoded_size, block, LZ_BLOCK_SIZE) != raw_size)
+                break;
+
+            if (!send_all(fd, block, raw_size, NULL))
+                break;
+        }
+
+        decoded += raw_size;
+    }
+
+    free(encoded);
+    free(block);
+
+    return received;
+}
+
+/**
+ * Streams a file to a socket with the given codec.
+ *
+ * @param socket The socket to send the file to.
+ * @param file_path The path to the file.
+ * @param size The number of bytes to send.
+ * @param codec The codec negotiated for the job.
+ * @param stats The statistics to account the wire bytes against, may be NULL.
+ *
+ * @return Whether or not the whole file was sent.
+ */
+bool send_encoded_file(int socket, char *file_path, long size, int codec, TransferStats *stats) {
+    if (codec != CODEC_LZ)
+        return send_file(socket, file_path, size, stats);
+
+    int fd = open(file_path, O_RDONLY);
+
+    if (fd == -1) {
+        perror("[X] open");
+        return false;
+    }
+
+    bool sent = send_compressed(socket, fd, size, stats);
+
+    close(fd);
+
+    return sent;
+}
+
+/**
+ * Receives a file sent with the given codec straight into the file at the given path.
+ *
+ * @param socket The socket to receive the file from.
+ * @param file_path The path to create or truncate.
+ * @param size The decoded size of the file.
+ * @param mode The permissions of the file if it is created.
+ * @param codec The codec negotiated for the job.
+ * @param stats The statistics to account the wire bytes against, may be NULL.
+ *
+ * @return Whether or not the whole file was received.
+ */
+bool recv_decoded_file(int socket, char *file_path, long size, mode_t mode, int codec, TransferStats *stats) {
+    if (codec != CODEC_LZ)
+        return recv_file(socket, file_path, size, mode, stats);
+
+    int fd = open(file_path, O_WRONLY | O_CREAT | O_TRUNC, mode);
+
+    if (fd == -1) {
+        perror("[X] open");
+        return false;
+    }
+
+    bool received = recv_decompressed(socket, fd, size, stats);
+
+    close(fd);
+
+    return received;
+}
+
+/**
+ * Receives a file sent with the given codec into memory, keeping it encoded.
+ *
+ * @param socket The socket to receive the file from.
+ * @param buf The buffer whose decoded size was announced; its data is allocated here.
+ * @param codec The codec negotiated for the job.
+ * @param stats The statistics to account the wire bytes against, may be NULL.
+ *
+ * @return Whether or not the whole file was received.
+ */
+bool recv_encoded(int socket, Buffer *buf, int codec, TransferStats *stats) {
+    if (codec == CODEC_LZ)
+        return recv_compressed(socket, buf, stats);
+
+    buf->data = (char *)malloc(sizeof(char) * (buf->size > 0 ? buf->size : 1));
+
+    if (!buf->data) {
+        perror("[X] malloc");
+        return false;
+    }
+
+    return recv_exact(socket, buf->data, buf->size, stats);
+}
+
+#endif
@@ -0,0 +1,721 @@
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+
+#include "utilities.h"
+#include "transfer.h"
+#include "compress.h"
+#include "sha256.h"
+
+/*
+ * Content-defined chunking (FastCDC with a Gear rolling hash) and a chunk store.
+ *
+ * A deduplicated file travels as a manifest, the list of its chunks' ids and
+ * lengths, followed by only the chunks the receiver reports missing. Chunk
+ * boundaries depend on content rather than offsets, so an edit only changes
+ * the chunks around it and the rest are found in the receiver's store.
+ *
+ * Wire format, per file:
+ *   sender   -> u32 count, then count x (16 byte id, u32 length)
+ *   receiver -> count bytes, 1 for each chunk it is missing
+ *   sender   -> the missing chunks' bytes, in manifest order
+ */
+
+#define CDC_MIN_CHUNK (2 * 1024)
+#define CDC_AVG_CHUNK (8 * 1024)
+#define CDC_MAX_CHUNK (64 * 1024)
+
+/* Harder cut condition below the average size, easier above it ("normalized chunking"). */
+#define CDC_MASK_SMALL 0x0000d9f003530000ULL
+#define CDC_MASK_LARGE 0x0000d90003530000ULL
+
+#define CHUNK_ID_SIZE 16
+#define MANIFEST_ENTRY_SIZE (CHUNK_ID_SIZE + 4)
+
+/*
+ * A store holds up to CHUNK_STORE_SIZE of chunks. Past it, the least recently
+ * used chunks go until it is back under CHUNK_STORE_LOW_WATER percent of that;
+ * a chunk counts as used when it is stored and whenever it is found in the
+ * store, which touches its mtime. Chunks used in the last CHUNK_STORE_MIN_AGE
+ * seconds are kept whatever the size, as the master forwards a job's chunks
+ * from the store once a slave is free, and a slave reassembles files from it.
+ */
+#define CHUNK_STORE_SIZE 1024
+#define CHUNK_STORE_SIZE_ENV "DLB_CHUNK_STORE_MB"
+#define CHUNK_STORE_LOW_WATER 90
+#define CHUNK_STORE_MIN_AGE 600
+
+typedef struct ChunkStore ChunkStore;
+typedef struct StoredChunk StoredChunk;
+typedef struct Manifest Manifest;
+
+struct ChunkStore {
+    char *path;
+
+    /* The most bytes of chunks kept, or 0 to keep them all, and the bytes held now. */
+    long max_size;
+    long size;
+
+    /* Held by the one evict_chunks() running at a time, and when it last ran, so a store of recent chunks is not read again on every put. */
+    pthread_mutex_t eviction;
+    time_t evicted;
+};
+
+/* A chunk file as evict_chunks() found it. */
+struct StoredChunk {
+    char name[CHUNK_ID_SIZE * 2 + 1];
+    time_t used;
+    long size;
+};
+
+struct Manifest {
+    unsigned char *entries;
+    long count;
+};
+
+void get_chunk_id(const unsigned char *data, long size, unsigned char *id);
+long cdc_cut(const unsigned char *data, long size);
+Manifest *build_manifest(const unsigned char *data, long size);
+long get_manifest_length(Manifest *manifest, long i);
+ChunkStore *createChunkStore(char *path, long max_size);
+long evict_chunks(ChunkStore *store, long target);
+void get_chunk_path(ChunkStore *store, const unsigned char *id, char *path, size_t size);
+bool has_chunk(ChunkStore *store, const unsigned char *id);
+bool put_chunk(ChunkStore *store, const unsigned char *id, const char *data, long size);
+bool send_deduplicated_file(int socket, char *file_path, long size, TransferStats *stats, long *saved);
+bool recv_manifest(int socket, Manifest *manifest, long size, TransferStats *stats);
+bool recv_missing_chunks(int socket, ChunkStore *store, Manifest *manifest, int out_fd, TransferStats *stats, long *saved);
+bool recv_deduplicated(int socket, ChunkStore *store, Buffer *buf, TransferStats *stats, long *saved);
+bool forward_deduplicated(int socket, ChunkStore *store, Buffer *buf, TransferStats *stats, long *saved);
+bool recv_deduplicated_file(int socket, ChunkStore *store, char *file_path, long size, mode_t mode, TransferStats *stats, long *saved);
+
+static uint64_t gear[256];
+
+/**
+ * Computes the 128 bit id of a chunk, its SHA-256 digest cut short.
+ *
+ * The store is shared by every client, and a sender is told to skip a chunk
+ * whose id is stored, so ids must not be collided on purpose; 64 bit hashes
+ * such as MurmurHash can be, whatever their seeds.
+ *
+ * @param data The chunk.
+ * @param size The size of the chunk.
+ * @param id The destination of the CHUNK_ID_SIZE byte id.
+ */
+void get_chunk_id(const unsigned char *data, long size, unsigned char *id) {
+    unsigned char digest[SHA256_SIZE];
+
+    sha256(data, size, digest);
+    memcpy(id, digest, CHUNK_ID_SIZE);
+}
+
+/**
+ * Fills the Gear table with fixed pseudo-random values (splitmix64), so every
+ * process cuts the same content at the same places.
+ */
+static void init_gear() {
+    if (gear[255])
+        return;
+
+    uint64_t x = 0x2545f4914f6cdd1dULL;
+
+    for (int i = 0; i < 256; i++) {
+        uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        gear[i] = z ^ (z >> 31);
+    }
+}
+
+/**
+ * Finds the length of the next content-defined chunk.
+ *
+ * @param data The bytes from the start of the chunk onwards.
+ * @param size The number of bytes available.
+ *
+ * @return The length of the chunk, between CDC_MIN_CHUNK and CDC_MAX_CHUNK unless the data ends first.
+ */
+long cdc_cut(const unsigned char *data, long size) {
+    init_gear();
+
+    if (size <= CDC_MIN_CHUNK)
+        return size;
+
+    long limit = size < CDC_MAX_CHUNK ? size : CDC_MAX_CHUNK;
+    long normal = limit < CDC_AVG_CHUNK ? limit : CDC_AVG_CHUNK;
+    uint64_t fingerprint = 0;
+    long i = CDC_MIN_CHUNK;
+
+    for (; i < normal; i++) {
+        fingerprint = (fingerprint << 1) + gear[data[i]];
+
+        if (!(fingerprint & CDC_MASK_SMALL))
+            return i + 1;
+    }
+
+    for (; i < limit; i++) {
+        fingerprint = (fingerprint << 1) + gear[data[i]];
+
+        if (!(fingerprint & CDC_MASK_LARGE))
+            return i + 1;
+    }
+
+    return limit;
+}
+
+/**
+ * Splits data into content-defined chunks and lists their ids and lengths.
+ *
+ * WARNING: 'build_manifest' malloc()s memory to '*manifest' which must be freed by
+ * the caller.
+ *
+ * @param data The data to chunk.
+ * @param size The size of the data.
+ *
+ * @return The manifest of the data.
+ */
+Manifest *build_manifest(const unsigned char *data, long size) {
+    Manifest *manifest = (Manifest *)malloc(sizeof(Manifest));
+    long capacity = size / CDC_MIN_CHUNK + 1;
+
+    manifest->entries = (unsigned char *)malloc(capacity * MANIFEST_ENTRY_SIZE);
+    manifest->count = 0;
+
+    for (long offset = 0; offset < size;) {
+        long length = cdc_cut(data + offset, size - offset);
+        unsigned char *entry = manifest->entries + manifest->count++ * MANIFEST_ENTRY_SIZE;
+        uint32_t wire_length = htonl(length);
+
+        get_chunk_id(data + offset, length, entry);
+        memcpy(entry + CHUNK_ID_SIZE, &wire_length, sizeof(wire_length));
+
+        offset += length;
+    }
+
+    return manifest;
+}
+
+/**
+ * Obtains the length of a chunk listed in a manifest.
+ *
+ * @param manifest The manifest.
+ * @param i The index of the chunk.
+ *
+ * @return The length of the chunk.
+ */
+long get_manifest_length(Manifest *manifest, long i) {
+    uint32_t length;
+    memcpy(&length, manifest->entries + i * MANIFEST_ENTRY_SIZE + CHUNK_ID_SIZE, sizeof(length));
+
+    return ntohl(length);
+}
+
+/**
+ * Creates (or opens) a chunk store in the given directory.
+ *
+ * WARNING: 'createChunkStore' malloc()s memory to '*store' which must be freed by
+ * the caller.
+ *
+ * @param path The directory holding the chunks.
+ * @param max_size The most bytes of chunks to keep, or 0 to keep them all.
+ *
+ * @return The chunk store, holding what a previous run left in the directory, evicted down to 'max_size'.
+ */
+ChunkStore *createChunkStore(char *path, long max_size) {
+    ChunkStore *store = (ChunkStore *)malloc(sizeof(ChunkStore));
+
+    if (!store) {
+        perror("[X] malloc");
+        exit(1);
+    }
+
+    if (mkdir(path, 0755) == -1 && errno != EEXIST)
+        perror("[X] mkdir");
+
+    store->path = path;
+    store->max_size = max_size > 0 ? max_size : 0;
+    store->size = 0;
+    store->evicted = 0;
+    pthread_mutex_init(&store->eviction, NULL);
+
+    /* Taking stock of the directory also brings a store a previous run left too big back under its limit. */
+    if (store->max_size > 0)
+        evict_chunks(store, store->max_size);
+
+    return store;
+}
+
+/**
+ * Orders chunks from the least to the most recently used.
+ */
+static int compare_stored_chunks(const void *a, const void *b) {
+    time_t x = ((const StoredChunk *)a)->used, y = ((const StoredChunk *)b)->used;
+
+    return (x > y) - (x < y);
+}
+
+/**
+ * Removes the least recently used chunks of a store until it holds no more than a target,
+ * sparing chunks used in the last CHUNK_STORE_MIN_AGE seconds.
+ *
+ * Chunks left behind by writes that never finished are removed too, once as old.
+ *
+ * @param store The chunk store.
+ * @param target The most bytes of chunks to keep.
+ *
+ * @return The bytes of chunks the store holds afterwards, or -1 if it could not be read or another eviction is running.
+ */
+long evict_chunks(ChunkStore *store, long target) {
+    if (pthread_mutex_trylock(&store->eviction) != 0)
+        return -1;
+
+    DIR *directory = opendir(store->path);
+
+    if (!directory) {
+        perror("[X] opendir");
+        pthread_mutex_unlock(&store->eviction);
+        return -1;
+    }
+
+    StoredChunk *chunks = NULL;
+    long count = 0, capacity = 0, total = 0;
+    time_t oldest = time(NULL) - CHUNK_STORE_MIN_AGE;
+    struct dirent *entry;
+
+    while ((entry = readdir(directory))) {
+        char path[PATH_MAX];
+        struct stat status;
+
+        if (entry->d_name[0] == '.' && (entry->d_name[1] == '\0' || (entry->d_name[1] == '.' && entry->d_name[2] == '\0')))
+            continue;
+
+        snprintf(path, sizeof(path), "%s/%s", store->path, entry->d_name);
+
+        if (lstat(path, &status) == -1 || !S_ISREG(status.st_mode))
+            continue;
+
+        /* A temporary file is only ever as old as the write that was meant to rename it. */
+        if (entry->d_name[0] == '.') {
+            if (status.st_mtime < oldest)
+                unlink(path);
+
+            continue;
+        }
+
+        if (strlen(entry->d_name) != CHUNK_ID_SIZE * 2)
+            continue;
+
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 1024;
+            StoredChunk *grown = (StoredChunk *)realloc(chunks, sizeof(StoredChunk) * capacity);
+
+            if (!grown) {
+                perror("[X] realloc");
+                exit(1);
+            }
+
+            chunks = grown;
+        }
+
+        memcpy(chunks[count].name, entry->d_name, sizeof(chunks[count].name));
+        chunks[count].used = status.st_mtime;
+        chunks[count].size = status.st_size;
+        total += status.st_size;
+        count++;
+    }
+
+    closedir(directory);
+
+    if (total > target) {
+        long low_water = target / 100 * CHUNK_STORE_LOW_WATER;
+
+        qsort(chunks, count, sizeof(StoredChunk), compare_stored_chunks);
+
+        for (long i = 0; i < count && total > low_water && chunks[i].used < oldest; i++) {
+            char path[PATH_MAX];
+
+            snprintf(path, sizeof(path), "%s/%s", store->path, chunks[i].name);
+
+            if (unlink(path) == 0)
+                total -= chunks[i].size;
+        }
+    }
+
+    free(chunks);
+
+    /* Chunks stored while the directory was read may be missed here; they are found by the next eviction. */
+    __atomic_store_n(&store->size, total, __ATOMIC_RELAXED);
+    __atomic_store_n(&store->evicted, time(NULL), __ATOMIC_RELAXED);
+
+    pthread_mutex_unlock(&store->eviction);
+
+    return total;
+}
+
+/**
+ * Obtains the path of a chunk within a store.
+ *
+ * @param store The chunk store.
+ * @param id The id of the chunk.
+ * @param path The destination of the path.
+ * @param size The size of the destination.
+ */
+void get_chunk_path(ChunkStore *store, const unsigned char *id, char *path, size_t size) {
+    int n = snprintf(path, size, "%s/", store->path);
+
+    for (int i = 0; i < CHUNK_ID_SIZE && n + 2 < (int)size; i++)
+        n += snprintf(path + n, size - n, "%02x", id[i]);
+}
+
+/**
+ * Determines whether a store holds a chunk, marking it as used if it does.
+ *
+ * @param store The chunk store.
+ * @param id The id of the chunk.
+ *
+ * @return Whether or not the chunk is stored.
+ */
+bool has_chunk(ChunkStore *store, const unsigned char *id) {
+    char path[PATH_MAX];
+    get_chunk_path(store, id, path, sizeof(path));
+
+    /* Touching the chunk keeps it from eviction while the job that found it is still to use it. */
+    return utimensat(AT_FDCWD, path, NULL, 0) == 0;
+}
+
+/**
+ * Adds a chunk to a store.
+ *
+ * The chunk is written under a temporary name and renamed into place, so
+ * concurrent jobs carrying the same chunk never observe a partial file.
+ *
+ * @param store The chunk store.
+ * @param id The id of the chunk.
+ * @param data The chunk.
+ * @param size The size of the chunk.
+ *
+ * @return Whether or not the chunk was stored.
+ */
+bool put_chunk(ChunkStore *store, const unsigned char *id, const char *data, long size) {
+    char path[PATH_MAX], temporary[PATH_MAX];
+
+    get_chunk_path(store, id, path, sizeof(path));
+    snprintf(temporary, sizeof(temporary), "%s/.chunk_XXXXXX", store->path);
+
+    int fd = mkstemp(temporary);
+
+    if (fd == -1) {
+        perror("[X] mkstemp");
+        return false;
+    }
+
+    bool written = send_all(fd, data, size, NULL);
+
+    close(fd);
+
+    if (!written || rename(temporary, path) == -1) {
+        unlink(temporary);
+        return false;
+    }
+
+    if (store->max_size > 0 && __atomic_add_fetch(&store->size, size, __ATOMIC_RELAXED) > store->max_size
+        && time(NULL) > __atomic_load_n(&store->evicted, __ATOMIC_RELAXED))
+        evict_chunks(store, store->max_size);
+
+    return true;
+}
+
+/**
+ * Sends a file as a manifest followed by the chunks the receiver is missing.
+ *
+ * The file is mapped rather than read, so chunking and sending both work
+ * straight from the page cache.
+ *
+ * @param socket The socket to send the file to.
+ * @param file_path The path to the file.
+ * @param size The size of the file.
+ * @param stats The statistics to account the wire bytes against, may be NULL.
+ * @param saved Incremented by the number of bytes the receiver already had, may be NULL.
+ *
+ * @return Whether or not the whole file was sent.
+ */
+bool send_deduplicated_file(int socket, char *file_path, long size, TransferStats *stats, long *saved) {
+    int fd = open(file_path, O_RDONLY);
+
+    if (fd == -1) {
+        perror("[X] open");
+        return false;
+    }
+
+    unsigned char *data = size > 0 ? (unsigned char *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+
+    close(fd);
+
+    if (data == MAP_FAILED) {
+        perror("[X] mmap");
+        return false;
+    }
+
+    Manifest *manifest = build_manifest(data, size);
+    uint32_t count = htonl(manifest->count);
+    unsigned char *missing = (unsigned char *)malloc(manifest->count + 1);
+    struct iovec iov[2] = {
+        { &count, sizeof(count) },
+        { manifest->entries, manifest->count * MANIFEST_ENTRY_SIZE }
+    };
+
+    bool sent = send_allv(socket, iov, 2, stats) && recv_exact(socket, missing, manifest->count, stats);
+    long offset = 0;
+
+    for (long i = 0; sent && i < manifest->count; i++) {
+        long length = get_manifest_length(manifest, i);
+
+        if (missing[i])
+            sent = send_all(socket, data + offset, length, stats);
+        else if (saved)
+            *saved += length;
+
+        offset += length;
+    }
+
+    if (data)
+        munmap(data, size);
+
+    free(missing);
+    free(manifest->entries);
+    free(manifest);
+
+    return sent;
+}
+
+/**
+ * Receives and validates a manifest announced for a file of the given size.
+ *
+ * @param socket The socket to receive the manifest from.
+ * @param manifest The manifest to fill; its entries are allocated here.
+ * @param size The size of the file the manifest describes.
+ * @param stats The statistics to account the wire bytes against, may be NULL.
+ *
+ * @return Whether or not a manifest whose chunks add up to 'size' was received.
+ */
+bool recv_manifest(int socket, Manifest *manifest, long size, TransferStats *stats) {
+    uint32_t count;
+
+    manifest->entries = NULL;
+    manifest->count = 0;
+
+    if (!recv_exact(socket, &count, sizeof(count), stats))
+        return false;
+
+    manifest->count = ntohl(count);
+
+    if (manifest->count > size / CDC_MIN_CHUNK + 1)
+        return false;
+
+    manifest->entries = (unsigned char *)malloc(manifest->count * MANIFEST_ENTRY_SIZE + 1);
+
+    if (!manifest->entries || !recv_exact(socket, manifest->entries, manifest->count * MANIFEST_ENTRY_SIZE, stats))
+        return false;
+
+    long total = 0;
+
+    for (long i = 0; i < manifest->count; i++) {
+        long length = get_manifest_length(manifest, i);
+
+        if (length <= 0 || length > CDC_MAX_CHUNK)
+            return false;
+
+        total += length;
+    }
+
+    return total == size;
+}
+
+/**
+ * Tells the sender which chunks of a manifest are missing, receives them into
+ * the store and optionally reassembles the whole file.
+ *
+ * Every received chunk is hashed and checked against its id before it is
+ * stored, so a corrupt chunk can never poison the store.
+ *
+ * @param socket The socket to receive the chunks from.
+ * @param store The chunk store.
+ * @param manifest The manifest of the file.
+ * @param out_fd The file descriptor to reassemble the file into, or -1.
+ * @param stats The statistics to account the wire bytes against, may be NULL.
+ * @param saved Incremented by the number of bytes found in the store, may be NULL.
+ *
+ * @return Whether or not every chunk is now in the store (and written to 'out_fd').
+ */
+bool recv_missing_chunks(int socket, ChunkStore *store, Manifest *manifest, int out_fd, TransferStats *stats, long *saved) {
+    unsigned char *missing = (unsigned char *)malloc(manifest->count + 1);
+    char *chunk = (char *)malloc(CDC_MAX_CHUNK);
+    bool received = missing && chunk;
+
+    for (long i = 0; received && i < manifest->count; i++)
+        missing[i] = !has_chunk(store, manifest->entries + i * MANIFEST_ENTRY_SIZE);
+
+    received = received && send_all(socket, missing, manifest->count, stats);
+
+    for (long i = 0; received && i < manifest->count; i++) {
+        unsigned char *id = manifest->entries + i * MANIFEST_ENTRY_SIZE;
+        long length = get_manifest_length(manifest, i);
+
+        if (missing[i]) {
+            unsigned char actual[CHUNK_ID_SIZE];
+
+            received = recv_exact(socket, chunk, length, stats);
+
+            if (received) {
+                get_chunk_id((unsigned char *)chunk, length, actual);
+                received = memcmp(actual, id, CHUNK_ID_SIZE) == 0 && put_chunk(store, id, chunk, length);
+            }
+
+            if (received && out_fd != -1)
+                received = send_all(out_fd, chunk, length, NULL);
+        } else {
+            if (saved)
+                *saved += length;
+
+            if (out_fd != -1) {
+                char path[PATH_MAX];
+                get_chunk_path(store, id, path, sizeof(path));
+
+                int fd = open(path, O_RDONLY);
+                received = fd != -1 && recv_exact(fd, chunk, length, NULL) && send_all(out_fd, chunk, length, NULL);
+
+                if (fd != -1)
+                    close(fd);
+            }
+        }
+    }
+
+    free(missing);
+    free(chunk);
+
+    return received;
+}
+
+/**
+ * Receives a deduplicated file into a store, keeping only its manifest in memory.
+ *
+ * Used by the master, which forwards the file with forward_deduplicated().
+ *
+ * @param socket The socket to receive the file from.
+ * @param store The chunk store.
+ * @param buf The buffer whose size was announced; its data becomes the encoded manifest.
+ * @param stats The statistics to account the wire bytes against, may be NULL.
+ * @param saved Incremented by the number of bytes found in the store, may be NULL.
+ *
+ * @return Whether or not every chunk of the file is now in the store.
+ */
+bool recv_deduplicated(int socket, ChunkStore *store, Buffer *buf, TransferStats *stats, long *saved) {
+    Manifest manifest;
+
+    if (!recv_manifest(socket, &manifest, buf->size, stats) || !recv_missing_chunks(socket, store, &manifest, -1, stats, saved)) {
+        free(manifest.entries);
+        return false;
+    }
+
+    buf->data = (char *)manifest.entries;
+    buf->encoded_size = manifest.count * MANIFEST_ENTRY_SIZE;
+
+    return true;
+}
+
+/**
+ * Sends a file received by recv_deduplicated() on from the store.
+ *
+ * @param socket The socket to send the file to.
+ * @param store The chunk store holding the file's chunks.
+ * @param buf The buffer holding the file's manifest.
+ * @param stats The statistics to account the wire bytes against, may be NULL.
+ * @param saved Incremented by the number of bytes the receiver already had, may be NULL.
+ *
+ * @return Whether or not the whole file was sent.
+ */
+bool forward_deduplicated(int socket, ChunkStore *store, Buffer *buf, TransferStats *stats, long *saved) {
+    long count = buf->encoded_size / MANIFEST_ENTRY_SIZE;
+    uint32_t wire_count = htonl(count);
+    unsigned char *missing = (unsigned char *)malloc(count + 1);
+    Manifest manifest = { (unsigned char *)buf->data, count };
+    struct iovec iov[2] = {
+        { &wire_count, sizeof(wire_count) },
+        { buf->data, buf->encoded_size }
+    };
+
+    bool sent = missing && send_allv(socket, iov, 2, stats) && recv_exact(socket, missing, count, stats);
+
+    for (long i = 0; sent && i < count; i++) {
+        long length = get_manifest_length(&manifest, i);
+
+        if (!missing[i]) {
+            if (saved)
+                *saved += length;
+
+            continue;
+        }
+
+        char path[PATH_MAX];
+        get_chunk_path(store, manifest.entries + i * MANIFEST_ENTRY_SIZE, path, sizeof(path));
+
+        sent = send_file(socket, path, length, stats);
+    }
+
+    free(missing);
+
+    return sent;
+}
+
+/**
+ * Receives a deduplicated file into a store and reassembles it at the given path.
+ *
+ * @param socket The socket to receive the file from.
+ * @param store The chunk store.
+ * @param file_path The path to create or truncate.
+ * @param size The size of the file.
+ * @param mode The permissions of the file if it is created.
+ * @param stats The statistics to account the wire bytes against, may be NULL.
+ * @param saved Incremented by the number of bytes found in the store, may be NULL.
+ *
+ * @return Whether or not the whole file was reassembled.
+ */
+bool recv_deduplicated_file(int socket, ChunkStore *store, char *file_path, long size, mode_t mode, TransferStats *stats, long *saved) {
+    Manifest manifest;
+
+    if (!recv_manifest(socket, &manifest, size, stats)) {
+        free(manifest.entries);
+        return false;
+    }
+
+    int fd = open(file_path, O_WRONLY | O_CREAT | O_TRUNC, mode);
+
+    if (fd == -1) {
+        perror("[X] open");
+        free(manifest.entries);
+        return false;
+    }
+
+    bool received = recv_missing_chunks(socket, store, &manifest, fd, stats, saved);
+
+    close(fd);
+    free(manifest.entries);
+
+    return received;
+}
+
+#endif
@@ -0,0 +1,520 @@
+#ifndef DLB_H
+#define DLB_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include "utilities.h"
+#include "transfer.h"
+#include "compress.h"
+#include "log.h"
+#include "trace.h"
+#include "submit.h"
+#include "stream.h"
+
+/*
+ * Submits many jobs over one persistent connection to the master.
+ *
+ * dlb_submit() uploads a job and returns at once, while a receiver thread
+ * writes each output out block by block as the master streams it back. Completed jobs are handed
+ * to their callback, or queued for dlb_poll() and dlb_wait() when they have
+ * none. Up to 'window' jobs are in flight at a time; dlb_submit() blocks
+ * while the window is full. Jobs submitted while 'deadline' is set fail with
+ * {FAILED_TO_MEET_DEADLINE} once they have taken that many milliseconds, and
+ * jobs wait for a slave according to the session's 'priority' class.
+ *
+ *     DLBSession *session = dlb_connect("10.211.55.13", CODEC_LZ, 16);
+ *     dlb_submit(session, "countwords", "in.txt", "out.txt", NULL, NULL);
+ *
+ *     for (DLBJob *job; (job = dlb_wait(session)); dlb_free_job(job))
+ *         puts(job->status ? job->status : job->output_path);
+ *
+ *     dlb_close(session);
+ */
+
+#define DEFAULT_JOBS_IN_FLIGHT 16
+
+typedef struct DLBJob DLBJob;
+typedef struct DLBSession DLBSession;
+typedef void (*DLBCallback)(DLBJob *job, void *context);
+
+struct DLBJob {
+    long tag;
+    char *executable;
+    char *input_file;
+    char *output_path;
+    int output_fd;
+    bool output_failed;
+    char trace_id[TRACE_ID_LENGTH + 1];
+
+    /* NULL once the output is stored at output_path, otherwise the status describing the failure. */
+    char *status;
+
+    /* When the status is {REJECTED_JOB}, the milliseconds the master asked to wait before submitting the job again. */
+    long retry_after;
+
+    unsigned long submitted;
+    DLBCallback callback;
+    void *context;
+    DLBJob *next;
+};
+
+struct DLBSession {
+    int socket;
+    struct sockaddr_in master_address;
+    int codec;
+    int window;
+    long deadline;
+    int priority;
+
+    /* Guards everything below; 'changed' is signalled whenever a job completes. */
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    long next_tag;
+    int in_flight;
+    bool broken;
+    DLBJob *pending;
+    DLBJob *completed;
+    DLBJob *last_completed;
+
+    /* Serializes uploads, so that each job's request and files stay together on the wire. */
+    pthread_mutex_t send_lock;
+    pthread_t receiver;
+};
+
+DLBSession *dlb_connect(char *address, int codec, int window);
+DLBJob *dlb_submit(DLBSession *session, char *executable, char *input_file, char *output_path, DLBCallback callback, void *context);
+DLBJob *dlb_poll(DLBSession *session);
+DLBJob *dlb_wait(DLBSession *session);
+void dlb_free_job(DLBJob *job);
+void dlb_close(DLBSession *session);
+void complete_job(DLBSession *session, DLBJob *job, char *status);
+DLBJob *take_pending_job(DLBSession *session, long tag);
+DLBJob *find_pending_job(DLBSession *session, long tag);
+void *receive_job_outputs(void *argv);
+
+/**
+ * Hands a job that is no longer in flight to its callback, or queues it for dlb_poll() and dlb_wait().
+ *
+ * @param session The session the job was submitted to.
+ * @param job The job, already removed from the pending jobs.
+ * @param status NULL if the job's output was stored, otherwise the status describing the failure.
+ */
+void complete_job(DLBSession *session, DLBJob *job, char *status) {
+    job->status = status;
+
+    if (job->output_fd != -1) {
+        close(job->output_fd);
+        job->output_fd = -1;
+    }
+
+    end_span(job->trace_id, "submit", job->submitted);
+
+    pthread_mutex_lock(&session->lock);
+
+    session->in_flight--;
+
+    if (!job->callback) {
+        if (session->last_completed)
+            session->last_completed->next = job;
+        else
+            session->completed = job;
+
+        session->last_completed = job;
+    }
+
+    pthread_cond_broadcast(&session->changed);
+    pthread_mutex_unlock(&session->lock);
+
+    /* Callbacks run on the receiver thread and own the job from here on. */
+    if (job->callback)
+        job->callback(job, job->context);
+}
+
+/**
+ * Removes an in-flight job from the pending jobs of a session.
+ *
+ * @param session The session.
+ * @param tag The tag of the job, or -1 for whichever job is first.
+ *
+ * @return The job, or NULL if no such job is in flight.
+ */
+DLBJob *take_pending_job(DLBSession *session, long tag) {
+    pthread_mutex_lock(&session->lock);
+
+    DLBJob **link = &session->pending;
+
+    while (*link && tag != -1 && (*link)->tag != tag)
+        link = &(*link)->next;
+
+    DLBJob *job = *link;
+
+    if (job) {
+        *link = job->next;
+        job->next = NULL;
+    }
+
+    pthread_mutex_unlock(&session->lock);
+
+    return job;
+}
+
+/**
+ * Finds an in-flight job of a session, leaving it pending.
+ *
+ * Only the receiver thread completes jobs that were sent, so the job stays valid on it.
+ *
+ * @param session The session.
+ * @param tag The tag of the job.
+ *
+ * @return The job, or NULL if no such job is in flight.
+ */
+DLBJob *find_pending_job(DLBSession *session, long tag) {
+    pthread_mutex_lock(&session->lock);
+
+    DLBJob *job = session->pending;
+
+    while (job && job->tag != tag)
+        job = job->next;
+
+    pthread_mutex_unlock(&session->lock);
+
+    return job;
+}
+
+/**
+ * Receives the outputs the master sends back in a session, until the connection closes.
+ *
+ * Jobs still in flight once it does fail with {FAILED_TO_RECEIVE_JOB_OUTPUT}.
+ *
+ * @param argv The session.
+ */
+void *receive_job_outputs(void *argv) {
+    DLBSession *session = (DLBSession *)argv;
+    char response[MAX_BUFFER_SIZE], status[MAX_BUFFER_SIZE];
+    char *payload = (char *)malloc(sizeof(char) * LZ_BLOCK_SIZE);
+    char *block = (char *)malloc(sizeof(char) * LZ_BLOCK_SIZE);
+    uint32_t header[2];
+    long tag;
+    DLBJob *job;
+
+    while (payload && block && recv_message(session->socket, response)) {
+        log_debug("[Client]: Received: [%s] from Master (%I).\n", response, &session->master_address);
+
+        /* Blocks of different jobs interleave; each follows its frame at once, so a failure here leaves the stream out of step. */
+        if (sscanf(response, "{JOB_BLOCK} %ld", &tag) == 1) {
+            if (!(job = find_pending_job(session, tag)) || recv_block(session->socket, header, payload, NULL) <= 0)
+                break;
+
+            if (job->output_fd == -1 && !job->output_failed && (job->output_fd = open(job->output_path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1) {
+                perror("[X] open");
+                job->output_failed = true;
+            }
+
+            if (job->output_fd != -1 && !write_block(job->output_fd, header, payload, block))
+                job->output_failed = true;
+
+            continue;
+        }
+
+        long retry_after = 0;
+
+        if (sscanf(response, "{JOB_END} %ld %s %ld", &tag, status, &retry_after) < 2 || !(job = take_pending_job(session, tag)))
+            break;
+
+        bool executed = strcmp(status, "{SUCCESSFULLY_EXECUTED_JOB}\0") == 0;
+
+        /* A job that wrote no output still leaves an empty output file. */
+        if (executed && job->output_fd == -1 && !job->output_failed && (job->output_fd = open(job->output_path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1) {
+            perror("[X] open");
+            job->output_failed = true;
+        }
+
+        char *failure = strcmp(status, "{FAILED_TO_MEET_DEADLINE}\0") == 0 ? "{FAILED_TO_MEET_DEADLINE}" : "{FAILED_TO_EXECUTE_JOB}";
+
+        /* A rejected job was never queued, so the master's load rather than the job is to blame. */
+        if (strcmp(status, "{REJECTED_JOB}\0") == 0) {
+            failure = "{REJECTED_JOB}";
+            job->retry_after = retry_after;
+        }
+
+        complete_job(session, job, !executed ? failure : job->output_failed ? "{FAILED_TO_RECEIVE_BUFFER}" : NULL);
+    }
+
+    free(payload);
+    free(block);
+
+    pthread_mutex_lock(&session->lock);
+    session->broken = true;
+    pthread_mutex_unlock(&session->lock);
+
+    /* Fail a submission still uploading rather than leave it blocked on a full socket. */
+    shutdown(session->socket, SHUT_RDWR);
+
+    while ((job = take_pending_job(session, -1)))
+        complete_job(session, job, "{FAILED_TO_RECEIVE_JOB_OUTPUT}");
+
+    pthread_exit(NULL);
+}
+
+/**
+ * Opens a session with the master node.
+ *
+ * WARNING: 'dlb_connect' malloc()s memory to '*session' which must be freed by
+ * the caller with dlb_close().
+ *
+ * @param address The host name or IPv4 address of the master node.
+ * @param codec The codec to propose for the jobs' files; "cdc" is answered with "lz".
+ * @param window The most jobs to keep in flight at a time.
+ *
+ * @return The session, or NULL if the master could not be reached or does not support sessions.
+ */
+DLBSession *dlb_connect(char *address, int codec, int window) {
+    struct sockaddr_in master_address;
+    char request[MAX_BUFFER_SIZE], response[MAX_BUFFER_SIZE];
+
+    if (!resolve_master(address, get_port(LISTEN_FOR_CLIENTS_PORT_ENV, LISTEN_FOR_CLIENTS_PORT), &master_address)) {
+        fprintf(stderr, "[X] Unknown host: %s.\n", address);
+        return NULL;
+    }
+
+    int master_socket = open_master_connection(&master_address);
+
+    if (master_socket == -1) {
+        perror("[X] connect");
+        return NULL;
+    }
+
+    snprintf(request, sizeof(request), "{OPEN_SESSION} %s", get_codec_name(codec));
+
+    send_message(master_socket, request);
+    log_debug("[Client]: Sending: [%s] to Master (%I).\n", request, &master_address);
+
+    recv_message(master_socket, response);
+    log_debug("[Client]: Received: [%s] from Master (%I).\n", response, &master_address);
+
+    char status[MAX_BUFFER_SIZE] = "", accepted_codec[MAX_BUFFER_SIZE] = "none";
+    sscanf(response, "%s %s", status, accepted_codec);
+
+    /* Masters that predate sessions take the request for a malformed job and hang up. */
+    if (strcmp(status, "{SUCCESSFULLY_OPENED_SESSION}\0") != 0 || get_codec(accepted_codec) == -1) {
+        fputs("{FAILED_TO_OPEN_SESSION}\n", stderr);
+        close(master_socket);
+        return NULL;
+    }
+
+    DLBSession *session = (DLBSession *)calloc(1, sizeof(DLBSession));
+
+    session->socket = master_socket;
+    session->master_address = master_address;
+    session->codec = get_codec(accepted_codec);
+    session->window = window > 0 ? window : DEFAULT_JOBS_IN_FLIGHT;
+    session->priority = PRIORITY_NORMAL;
+
+    pthread_mutex_init(&session->lock, NULL);
+    pthread_cond_init(&session->changed, NULL);
+    pthread_mutex_init(&session->send_lock, NULL);
+
+    pthread_create(&session->receiver, NULL, receive_job_outputs, (void *)session);
+
+    return session;
+}
+
+/**
+ * Submits a job to the master node without waiting for its output.
+ * The job gets the session's deadline and priority as they are when submitted.
+ *
+ * WARNING: 'dlb_submit' malloc()s memory to '*job' which must be freed by
+ * the caller with dlb_free_job(), once it was completed.
+ *
+ * @param session The session to submit the job to.
+ * @param executable The path to the job's executable.
+ * @param input_file The path to the job's input file.
+ * @param output_path Where to store the job's output.
+ * @param callback Called on the receiver thread once the job completes, or NULL to queue
+ * the job for dlb_poll() and dlb_wait() instead.
+ * @param context Passed to the callback.
+ *
+ * @return The job, which belongs to its callback once it completes, or NULL if the session is broken.
+ */
+DLBJob *dlb_submit(DLBSession *session, char *executable, char *input_file, char *output_path, DLBCallback callback, void *context) {
+    DLBJob *job = (DLBJob *)calloc(1, sizeof(DLBJob));
+
+    job->executable = strdup(executable);
+    job->input_file = strdup(input_file);
+    job->output_path = strdup(output_path);
+    job->output_fd = -1;
+    job->callback = callback;
+    job->context = context;
+    mint_trace_id(job->trace_id);
+
+    pthread_mutex_lock(&session->lock);
+
+    while (session->in_flight >= session->window && !session->broken)
+        pthread_cond_wait(&session->changed, &session->lock);
+
+    if (session->broken) {
+        pthread_mutex_unlock(&session->lock);
+        dlb_free_job(job);
+
+        return NULL;
+    }
+
+    job->tag = session->next_tag++;
+    job->next = session->pending;
+    session->pending = job;
+    session->in_flight++;
+
+    pthread_mutex_unlock(&session->lock);
+
+    /* Once sent, the job may complete and be freed at any time, so keep what is needed afterwards. */
+    char trace_id[TRACE_ID_LENGTH + 1];
+    unsigned long submitted = job->submitted = now_nanoseconds();
+
+    memcpy(trace_id, job->trace_id, sizeof(trace_id));
+
+    /* stat_file() names the buffers after the paths it is given, so hand it copies. */
+    char executable_path[PATH_MAX], input_file_path[PATH_MAX];
+    snprintf(executable_path, sizeof(executable_path), "%s", executable);
+    snprintf(input_file_path, sizeof(input_file_path), "%s", input_file);
+
+    Buffer *b1 = stat_file(executable_path);
+    Buffer *b2 = stat_file(input_file_path);
+
+    if (!b1 || !b2) {
+        free(b1);
+        free(b2);
+
+        if (take_pending_job(session, job->tag))
+            complete_job(session, job, "{FAILED_TO_READ_JOB}");
+
+        return job;
+    }
+
+    char job_request[MAX_BUFFER_SIZE];
+
+    char *tenant = get_tenant();
+
+    /* As with send_job(), the trace id gives way to "-" before the deadline, priority and tenant are left off. */
+    if (snprintf(job_request, sizeof(job_request), "{SUBMIT_JOB} %ld %s %ld %s %ld %s %ld %s%s%s", job->tag, b1->file_name, b1->size, b2->file_name, b2->size, trace_id, session->deadline, PRIORITY_NAMES[session->priority], tenant ? " " : "", tenant ? tenant : "") >= (int)sizeof(job_request)
+        && snprintf(job_request, sizeof(job_request), "{SUBMIT_JOB} %ld %s %ld %s %ld - %ld %s%s%s", job->tag, b1->file_name, b1->size, b2->file_name, b2->size, session->deadline, PRIORITY_NAMES[session->priority], tenant ? " " : "", tenant ? tenant : "") >= (int)sizeof(job_request))
+        snprintf(job_request, sizeof(job_request), "{SUBMIT_JOB} %ld %s %ld %s %ld", job->tag, b1->file_name, b1->size, b2->file_name, b2->size);
+
+    TransferStats stats = {0, 0};
+
+    pthread_mutex_lock(&session->send_lock);
+
+    /* Cork so the request and the files share segments. */
+    set_cork(session->socket, true);
+
+    bool sent = send_message(session->socket, job_request)
+        && send_encoded_file(session->socket, executable, b1->size, session->codec, &stats)
+        && send_encoded_file(session->socket, input_file, b2->size, session->codec, &stats);
+
+    set_cork(session->socket, false);
+
+    pthread_mutex_unlock(&session->send_lock);
+
+    log_info("[Client]: Sending Job Request: [%s] to Master (%I) (%.2f MB/s).\n", job_request, &session->master_address, get_throughput(&stats));
+    end_span(trace_id, "upload", submitted);
+
+    free(b1);
+    free(b2);
+
+    /* A partly sent job leaves the stream out of step; the receiver fails every job in flight once it closes. */
+    if (!sent)
+        shutdown(session->socket, SHUT_RDWR);
+
+    return job;
+}
+
+/**
+ * Takes the next completed job of a session that has no callback, without blocking.
+ *
+ * @param session The session.
+ *
+ * @return The job, or NULL if none has completed yet.
+ */
+DLBJob *dlb_poll(DLBSession *session) {
+    pthread_mutex_lock(&session->lock);
+
+    DLBJob *job = session->completed;
+
+    if (job) {
+        session->completed = job->next;
+        job->next = NULL;
+
+        if (!session->completed)
+            session->last_completed = NULL;
+    }
+
+    pthread_mutex_unlock(&session->lock);
+
+    return job;
+}
+
+/**
+ * Takes the next completed job of a session that has no callback, waiting for one if need be.
+ *
+ * @param session The session.
+ *
+ * @return The job, or NULL once no job is left in flight or waiting to be taken.
+ */
+DLBJob *dlb_wait(DLBSession *session) {
+    pthread_mutex_lock(&session->lock);
+
+    while (!session->completed && session->in_flight > 0)
+        pthread_cond_wait(&session->changed, &session->lock);
+
+    pthread_mutex_unlock(&session->lock);
+
+    return dlb_poll(session);
+}
+
+/**
+ * Frees a job returned by dlb_submit(), dlb_poll() or dlb_wait().
+ *
+ * @param job The job to free.
+ */
+void dlb_free_job(DLBJob *job) {
+    free(job->executable);
+    free(job->input_file);
+    free(job->output_path);
+    free(job);
+}
+
+/**
+ * Waits for every job in flight to complete and closes a session.
+ *
+ * Completed jobs that were never taken are freed with it.
+ *
+ * @param session The session to close.
+ */
+void dlb_close(DLBSession *session) {
+    pthread_mutex_lock(&session->lock);
+
+    while (session->in_flight > 0)
+        pthread_cond_wait(&session->changed, &session->lock);
+
+    pthread_mutex_unlock(&session->lock);
+
+    /* The master ends the session once the connection closes. */
+    shutdown(session->socket, SHUT_RDWR);
+    pthread_join(session->receiver, NULL);
+    close(session->socket);
+
+    for (DLBJob *job; (job = dlb_poll(session)); )
+        dlb_free_job(job);
+
+    pthread_mutex_destroy(&session->lock);
+    pthread_cond_destroy(&session->changed);
+    pthread_mutex_destroy(&session->send_lock);
+    free(session);
+}
+
+#endif
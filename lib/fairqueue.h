@@ -0,0 +1,481 @@
+#ifndef FAIRQUEUE_H
+#define FAIRQUEUE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#include "utilities.h"
+#include "slavelist.h"
+#include "scheduler.h"
+
+/*
+ * Jobs wait at the master for a turn on the slaves, instead of piling up on
+ * whichever slave they were placed on. There are as many turns as available
+ * slaves times SLAVE_SLOTS, and a job holds its turn from before its first
+ * attempt until after its last.
+ *
+ * Waiting jobs are queued per identity within their priority class. An
+ * identity is what the master itself knows a client by: the user id the kernel
+ * reports for a client on its Unix socket, or else the client's address. Turns
+ * go to the classes by deficit round robin: every job costs one turn, and a
+ * class earns PRIORITY_WEIGHTS of them when its first job arrives and again
+ * every round it still has jobs waiting. A class that runs out of jobs gives
+ * up the rest of its turns. Within a class, its identities take one turn each
+ * in rotation. So interactive jobs go ahead of batch jobs without shutting
+ * them out, and a client with many jobs waiting cannot hold back one with a
+ * few.
+ *
+ * The tenant a client names is only a queue of its own within the client's
+ * identity, whose turns its tenants take in rotation. Naming a new tenant for
+ * every job therefore gains a client no more turns.
+ */
+#define SLAVE_SLOTS 1
+#define SLAVE_SLOTS_ENV "DLB_SLAVE_SLOTS"
+
+const int PRIORITY_WEIGHTS[PRIORITY_COUNT] = {
+    8, 4, 1
+};
+
+typedef struct Ticket Ticket;
+typedef struct Tenant Tenant;
+typedef struct Identity Identity;
+typedef struct FairQueue FairQueue;
+
+/* A job waiting for a turn; it lives on the waiting thread's stack. */
+struct Ticket {
+    Tenant *tenant;
+    Ticket *next;
+    bool granted;
+    pthread_cond_t turn;
+};
+
+/* The jobs of a tenant waiting in one class, oldest first. Freed once none are left. */
+struct Tenant {
+    char name[TENANT_LENGTH + 1];
+    Identity *identity;
+    Ticket *head;
+    Ticket *tail;
+    Tenant *next;
+};
+
+/* The tenants of an identity with jobs waiting in one class, in the order they take its turns. Freed once none are left. */
+struct Identity {
+    char name[INET6_ADDRSTRLEN];
+    int priority;
+    Tenant *tenants;
+    Tenant *last;
+    Identity *next;
+};
+
+struct FairQueue {
+    SlaveList *list;
+    int slots;
+
+    /* Turns granted and not yet ended. */
+    int running;
+
+    /* Per class: its identities with jobs waiting, in the order they take turns, its jobs waiting, and the turns left to it this round. */
+    Identity *identities[PRIORITY_COUNT];
+    Identity *last[PRIORITY_COUNT];
+    int waiting[PRIORITY_COUNT];
+    int deficits[PRIORITY_COUNT];
+
+    pthread_mutex_t lock;
+};
+
+FairQueue *createFairQueue(SlaveList *list, int slots);
+int count_turns(FairQueue *queue);
+int count_waiting(FairQueue *queue);
+int next_class(FairQueue *queue);
+void grant_turns(FairQueue *queue);
+void offer_turns(FairQueue *queue);
+void enqueue_job(FairQueue *queue, Ticket *ticket, char *identity, char *tenant, int priority);
+bool await_turn(FairQueue *queue, Ticket *ticket, int timeout);
+bool leave_queue(FairQueue *queue, Ticket *ticket);
+void end_turn(FairQueue *queue);
+
+/**
+ * Creates an empty queue of jobs waiting for the slaves of a list.
+ *
+ * WARNING: 'createFairQueue' malloc()s memory to '*queue' which must be freed by
+ * the caller.
+ *
+ * @param list The slaves the jobs wait for.
+ * @param slots The jobs each available slave is given at a time.
+ *
+ * @return The queue.
+ */
+FairQueue *createFairQueue(SlaveList *list, int slots) {
+    FairQueue *queue = (FairQueue *)calloc(1, sizeof(FairQueue));
+
+    if (!queue) {
+        perror("[X] calloc");
+        exit(1);
+    }
+
+    queue->list = list;
+    queue->slots = slots;
+    pthread_mutex_init(&queue->lock, NULL);
+
+    return queue;
+}
+
+/**
+ * Counts the turns there are on the slaves that are available right now.
+ *
+ * @param queue The queue.
+ *
+ * @return The number of jobs the slaves may be given at a time.
+ */
+int count_turns(FairQueue *queue) {
+    int size = __atomic_load_n(&queue->list->size, __ATOMIC_ACQUIRE), available = 0;
+    unsigned long now = now_nanoseconds();
+
+    for (int i = 0; i < size; i++)
+        available += is_available(queue->list->slaves[i], now);
+
+    return available * queue->slots;
+}
+
+/**
+ * Counts the jobs waiting for a turn in every class.
+ *
+ * @param queue The queue.
+ *
+ * @return The number of jobs waiting.
+ */
+int count_waiting(FairQueue *queue) {
+    int waiting = 0;
+
+    for (int priority = 0; priority < PRIORITY_COUNT; priority++)
+        waiting += __atomic_load_n(&queue->waiting[priority], __ATOMIC_RELAXED);
+
+    return waiting;
+}
+
+/**
+ * Picks the class the next turn goes to, starting a new round once every class with jobs waiting used its turns.
+ *
+ * The caller holds the queue's lock.
+ *
+ * @param queue The queue.
+ *
+ * @return The PRIORITY_*, or -1 if no job is waiting.
+ */
+int next_class(FairQueue *queue) {
+    for (int round = 0; round < 2; round++) {
+        for (int priority = 0; priority < PRIORITY_COUNT; priority++) {
+            if (queue->identities[priority] && queue->deficits[priority] > 0)
+                return priority;
+        }
+
+        for (int priority = 0; priority < PRIORITY_COUNT; priority++)
+            queue->deficits[priority] = queue->identities[priority] ? PRIORITY_WEIGHTS[priority] : 0;
+    }
+
+    return -1;
+}
+
+/**
+ * Grants turns to waiting jobs for as long as there are turns to spare.
+ *
+ * The caller holds the queue's lock.
+ *
+ * @param queue The queue.
+ */
+void grant_turns(FairQueue *queue) {
+    int turns = count_turns(queue), priority;
+
+    while (queue->running < turns && (priority = next_class(queue)) != -1) {
+        Identity *identity = queue->identities[priority];
+        Tenant *tenant = identity->tenants;
+        Ticket *ticket = tenant->head;
+
+        /* The tenant goes to the back of its identity, or leaves it once it has nothing left waiting. */
+        tenant->head = ticket->next;
+        identity->tenants = tenant->next;
+
+        if (!identity->tenants)
+            identity->last = NULL;
+
+        if (tenant->head) {
+            tenant->next = NULL;
+
+            if (identity->last)
+                identity->last->next = tenant;
+            else
+                identity->tenants = tenant;
+
+            identity->last = tenant;
+        } else {
+            free(tenant);
+        }
+
+        /* Likewise the identity within its class. */
+        queue->identities[priority] = identity->next;
+
+        if (!queue->identities[priority])
+            queue->last[priority] = NULL;
+
+        if (identity->tenants) {
+            identity->next = NULL;
+
+            if (queue->last[priority])
+                queue->last[priority]->next = identity;
+            else
+                queue->identities[priority] = identity;
+
+            queue->last[priority] = identity;
+        } else {
+            free(identity);
+        }
+
+        queue->deficits[priority] = queue->identities[priority] ? queue->deficits[priority] - 1 : 0;
+        __atomic_store_n(&queue->waiting[priority], queue->waiting[priority] - 1, __ATOMIC_RELAXED);
+        queue->running++;
+
+        ticket->tenant = NULL;
+        ticket->granted = true;
+        pthread_cond_signal(&ticket->turn);
+    }
+}
+
+/**
+ * Grants turns that became free outside of the queue, e.g. because a slave registered.
+ *
+ * @param queue The queue.
+ */
+void offer_turns(FairQueue *queue) {
+    pthread_mutex_lock(&queue->lock);
+    grant_turns(queue);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+/**
+ * Queues a job for a turn behind the other jobs of its tenant and class.
+ *
+ * @param queue The queue.
+ * @param ticket The job's ticket, which must stay in place until the job leaves the queue.
+ * @param identity What the master knows the job's client by, e.g. its address.
+ * @param tenant The tenant the client named for the job, or "" if it named none.
+ * @param priority The PRIORITY_* class of the job.
+ */
+void enqueue_job(FairQueue *queue, Ticket *ticket, char *identity, char *tenant, int priority) {
+    pthread_condattr_t attributes;
+
+    pthread_condattr_init(&attributes);
+    pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+    pthread_cond_init(&ticket->turn, &attributes);
+    pthread_condattr_destroy(&attributes);
+
+    ticket->next = NULL;
+    ticket->granted = false;
+
+    pthread_mutex_lock(&queue->lock);
+
+    Identity *client = queue->identities[priority];
+
+    while (client && strcmp(client->name, identity) != 0)
+        client = client->next;
+
+    if (!client) {
+        client = (Identity *)calloc(1, sizeof(Identity));
+
+        if (!client) {
+            perror("[X] calloc");
+            exit(1);
+        }
+
+        snprintf(client->name, sizeof(client->name), "%s", identity);
+        client->priority = priority;
+
+        if (!queue->identities[priority])
+            queue->deficits[priority] = PRIORITY_WEIGHTS[priority];
+
+        if (queue->last[priority])
+            queue->last[priority]->next = client;
+        else
+            queue->identities[priority] = client;
+
+        queue->last[priority] = client;
+    }
+
+    Tenant *waiting = client->tenants;
+
+    while (waiting && strcmp(waiting->name, tenant) != 0)
+        waiting = waiting->next;
+
+    if (!waiting) {
+        waiting = (Tenant *)calloc(1, sizeof(Tenant));
+
+        if (!waiting) {
+            perror("[X] calloc");
+            exit(1);
+        }
+
+        snprintf(waiting->name, sizeof(waiting->name), "%s", tenant);
+        waiting->identity = client;
+
+        if (client->last)
+            client->last->next = waiting;
+        else
+            client->tenants = waiting;
+
+        client->last = waiting;
+    }
+
+    if (waiting->tail)
+        waiting->tail->next = ticket;
+    else
+        waiting->head = ticket;
+
+    waiting->tail = ticket;
+    ticket->tenant = waiting;
+
+    __atomic_store_n(&queue->waiting[priority], queue->waiting[priority] + 1, __ATOMIC_RELAXED);
+
+    grant_turns(queue);
+
+    pthread_mutex_unlock(&queue->lock);
+}
+
+/**
+ * Waits for a queued job's turn.
+ *
+ * Slaves that come back from suspension add turns without telling the queue,
+ * so the turns are counted again before waiting.
+ *
+ * @param queue The queue.
+ * @param ticket The job's ticket.
+ * @param timeout The longest to wait, in milliseconds.
+ *
+ * @return Whether or not the job was granted its turn, after which it leaves the queue.
+ */
+bool await_turn(FairQueue *queue, Ticket *ticket, int timeout) {
+    struct timespec until;
+
+    clock_gettime(CLOCK_MONOTONIC, &until);
+    until.tv_sec += timeout / 1000;
+    until.tv_nsec += (long)(timeout % 1000) * 1000000L;
+
+    if (until.tv_nsec >= 1000000000L) {
+        until.tv_sec++;
+        until.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&queue->lock);
+
+    grant_turns(queue);
+
+    while (!ticket->granted && pthread_cond_timedwait(&ticket->turn, &queue->lock, &until) != ETIMEDOUT);
+
+    bool granted = ticket->granted;
+
+    pthread_mutex_unlock(&queue->lock);
+
+    if (granted)
+        pthread_cond_destroy(&ticket->turn);
+
+    return granted;
+}
+
+/**
+ * Takes a job that gave up waiting out of the queue.
+ *
+ * @param queue The queue.
+ * @param ticket The job's ticket.
+ *
+ * @return Whether or not the job was granted its turn in the meantime, which it must then end.
+ */
+bool leave_queue(FairQueue *queue, Ticket *ticket) {
+    pthread_mutex_lock(&queue->lock);
+
+    bool granted = ticket->granted;
+    Tenant *tenant = ticket->tenant;
+
+    if (!granted) {
+        Identity *identity = tenant->identity;
+        int priority = identity->priority;
+        Ticket *previous = NULL;
+
+        for (Ticket *waiting = tenant->head; waiting != ticket; waiting = waiting->next)
+            previous = waiting;
+
+        if (previous)
+            previous->next = ticket->next;
+        else
+            tenant->head = ticket->next;
+
+        if (tenant->tail == ticket)
+            tenant->tail = previous;
+
+        /* A tenant with nothing left waiting leaves its identity. */
+        if (!tenant->head) {
+            Tenant *before = NULL;
+
+            for (Tenant *waiting = identity->tenants; waiting != tenant; waiting = waiting->next)
+                before = waiting;
+
+            if (before)
+                before->next = tenant->next;
+            else
+                identity->tenants = tenant->next;
+
+            if (identity->last == tenant)
+                identity->last = before;
+
+            free(tenant);
+        }
+
+        /* And an identity with no tenants left leaves its class. */
+        if (!identity->tenants) {
+            Identity *before = NULL;
+
+            for (Identity *waiting = queue->identities[priority]; waiting != identity; waiting = waiting->next)
+                before = waiting;
+
+            if (before)
+                before->next = identity->next;
+            else
+                queue->identities[priority] = identity->next;
+
+            if (queue->last[priority] == identity)
+                queue->last[priority] = before;
+
+            if (!queue->identities[priority])
+                queue->deficits[priority] = 0;
+
+            free(identity);
+        }
+
+        __atomic_store_n(&queue->waiting[priority], queue->waiting[priority] - 1, __ATOMIC_RELAXED);
+    }
+
+    pthread_mutex_unlock(&queue->lock);
+
+    pthread_cond_destroy(&ticket->turn);
+
+    return granted;
+}
+
+/**
+ * Hands back the turn of a job that is done with the slaves, granting it to the next job waiting.
+ *
+ * @param queue The queue.
+ */
+void end_turn(FairQueue *queue) {
+    pthread_mutex_lock(&queue->lock);
+
+    queue->running--;
+    grant_turns(queue);
+
+    pthread_mutex_unlock(&queue->lock);
+}
+
+#endif
@@ -0,0 +1,594 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/*
+ * Every thread logs into its own single-producer single-consumer ring of fixed-size records.
+ * A record holds the format string's address and the raw arguments; a background flusher
+ * thread does the formatting and the stdio writes. Format strings must therefore be literals.
+ *
+ * Besides the usual printf conversions, %I formats a struct sockaddr_in * as "'<ip>', <port>".
+ * The address is copied when the record is made, so it is safe to log a reused address.
+ */
+#define LOG_DEBUG 0
+#define LOG_INFO 1
+#define LOG_WARN 2
+#define LOG_ERROR 3
+#define LOG_OFF 4
+
+/* Calls below LOG_COMPILE_LEVEL are removed by the preprocessor; release builds drop debug. */
+#ifndef LOG_COMPILE_LEVEL
+#ifdef NDEBUG
+#define LOG_COMPILE_LEVEL LOG_INFO
+#else
+#define LOG_COMPILE_LEVEL LOG_DEBUG
+#endif
+#endif
+
+#define LOG_RING_SLOTS 256
+#define LOG_RECORD_SIZE 512
+#define LOG_ARGS_SIZE (LOG_RECORD_SIZE - sizeof(unsigned long) - sizeof(const char *) - 2 * sizeof(int))
+#define LOG_FLUSH_INTERVAL_NS 1000000
+
+#define LOG_AT(level, ...) \
+    do { if ((level) >= __atomic_load_n(&log_level, __ATOMIC_RELAXED)) log_record((level), __VA_ARGS__); } while (0)
+
+#if LOG_COMPILE_LEVEL <= LOG_DEBUG
+#define log_debug(...) LOG_AT(LOG_DEBUG, __VA_ARGS__)
+#else
+#define log_debug(...) do { } while (0)
+#endif
+
+#if LOG_COMPILE_LEVEL <= LOG_INFO
+#define log_info(...) LOG_AT(LOG_INFO, __VA_ARGS__)
+#else
+#define log_info(...) do { } while (0)
+#endif
+
+#if LOG_COMPILE_LEVEL <= LOG_WARN
+#define log_warn(...) LOG_AT(LOG_WARN, __VA_ARGS__)
+#else
+#define log_warn(...) do { } while (0)
+#endif
+
+#define log_error(...) LOG_AT(LOG_ERROR, __VA_ARGS__)
+
+typedef struct LogRecord LogRecord;
+typedef struct LogRing LogRing;
+typedef struct LogConversion LogConversion;
+
+struct LogRecord {
+    unsigned long timestamp;
+    const char *format;
+    int level;
+    int length;
+    unsigned char args[LOG_ARGS_SIZE];
+};
+
+struct LogRing {
+    LogRecord records[LOG_RING_SLOTS];
+
+    /* The producer owns head and the flusher owns tail; each sits on its own cache line. */
+    unsigned long head __attribute__((aligned(64)));
+    unsigned long tail __attribute__((aligned(64)));
+    unsigned long dropped;
+    int closed;
+
+    LogRing *next;
+};
+
+struct LogConversion {
+    const char *start;
+    const char *length_modifier;
+    const char *end;
+    char size;
+    char type;
+};
+
+int log_level = LOG_INFO;
+FILE *log_output;
+bool log_running = false;
+LogRing *log_rings = NULL;
+pthread_mutex_t log_rings_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_key_t log_ring_key;
+pthread_t log_flusher;
+__thread LogRing *log_ring = NULL;
+
+int get_log_level(char *name);
+void log_init(FILE *out);
+void log_shutdown();
+void log_record(int level, const char *format, ...);
+LogRing *get_log_ring();
+void close_log_ring(void *ring);
+const char *parse_conversion(const char *p, LogConversion *conversion);
+int encode_arguments(unsigned char *args, const char *format, va_list *ap);
+void write_record(FILE *out, LogRecord *record);
+int drain_log(FILE *out);
+void *flush_log(void *argv);
+
+/**
+ * Parses the name of a log level.
+ *
+ * @param name One of "debug", "info", "warn", "error" or "off".
+ *
+ * @return The LOG_* level, or -1 if the name is unknown.
+ */
+int get_log_level(char *name) {
+    char *names[] = { "debug", "info", "warn", "error", "off" };
+
+    for (int level = LOG_DEBUG; name && level <= LOG_OFF; level++)
+        if (strcmp(name, names[level]) == 0)
+            return level;
+
+    return -1;
+}
+
+/**
+ * Starts the background flusher. The level is read from DLB_LOG_LEVEL and defaults to info.
+ * Records made before log_init() or after log_shutdown() are written synchronously to stdout.
+ *
+ * @param out The stream the flusher writes to.
+ */
+void log_init(FILE *out) {
+    int level = get_log_level(getenv("DLB_LOG_LEVEL"));
+
+    if (level != -1)
+        __atomic_store_n(&log_level, level, __ATOMIC_RELAXED);
+
+    log_output = out;
+
+    pthread_key_create(&log_ring_key, close_log_ring);
+
+    __atomic_store_n(&log_running, true, __ATOMIC_RELEASE);
+
+    if (pthread_create(&log_flusher, NULL, flush_log, NULL) != 0) {
+        perror("[X] pthread_create");
+        exit(1);
+    }
+
+    atexit(log_shutdown);
+}
+
+/**
+ * Stops the background flusher once every ring has been drained.
+ */
+void log_shutdown() {
+    if (!__atomic_exchange_n(&log_running, false, __ATOMIC_ACQ_REL))
+        return;
+
+    pthread_join(log_flusher, NULL);
+}
+
+/**
+ * Records a log message without formatting it. Never blocks: when the calling thread's ring
+ * is full the record is dropped and counted.
+ *
+ * @param level The LOG_* level of the message.
+ * @param format A printf format string with static storage duration.
+ */
+void log_record(int level, const char *format, ...) {
+    va_list ap;
+    LogRing *ring = __atomic_load_n(&log_running, __ATOMIC_ACQUIRE) ? get_log_ring() : NULL;
+
+    if (!ring) {
+        LogRecord record = { 0, format, level, 0 };
+
+        va_start(ap, format);
+        record.length = encode_arguments(record.args, format, &ap);
+        va_end(ap);
+
+        write_record(stdout, &record);
+        fflush(stdout);
+
+        return;
+    }
+
+    unsigned long head = ring->head;
+
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= LOG_RING_SLOTS) {
+        __atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    LogRecord *record = &ring->records[head & (LOG_RING_SLOTS - 1)];
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    record->timestamp = (unsigned long)now.tv_sec * 1000000000UL + (unsigned long)now.tv_nsec;
+    record->format = format;
+    record->level = level;
+
+    va_start(ap, format);
+    record->length = encode_arguments(record->args, format, &ap);
+    va_end(ap);
+
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Obtains the calling thread's ring, registering a new one with the flusher on first use.
+ *
+ * @return The calling thread's ring.
+ */
+LogRing *get_log_ring() {
+    if (log_ring)
+        return log_ring;
+
+    LogRing *ring = (LogRing *)calloc(1, sizeof(LogRing));
+
+    if (!ring) {
+        perror("[X] calloc");
+        exit(1);
+    }
+
+    pthread_mutex_lock(&log_rings_lock);
+    ring->next = log_rings;
+    log_rings = ring;
+    pthread_mutex_unlock(&log_rings_lock);
+
+    pthread_setspecific(log_ring_key, ring);
+
+    return log_ring = ring;
+}
+
+/**
+ * Hands an exiting thread's ring over to the flusher, which frees it once drained.
+ *
+ * @param ring The exiting thread's ring.
+ */
+void close_log_ring(void *ring) {
+    __atomic_store_n(&((LogRing *)ring)->closed, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Parses one conversion specification of a format string.
+ *
+ * @param p The '%' starting the specification.
+ * @param conversion Receives the bounds, length modifier and type of the specification.
+ *
+ * @return The character following the specification.
+ */
+const char *parse_conversion(const char *p, LogConversion *conversion) {
+    conversion->start = p++;
+
+    while (*p && strchr("-+ #0", *p)) p++;
+    while (*p == '*' || (*p >= '0' && *p <= '9')) p++;
+
+    if (*p == '.') {
+        p++;
+        while (*p == '*' || (*p >= '0' && *p <= '9')) p++;
+    }
+
+    conversion->length_modifier = p;
+    conversion->size = 0;
+
+    while (*p && strchr("hlzjtL", *p)) {
+        /* Only the widths that change how an argument is read matter: long, long long and size_t. */
+        conversion->size = *p == 'l' ? (conversion->size == 'l' ? 'q' : 'l') : (*p == 'z' ? 'z' : conversion->size);
+        p++;
+    }
+
+    conversion->type = *p;
+    conversion->end = *p ? p + 1 : p;
+
+    return conversion->end;
+}
+
+/**
+ * Copies the arguments of a format string into a record without formatting them.
+ *
+ * @param args The record's argument area of LOG_ARGS_SIZE bytes.
+ * @param format The format string.
+ * @param ap The arguments.
+ *
+ * @return The number of bytes used; arguments that do not fit are left out.
+ */
+int encode_arguments(unsigned char *args, const char *format, va_list *ap) {
+    int length = 0;
+    LogConversion conversion;
+
+    #define LOG_PUT(value) do { \
+        if (length + (int)sizeof(value) > (int)LOG_ARGS_SIZE) return length; \
+        memcpy(args + length, &(value), sizeof(value)); \
+        length += sizeof(value); \
+    } while (0)
+
+    for (const char *p = format; (p = strchr(p, '%')); ) {
+        p = parse_conversion(p, &conversion);
+
+        int precision = -1;
+
+        for (const char *q = conversion.start; q < conversion.length_modifier; q++) {
+            if (*q == '*') {
+                int star = va_arg(*ap, int);
+                LOG_PUT(star);
+
+                if (q[-1] == '.')
+                    precision = star;
+            } else if (*q == '.' && q[1] != '*') {
+                precision = atoi(q + 1);
+            }
+        }
+
+        switch (conversion.type) {
+            case 'd': case 'i': case 'c': {
+                long long value = conversion.size == 'l' ? va_arg(*ap, long)
+                    : conversion.size == 'q' ? va_arg(*ap, long long)
+                    : conversion.size == 'z' ? va_arg(*ap, ssize_t)
+                    : va_arg(*ap, int);
+                LOG_PUT(value);
+                break;
+            }
+            case 'u': case 'x': case 'X': case 'o': {
+                unsigned long long value = conversion.size == 'l' ? va_arg(*ap, unsigned long)
+                    : conversion.size == 'q' ? va_arg(*ap, unsigned long long)
+                    : conversion.size == 'z' ? va_arg(*ap, size_t)
+                    : va_arg(*ap, unsigned int);
+                LOG_PUT(value);
+                break;
+            }
+            case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': {
+                double value = va_arg(*ap, double);
+                LOG_PUT(value);
+                break;
+            }
+            case 'p': {
+                void *value = va_arg(*ap, void *);
+                LOG_PUT(value);
+                break;
+            }
+            case 'I': {
+                struct sockaddr_in *address = va_arg(*ap, struct sockaddr_in *);
+                struct sockaddr_in value;
+
+                if (address)
+                    value = *address;
+                else
+                    memset(&value, 0, sizeof(value));
+
+                LOG_PUT(value);
+                break;
+            }
+            case 's': {
+                const char *value = va_arg(*ap, const char *);
+                int room = (int)LOG_ARGS_SIZE - length - 1;
+
+                if (room < 0)
+                    return length;
+
+                value = value ? value : "(null)";
+
+                int size = precision >= 0 ? (int)strnlen(value, precision) : (int)strlen(value);
+                size = size < room ? size : room;
+
+                memcpy(args + length, value, size);
+                args[length + size] = '\0';
+                length += size + 1;
+                break;
+            }
+            case '%':
+                break;
+            default:
+                return length;
+        }
+    }
+
+    #undef LOG_PUT
+
+    return length;
+}
+
+/**
+ * Formats a record.
+ *
+ * @param out The stream to write to.
+ * @param record The record to format.
+ */
+void write_record(FILE *out, LogRecord *record) {
+    const char *p = record->format;
+    int offset = 0;
+    LogConversion conversion;
+
+    #define LOG_GET(value) do { \
+        if (offset + (int)sizeof(value) > record->length) { fputs("...\n", out); return; } \
+        memcpy(&(value), record->args + offset, sizeof(value)); \
+        offset += sizeof(value); \
+    } while (0)
+
+    for (const char *next; (next = strchr(p, '%')); p = conversion.end) {
+        fwrite(p, 1, next - p, out);
+        parse_conversion(next, &conversion);
+
+        /* Rebuild the specification with '*' replaced by the recorded values and the length
+           modifier replaced by the one matching the recorded type. */
+        char spec[64];
+        int size = 0;
+
+        for (const char *q = conversion.start; q < conversion.length_modifier && size < 32; q++) {
+            if (*q != '*') {
+                spec[size++] = *q;
+                continue;
+            }
+
+            int star;
+            LOG_GET(star);
+
+            if (q[-1] == '.' && star < 0)
+                size--;
+            else
+                size += snprintf(spec + size, sizeof(spec) - size, "%d", star);
+        }
+
+        switch (conversion.type) {
+            case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': {
+                long long value;
+                LOG_GET(value);
+                snprintf(spec + size, sizeof(spec) - size, "ll%c", conversion.type);
+                fprintf(out, spec, value);
+                break;
+            }
+            case 'c': {
+                long long value;
+                LOG_GET(value);
+                snprintf(spec + size, sizeof(spec) - size, "c");
+                fprintf(out, spec, (int)value);
+                break;
+            }
+            case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': {
+                double value;
+                LOG_GET(value);
+                snprintf(spec + size, sizeof(spec) - size, "%c", conversion.type);
+                fprintf(out, spec, value);
+                break;
+            }
+            case 'p': {
+                void *value;
+                LOG_GET(value);
+                snprintf(spec + size, sizeof(spec) - size, "p");
+                fprintf(out, spec, value);
+                break;
+            }
+            case 'I': {
+                struct sockaddr_in value;
+                char address[INET_ADDRSTRLEN];
+                LOG_GET(value);
+                inet_ntop(AF_INET, &value.sin_addr, address, sizeof(address));
+                fprintf(out, "'%s', %d", address, ntohs(value.sin_port));
+                break;
+            }
+            case 's': {
+                if (offset >= record->length) {
+                    fputs("...\n", out);
+                    return;
+                }
+
+                const char *value = (const char *)record->args + offset;
+                offset += strlen(value) + 1;
+                snprintf(spec + size, sizeof(spec) - size, "s");
+                fprintf(out, spec, value);
+                break;
+            }
+            case '%':
+                fputc('%', out);
+                break;
+            default:
+                fputs("...\n", out);
+                return;
+        }
+    }
+
+    #undef LOG_GET
+
+    fputs(p, out);
+}
+
+/**
+ * Formats every record waiting in the rings, oldest first, and frees the rings of exited threads.
+ *
+ * @param out The stream to write to.
+ *
+ * @return The number of records written.
+ */
+int drain_log(FILE *out) {
+    static LogRing **rings = NULL;
+    static int capacity = 0;
+    int count = 0, written = 0;
+
+    pthread_mutex_lock(&log_rings_lock);
+
+    for (LogRing **link = &log_rings; *link; ) {
+        LogRing *ring = *link;
+
+        /* A closed ring receives no more records, so one found empty can go. */
+        if (__atomic_load_n(&ring->closed, __ATOMIC_ACQUIRE)
+            && __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == ring->tail
+            && __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED) == 0) {
+            *link = ring->next;
+            free(ring);
+            continue;
+        }
+
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            rings = (LogRing **)realloc(rings, sizeof(LogRing *) * capacity);
+
+            if (!rings) {
+                perror("[X] realloc");
+                exit(1);
+            }
+        }
+
+        rings[count++] = ring;
+        link = &ring->next;
+    }
+
+    pthread_mutex_unlock(&log_rings_lock);
+
+    for (int i = 0; i < count; i++) {
+        unsigned long dropped = __atomic_exchange_n(&rings[i]->dropped, 0, __ATOMIC_RELAXED);
+
+        if (dropped) {
+            fprintf(out, "[!] Dropped %lu log records.\n", dropped);
+            written++;
+        }
+    }
+
+    /* Merge the rings by timestamp so that interleaved threads read in order. */
+    while (true) {
+        LogRing *oldest = NULL;
+
+        for (int i = 0; i < count; i++) {
+            LogRing *ring = rings[i];
+
+            if (ring->tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE))
+                continue;
+
+            if (!oldest || ring->records[ring->tail & (LOG_RING_SLOTS - 1)].timestamp
+                           < oldest->records[oldest->tail & (LOG_RING_SLOTS - 1)].timestamp)
+                oldest = ring;
+        }
+
+        if (!oldest)
+            return written;
+
+        write_record(out, &oldest->records[oldest->tail & (LOG_RING_SLOTS - 1)]);
+        __atomic_store_n(&oldest->tail, oldest->tail + 1, __ATOMIC_RELEASE);
+
+        written++;
+    }
+}
+
+/**
+ * Drains the rings until the logger is shut down.
+ *
+ * @param argv Unused.
+ */
+void *flush_log(void *argv) {
+    struct timespec interval = { 0, LOG_FLUSH_INTERVAL_NS };
+
+    while (true) {
+        bool running = __atomic_load_n(&log_running, __ATOMIC_ACQUIRE);
+
+        if (drain_log(log_output) > 0)
+            fflush(log_output);
+        else if (!running)
+            break;
+        else
+            nanosleep(&interval, NULL);
+    }
+
+    return NULL;
+}
+
+#endif
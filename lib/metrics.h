@@ -0,0 +1,317 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "transfer.h"
+
+/*
+ * Latencies are kept in log-linear buckets in the style of an HDR histogram: every power of two
+ * of nanoseconds is split into HISTOGRAM_SUB_BUCKETS linear buckets, bounding the relative error
+ * of a recorded value to 1 / HISTOGRAM_SUB_BUCKETS. Recording is a clock read and three relaxed
+ * atomic adds, so it can sit on every phase of every job.
+ */
+#define HISTOGRAM_SUB_BUCKET_BITS 3
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BUCKET_BITS)
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BUCKET_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+/* Exported bucket bounds are the powers of two from ~1us to ~69s. */
+#define HISTOGRAM_MIN_EXPORTED_EXPONENT 10
+#define HISTOGRAM_MAX_EXPORTED_EXPONENT 36
+
+#define PHASE_REQUEST 0
+#define PHASE_UPLOAD 1
+#define PHASE_QUEUE 2
+#define PHASE_SELECT 3
+#define PHASE_DISPATCH 4
+#define PHASE_EXECUTE 5
+#define PHASE_COLLECT 6
+#define PHASE_DOWNLOAD 7
+#define PHASE_TOTAL 8
+#define PHASE_COUNT 9
+
+#define BYTES_FROM_CLIENTS 0
+#define BYTES_TO_CLIENTS 1
+#define BYTES_TO_SLAVES 2
+#define BYTES_FROM_SLAVES 3
+#define BYTES_COUNT 4
+
+#define CANCEL_CLIENT 0
+#define CANCEL_DEADLINE 1
+#define CANCEL_COUNT 2
+
+#define REJECT_QUEUE 0
+#define REJECT_MEMORY 1
+#define REJECT_WAIT 2
+#define REJECT_COUNT 3
+
+typedef struct Histogram Histogram;
+typedef struct Metrics Metrics;
+
+struct Histogram {
+    unsigned long counts[HISTOGRAM_BUCKETS];
+    unsigned long count;
+    unsigned long sum;
+};
+
+struct Metrics {
+    Histogram phases[PHASE_COUNT];
+    unsigned long bytes[BYTES_COUNT];
+    unsigned long jobs_completed;
+    unsigned long jobs_failed;
+    unsigned long retries;
+
+    /* Backup copies started for straggler jobs, and those that finished first. */
+    unsigned long speculations;
+    unsigned long speculations_won;
+
+    /* Jobs an idle slave took over from a busy slave's queue before they started. */
+    unsigned long steals;
+
+    /* Batches of tiny jobs sent to a slave in one frame, and the jobs in them. */
+    unsigned long batches;
+    unsigned long batched_jobs;
+
+    /* Bytes of job files sent to slaves on the master's host through shared memory rather than TCP. */
+    unsigned long shared_memory_bytes;
+
+    /* Bytes of job files clients on the master's host passed the descriptors of, which went to slaves without the master holding them. */
+    unsigned long passed_bytes;
+
+    /* Jobs cancelled on their slaves because the client went away or the deadline passed. */
+    unsigned long cancellations[CANCEL_COUNT];
+
+    /* Jobs turned away before their files were received, by the limit they would have gone past. */
+    unsigned long rejections[REJECT_COUNT];
+
+    /* How long jobs of each priority class waited for a turn on the slaves. */
+    Histogram queueing[PRIORITY_COUNT];
+
+    /* At least how much sooner each job a backup won for had output than its primary would have. */
+    Histogram speculation_saved;
+};
+
+const char *PHASE_NAMES[PHASE_COUNT] = {
+    "request", "upload", "queue", "select", "dispatch", "execute", "collect", "download", "total"
+};
+
+const char *BYTES_NAMES[BYTES_COUNT] = {
+    "from_clients", "to_clients", "to_slaves", "from_slaves"
+};
+
+const char *CANCEL_NAMES[CANCEL_COUNT] = {
+    "client", "deadline"
+};
+
+const char *REJECT_NAMES[REJECT_COUNT] = {
+    "queue", "memory", "wait"
+};
+
+Metrics *createMetrics();
+int get_bucket(unsigned long value);
+void record_value(Histogram *histogram, unsigned long value);
+unsigned long record_phase(Metrics *metrics, int phase, unsigned long started);
+void add_counter(unsigned long *counter, unsigned long value);
+unsigned long read_counter(unsigned long *counter);
+void write_histogram(FILE *out, const char *name, const char *label, const char *value, Histogram *histogram);
+void write_metrics(FILE *out, Metrics *metrics);
+
+/**
+ * Creates an empty set of metrics.
+ *
+ * WARNING: 'createMetrics' malloc()s memory to '*metrics' which must be freed by
+ * the caller.
+ *
+ * @return The zeroed metrics.
+ */
+Metrics *createMetrics() {
+    Metrics *metrics = (Metrics *)calloc(1, sizeof(Metrics));
+
+    if (!metrics) {
+        perror("[X] calloc");
+        exit(1);
+    }
+
+    return metrics;
+}
+
+/**
+ * Maps a value onto its log-linear histogram bucket.
+ *
+ * @param value The value to map.
+ *
+ * @return The index of the bucket holding the value.
+ */
+int get_bucket(unsigned long value) {
+    if (value < HISTOGRAM_SUB_BUCKETS)
+        return (int)value;
+
+    int exponent = 63 - __builtin_clzl(value);
+    int sub_bucket = (int)(value >> (exponent - HISTOGRAM_SUB_BUCKET_BITS)) & (HISTOGRAM_SUB_BUCKETS - 1);
+
+    return (exponent - HISTOGRAM_SUB_BUCKET_BITS + 1) * HISTOGRAM_SUB_BUCKETS + sub_bucket;
+}
+
+/**
+ * Records a value into a histogram. Safe to call from any number of threads.
+ *
+ * @param histogram The histogram to record into.
+ * @param value The value to record.
+ */
+void record_value(Histogram *histogram, unsigned long value) {
+    __atomic_fetch_add(&histogram->counts[get_bucket(value)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->sum, value, __ATOMIC_RELAXED);
+}
+
+/**
+ * Records the latency of a phase that started at a given time and ended now.
+ *
+ * @param metrics The metrics to record into.
+ * @param phase The PHASE_* that ended.
+ * @param started When the phase started, as returned by now_nanoseconds().
+ *
+ * @return The time the phase ended, which is when the next phase starts.
+ */
+unsigned long record_phase(Metrics *metrics, int phase, unsigned long started) {
+    unsigned long now = now_nanoseconds();
+
+    record_value(&metrics->phases[phase], now - started);
+
+    return now;
+}
+
+/**
+ * Adds to a counter. Safe to call from any number of threads.
+ *
+ * @param counter The counter to add to.
+ * @param value The amount to add.
+ */
+void add_counter(unsigned long *counter, unsigned long value) {
+    __atomic_fetch_add(counter, value, __ATOMIC_RELAXED);
+}
+
+/**
+ * Reads a counter that other threads may be adding to.
+ *
+ * @param counter The counter to read.
+ *
+ * @return The value of the counter.
+ */
+unsigned long read_counter(unsigned long *counter) {
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+/**
+ * Writes the series of one labelled histogram of latencies in the Prometheus text exposition format.
+ *
+ * @param out The stream to write to.
+ * @param name The name of the histogram, e.g. "dlb_phase_seconds".
+ * @param label The label telling the histogram's series apart, e.g. "phase".
+ * @param value The value of the label for this series.
+ * @param histogram The histogram to write.
+ */
+void write_histogram(FILE *out, const char *name, const char *label, const char *value, Histogram *histogram) {
+    unsigned long cumulative = 0;
+    int bucket = 0;
+
+    /* Every bucket below 2^exponent holds values strictly below the bound. */
+    for (int exponent = HISTOGRAM_MIN_EXPORTED_EXPONENT; exponent <= HISTOGRAM_MAX_EXPORTED_EXPONENT; exponent++) {
+        for (; bucket < get_bucket(1UL << exponent); bucket++)
+            cumulative += read_counter(&histogram->counts[bucket]);
+
+        fprintf(out, "%s_bucket{%s=\"%s\",le=\"%.9g\"} %lu\n", name, label, value, (double)(1UL << exponent) / 1e9, cumulative);
+    }
+
+    unsigned long count = read_counter(&histogram->count);
+
+    fprintf(out, "%s_bucket{%s=\"%s\",le=\"+Inf\"} %lu\n", name, label, value, count);
+    fprintf(out, "%s_sum{%s=\"%s\"} %.9f\n", name, label, value, read_counter(&histogram->sum) / 1e9);
+    fprintf(out, "%s_count{%s=\"%s\"} %lu\n", name, label, value, count);
+}
+
+/**
+ * Writes the phase and queueing histograms and the job, byte and retry counters in the Prometheus text
+ * exposition format.
+ *
+ * @param out The stream to write to.
+ * @param metrics The metrics to write.
+ */
+void write_metrics(FILE *out, Metrics *metrics) {
+    fputs("# HELP dlb_phase_seconds Latency of each phase of a job on the master.\n", out);
+    fputs("# TYPE dlb_phase_seconds histogram\n", out);
+
+    for (int phase = 0; phase < PHASE_COUNT; phase++)
+        write_histogram(out, "dlb_phase_seconds", "phase", PHASE_NAMES[phase], &metrics->phases[phase]);
+
+    fputs("# HELP dlb_queue_seconds Time jobs waited for a turn on the slaves, by priority class.\n", out);
+    fputs("# TYPE dlb_queue_seconds histogram\n", out);
+
+    for (int priority = 0; priority < PRIORITY_COUNT; priority++)
+        write_histogram(out, "dlb_queue_seconds", "class", PRIORITY_NAMES[priority], &metrics->queueing[priority]);
+
+    fputs("# HELP dlb_jobs_total Jobs finished by the master.\n", out);
+    fputs("# TYPE dlb_jobs_total counter\n", out);
+    fprintf(out, "dlb_jobs_total{status=\"completed\"} %lu\n", read_counter(&metrics->jobs_completed));
+    fprintf(out, "dlb_jobs_total{status=\"failed\"} %lu\n", read_counter(&metrics->jobs_failed));
+
+    fputs("# HELP dlb_bytes_total Bytes moved on the wire by the master.\n", out);
+    fputs("# TYPE dlb_bytes_total counter\n", out);
+
+    for (int direction = 0; direction < BYTES_COUNT; direction++)
+        fprintf(out, "dlb_bytes_total{direction=\"%s\"} %lu\n", BYTES_NAMES[direction], read_counter(&metrics->bytes[direction]));
+
+    fputs("# HELP dlb_retries_total Attempts to pass a job to a slave after a failed one.\n", out);
+    fputs("# TYPE dlb_retries_total counter\n", out);
+    fprintf(out, "dlb_retries_total %lu\n", read_counter(&metrics->retries));
+
+    /* A backup is counted before it can win, so reading the wins first keeps them within the total. */
+    unsigned long won = read_counter(&metrics->speculations_won);
+    unsigned long speculations = read_counter(&metrics->speculations);
+
+    fputs("# HELP dlb_speculations_total Backup copies of straggler jobs, by the copy that was kept.\n", out);
+    fputs("# TYPE dlb_speculations_total counter\n", out);
+    fprintf(out, "dlb_speculations_total{winner=\"primary\"} %lu\n", speculations - won);
+    fprintf(out, "dlb_speculations_total{winner=\"backup\"} %lu\n", won);
+
+    fputs("# HELP dlb_speculation_saved_seconds Lower bound on how much sooner jobs had output thanks to a winning backup: how long their primary went on without output after the backup's.\n", out);
+    fputs("# TYPE dlb_speculation_saved_seconds histogram\n", out);
+    write_histogram(out, "dlb_speculation_saved_seconds", "winner", "backup", &metrics->speculation_saved);
+
+    fputs("# HELP dlb_steals_total Jobs an idle slave took over from a busy slave's queue.\n", out);
+    fputs("# TYPE dlb_steals_total counter\n", out);
+    fprintf(out, "dlb_steals_total %lu\n", read_counter(&metrics->steals));
+
+    fputs("# HELP dlb_batches_total Batches of tiny jobs sent to a slave in one frame.\n", out);
+    fputs("# TYPE dlb_batches_total counter\n", out);
+    fprintf(out, "dlb_batches_total %lu\n", read_counter(&metrics->batches));
+
+    fputs("# HELP dlb_batched_jobs_total Jobs sent to a slave as part of a batch.\n", out);
+    fputs("# TYPE dlb_batched_jobs_total counter\n", out);
+    fprintf(out, "dlb_batched_jobs_total %lu\n", read_counter(&metrics->batched_jobs));
+
+    fputs("# HELP dlb_shared_memory_bytes_total Bytes of job files sent to slaves on the master's host through shared memory.\n", out);
+    fputs("# TYPE dlb_shared_memory_bytes_total counter\n", out);
+    fprintf(out, "dlb_shared_memory_bytes_total %lu\n", read_counter(&metrics->shared_memory_bytes));
+
+    fputs("# HELP dlb_passed_file_bytes_total Bytes of job files clients on the master's host passed the descriptors of.\n", out);
+    fputs("# TYPE dlb_passed_file_bytes_total counter\n", out);
+    fprintf(out, "dlb_passed_file_bytes_total %lu\n", read_counter(&metrics->passed_bytes));
+
+    fputs("# HELP dlb_cancellations_total Jobs cancelled on their slaves, by the reason they were cancelled.\n", out);
+    fputs("# TYPE dlb_cancellations_total counter\n", out);
+
+    for (int reason = 0; reason < CANCEL_COUNT; reason++)
+        fprintf(out, "dlb_cancellations_total{reason=\"%s\"} %lu\n", CANCEL_NAMES[reason], read_counter(&metrics->cancellations[reason]));
+
+    fputs("# HELP dlb_rejections_total Jobs turned away before their files were received, by the limit they hit.\n", out);
+    fputs("# TYPE dlb_rejections_total counter\n", out);
+
+    for (int reason = 0; reason < REJECT_COUNT; reason++)
+        fprintf(out, "dlb_rejections_total{reason=\"%s\"} %lu\n", REJECT_NAMES[reason], read_counter(&metrics->rejections[reason]));
+}
+
+#endif
@@ -0,0 +1,483 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "slavelist.h"
+#include "transfer.h"
+
+#define POLICY_MIN_UTILIZATION 0
+#define POLICY_P2C 1
+#define POLICY_LEAST_OUTSTANDING 2
+#define POLICY_AFFINITY 3
+#define POLICY_COUNT 4
+
+#define POLICY_ENV "DLB_POLICY"
+
+/* Affinity moves a key off its preferred slave once that slave holds this many times its share of the outstanding jobs. */
+#define AFFINITY_LOAD_FACTOR 1.25
+
+/*
+ * A slave that fails an attempt is suspected and skipped for a backoff that
+ * doubles with each consecutive failure. Once CIRCUIT_BREAKER_THRESHOLD
+ * attempts in a row have failed, its circuit opens and it is skipped for
+ * MAX_BACKOFF. When the backoff runs out, a single job is let through to
+ * probe the slave, and only its success makes the slave healthy again.
+ * Backoffs are jittered so that jobs failed by the same outage do not all
+ * come back at once.
+ */
+#define MIN_BACKOFF 250000000UL
+#define MAX_BACKOFF 30000000000UL
+#define CIRCUIT_BREAKER_THRESHOLD 5
+
+typedef struct Scheduler Scheduler;
+
+struct Scheduler {
+    int policy;
+    SlaveList *list;
+
+    /* The slave that last reported the lowest utilization, or NULL before any report. */
+    Slave *optimal_slave;
+
+    /* Advanced on every random draw, so concurrent selections draw differently. */
+    uint64_t sequence;
+
+    /* The jobs a slave is given at a time before the least loaded slave is preferred to it; 0 for no limit. */
+    int slots;
+};
+
+Scheduler *createScheduler(SlaveList *list, int policy, uint64_t seed);
+int get_policy(char *name);
+char *get_policy_name(int policy);
+uint64_t mix64(uint64_t x);
+uint64_t hash_key(char *key);
+bool is_less_loaded(Slave *a, Slave *b);
+bool is_available(Slave *slave, unsigned long now);
+Slave *select_least_outstanding(SlaveList *list, int size, unsigned long now);
+Slave *select_two_choices(Scheduler *scheduler, int size, unsigned long now);
+Slave *select_affinity(SlaveList *list, int size, char *key, unsigned long now);
+bool report_utilization(Scheduler *scheduler, Slave *slave, float utilization);
+unsigned long get_backoff(Scheduler *scheduler, unsigned int failures);
+bool claim_slave(Slave *slave, unsigned long now);
+Slave *select_slave(Scheduler *scheduler, char *key);
+Slave *select_idle_slave(Scheduler *scheduler, Slave *busy_slave);
+bool claim_idle_slave(Slave *slave);
+void release_slave(Slave *slave);
+bool report_failure(Scheduler *scheduler, Slave *slave);
+void report_success(Slave *slave);
+
+/**
+ * Creates a scheduler that places jobs on the slaves of a list.
+ *
+ * WARNING: 'createScheduler' malloc()s memory to '*scheduler' which must be freed by
+ * the caller.
+ *
+ * @param list The slaves to place jobs on.
+ * @param policy The POLICY_* to place jobs with.
+ * @param seed Seeds the random draws of POLICY_P2C.
+ *
+ * @return The scheduler.
+ */
+Scheduler *createScheduler(SlaveList *list, int policy, uint64_t seed) {
+    Scheduler *scheduler = (Scheduler *)malloc(sizeof(Scheduler));
+
+    if (!scheduler) {
+        perror("[X] malloc");
+        exit(1);
+    }
+
+    scheduler->policy = policy;
+    scheduler->list = list;
+    scheduler->optimal_slave = NULL;
+    scheduler->sequence = seed;
+    scheduler->slots = 0;
+
+    return scheduler;
+}
+
+/**
+ * Looks up a placement policy by name.
+ *
+ * @param name "min-utilization", "p2c", "least-outstanding" or "affinity"; NULL selects the default.
+ *
+ * @return The POLICY_*, or -1 if the name is unknown.
+ */
+int get_policy(char *name) {
+    if (!name || strcmp(name, "min-utilization") == 0)
+        return POLICY_MIN_UTILIZATION;
+
+    if (strcmp(name, "p2c") == 0)
+        return POLICY_P2C;
+
+    if (strcmp(name, "least-outstanding") == 0)
+        return POLICY_LEAST_OUTSTANDING;
+
+    if (strcmp(name, "affinity") == 0)
+        return POLICY_AFFINITY;
+
+    return -1;
+}
+
+/**
+ * Obtains the name of a placement policy.
+ *
+ * @param policy The POLICY_*.
+ *
+ * @return The name of the policy.
+ */
+char *get_policy_name(int policy) {
+    if (policy == POLICY_P2C)
+        return "p2c";
+
+    if (policy == POLICY_LEAST_OUTSTANDING)
+        return "least-outstanding";
+
+    if (policy == POLICY_AFFINITY)
+        return "affinity";
+
+    return "min-utilization";
+}
+
+/**
+ * Scrambles a 64-bit value with the splitmix64 finalizer.
+ *
+ * @param x The value.
+ *
+ * @return The scrambled value.
+ */
+uint64_t mix64(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+
+    return x ^ (x >> 31);
+}
+
+/**
+ * Hashes an affinity key with FNV-1a.
+ *
+ * @param key The key.
+ *
+ * @return The hash of the key.
+ */
+uint64_t hash_key(char *key) {
+    uint64_t hash = 0xCBF29CE484222325ULL;
+
+    for (; *key; key++)
+        hash = (hash ^ (unsigned char)*key) * 0x100000001B3ULL;
+
+    return hash;
+}
+
+/**
+ * Compares the load of two slaves by their outstanding jobs, then their utilization.
+ *
+ * @param a The first slave.
+ * @param b The second slave.
+ *
+ * @return Whether or not the first slave is less loaded than the second.
+ */
+bool is_less_loaded(Slave *a, Slave *b) {
+    unsigned long x = __atomic_load_n(&a->outstanding, __ATOMIC_RELAXED);
+    unsigned long y = __atomic_load_n(&b->outstanding, __ATOMIC_RELAXED);
+
+    return x < y || (x == y && a->utilization < b->utilization);
+}
+
+/**
+ * Checks whether a slave may be given jobs, i.e. it is alive and not suspected.
+ *
+ * @param slave The slave.
+ * @param now The current time, as returned by now_nanoseconds().
+ *
+ * @return Whether or not the slave is available.
+ */
+bool is_available(Slave *slave, unsigned long now) {
+    return __atomic_load_n(&slave->state, __ATOMIC_ACQUIRE) == SLAVE_ALIVE && __atomic_load_n(&slave->suspended_until, __ATOMIC_RELAXED) <= now;
+}
+
+/**
+ * Selects the available slave with the fewest outstanding jobs.
+ *
+ * @param list The slaves.
+ * @param size The number of slaves to consider.
+ * @param now The current time, as returned by now_nanoseconds().
+ *
+ * @return The least loaded available slave, or NULL if no slave is available.
+ */
+Slave *select_least_outstanding(SlaveList *list, int size, unsigned long now) {
+    Slave *best = NULL;
+
+    for (int i = 0; i < size; i++) {
+        if (is_available(list->slaves[i], now) && (!best || is_less_loaded(list->slaves[i], best)))
+            best = list->slaves[i];
+    }
+
+    return best;
+}
+
+/**
+ * Selects the less loaded of two slaves drawn at random.
+ *
+ * @param scheduler The scheduler.
+ * @param size The number of slaves to draw from.
+ * @param now The current time, as returned by now_nanoseconds().
+ *
+ * @return The selected slave, or NULL if no slave is available.
+ */
+Slave *select_two_choices(Scheduler *scheduler, int size, unsigned long now) {
+    uint64_t draw = mix64(__atomic_fetch_add(&scheduler->sequence, 1, __ATOMIC_RELAXED));
+    Slave *a = scheduler->list->slaves[(draw & 0xFFFFFFFF) % size];
+
+    if (size == 1)
+        return is_available(a, now) ? a : NULL;
+
+    /* Offsetting the second draw by 1..size-1 keeps the two choices distinct. */
+    Slave *b = scheduler->list->slaves[(a->id + 1 + (draw >> 32) % (size - 1)) % size];
+
+    if (!is_available(a, now) || !is_available(b, now)) {
+        /* A suspected choice falls back to the best slave that is not. */
+        if (is_available(a, now) || is_available(b, now))
+            return is_available(a, now) ? a : b;
+
+        return select_least_outstanding(scheduler->list, size, now);
+    }
+
+    return is_less_loaded(b, a) ? b : a;
+}
+
+/**
+ * Selects the slave a key hashes to, unless that slave is overloaded.
+ *
+ * Every slave is ranked by a hash of the key and its id (rendezvous hashing),
+ * so adding a slave only moves the keys it now ranks first for. The key goes
+ * to the highest ranked slave holding fewer than AFFINITY_LOAD_FACTOR times
+ * its share of the outstanding jobs.
+ *
+ * @param list The slaves.
+ * @param size The number of slaves to consider.
+ * @param key The affinity key of the job.
+ * @param now The current time, as returned by now_nanoseconds().
+ *
+ * @return The selected slave, or NULL if no slave is available.
+ */
+Slave *select_affinity(SlaveList *list, int size, char *key, unsigned long now) {
+    uint64_t hash = hash_key(key);
+    unsigned long total = 0;
+
+    for (int i = 0; i < size; i++)
+        total += __atomic_load_n(&list->slaves[i]->outstanding, __ATOMIC_RELAXED);
+
+    double bound = AFFINITY_LOAD_FACTOR * (total + 1) / size;
+    Slave *best = NULL;
+    uint64_t best_rank = 0;
+
+    for (int i = 0; i < size; i++) {
+        Slave *slave = list->slaves[i];
+        uint64_t rank = mix64(hash ^ mix64((uint64_t)slave->id));
+
+        if (is_available(slave, now) && __atomic_load_n(&slave->outstanding, __ATOMIC_RELAXED) + 1 <= bound && (!best || rank > best_rank)) {
+            best = slave;
+            best_rank = rank;
+        }
+    }
+
+    return best ? best : select_least_outstanding(list, size, now);
+}
+
+/**
+ * Records a slave's utilization and elects it optimal if it is the least utilized.
+ *
+ * @param scheduler The scheduler.
+ * @param slave The slave that reported.
+ * @param utilization The reported utilization.
+ *
+ * @return Whether or not the slave was elected optimal.
+ */
+bool report_utilization(Scheduler *scheduler, Slave *slave, float utilization) {
+    slave->utilization = utilization;
+
+    Slave *optimal_slave = __atomic_load_n(&scheduler->optimal_slave, __ATOMIC_ACQUIRE);
+
+    if (optimal_slave && optimal_slave->utilization < utilization)
+        return false;
+
+    __atomic_store_n(&scheduler->optimal_slave, slave, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+/**
+ * Draws how long to back off after a number of consecutive failures.
+ *
+ * The backoff doubles from MIN_BACKOFF with every failure up to MAX_BACKOFF,
+ * and a random half of it is taken off so that retries spread out.
+ *
+ * @param scheduler The scheduler, whose sequence the random draw advances.
+ * @param failures The number of consecutive failures, at least 1.
+ *
+ * @return The backoff in nanoseconds.
+ */
+unsigned long get_backoff(Scheduler *scheduler, unsigned int failures) {
+    unsigned long backoff = MAX_BACKOFF;
+
+    if (failures < CIRCUIT_BREAKER_THRESHOLD && (MIN_BACKOFF << (failures - 1)) < MAX_BACKOFF)
+        backoff = MIN_BACKOFF << (failures - 1);
+
+    uint64_t draw = mix64(__atomic_fetch_add(&scheduler->sequence, 1, __ATOMIC_RELAXED));
+
+    return backoff - draw % (backoff / 2 + 1);
+}
+
+/**
+ * Claims a slave for a job, which for a slave that has been failing makes the job its only probe.
+ *
+ * @param slave The available slave.
+ * @param now The current time, as returned by now_nanoseconds().
+ *
+ * @return Whether or not the job may go to the slave.
+ */
+bool claim_slave(Slave *slave, unsigned long now) {
+    if (__atomic_load_n(&slave->failures, __ATOMIC_RELAXED) == 0)
+        return true;
+
+    /* Suspending the slave again keeps other jobs off it until the probe reports back. */
+    unsigned long suspended_until = __atomic_load_n(&slave->suspended_until, __ATOMIC_RELAXED);
+
+    return suspended_until <= now && __atomic_compare_exchange_n(&slave->suspended_until, &suspended_until, now + MAX_BACKOFF,
+                                                                 false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+/**
+ * Selects the slave to run a job on, and counts the job as outstanding on it.
+ *
+ * Suspected, draining and evicted slaves are passed over for the next best one. Every slave returned
+ * must be handed back to release_slave() once the job leaves it, and its
+ * outcome reported with report_success() or report_failure().
+ *
+ * @param scheduler The scheduler.
+ * @param key The affinity key of the job, e.g. its executable's name, or NULL.
+ *
+ * @return The selected slave, or NULL if there are no slaves or none is available.
+ */
+Slave *select_slave(Scheduler *scheduler, char *key) {
+    int size = __atomic_load_n(&scheduler->list->size, __ATOMIC_ACQUIRE);
+    unsigned long now = now_nanoseconds();
+    Slave *slave = NULL;
+
+    /* A slave lost to another job's probe is suspected again by then, so each retry selects another slave. */
+    for (int attempt = 0; attempt < size; attempt++) {
+        switch (scheduler->policy) {
+            case POLICY_P2C:
+                slave = select_two_choices(scheduler, size, now);
+                break;
+            case POLICY_LEAST_OUTSTANDING:
+                slave = select_least_outstanding(scheduler->list, size, now);
+                break;
+            case POLICY_AFFINITY:
+                slave = key ? select_affinity(scheduler->list, size, key, now) : select_least_outstanding(scheduler->list, size, now);
+                break;
+            default:
+                /* Until a slave reports its utilization, there is nothing to compare. */
+                slave = __atomic_load_n(&scheduler->optimal_slave, __ATOMIC_ACQUIRE);
+                slave = slave && is_available(slave, now) ? slave : select_least_outstanding(scheduler->list, size, now);
+        }
+
+        /* A slave that has all the jobs it may be given loses the job to the least loaded one. */
+        if (slave && scheduler->slots > 0 && __atomic_load_n(&slave->outstanding, __ATOMIC_RELAXED) >= (unsigned long)scheduler->slots)
+            slave = select_least_outstanding(scheduler->list, size, now);
+
+        if (!slave || claim_slave(slave, now))
+            break;
+
+        slave = NULL;
+    }
+
+    if (slave)
+        __atomic_fetch_add(&slave->outstanding, 1, __ATOMIC_RELAXED);
+
+    return slave;
+}
+
+/**
+ * Selects an available slave with no outstanding jobs, e.g. to run a backup copy of a job on.
+ *
+ * @param scheduler The scheduler.
+ * @param busy_slave A slave that must not be selected, e.g. the one running the job already.
+ *
+ * @return The least utilized idle slave, counted as running the job, or NULL if no slave is idle.
+ */
+Slave *select_idle_slave(Scheduler *scheduler, Slave *busy_slave) {
+    int size = __atomic_load_n(&scheduler->list->size, __ATOMIC_ACQUIRE);
+    unsigned long now = now_nanoseconds();
+    Slave *idle = NULL;
+
+    for (int i = 0; i < size; i++) {
+        Slave *slave = scheduler->list->slaves[i];
+
+        /* A backup is no probe, so slaves that have been failing are left out. */
+        if (slave != busy_slave && is_available(slave, now) && __atomic_load_n(&slave->failures, __ATOMIC_RELAXED) == 0
+            && __atomic_load_n(&slave->outstanding, __ATOMIC_RELAXED) == 0 && (!idle || slave->utilization < idle->utilization))
+            idle = slave;
+    }
+
+    /* Another job may have taken the slave since it was seen idle, in which case the backup is not worth it. */
+    return idle && claim_idle_slave(idle) ? idle : NULL;
+}
+
+/**
+ * Counts a job as outstanding on a slave, but only if the slave has no other.
+ *
+ * @param slave The slave.
+ *
+ * @return Whether or not the slave was idle, in which case it must be handed back to release_slave().
+ */
+bool claim_idle_slave(Slave *slave) {
+    unsigned long idle = 0;
+
+    return __atomic_compare_exchange_n(&slave->outstanding, &idle, 1, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+/**
+ * Stops counting a job as outstanding on the slave select_slave() placed it on.
+ *
+ * @param slave The slave.
+ */
+void release_slave(Slave *slave) {
+    __atomic_fetch_sub(&slave->outstanding, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Suspects a slave a job failed to reach or run on, opening its circuit after repeated failures.
+ *
+ * @param scheduler The scheduler.
+ * @param slave The slave.
+ *
+ * @return Whether or not the slave's circuit is open.
+ */
+bool report_failure(Scheduler *scheduler, Slave *slave) {
+    unsigned int failures = __atomic_add_fetch(&slave->failures, 1, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&slave->suspended_until, now_nanoseconds() + get_backoff(scheduler, failures), __ATOMIC_RELAXED);
+
+    return failures >= CIRCUIT_BREAKER_THRESHOLD;
+}
+
+/**
+ * Clears any suspicion of a slave a job reached and ran on.
+ *
+ * @param slave The slave.
+ */
+void report_success(Slave *slave) {
+    if (__atomic_load_n(&slave->failures, __ATOMIC_RELAXED) == 0)
+        return;
+
+    __atomic_store_n(&slave->failures, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&slave->suspended_until, 0, __ATOMIC_RELAXED);
+}
+
+#endif
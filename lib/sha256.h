@@ -0,0 +1,287 @@
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define SHA256_X86
+#endif
+
+/*
+ * SHA-256 (FIPS 180-4), for ids that must hold up against someone choosing
+ * bytes to collide with another's: chunks shared by every client in a store,
+ * and executables whose workers jobs are handed to.
+ *
+ * Blocks go through the SHA extensions on x86 processors that have them, which
+ * is several times faster than the portable code.
+ */
+#define SHA256_SIZE 32
+#define SHA256_BLOCK_SIZE 64
+
+typedef struct Sha256 Sha256;
+
+struct Sha256 {
+    uint32_t state[8];
+    unsigned char block[SHA256_BLOCK_SIZE];
+    long buffered;
+    uint64_t length;
+};
+
+void sha256_init(Sha256 *context);
+void sha256_update(Sha256 *context, const void *data, long size);
+void sha256_final(Sha256 *context, unsigned char *digest);
+void sha256(const void *data, long size, unsigned char *digest);
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define SHA256_ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+#ifdef SHA256_X86
+/**
+ * Tells whether the processor has the SHA extensions.
+ *
+ * @return Whether or not sha256_transform_x86() may run.
+ */
+static bool has_sha_extensions() {
+    static int supported = -1;
+    unsigned int eax, ebx, ecx, edx;
+
+    if (supported == -1)
+        supported = __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & (1u << 29))
+            && __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_SSE4_1);
+
+    return supported;
+}
+
+/**
+ * Runs the compression function over consecutive blocks with the SHA extensions.
+ *
+ * @param state The hash state to update.
+ * @param blocks The blocks.
+ * @param count The number of blocks.
+ */
+__attribute__((target("sha,sse4.1")))
+static void sha256_transform_x86(uint32_t *state, const unsigned char *blocks, long count) {
+    const __m128i shuffle = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    /* The state is kept as ABEF and CDGH, as the instructions take it. */
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[0]), 0xb1);
+    __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[4]), 0x1b);
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+
+    state1 = _mm_blend_epi16(state1, tmp, 0xf0);
+
+    for (; count > 0; count--, blocks += SHA256_BLOCK_SIZE) {
+        __m128i abef = state0, cdgh = state1, message, w[4];
+
+        for (int i = 0; i < 4; i++)
+            w[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(blocks + i * 16)), shuffle);
+
+        for (int i = 0; i < 16; i++) {
+            __m128i current = w[i % 4];
+
+            /* From the fifth group of rounds on, the schedule is extended four words at a time. */
+            if (i >= 4) {
+                current = _mm_sha256msg1_epu32(w[i % 4], w[(i + 1) % 4]);
+                current = _mm_add_epi32(current, _mm_alignr_epi8(w[(i + 3) % 4], w[(i + 2) % 4], 4));
+                current = _mm_sha256msg2_epu32(current, w[(i + 3) % 4]);
+                w[i % 4] = current;
+            }
+
+            message = _mm_add_epi32(current, _mm_loadu_si128((const __m128i *)&sha256_k[i * 4]));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, message);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(message, 0x0e));
+        }
+
+        state0 = _mm_add_epi32(state0, abef);
+        state1 = _mm_add_epi32(state1, cdgh);
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1b);
+    state1 = _mm_shuffle_epi32(state1, 0xb1);
+    state0 = _mm_blend_epi16(tmp, state1, 0xf0);
+    state1 = _mm_alignr_epi8(state1, tmp, 8);
+
+    _mm_storeu_si128((__m128i *)&state[0], state0);
+    _mm_storeu_si128((__m128i *)&state[4], state1);
+}
+#endif
+
+/**
+ * Runs the compression function over one block.
+ *
+ * @param state The hash state to update.
+ * @param block The SHA256_BLOCK_SIZE byte block.
+ */
+static void sha256_transform_block(uint32_t *state, const unsigned char *block) {
+    uint32_t w[64];
+
+    for (int i = 0; i < 16; i++)
+        w[i] = (uint32_t)block[i * 4] << 24 | (uint32_t)block[i * 4 + 1] << 16 | (uint32_t)block[i * 4 + 2] << 8 | block[i * 4 + 3];
+
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = SHA256_ROTR(w[i - 15], 7) ^ SHA256_ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = SHA256_ROTR(w[i - 2], 17) ^ SHA256_ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+
+    for (int i = 0; i < 64; i++) {
+        uint32_t t1 = h + (SHA256_ROTR(e, 6) ^ SHA256_ROTR(e, 11) ^ SHA256_ROTR(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+        uint32_t t2 = (SHA256_ROTR(a, 2) ^ SHA256_ROTR(a, 13) ^ SHA256_ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+
+/**
+ * Runs the compression function over consecutive blocks.
+ *
+ * @param state The hash state to update.
+ * @param blocks The blocks.
+ * @param count The number of blocks.
+ */
+static void sha256_transform(uint32_t *state, const unsigned char *blocks, long count) {
+#ifdef SHA256_X86
+    if (has_sha_extensions()) {
+        sha256_transform_x86(state, blocks, count);
+        return;
+    }
+#endif
+
+    for (long i = 0; i < count; i++)
+        sha256_transform_block(state, blocks + i * SHA256_BLOCK_SIZE);
+}
+
+/**
+ * Starts a hash.
+ *
+ * @param context The hash to start.
+ */
+void sha256_init(Sha256 *context) {
+    static const uint32_t initial[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+
+    memcpy(context->state, initial, sizeof(initial));
+    context->buffered = 0;
+    context->length = 0;
+}
+
+/**
+ * Adds bytes to a hash.
+ *
+ * @param context The hash.
+ * @param data The bytes.
+ * @param size The number of bytes.
+ */
+void sha256_update(Sha256 *context, const void *data, long size) {
+    const unsigned char *bytes = (const unsigned char *)data;
+
+    context->length += (uint64_t)size;
+
+    if (context->buffered > 0) {
+        long taken = SHA256_BLOCK_SIZE - context->buffered < size ? SHA256_BLOCK_SIZE - context->buffered : size;
+
+        memcpy(context->block + context->buffered, bytes, taken);
+        context->buffered += taken;
+        bytes += taken;
+        size -= taken;
+
+        if (context->buffered < SHA256_BLOCK_SIZE)
+            return;
+
+        sha256_transform(context->state, context->block, 1);
+        context->buffered = 0;
+    }
+
+    long blocks = size / SHA256_BLOCK_SIZE;
+
+    sha256_transform(context->state, bytes, blocks);
+    bytes += blocks * SHA256_BLOCK_SIZE;
+    size -= blocks * SHA256_BLOCK_SIZE;
+
+    memcpy(context->block, bytes, size);
+    context->buffered = size;
+}
+
+/**
+ * Finishes a hash.
+ *
+ * @param context The hash, which must be started again before it is reused.
+ * @param digest The destination of the SHA256_SIZE byte digest.
+ */
+void sha256_final(Sha256 *context, unsigned char *digest) {
+    uint64_t bits = context->length * 8;
+
+    context->block[context->buffered++] = 0x80;
+
+    if (context->buffered > SHA256_BLOCK_SIZE - 8) {
+        memset(context->block + context->buffered, 0, SHA256_BLOCK_SIZE - context->buffered);
+        sha256_transform(context->state, context->block, 1);
+        context->buffered = 0;
+    }
+
+    memset(context->block + context->buffered, 0, SHA256_BLOCK_SIZE - 8 - context->buffered);
+
+    for (int i = 0; i < 8; i++)
+        context->block[SHA256_BLOCK_SIZE - 1 - i] = (unsigned char)(bits >> (i * 8));
+
+    sha256_transform(context->state, context->block, 1);
+
+    for (int i = 0; i < 8; i++) {
+        digest[i * 4] = (unsigned char)(context->state[i] >> 24);
+        digest[i * 4 + 1] = (unsigned char)(context->state[i] >> 16);
+        digest[i * 4 + 2] = (unsigned char)(context->state[i] >> 8);
+        digest[i * 4 + 3] = (unsigned char)context->state[i];
+    }
+}
+
+/**
+ * Hashes a block of bytes.
+ *
+ * @param data The bytes.
+ * @param size The number of bytes.
+ * @param digest The destination of the SHA256_SIZE byte digest.
+ */
+void sha256(const void *data, long size, unsigned char *digest) {
+    Sha256 context;
+
+    sha256_init(&context);
+    sha256_update(&context, data, size);
+    sha256_final(&context, digest);
+}
+
+#endif
@@ -0,0 +1,270 @@
+#ifndef SHM_H
+#define SHM_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+
+#include "utilities.h"
+#include "transfer.h"
+#include "compress.h"
+
+/*
+ * A slave on the master's host is sent the files of a job through shared
+ * memory instead of loopback TCP. The master writes them into a shared memory
+ * object of the job's own and names it in a {SHARED_MEMORY} frame ahead of the
+ * job request, which then has nothing following it on the connection. The
+ * slave reads the files out of the object as they would have come off the
+ * socket, and removes it. Everything else, the job's output included, still
+ * goes over the connection, so the protocol is otherwise unchanged.
+ *
+ * A slave registers with the name of a probe object it created. The master
+ * only uses shared memory with a slave whose probe it can open, i.e. one that
+ * shares its /dev/shm and its user.
+ *
+ * Jobs whose files take less than SHARED_MEMORY_MIN_SIZE on the wire are sent
+ * over TCP, as setting up an object costs more than it saves for them.
+ */
+#define SHARED_MEMORY_ENV "DLB_SHARED_MEMORY"
+
+/* In KiB, of the files of a job as they go on the wire. */
+#define SHARED_MEMORY_MIN_SIZE 64
+#define SHARED_MEMORY_MIN_SIZE_ENV "DLB_SHARED_MEMORY_MIN_KB"
+
+#define SHARED_MEMORY_PREFIX "/dlb-"
+
+bool get_shared_memory();
+bool create_probe(int job_port, char *name);
+bool is_co_located(char *name);
+int create_payload(char *name, struct iovec *payload, int count, TransferStats *stats);
+int create_payload_from_files(char *name, int *fds, long *sizes, int count, TransferStats *stats);
+int open_payload(char *name);
+void close_payload(int payload, char *name);
+bool recv_shared_file(int payload, char *file_path, long size, mode_t mode, int codec, TransferStats *stats);
+
+/**
+ * Obtains whether files go through shared memory to slaves on the same host from SHARED_MEMORY_ENV.
+ *
+ * @return False if the variable is "0", otherwise true.
+ */
+bool get_shared_memory() {
+    char *value = getenv(SHARED_MEMORY_ENV);
+
+    return !value || strcmp(value, "0") != 0;
+}
+
+/**
+ * Creates the probe a slave registers with, by which the master tells that it shares the slave's host.
+ *
+ * @param job_port The port the slave listens for jobs on.
+ * @param name Receives the name of the probe, at least MAX_BUFFER_SIZE bytes long.
+ *
+ * @return Whether or not the probe was created; it must be removed with shm_unlink() once the slave registered.
+ */
+bool create_probe(int job_port, char *name) {
+    snprintf(name, MAX_BUFFER_SIZE, "%sprobe-%d-%d", SHARED_MEMORY_PREFIX, (int)getpid(), job_port);
+
+    int probe = shm_open(name, O_CREAT | O_RDWR | O_CLOEXEC, 0600);
+
+    if (probe == -1) {
+        perror("[X] shm_open");
+        return false;
+    }
+
+    close(probe);
+
+    return true;
+}
+
+/**
+ * Tells whether a slave shares the master's host, by opening the probe it registered with.
+ *
+ * @param name The name of the probe.
+ *
+ * @return Whether or not the probe could be opened.
+ */
+bool is_co_located(char *name) {
+    if (strncmp(name, SHARED_MEMORY_PREFIX, strlen(SHARED_MEMORY_PREFIX)) != 0)
+        return false;
+
+    int probe = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+
+    if (probe == -1)
+        return false;
+
+    close(probe);
+
+    return true;
+}
+
+/**
+ * Creates a shared memory object under a name of its own.
+ *
+ * @param name Receives the name of the object, at least MAX_BUFFER_SIZE bytes long.
+ *
+ * @return The object, empty, or -1 if it could not be created.
+ */
+static int open_new_payload(char *name) {
+    static unsigned long payloads = 0;
+
+    snprintf(name, MAX_BUFFER_SIZE, "%s%d-%lu", SHARED_MEMORY_PREFIX, (int)getpid(), __atomic_add_fetch(&payloads, 1, __ATOMIC_RELAXED));
+
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, 0600);
+
+    if (fd == -1)
+        perror("[X] shm_open");
+
+    return fd;
+}
+
+/**
+ * Writes the files of a job into a shared memory object of their own.
+ *
+ * @param name Receives the name of the object, at least MAX_BUFFER_SIZE bytes long.
+ * @param payload The buffers making up the files as they would go on the wire, in order.
+ * @param count The number of buffers.
+ * @param stats The statistics to account the bytes against, may be NULL.
+ *
+ * @return The object, which must be closed with close_payload() once the slave answered, or -1 if it could not be written.
+ */
+int create_payload(char *name, struct iovec *payload, int count, TransferStats *stats) {
+    struct iovec iov[count];
+    int fd = open_new_payload(name);
+
+    if (fd == -1)
+        return -1;
+
+    /* send_allv() moves along the buffers it was given, which are the caller's. */
+    memcpy(iov, payload, sizeof(struct iovec) * count);
+
+    if (!send_allv(fd, iov, count, stats)) {
+        close_payload(fd, name);
+        return -1;
+    }
+
+    return fd;
+}
+
+/**
+ * Copies the files of a job from open descriptors into a shared memory object of their own, in the kernel.
+ *
+ * @param name Receives the name of the object, at least MAX_BUFFER_SIZE bytes long.
+ * @param fds The descriptors of the files, in order, read from their starts.
+ * @param sizes The number of bytes of each file.
+ * @param count The number of files.
+ * @param stats The statistics to account the bytes against, may be NULL.
+ *
+ * @return The object, which must be closed with close_payload() once the slave answered, or -1 if it could not be written.
+ */
+int create_payload_from_files(char *name, int *fds, long *sizes, int count, TransferStats *stats) {
+    int fd = open_new_payload(name);
+
+    if (fd == -1)
+        return -1;
+
+    for (int i = 0; i < count; i++) {
+        if (!send_open_file(fd, fds[i], sizes[i], stats)) {
+            close_payload(fd, name);
+            return -1;
+        }
+    }
+
+    return fd;
+}
+
+/**
+ * Opens the shared memory object the files of a job were written into, and removes its name.
+ *
+ * @param name The name of the object.
+ *
+ * @return The object, read from its start, or -1 if it could not be opened.
+ */
+int open_payload(char *name) {
+    if (strncmp(name, SHARED_MEMORY_PREFIX, strlen(SHARED_MEMORY_PREFIX)) != 0)
+        return -1;
+
+    int fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+
+    if (fd == -1) {
+        perror("[X] shm_open");
+        return -1;
+    }
+
+    /* The object goes once both sides closed it, whichever way the job ends. */
+    shm_unlink(name);
+
+    return fd;
+}
+
+/**
+ * Closes a job's shared memory object on the master, removing it if the slave did not.
+ *
+ * @param payload The object.
+ * @param name The name of the object.
+ */
+void close_payload(int payload, char *name) {
+    if (shm_unlink(name) == -1 && errno != ENOENT)
+        perror("[X] shm_unlink");
+
+    close(payload);
+}
+
+/**
+ * Reads a file out of a job's shared memory object into the file at the given path.
+ *
+ * @param payload The object, read from where the previous file ended.
+ * @param file_path The path to create or truncate.
+ * @param size The decoded size of the file.
+ * @param mode The permissions of the file if it is created.
+ * @param codec The codec the file is in.
+ * @param stats The statistics to account the bytes against, may be NULL.
+ *
+ * @return Whether or not the whole file was read.
+ */
+bool recv_shared_file(int payload, char *file_path, long size, mode_t mode, int codec, TransferStats *stats) {
+    if (codec != CODEC_NONE)
+        return recv_decoded_file(payload, file_path, size, mode, codec, stats);
+
+    int fd = open(file_path, O_WRONLY | O_CREAT | O_TRUNC, mode);
+
+    if (fd == -1) {
+        perror("[X] open");
+        return false;
+    }
+
+    /* Uncompressed files are copied by the kernel from the object's pages into the file's. */
+    double started = now_seconds();
+    long copied = 0;
+
+    while (copied < size) {
+        ssize_t n = sendfile(fd, payload, NULL, size - copied);
+
+        if (n == -1 && errno == EINTR)
+            continue;
+
+        if (n <= 0) {
+            if (n == -1)
+                perror("[X] sendfile");
+
+            break;
+        }
+
+        copied += n;
+    }
+
+    close(fd);
+
+    record_transfer(stats, copied, started);
+
+    return copied == size;
+}
+
+#endif
@@ -1,27 +1,80 @@
+#ifndef SLAVELIST_H
+#define SLAVELIST_H
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#include "transfer.h"
+
+/*
+ * A slave is alive from the moment it registers. It drains once it announces
+ * that it is shutting down, which keeps new jobs off it while its outstanding
+ * ones finish, and it is evicted once drained or once its heartbeats stop.
+ *
+ * Slots are never freed, so the scheduler can keep reading the list without a
+ * lock while slaves come and go. A slave that registers again gets its old
+ * slot back, and anything else gets the slot of an evicted slave with no
+ * outstanding jobs before the list grows. Every registration bumps the slot's
+ * generation, which tells a restarted or replaced slave's heartbeats apart from
+ * its predecessor's.
+ */
+#define SLAVE_ALIVE 0
+#define SLAVE_DRAINING 1
+#define SLAVE_EVICTED 2
 
 typedef struct Slave Slave;
 typedef struct SlaveList SlaveList;
 
 struct Slave {
     int id;
-    char *address;
+    char address[INET6_ADDRSTRLEN];
+    int port;
+    int state;
+    unsigned int generation;
+
+    /* When the slave last registered or reported its utilization, as returned by now_nanoseconds(). */
+    unsigned long last_heartbeat;
+
     float utilization;
+    unsigned long dispatches;
+    unsigned long outstanding;
+
+    /* Attempts that failed on this slave since its last success. */
+    unsigned int failures;
+
+    /* The slave is skipped until this time, as returned by now_nanoseconds(); 0 while it is healthy. */
+    unsigned long suspended_until;
+
+    /* Whether the slave greets each job with {READY_FOR_JOB} once it gets to it, rather than taking its files at once. */
+    bool ready;
+
+    /* Whether the slave runs batches of jobs sent in one {RUN_BATCH} frame. */
+    bool batching;
+
+    /* Whether the slave shares the master's host, so that the files of its jobs go through shared memory. */
+    bool shared_memory;
 };
 
 struct SlaveList {
     Slave **slaves;
     int size;
     int capacity;
+
+    /* Serialises changes to membership; selecting a slave never takes it. */
+    pthread_mutex_t lock;
 };
 
-Slave *createSlave(char *address, int id);
+Slave *createSlave(char *address, int port, int id);
 SlaveList *createSlaveList(int capacity);
-int add(SlaveList *list, char *address);
-Slave *searchList(SlaveList *list, char *address);
+int add(SlaveList *list, char *address, int port, bool ready, bool batching, bool shared_memory);
+Slave *searchList(SlaveList *list, char *address, int port);
+Slave *get_slave(SlaveList *list, int id, int generation);
+bool drain(SlaveList *list, Slave *slave, unsigned int generation);
+bool evict(SlaveList *list, Slave *slave, unsigned int generation);
 void cleanupList(SlaveList *list);
 
 /**
@@ -30,12 +83,13 @@ void cleanupList(SlaveList *list);
  * WARNING: 'createSlave' malloc()s memory to '*slave' which must be freed by
  * the caller.
  *
- * @param address The IP Address of this slave.
+ * @param address The IP Address of this slave, which is copied.
+ * @param port The port this slave listens for jobs on.
  * @param id The id of this slave.
  *
  * @return The struct representing this slave.
  */
-Slave *createSlave(char *address, int id) {
+Slave *createSlave(char *address, int port, int id) {
     Slave *slave = (Slave *)malloc(sizeof(Slave));
 
     if (!slave) {
@@ -44,8 +98,19 @@ Slave *createSlave(char *address, int id) {
     }
 
     slave->id = id;
-    slave->address = address;
+    snprintf(slave->address, sizeof(slave->address), "%s", address);
+    slave->port = port;
+    slave->state = SLAVE_ALIVE;
+    slave->generation = 0;
+    slave->last_heartbeat = now_nanoseconds();
     slave->utilization = 1;
+    slave->dispatches = 0;
+    slave->outstanding = 0;
+    slave->failures = 0;
+    slave->suspended_until = 0;
+    slave->ready = false;
+    slave->batching = false;
+    slave->shared_memory = false;
 
     return slave;
 }
@@ -75,6 +140,7 @@ SlaveList *createSlaveList(int capacity) {
 
     slaveList->capacity = capacity;
     slaveList->size = 0;
+    pthread_mutex_init(&slaveList->lock, NULL);
 
     return slaveList;
 }
@@ -82,35 +148,76 @@ SlaveList *createSlaveList(int capacity) {
 /**
  * Given a list of slaves, adds a slave based on its IP Address to the list.
  *
- * @param list The list of slaves to be added to0.
+ * A slave that was already in the list, e.g. because it restarted, is added
+ * back to its old slot. Otherwise the slot of an evicted slave is reused
+ * before the list grows.
+ *
+ * @param list The list of slaves to be added to.
  * @param address The IP Address of the slave to be added.
+ * @param port The port the slave listens for jobs on.
+ * @param ready Whether the slave greets each job once it gets to it.
+ * @param batching Whether the slave runs batches of jobs.
+ * @param shared_memory Whether the slave shares the master's host.
  *
- * @return The id of the slave.
+ * @return The id of the slave, or -1 if the list is full.
  */
-int add(SlaveList *list, char *address) {
-   if (list->size != list->capacity - 1) {
-        int index = list->size;
-        Slave *slave = createSlave(address, index);
-        list->slaves[list->size++] = slave;
-        return index;
+int add(SlaveList *list, char *address, int port, bool ready, bool batching, bool shared_memory) {
+    pthread_mutex_lock(&list->lock);
+
+    Slave *slave = searchList(list, address, port);
+
+    for (int i = 0; !slave && i < list->size; i++) {
+        Slave *evicted = list->slaves[i];
+
+        if (__atomic_load_n(&evicted->state, __ATOMIC_ACQUIRE) == SLAVE_EVICTED && __atomic_load_n(&evicted->outstanding, __ATOMIC_RELAXED) == 0) {
+            slave = evicted;
+            snprintf(slave->address, sizeof(slave->address), "%s", address);
+            slave->port = port;
+            slave->dispatches = 0;
+        }
+    }
+
+    if (slave) {
+        /* Nothing the slot's previous slave did counts against this one. */
+        slave->utilization = 1;
+        __atomic_store_n(&slave->failures, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&slave->suspended_until, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&slave->ready, ready, __ATOMIC_RELAXED);
+        __atomic_store_n(&slave->batching, batching, __ATOMIC_RELAXED);
+        __atomic_store_n(&slave->shared_memory, shared_memory, __ATOMIC_RELAXED);
+        __atomic_store_n(&slave->last_heartbeat, now_nanoseconds(), __ATOMIC_RELAXED);
+        __atomic_add_fetch(&slave->generation, 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&slave->state, SLAVE_ALIVE, __ATOMIC_RELEASE);
+    } else if (list->size != list->capacity - 1) {
+        slave = createSlave(address, port, list->size);
+        slave->ready = ready;
+        slave->batching = batching;
+        slave->shared_memory = shared_memory;
+        list->slaves[list->size] = slave;
+
+        /* The slot is filled before the scheduler can see it. */
+        __atomic_store_n(&list->size, list->size + 1, __ATOMIC_RELEASE);
     }
 
-    return -1;
+    pthread_mutex_unlock(&list->lock);
+
+    return slave ? slave->id : -1;
 }
 
 /**
- * Searches for a given slave based on its IP Address within a given list of slaves.
+ * Searches for a given slave based on its IP Address and job port within a given list of slaves.
  *
  * @param list The list of slaves to search in.
  * @param address The IP Address of the target slave.
+ * @param port The job port of the target slave.
  *
- * @return The slave that was found within the list that has the given IP Address.
+ * @return The slave that was found within the list that has the given IP Address and port.
  */
-Slave *searchList(SlaveList *list, char *address) {
+Slave *searchList(SlaveList *list, char *address, int port) {
     Slave *slave = NULL;
 
-    for (int i = 0; i < list->capacity; i++) {
-        if (strcmp(list->slaves[i]->address, address) == 0) {
+    for (int i = 0; i < list->size; i++) {
+        if (strcmp(list->slaves[i]->address, address) == 0 && list->slaves[i]->port == port) {
             slave = list->slaves[i];
             break;
         }
@@ -119,6 +226,74 @@ Slave *searchList(SlaveList *list, char *address) {
     return slave;
 }
 
+/**
+ * Looks up a slave that has not been evicted by its id.
+ *
+ * @param list The list of slaves to search in.
+ * @param id The id of the slave.
+ * @param generation The generation the slave was registered with, or -1 to accept any.
+ *
+ * @return The slave, or NULL if no such slave is in the list.
+ */
+Slave *get_slave(SlaveList *list, int id, int generation) {
+    if (id < 0 || id >= __atomic_load_n(&list->size, __ATOMIC_ACQUIRE))
+        return NULL;
+
+    Slave *slave = list->slaves[id];
+
+    if (__atomic_load_n(&slave->state, __ATOMIC_ACQUIRE) == SLAVE_EVICTED)
+        return NULL;
+
+    if (generation != -1 && __atomic_load_n(&slave->generation, __ATOMIC_RELAXED) != (unsigned int)generation)
+        return NULL;
+
+    return slave;
+}
+
+/**
+ * Stops placing new jobs on a slave that is shutting down.
+ *
+ * @param list The list the slave is in.
+ * @param slave The slave.
+ * @param generation The generation of the slave that is shutting down.
+ *
+ * @return Whether or not the slave is draining, i.e. it had not been evicted or replaced.
+ */
+bool drain(SlaveList *list, Slave *slave, unsigned int generation) {
+    pthread_mutex_lock(&list->lock);
+
+    bool draining = slave->generation == generation && slave->state != SLAVE_EVICTED;
+
+    if (draining)
+        __atomic_store_n(&slave->state, SLAVE_DRAINING, __ATOMIC_RELEASE);
+
+    pthread_mutex_unlock(&list->lock);
+
+    return draining;
+}
+
+/**
+ * Removes a slave from the list, freeing its slot for another once its outstanding jobs are done.
+ *
+ * @param list The list the slave is in.
+ * @param slave The slave.
+ * @param generation The generation of the slave to evict, so that a slave that registered again in the meantime stays.
+ *
+ * @return Whether or not this call evicted the slave.
+ */
+bool evict(SlaveList *list, Slave *slave, unsigned int generation) {
+    pthread_mutex_lock(&list->lock);
+
+    bool evicted = slave->generation == generation && slave->state != SLAVE_EVICTED;
+
+    if (evicted)
+        __atomic_store_n(&slave->state, SLAVE_EVICTED, __ATOMIC_RELEASE);
+
+    pthread_mutex_unlock(&list->lock);
+
+    return evicted;
+}
+
 /**
  * Frees the memory created when 'createSlaveList' is called.
  *
@@ -128,5 +303,8 @@ void cleanupList(SlaveList *list) {
     for (int i = 0; i < list->capacity; i++)
         free(list->slaves[i]);
 
+    pthread_mutex_destroy(&list->lock);
     free(list);
-}
\ No newline at end of file
+}
+
+#endif
@@ -0,0 +1,227 @@
+#ifndef SPECULATE_H
+#define SPECULATE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+
+/*
+ * The master remembers how long each executable's recent jobs took to produce
+ * their first output once a slave had them. A job that has gone longer than a
+ * percentile of that without any output is a straggler, and is worth a backup
+ * copy on an idle slave: whichever copy produces output first is kept, and the
+ * other is cancelled.
+ *
+ * Executables are told apart by a hash of their bytes. The table is small and
+ * direct mapped, so a rarely used executable may lose its history to another
+ * one; it is only ever used to decide when to start a backup.
+ */
+#define RUNTIME_KEYS 256
+#define RUNTIME_SAMPLES 64
+
+/* Fewer samples than this say too little about an executable to call any of its jobs a straggler. */
+#define MIN_RUNTIME_SAMPLES 16
+
+#define SPECULATION_PERCENTILE 95
+#define SPECULATION_PERCENTILE_ENV "DLB_SPECULATION_PERCENTILE"
+
+/*
+ * A primary that a backup beat is watched for as long again as the backup took
+ * to produce output, up to OUTRUN_WINDOW milliseconds, before it is cancelled,
+ * so the master can tell at least how much sooner the backup had output.
+ */
+#define OUTRUN_WINDOW 1000
+
+typedef struct Runtimes Runtimes;
+typedef struct RuntimeTable RuntimeTable;
+
+struct Runtimes {
+    uint64_t key;
+    unsigned long samples[RUNTIME_SAMPLES];
+    int count;
+    int next;
+};
+
+struct RuntimeTable {
+    Runtimes entries[RUNTIME_KEYS];
+    int percentile;
+    pthread_mutex_t lock;
+};
+
+RuntimeTable *createRuntimeTable(int percentile);
+int get_speculation_percentile();
+uint64_t hash_bytes(const char *data, long size);
+bool hash_open_file(int fd, long size, uint64_t *hash);
+void record_runtime(RuntimeTable *table, uint64_t key, unsigned long runtime);
+int compare_runtimes(const void *a, const void *b);
+unsigned long get_straggler_threshold(RuntimeTable *table, uint64_t key);
+
+/**
+ * Creates an empty table of runtimes.
+ *
+ * WARNING: 'createRuntimeTable' malloc()s memory to '*table' which must be freed by
+ * the caller.
+ *
+ * @param percentile The percentile of an executable's runtimes past which its jobs are stragglers, or 0 to never speculate.
+ *
+ * @return The table.
+ */
+RuntimeTable *createRuntimeTable(int percentile) {
+    RuntimeTable *table = (RuntimeTable *)calloc(1, sizeof(RuntimeTable));
+
+    if (!table) {
+        perror("[X] calloc");
+        exit(1);
+    }
+
+    table->percentile = percentile;
+    pthread_mutex_init(&table->lock, NULL);
+
+    return table;
+}
+
+/**
+ * Obtains the straggler percentile from SPECULATION_PERCENTILE_ENV.
+ *
+ * @return The percentile, 0 if speculation is disabled, or SPECULATION_PERCENTILE if the variable is unset or out of range.
+ */
+int get_speculation_percentile() {
+    char *value = getenv(SPECULATION_PERCENTILE_ENV);
+    int percentile = value ? atoi(value) : SPECULATION_PERCENTILE;
+
+    return percentile >= 0 && percentile < 100 ? percentile : SPECULATION_PERCENTILE;
+}
+
+/**
+ * Hashes a run of bytes with FNV-1a.
+ *
+ * @param data The bytes.
+ * @param size The number of bytes.
+ *
+ * @return The hash of the bytes.
+ */
+uint64_t hash_bytes(const char *data, long size) {
+    uint64_t hash = 0xCBF29CE484222325ULL;
+
+    for (long i = 0; i < size; i++)
+        hash = (hash ^ (unsigned char)data[i]) * 0x100000001B3ULL;
+
+    return hash;
+}
+
+/**
+ * Hashes the first bytes of an open file with FNV-1a, as hash_bytes() would hash them in memory.
+ *
+ * The file is read block by block from explicit offsets rather than mapped, so
+ * a file another process truncates fails the hash instead of the reader.
+ *
+ * @param fd The descriptor of the file, whose own offset is left where it was.
+ * @param size The number of bytes to hash.
+ * @param hash Receives the hash of the bytes.
+ *
+ * @return Whether or not the file held that many bytes.
+ */
+bool hash_open_file(int fd, long size, uint64_t *hash) {
+    char block[65536];
+    long offset = 0;
+
+    *hash = 0xCBF29CE484222325ULL;
+
+    while (offset < size) {
+        ssize_t n = pread(fd, block, size - offset < (long)sizeof(block) ? size - offset : (long)sizeof(block), offset);
+
+        if (n == -1 && errno == EINTR)
+            continue;
+
+        if (n <= 0)
+            return false;
+
+        for (ssize_t i = 0; i < n; i++)
+            *hash = (*hash ^ (unsigned char)block[i]) * 0x100000001B3ULL;
+
+        offset += n;
+    }
+
+    return true;
+}
+
+/**
+ * Records how long a job of an executable took to produce its first output.
+ *
+ * @param table The table.
+ * @param key The hash of the executable.
+ * @param runtime The time to first output, in nanoseconds.
+ */
+void record_runtime(RuntimeTable *table, uint64_t key, unsigned long runtime) {
+    Runtimes *runtimes = &table->entries[key % RUNTIME_KEYS];
+
+    pthread_mutex_lock(&table->lock);
+
+    /* Another executable's history is overwritten rather than mixed in. */
+    if (runtimes->key != key) {
+        runtimes->key = key;
+        runtimes->count = 0;
+        runtimes->next = 0;
+    }
+
+    runtimes->samples[runtimes->next] = runtime;
+    runtimes->next = (runtimes->next + 1) % RUNTIME_SAMPLES;
+    runtimes->count += runtimes->count < RUNTIME_SAMPLES;
+
+    pthread_mutex_unlock(&table->lock);
+}
+
+/**
+ * Orders runtimes for qsort().
+ *
+ * @param a The first runtime.
+ * @param b The second runtime.
+ *
+ * @return Less than, equal to or greater than 0 as the first runtime is shorter than, as long as or longer than the second.
+ */
+int compare_runtimes(const void *a, const void *b) {
+    unsigned long x = *(const unsigned long *)a, y = *(const unsigned long *)b;
+
+    return (x > y) - (x < y);
+}
+
+/**
+ * Obtains how long a job of an executable may go without output before it is a straggler.
+ *
+ * @param table The table.
+ * @param key The hash of the executable.
+ *
+ * @return The table's percentile of the executable's recent runtimes in nanoseconds, or 0 if
+ *         speculation is disabled or too few of its jobs have run.
+ */
+unsigned long get_straggler_threshold(RuntimeTable *table, uint64_t key) {
+    Runtimes *runtimes = &table->entries[key % RUNTIME_KEYS];
+    unsigned long samples[RUNTIME_SAMPLES];
+    int count = 0;
+
+    if (table->percentile == 0)
+        return 0;
+
+    pthread_mutex_lock(&table->lock);
+
+    if (runtimes->key == key && runtimes->count >= MIN_RUNTIME_SAMPLES) {
+        count = runtimes->count;
+        memcpy(samples, runtimes->samples, sizeof(unsigned long) * count);
+    }
+
+    pthread_mutex_unlock(&table->lock);
+
+    if (count == 0)
+        return 0;
+
+    qsort(samples, count, sizeof(unsigned long), compare_runtimes);
+
+    return samples[(count - 1) * table->percentile / 100];
+}
+
+#endif
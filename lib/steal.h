@@ -0,0 +1,220 @@
+#ifndef STEAL_H
+#define STEAL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#include "slavelist.h"
+#include "scheduler.h"
+
+/*
+ * A slave runs one job at a time, so a job placed on a busy slave waits in
+ * that slave's queue. The slave greets the job with {READY_FOR_JOB} once it
+ * gets to it, and only then does the master send the job's files. Where a job
+ * is placed is therefore only final once it starts.
+ *
+ * Jobs waiting for their greeting are parked on a board. A slave that runs
+ * out of jobs steals from the slave with the most jobs outstanding, taking the
+ * job parked there last, i.e. the one with the longest wait ahead of it. The
+ * job then goes to the thief, files and all, and gives up its place in the
+ * other slave's queue.
+ */
+#define STEALING_ENV "DLB_WORK_STEALING"
+
+typedef struct Parked Parked;
+typedef struct StealBoard StealBoard;
+
+/* A job waiting for its slave's greeting; it lives on the waiting thread's stack. */
+struct Parked {
+    Slave *slave;
+
+    /* The slave that stole the job, counted as running it, once 'wakeup' is signalled. */
+    Slave *thief;
+    int wakeup;
+
+    Parked *previous;
+    Parked *next;
+};
+
+struct StealBoard {
+    bool enabled;
+
+    /* Parked jobs, oldest first. */
+    Parked *head;
+    Parked *tail;
+
+    pthread_mutex_t lock;
+};
+
+StealBoard *createStealBoard(bool enabled);
+bool get_stealing();
+bool park_job(StealBoard *board, Parked *parked, Slave *slave);
+void unlink_parked(StealBoard *board, Parked *parked);
+Slave *unpark_job(StealBoard *board, Parked *parked);
+Slave *steal_job(StealBoard *board, Slave *thief);
+
+/**
+ * Creates an empty board of parked jobs.
+ *
+ * WARNING: 'createStealBoard' malloc()s memory to '*board' which must be freed by
+ * the caller.
+ *
+ * @param enabled Whether or not idle slaves steal parked jobs.
+ *
+ * @return The board.
+ */
+StealBoard *createStealBoard(bool enabled) {
+    StealBoard *board = (StealBoard *)calloc(1, sizeof(StealBoard));
+
+    if (!board) {
+        perror("[X] calloc");
+        exit(1);
+    }
+
+    board->enabled = enabled;
+    pthread_mutex_init(&board->lock, NULL);
+
+    return board;
+}
+
+/**
+ * Obtains whether idle slaves steal jobs from STEALING_ENV.
+ *
+ * @return False if the variable is "0", otherwise true.
+ */
+bool get_stealing() {
+    char *value = getenv(STEALING_ENV);
+
+    return !value || strcmp(value, "0") != 0;
+}
+
+/**
+ * Parks a job while it waits for a busy slave, where idle slaves can steal it.
+ *
+ * @param board The board.
+ * @param parked The job's entry, which must stay in place until the job is unparked.
+ * @param slave The slave the job waits for.
+ *
+ * @return Whether or not the job was parked; it cannot be stolen otherwise.
+ */
+bool park_job(StealBoard *board, Parked *parked, Slave *slave) {
+    if (!board->enabled)
+        return false;
+
+    if ((parked->wakeup = eventfd(0, EFD_CLOEXEC)) == -1) {
+        perror("[X] eventfd");
+        return false;
+    }
+
+    parked->slave = slave;
+    parked->thief = NULL;
+    parked->next = NULL;
+
+    pthread_mutex_lock(&board->lock);
+
+    parked->previous = board->tail;
+
+    if (board->tail)
+        board->tail->next = parked;
+    else
+        board->head = parked;
+
+    board->tail = parked;
+
+    pthread_mutex_unlock(&board->lock);
+
+    return true;
+}
+
+/**
+ * Takes a parked job off the board.
+ *
+ * The caller holds the board's lock.
+ *
+ * @param board The board.
+ * @param parked The job's entry.
+ */
+void unlink_parked(StealBoard *board, Parked *parked) {
+    if (parked->previous)
+        parked->previous->next = parked->next;
+    else
+        board->head = parked->next;
+
+    if (parked->next)
+        parked->next->previous = parked->previous;
+    else
+        board->tail = parked->previous;
+}
+
+/**
+ * Takes a job that is done waiting off the board.
+ *
+ * @param board The board.
+ * @param parked The job's entry.
+ *
+ * @return The slave that stole the job, counted as running it, or NULL if it was not stolen.
+ */
+Slave *unpark_job(StealBoard *board, Parked *parked) {
+    pthread_mutex_lock(&board->lock);
+
+    /* A stolen job is already off the board. */
+    if (!parked->thief)
+        unlink_parked(board, parked);
+
+    pthread_mutex_unlock(&board->lock);
+
+    close(parked->wakeup);
+
+    return parked->thief;
+}
+
+/**
+ * Lets an idle slave steal the parked job with the longest wait ahead of it.
+ *
+ * @param board The board.
+ * @param thief The slave, which is only counted as running the job if it is still idle.
+ *
+ * @return The slave the job was stolen from, or NULL if nothing was stolen.
+ */
+Slave *steal_job(StealBoard *board, Slave *thief) {
+    Parked *victim = NULL;
+    Slave *robbed = NULL;
+
+    /* A slave that has been failing, or is on its way out, gets no jobs this way either. */
+    if (!board->enabled || !is_available(thief, now_nanoseconds()) || __atomic_load_n(&thief->failures, __ATOMIC_RELAXED) > 0)
+        return NULL;
+
+    pthread_mutex_lock(&board->lock);
+
+    /* Newest first, so each slave's last parked job is the one seen first. A job that is its slave's only one is about to be greeted. */
+    for (Parked *parked = board->tail; parked; parked = parked->previous) {
+        unsigned long outstanding = __atomic_load_n(&parked->slave->outstanding, __ATOMIC_RELAXED);
+
+        if (parked->slave != thief && outstanding > 1 && (!victim || outstanding > __atomic_load_n(&victim->slave->outstanding, __ATOMIC_RELAXED)))
+            victim = parked;
+    }
+
+    if (victim && claim_idle_slave(thief)) {
+        unlink_parked(board, victim);
+        victim->thief = thief;
+        robbed = victim->slave;
+
+        uint64_t stolen = 1;
+
+        if (write(victim->wakeup, &stolen, sizeof(stolen)) == -1)
+            perror("[X] write");
+    }
+
+    /* The job's entry is gone as soon as its thread wakes up. */
+    pthread_mutex_unlock(&board->lock);
+
+    return robbed;
+}
+
+#endif
@@ -0,0 +1,193 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+
+#include "utilities.h"
+#include "transfer.h"
+#include "compress.h"
+
+/*
+ * Job output is streamed from the slave to the master to the client while the
+ * job runs, in the block format of compress.h: each block is sent as soon as
+ * the job writes it, compressed when the job's codec is lz and stored
+ * otherwise, and a header of two zeros ends the stream.
+ *
+ * No hop holds more than one block. A hop that falls behind stops reading,
+ * so TCP's flow control stalls the hop before it and, in the end, the job's
+ * own writes to its pipe.
+ */
+
+bool send_block(int socket, const char *block, long size, int codec, char *encoded, TransferStats *stats);
+bool send_stream(int socket, int fd, int codec, TransferStats *stats);
+long recv_block(int socket, uint32_t *header, char *payload, TransferStats *stats);
+bool write_block(int fd, uint32_t *header, char *payload, char *block);
+bool recv_stream(int socket, int fd, TransferStats *stats);
+bool recv_stream_file(int socket, char *file_path, TransferStats *stats);
+
+/**
+ * Sends one block of a stream.
+ *
+ * @param socket The socket to send the block to.
+ * @param block The decoded bytes of the block.
+ * @param size The number of bytes in the block, at most LZ_BLOCK_SIZE; 0 sends the terminator.
+ * @param codec The codec negotiated for the job; blocks are only compressed with CODEC_LZ.
+ * @param encoded Scratch space of LZ_BLOCK_SIZE bytes to compress into.
+ * @param stats The statistics to account the wire bytes against, may be NULL.
+ *
+ * @return Whether or not the whole block was sent.
+ */
+bool send_block(int socket, const char *block, long size, int codec, char *encoded, TransferStats *stats) {
+    /* A block that does not shrink is stored as is. */
+    long encoded_size = codec == CODEC_LZ && size > 0 ? lz_compress(block, size, encoded, size - 1) : 0;
+    uint32_t header[2] = { htonl(size), htonl(encoded_size > 0 ? encoded_size : size) };
+    struct iovec iov[2] = {
+        { header, LZ_BLOCK_HEADER_SIZE },
+        { encoded_size > 0 ? encoded : (char *)block, encoded_size > 0 ? encoded_size : size }
+    };
+
+    return send_allv(socket, iov, size > 0 ? 2 : 1, stats);
+}
+
+/**
+ * Streams everything read from a file descriptor, a block per read(), until it ends.
+ *
+ * Blocks go out as soon as they are read, so a pipe's bytes are sent as they are
+ * written. The stream's terminator is left to the caller.
+ *
+ * @param socket The socket to send the blocks to.
+ * @param fd The file descriptor to read from.
+ * @param codec The codec negotiated for the job.
+ * @param stats The statistics to account the wire bytes against, may be NULL.
+ *
+ * @return Whether or not everything was read and sent.
+ */
+bool send_stream(int socket, int fd, int codec, TransferStats *stats) {
+    char *block = (char *)malloc(sizeof(char) * LZ_BLOCK_SIZE);
+    char *encoded = (char *)malloc(sizeof(char) * LZ_BLOCK_SIZE);
+    bool sent = block && encoded;
+    ssize_t n;
+
+    while (sent && (n = read(fd, block, LZ_BLOCK_SIZE)) != 0) {
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+
+            perror("[X] read");
+            sent = false;
+            break;
+        }
+
+        sent = send_block(socket, block, n, codec, encoded, stats);
+    }
+
+    free(block);
+    free(encoded);
+
+    return sent;
+}
+
+/**
+ * Receives one block of a stream without decoding it.
+ *
+ * @param socket The socket to receive the block from.
+ * @param header Receives the block's header, in network byte order.
+ * @param payload Receives the block's encoded bytes; at least LZ_BLOCK_SIZE bytes long.
+ * @param stats The statistics to account the wire bytes against, may be NULL.
+ *
+ * @return The decoded size of the block, 0 for the terminator, or -1 if no well formed block was received.
+ */
+long recv_block(int socket, uint32_t *header, char *payload, TransferStats *stats) {
+    if (!recv_exact(socket, header, LZ_BLOCK_HEADER_SIZE, stats))
+        return -1;
+
+    long raw_size = ntohl(header[0]), encoded_size = ntohl(header[1]);
+
+    if (raw_size > LZ_BLOCK_SIZE || encoded_size > raw_size || (raw_size == 0 && encoded_size != 0))
+        return -1;
+
+    return recv_exact(socket, payload, encoded_size, stats) ? raw_size : -1;
+}
+
+/**
+ * Decodes a block received by recv_block() and writes it to a file descriptor.
+ *
+ * @param fd The file descriptor to write to.
+ * @param header The block's header, in network byte order.
+ * @param payload The block's encoded bytes.
+ * @param block Scratch space of LZ_BLOCK_SIZE bytes to decompress into.
+ *
+ * @return Whether or not the block decoded and was written.
+ */
+bool write_block(int fd, uint32_t *header, char *payload, char *block) {
+    long raw_size = ntohl(header[0]), encoded_size = ntohl(header[1]);
+
+    if (encoded_size == raw_size)
+        return send_all(fd, payload, raw_size, NULL);
+
+    return lz_decompress(payload, encoded_size, block, LZ_BLOCK_SIZE) == raw_size && send_all(fd, block, raw_size, NULL);
+}
+
+/**
+ * Receives a stream and decodes it block by block into a file descriptor.
+ *
+ * @param socket The socket to receive the stream from.
+ * @param fd The file descriptor to write the decoded bytes to.
+ * @param stats The statistics to account the wire bytes against, may be NULL.
+ *
+ * @return Whether or not the stream was received up to its terminator.
+ */
+bool recv_stream(int socket, int fd, TransferStats *stats) {
+    char *payload = (char *)malloc(sizeof(char) * LZ_BLOCK_SIZE);
+    char *block = (char *)malloc(sizeof(char) * LZ_BLOCK_SIZE);
+    uint32_t header[2];
+    long raw_size = -1;
+
+    while (payload && block && (raw_size = recv_block(socket, header, payload, stats)) > 0) {
+        if (!write_block(fd, header, payload, block)) {
+            raw_size = -1;
+            break;
+        }
+    }
+
+    bool received = raw_size == 0;
+
+    free(payload);
+    free(block);
+
+    return received;
+}
+
+/**
+ * Receives a stream straight into the file at the given path.
+ *
+ * @param socket The socket to receive the stream from.
+ * @param file_path The path to create or truncate.
+ * @param stats The statistics to account the wire bytes against, may be NULL.
+ *
+ * @return Whether or not the stream was received up to its terminator.
+ */
+bool recv_stream_file(int socket, char *file_path, TransferStats *stats) {
+    int fd = open(file_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (fd == -1) {
+        perror("[X] open");
+        return false;
+    }
+
+    bool received = recv_stream(socket, fd, stats);
+
+    close(fd);
+
+    return received;
+}
+
+#endif
@@ -0,0 +1,311 @@
+#ifndef SUBMIT_H
+#define SUBMIT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <libgen.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "utilities.h"
+#include "transfer.h"
+#include "compress.h"
+#include "dedup.h"
+#include "log.h"
+#include "trace.h"
+#include "stream.h"
+#include "unix.h"
+
+bool resolve_master(char *address, int port, struct sockaddr_in *master_address);
+int open_master_connection(struct sockaddr_in *master_address);
+char *send_job(int master_socket, struct sockaddr_in *master_address, char *executable, char *input_file, int *codec, bool *stream, char *trace_id, long deadline, int priority);
+char *receive_job_output(int master_socket, struct sockaddr_in *master_address, int codec, bool stream, char *output_path, char *trace_id);
+char *submit_job(int master_socket, struct sockaddr_in *master_address, char *executable, char *input_file, int codec, char *output_path, char *trace_id, long deadline, int priority);
+
+/**
+ * Resolves the address of the master node.
+ *
+ * @param address The host name or IPv4 address of the master node.
+ * @param port The port on the master node.
+ * @param master_address Receives the resolved address.
+ *
+ * @return Whether or not the address could be resolved.
+ */
+bool resolve_master(char *address, int port, struct sockaddr_in *master_address) {
+    struct hostent *server_host = gethostbyname(address);
+
+    if (!server_host)
+        return false;
+
+    memset(master_address, 0, sizeof(*master_address));
+    master_address->sin_family = AF_INET;
+    master_address->sin_port = htons(port);
+    memcpy(&master_address->sin_addr.s_addr, server_host->h_addr, server_host->h_length);
+
+    return true;
+}
+
+/**
+ * Opens a tuned connection to the master node, over its Unix socket if it is on this host and has one.
+ *
+ * @param master_address The address of the master node.
+ *
+ * @return The connected socket, or -1 if the master node could not be reached.
+ */
+int open_master_connection(struct sockaddr_in *master_address) {
+    char path[MAX_BUFFER_SIZE];
+    int master_socket;
+
+    /* Masters that predate Unix sockets, or have theirs disabled, are reached over TCP. */
+    if (ntohl(master_address->sin_addr.s_addr) >> 24 == 127 && get_unix_socket_path(ntohs(master_address->sin_port), path, false)
+        && (master_socket = connect_unix(path)) != -1) {
+        /* Descriptors and files are only handed to a master run by the user or root. */
+        if (is_trusted_peer(master_socket))
+            return master_socket;
+
+        fprintf(stderr, "[X] %s is served by another user, so the Master is reached over TCP.\n", path);
+        close(master_socket);
+    }
+
+    /* Create TCP socket. */
+    if ((master_socket = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
+        perror("[X] socket");
+        return -1;
+    }
+
+    /* Connect to socket with master's address. */
+    if (connect(master_socket, (struct sockaddr *)master_address, sizeof(*master_address)) == -1) {
+        close(master_socket);
+        return -1;
+    }
+
+    tune_socket(master_socket);
+
+    return master_socket;
+}
+
+/**
+ * Sends a job request and the job's files to the master node.
+ *
+ * @param master_socket The socket connected to the master node.
+ * @param master_address The address of the master node.
+ * @param executable The path to the job's executable.
+ * @param input_file The path to the job's input file.
+ * @param codec The codec to propose; receives the codec the master accepted.
+ * @param stream Receives whether or not the master can stream the job's output.
+ * @param trace_id The trace id of the job.
+ * @param deadline The milliseconds the job may take, or 0 if it has no deadline.
+ * @param priority The PRIORITY_* class of the job.
+ *
+ * @return NULL if the master received the job, otherwise the status describing the failure; {REJECTED_JOB}
+ *         if the master turned the job away under load before its files were sent.
+ */
+char *send_job(int master_socket, struct sockaddr_in *master_address, char *executable, char *input_file, int *codec, bool *stream, char *trace_id, long deadline, int priority) {
+    char response[MAX_BUFFER_SIZE];
+    TransferStats stats = {0, 0};
+
+    Buffer *b1 = stat_file(executable);
+    Buffer *b2 = stat_file(input_file);
+
+    if (!b1 || !b2) {
+        free(b1);
+        free(b2);
+
+        return "{FAILED_TO_READ_JOB}";
+    }
+
+    char job_request[MAX_BUFFER_SIZE];
+
+    char *tenant = get_tenant();
+
+    /* Over a Unix socket the descriptors of the files are proposed in place of their bytes. */
+    char *proposed = is_unix_socket(master_socket) ? FILE_DESCRIPTORS_CODEC : get_codec_name(*codec);
+
+    /*
+     * The deadline, priority and tenant follow the trace id. When they do not fit, the trace id gives way to "-"
+     * and the master mints its own; failing that, they are all left off.
+     */
+    if (snprintf(job_request, sizeof(job_request), "%s %ld %s %ld %s %s %ld %s%s%s", b1->file_name, b1->size, b2->file_name, b2->size, proposed, trace_id, deadline, PRIORITY_NAMES[priority], tenant ? " " : "", tenant ? tenant : "") >= (int)sizeof(job_request)
+        && snprintf(job_request, sizeof(job_request), "%s %ld %s %ld %s - %ld %s%s%s", b1->file_name, b1->size, b2->file_name, b2->size, proposed, deadline, PRIORITY_NAMES[priority], tenant ? " " : "", tenant ? tenant : "") >= (int)sizeof(job_request))
+        snprintf(job_request, sizeof(job_request), "%s %ld %s %ld %s", b1->file_name, b1->size, b2->file_name, b2->size, proposed);
+
+    send_message(master_socket, job_request);
+    log_info("[Client]: Sending Job Request: [%s] to Master (%I).\n", job_request, master_address);
+
+    recv_message(master_socket, response);
+    log_debug("[Client]: Received: [%s] from Master (%I).\n", response, master_address);
+
+    char status[MAX_BUFFER_SIZE] = "", accepted_codec[MAX_BUFFER_SIZE] = "none", feature[MAX_BUFFER_SIZE] = "";
+    sscanf(response, "%s %s %s", status, accepted_codec, feature);
+
+    /* Masters that predate compression acknowledge without naming a codec, and those that predate streaming without offering it. */
+    *codec = get_codec(accepted_codec) == -1 ? CODEC_NONE : get_codec(accepted_codec);
+    *stream = strcmp(feature, "stream") == 0;
+
+    bool passed = strcmp(accepted_codec, FILE_DESCRIPTORS_CODEC) == 0;
+    bool sent = false;
+    long saved = 0;
+
+    if (strcmp(status, "{SUCCESSFULLY_RECEIVED_JOB_REQUEST}\0") == 0) {
+        log_debug("[Client]: Sending: [%s, %s] to Master (%I).\n", b1->file_name, b2->file_name, master_address);
+
+        if (passed) {
+            int fds[2] = { open(executable, O_RDONLY | O_CLOEXEC), open(input_file, O_RDONLY | O_CLOEXEC) };
+
+            sent = fds[0] != -1 && fds[1] != -1 && send_file_descriptors(master_socket, "{FILE_DESCRIPTORS}", fds, 2);
+
+            if (fds[0] != -1)
+                close(fds[0]);
+
+            if (fds[1] != -1)
+                close(fds[1]);
+        } else if (*codec == CODEC_CDC) {
+            /* Not corked: each manifest waits on the master's reply, and a corked manifest would sit out the cork timeout. */
+            sent = send_deduplicated_file(master_socket, executable, b1->size, &stats, &saved) && send_deduplicated_file(master_socket, input_file, b2->size, &stats, &saved);
+        } else {
+            /* Cork so the tail of the executable and the head of the input share segments. */
+            set_cork(master_socket, true);
+            sent = send_encoded_file(master_socket, executable, b1->size, *codec, &stats) && send_encoded_file(master_socket, input_file, b2->size, *codec, &stats);
+            set_cork(master_socket, false);
+        }
+    }
+
+    if (sent && *codec == CODEC_CDC)
+        log_info("[Client]: Master already had %ld of %ld bytes.\n", saved, b1->size + b2->size);
+
+    if (sent && passed)
+        log_info("[Client]: Passed the descriptors of %ld bytes to Master.\n", b1->size + b2->size);
+    else if (sent)
+        log_info("[Client]: Sent %ld bytes to Master (%.2f MB/s).\n", stats.bytes, get_throughput(&stats));
+
+    free(b1);
+    free(b2);
+
+    /* A rejection names how long to wait, in milliseconds, before trying again. */
+    if (strcmp(status, "{REJECTED_JOB}\0") == 0) {
+        log_info("[Client]: Master (%I) rejected the Job; retry after %s ms.\n", master_address, accepted_codec);
+        return "{REJECTED_JOB}";
+    }
+
+    if (strcmp(status, "{SUCCESSFULLY_RECEIVED_JOB_REQUEST}\0") != 0)
+        return "{FAILED_TO_RECEIVE_JOB_REQUEST}";
+
+    if (!sent)
+        return "{FAILED_TO_SEND_BUFFER}";
+
+    recv_message(master_socket, response);
+    log_debug("[Client]: Received: [%s] from Master (%I).\n", response, master_address);
+
+    return strcmp(response, "{SUCCESSFULLY_RECEIVED_BUFFER}\0") == 0 ? NULL : "{FAILED_TO_RECEIVE_BUFFER}";
+}
+
+/**
+ * Requests the output of a job the master node received and stores it.
+ *
+ * @param master_socket The socket connected to the master node.
+ * @param master_address The address of the master node.
+ * @param codec The codec the master accepted for the job.
+ * @param stream Whether or not to have the output streamed while the job runs.
+ * @param output_path Where to store the output.
+ * @param trace_id The trace id of the job.
+ *
+ * @return NULL if the output was received, otherwise the status describing the failure.
+ */
+char *receive_job_output(int master_socket, struct sockaddr_in *master_address, int codec, bool stream, char *output_path, char *trace_id) {
+    char *payload;
+    char response[MAX_BUFFER_SIZE];
+    TransferStats stats = {0, 0};
+
+    unsigned long started = now_nanoseconds();
+
+    payload = stream ? "{REQUEST_JOB_OUTPUT} stream" : "{REQUEST_JOB_OUTPUT}";
+    send_message(master_socket, payload);
+    log_debug("[Client]: Sending: [%s] to Master (%I).\n", payload, master_address);
+
+    recv_message(master_socket, response);
+    log_debug("[Client]: Received: [%s] from Master (%I).\n", response, master_address);
+
+    started = end_span(trace_id, "wait", started);
+
+    char output_file_name[MAX_BUFFER_SIZE];
+    long output_size;
+
+    /* The master names its failure in place of the output header. */
+    if (strncmp(response, "{FAILED_", 8) == 0)
+        return strcmp(response, "{FAILED_TO_MEET_DEADLINE}\0") == 0 ? "{FAILED_TO_MEET_DEADLINE}" : "{FAILED_TO_EXECUTE_JOB}";
+
+    /* A streamed output is written out block by block as it arrives, and closed with the job's status. */
+    if (sscanf(response, "{STREAMING_OUTPUT} %s", output_file_name) == 1) {
+        bool received = recv_stream_file(master_socket, output_path, &stats) && recv_message(master_socket, response);
+
+        end_span(trace_id, "download", started);
+
+        if (!received)
+            return "{FAILED_TO_RECEIVE_BUFFER}";
+
+        log_info("[Client]: Received %ld bytes for file %s (%.2f MB/s): %s.\n", stats.bytes, output_file_name, get_throughput(&stats), response);
+
+        payload = "{SUCCESSFULLY_RECEIVED_BUFFER}";
+        send_message(master_socket, payload);
+        log_debug("[Client]: Sending: [%s] to Master (%I).\n", payload, master_address);
+
+        if (strcmp(response, "{SUCCESSFULLY_EXECUTED_JOB}\0") == 0)
+            return NULL;
+
+        return strcmp(response, "{FAILED_TO_MEET_DEADLINE}\0") == 0 ? "{FAILED_TO_MEET_DEADLINE}" : "{FAILED_TO_EXECUTE_JOB}";
+    }
+
+    if (sscanf(response, "%s %ld", output_file_name, &output_size) != 2 || output_size < 0)
+        return "{FAILED_TO_RECEIVE_JOB_OUTPUT}";
+
+    bool received = recv_decoded_file(master_socket, output_path, output_size, 0644, codec, &stats);
+
+    end_span(trace_id, "download", started);
+
+    if (!received)
+        return "{FAILED_TO_RECEIVE_BUFFER}";
+
+    log_info("[Client]: Received %ld bytes for file %s (%.2f MB/s).\n", stats.bytes, output_file_name, get_throughput(&stats));
+
+    payload = "{SUCCESSFULLY_RECEIVED_BUFFER}";
+    send_message(master_socket, payload);
+    log_debug("[Client]: Sending: [%s] to Master (%I).\n", payload, master_address);
+
+    return NULL;
+}
+
+/**
+ * Submits a job to the master node and receives its output.
+ *
+ * @param master_socket The socket connected to the master node.
+ * @param master_address The address of the master node.
+ * @param executable The path to the job's executable.
+ * @param input_file The path to the job's input file.
+ * @param codec The codec to propose for the job's files.
+ * @param output_path Where to store the job's output.
+ * @param trace_id The trace id of the job, as minted by mint_trace_id().
+ * @param deadline The milliseconds the job may take, or 0 if it has no deadline.
+ * @param priority The PRIORITY_* class of the job.
+ *
+ * @return NULL if the job's output was received, otherwise the status describing the failure.
+ */
+char *submit_job(int master_socket, struct sockaddr_in *master_address, char *executable, char *input_file, int codec, char *output_path, char *trace_id, long deadline, int priority) {
+    unsigned long started = now_nanoseconds();
+    bool stream = false;
+    char *status = send_job(master_socket, master_address, executable, input_file, &codec, &stream, trace_id, deadline, priority);
+
+    end_span(trace_id, "upload", started);
+
+    status = status ? status : receive_job_output(master_socket, master_address, codec, stream, output_path, trace_id);
+
+    end_span(trace_id, "submit", started);
+
+    return status;
+}
+
+#endif
@@ -0,0 +1,159 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/syscall.h>
+
+#include "utilities.h"
+#include "transfer.h"
+
+/*
+ * Every job carries a 128-bit trace id, minted by the client as 32 hex digits
+ * and passed along in the job request to the master and on to the slave. When
+ * DLB_TRACE_FILE is set, each process appends a span for every phase of a job
+ * to that file in the Chrome trace-event format, which chrome://tracing and
+ * Perfetto open directly.
+ *
+ * Each span is a single O_APPEND write(), so processes on one host can share a
+ * file. Files from different hosts are merged by concatenating their events.
+ */
+
+#define TRACE_FILE_ENV "DLB_TRACE_FILE"
+#define MAX_SPAN_SIZE 512
+
+int trace_fd = -1;
+
+/* Added to the monotonic clock spans are timed with to place them on the wall clock shared between hosts. */
+long trace_offset = 0;
+
+bool trace_init(char *process_name);
+void mint_trace_id(char *trace_id);
+bool is_trace_id(char *trace_id);
+void record_span(char *trace_id, const char *name, unsigned long started, unsigned long ended);
+unsigned long end_span(char *trace_id, const char *name, unsigned long started);
+
+/**
+ * Starts writing spans to the file named by DLB_TRACE_FILE, if it is set.
+ *
+ * @param process_name The name the process's spans are grouped under.
+ *
+ * @return Whether or not spans are being written.
+ */
+bool trace_init(char *process_name) {
+    char *path = getenv(TRACE_FILE_ENV);
+
+    if (!path || !*path)
+        return false;
+
+    /* Only the process that creates the file opens the event array. */
+    bool created = true;
+
+    if ((trace_fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_APPEND, 0644)) == -1) {
+        created = false;
+        trace_fd = open(path, O_WRONLY | O_APPEND);
+    }
+
+    if (trace_fd == -1) {
+        perror("[X] open");
+        return false;
+    }
+
+    struct timespec wall;
+    clock_gettime(CLOCK_REALTIME, &wall);
+    trace_offset = (long)((unsigned long)wall.tv_sec * 1000000000UL + wall.tv_nsec - now_nanoseconds());
+
+    char event[MAX_SPAN_SIZE];
+    int length = snprintf(event, sizeof(event), "%s{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, \"args\": {\"name\": \"%s\"}},\n",
+                          created ? "[\n" : "", getpid(), process_name);
+
+    return write(trace_fd, event, length) == length;
+}
+
+/**
+ * Mints a random trace id.
+ *
+ * @param trace_id Receives TRACE_ID_LENGTH hex digits and a terminating null byte.
+ */
+void mint_trace_id(char *trace_id) {
+    unsigned char bytes[TRACE_ID_LENGTH / 2];
+    int fd = open("/dev/urandom", O_RDONLY);
+
+    /* Without /dev/urandom, the clock and process id still keep concurrent ids apart. */
+    if (fd == -1 || read(fd, bytes, sizeof(bytes)) != sizeof(bytes)) {
+        unsigned long seed = now_nanoseconds() ^ ((unsigned long)getpid() << 32);
+
+        for (int i = 0; i < (int)sizeof(bytes); i++, seed = seed * 6364136223846793005UL + 1442695040888963407UL)
+            bytes[i] = (unsigned char)(seed >> 56);
+    }
+
+    if (fd != -1)
+        close(fd);
+
+    for (int i = 0; i < (int)sizeof(bytes); i++)
+        snprintf(trace_id + 2 * i, 3, "%02x", bytes[i]);
+}
+
+/**
+ * Checks whether a string is a trace id.
+ *
+ * @param trace_id The string.
+ *
+ * @return Whether or not the string is TRACE_ID_LENGTH hex digits.
+ */
+bool is_trace_id(char *trace_id) {
+    int length = 0;
+
+    for (; trace_id[length]; length++) {
+        char c = trace_id[length];
+
+        if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f')))
+            return false;
+    }
+
+    return length == TRACE_ID_LENGTH;
+}
+
+/**
+ * Records a span of a job, if spans are being written.
+ *
+ * @param trace_id The trace id of the job.
+ * @param name The name of the span, e.g. the phase it covers.
+ * @param started When the span started, as returned by now_nanoseconds().
+ * @param ended When the span ended, as returned by now_nanoseconds().
+ */
+void record_span(char *trace_id, const char *name, unsigned long started, unsigned long ended) {
+    if (trace_fd == -1)
+        return;
+
+    char event[MAX_SPAN_SIZE];
+    int length = snprintf(event, sizeof(event),
+                          "{\"name\": \"%s\", \"cat\": \"job\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": %d, \"tid\": %ld, \"args\": {\"trace_id\": \"%s\"}},\n",
+                          name, (started + trace_offset) / 1e3, (ended - started) / 1e3, getpid(), (long)syscall(SYS_gettid), trace_id);
+
+    if (write(trace_fd, event, length) != length)
+        perror("[X] write");
+}
+
+/**
+ * Records a span of a job that ends now.
+ *
+ * @param trace_id The trace id of the job.
+ * @param name The name of the span.
+ * @param started When the span started, as returned by now_nanoseconds().
+ *
+ * @return The time the span ended, which is when the next span starts.
+ */
+unsigned long end_span(char *trace_id, const char *name, unsigned long started) {
+    unsigned long now = now_nanoseconds();
+    record_span(trace_id, name, started, now);
+
+    return now;
+}
+
+#endif
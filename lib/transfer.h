@@ -0,0 +1,576 @@
+#ifndef TRANSFER_H
+#define TRANSFER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "utilities.h"
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+typedef struct TransferStats TransferStats;
+
+struct TransferStats {
+    long bytes;
+    double seconds;
+};
+
+double now_seconds();
+unsigned long now_nanoseconds();
+void record_transfer(TransferStats *stats, long bytes, double started);
+double get_throughput(TransferStats *stats);
+bool send_all(int fd, const void *data, long size, TransferStats *stats);
+bool send_allv(int fd, struct iovec *iov, int iovcnt, TransferStats *stats);
+bool recv_exact(int fd, void *data, long size, TransferStats *stats);
+bool copy_stream(int in_fd, int out_fd, long size, long chunk_size, TransferStats *stats);
+bool send_file(int socket, char *file_path, long size, TransferStats *stats);
+bool send_open_file(int socket, int fd, long size, TransferStats *stats);
+bool recv_file(int socket, char *file_path, long size, mode_t mode, TransferStats *stats);
+bool send_message(int socket, char *message);
+bool send_frame(int socket, char *header, struct iovec *payload, int count, TransferStats *stats);
+long get_chunk_size(int socket);
+void tune_socket(int socket);
+void set_cork(int socket, bool corked);
+bool connect_timeout(int socket, struct sockaddr_in *address, int timeout);
+void set_timeout(int socket, int timeout);
+bool recv_message(int socket, char *message);
+
+/**
+ * Obtains a monotonic timestamp in seconds.
+ *
+ * @return The number of seconds elapsed since an arbitrary fixed point.
+ */
+double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Obtains a monotonic timestamp in nanoseconds.
+ *
+ * @return The number of nanoseconds elapsed since an arbitrary fixed point.
+ */
+unsigned long now_nanoseconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (unsigned long)ts.tv_sec * 1000000000UL + (unsigned long)ts.tv_nsec;
+}
+
+/**
+ * Accounts a finished transfer against the given statistics.
+ *
+ * @param stats The statistics to update, may be NULL.
+ * @param bytes The number of bytes that were transferred.
+ * @param started The now_seconds() timestamp taken when the transfer began.
+ */
+void record_transfer(TransferStats *stats, long bytes, double started) {
+    if (!stats)
+        return;
+
+    stats->bytes += bytes;
+    stats->seconds += now_seconds() - started;
+}
+
+/**
+ * Calculates the throughput of the transfers recorded in the given statistics.
+ *
+ * @param stats The statistics of the transfers.
+ *
+ * @return The throughput in megabytes per second.
+ */
+double get_throughput(TransferStats *stats) {
+    if (stats->seconds <= 0)
+        return 0;
+
+    return stats->bytes / stats->seconds / (1024 * 1024);
+}
+
+/**
+ * Writes exactly 'size' bytes to a socket or file descriptor.
+ *
+ * Short writes are resumed from the last byte written and interrupted writes
+ * are retried, so the call only returns once every byte has been handed to the
+ * kernel or an unrecoverable error occurs.
+ *
+ * @param fd The socket or file descriptor to write to.
+ * @param data The bytes to write.
+ * @param size The number of bytes to write.
+ * @param stats The statistics to account the transfer against, may be NULL.
+ *
+ * @return Whether or not all bytes were written.
+ */
+bool send_all(int fd, const void *data, long size, TransferStats *stats) {
+    const char *bytes = (const char *)data;
+    double started = now_seconds();
+    long offset = 0;
+
+    while (offset < size) {
+        ssize_t n = send(fd, bytes + offset, size - offset, MSG_NOSIGNAL);
+
+        if (n == -1 && errno == ENOTSOCK)
+            n = write(fd, bytes + offset, size - offset);
+
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+
+            perror("[X] send");
+            return false;
+        }
+
+        offset += n;
+    }
+
+    record_transfer(stats, size, started);
+
+    return true;
+}
+
+/**
+ * Writes every byte described by an array of buffers with as few writev() calls as possible.
+ *
+ * After a short write the array is advanced past the bytes already written,
+ * so the caller's iovec array is modified.
+ *
+ * @param fd The socket or file descriptor to write to.
+ * @param iov The buffers to write, in order.
+ * @param iovcnt The number of buffers.
+ * @param stats The statistics to account the transfer against, may be NULL.
+ *
+ * @return Whether or not all bytes were written.
+ */
+bool send_allv(int fd, struct iovec *iov, int iovcnt, TransferStats *stats) {
+    double started = now_seconds();
+    long total = 0;
+
+    while (iovcnt > 0) {
+        ssize_t n = writev(fd, iov, iovcnt > IOV_MAX ? IOV_MAX : iovcnt);
+
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+
+            perror("[X] writev");
+            return false;
+        }
+
+        total += n;
+
+        /* Skip the buffers that were written completely. */
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+
+        /* Resume part-way through the buffer that was written partially. */
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+
+    record_transfer(stats, total, started);
+
+    return true;
+}
+
+/**
+ * Reads exactly 'size' bytes from a socket or file descriptor.
+ *
+ * @param fd The socket or file descriptor to read from.
+ * @param data The buffer to read into, at least 'size' bytes long.
+ * @param size The number of bytes to read.
+ * @param stats The statistics to account the transfer against, may be NULL.
+ *
+ * @return Whether or not all bytes were read before the peer closed the connection.
+ */
+bool recv_exact(int fd, void *data, long size, TransferStats *stats) {
+    char *bytes = (char *)data;
+    double started = now_seconds();
+    long offset = 0;
+
+    while (offset < size) {
+        ssize_t n = read(fd, bytes + offset, size - offset);
+
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+
+            perror("[X] recv");
+            return false;
+        }
+
+        /* The peer closed the connection early. */
+        if (n == 0)
+            return false;
+
+        offset += n;
+    }
+
+    record_transfer(stats, size, started);
+
+    return true;
+}
+
+/**
+ * Copies exactly 'size' bytes from one descriptor to another in chunks.
+ *
+ * Each read may return less than a full chunk; whatever arrives is written out
+ * in full before the next read, so the copy works for any mix of sockets, pipes
+ * and files.
+ *
+ * @param in_fd The socket or file descriptor to read from.
+ * @param out_fd The socket or file descriptor to write to.
+ * @param size The number of bytes to copy.
+ * @param chunk_size The largest number of bytes to move per read.
+ * @param stats The statistics to account the transfer against, may be NULL.
+ *
+ * @return Whether or not all bytes were copied.
+ */
+bool copy_stream(int in_fd, int out_fd, long size, long chunk_size, TransferStats *stats) {
+    char *chunk = (char *)malloc(sizeof(char) * chunk_size);
+
+    if (!chunk) {
+        perror("[X] malloc");
+        return false;
+    }
+
+    double started = now_seconds();
+    long offset = 0;
+
+    while (offset < size) {
+        long wanted = size - offset < chunk_size ? size - offset : chunk_size;
+        ssize_t n = read(in_fd, chunk, wanted);
+
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+
+            perror("[X] read");
+            break;
+        }
+
+        if (n == 0 || !send_all(out_fd, chunk, n, NULL))
+            break;
+
+        offset += n;
+    }
+
+    free(chunk);
+
+    record_transfer(stats, offset, started);
+
+    return offset == size;
+}
+
+/**
+ * Streams 'size' bytes of the file at the given path to a socket with sendfile().
+ *
+ * The data is copied straight from the page cache to the socket, so the file is
+ * never buffered in user space. Short writes are resumed from the kernel-updated
+ * offset until the whole file has been sent.
+ *
+ * @param socket The socket to send the file to.
+ * @param file_path The path to the file.
+ * @param size The number of bytes to send.
+ * @param stats The statistics to account the transfer against, may be NULL.
+ *
+ * @return Whether or not the whole file was sent.
+ */
+bool send_file(int socket, char *file_path, long size, TransferStats *stats) {
+    int fd = open(file_path, O_RDONLY);
+
+    if (fd == -1) {
+        perror("[X] open");
+        return false;
+    }
+
+    bool sent = send_open_file(socket, fd, size, stats);
+
+    close(fd);
+
+    return sent;
+}
+
+/**
+ * Streams the first 'size' bytes of an open file to a socket, or another file, with sendfile().
+ *
+ * The bytes are read from explicit offsets, so the descriptor's own offset,
+ * which may be shared with another process, is left where it was.
+ *
+ * @param socket The socket or file to send the file to.
+ * @param fd The descriptor of the file.
+ * @param size The number of bytes to send.
+ * @param stats The statistics to account the transfer against, may be NULL.
+ *
+ * @return Whether or not the whole file was sent.
+ */
+bool send_open_file(int socket, int fd, long size, TransferStats *stats) {
+    double started = now_seconds();
+    off_t offset = 0;
+
+    while (offset < size) {
+        ssize_t sent = sendfile(socket, fd, &offset, size - offset);
+
+        if (sent == -1) {
+            if (errno == EINTR)
+                continue;
+
+            perror("[X] sendfile");
+            break;
+        }
+
+        /* The file shrank underneath us. */
+        if (sent == 0)
+            break;
+    }
+
+    record_transfer(stats, offset, started);
+
+    return offset == size;
+}
+
+/**
+ * Receives exactly 'size' bytes from a socket straight into the file at the given path.
+ *
+ * @param socket The socket to receive the file from.
+ * @param file_path The path to create or truncate.
+ * @param size The number of bytes to receive.
+ * @param mode The permissions of the file if it is created, e.g. 0755 for executables.
+ * @param stats The statistics to account the transfer against, may be NULL.
+ *
+ * @return Whether or not the whole file was received.
+ */
+bool recv_file(int socket, char *file_path, long size, mode_t mode, TransferStats *stats) {
+    int fd = open(file_path, O_WRONLY | O_CREAT | O_TRUNC, mode);
+
+    if (fd == -1) {
+        perror("[X] open");
+        return false;
+    }
+
+    bool received = copy_stream(socket, fd, size, get_chunk_size(socket), stats);
+
+    close(fd);
+
+    return received;
+}
+
+/**
+ * Sends a control message as a fixed-size, NUL padded frame of MAX_BUFFER_SIZE bytes.
+ *
+ * Fixed-size frames keep control messages from running into the file data
+ * that follows them on the same stream.
+ *
+ * @param socket The socket to send the message to.
+ * @param message The NUL terminated message.
+ *
+ * @return Whether or not the whole frame was sent.
+ */
+bool send_message(int socket, char *message) {
+    char frame[MAX_BUFFER_SIZE];
+
+    memset(frame, 0, sizeof(frame));
+    strncpy(frame, message, sizeof(frame) - 1);
+
+    return send_all(socket, frame, sizeof(frame), NULL);
+}
+
+/**
+ * Receives a control message sent by send_message().
+ *
+ * @param socket The socket to receive the message from.
+ * @param message The buffer to receive into, at least MAX_BUFFER_SIZE bytes long.
+ *
+ * @return Whether or not a whole frame was received. On failure 'message' is empty.
+ */
+bool recv_message(int socket, char *message) {
+    if (!recv_exact(socket, message, MAX_BUFFER_SIZE, NULL)) {
+        message[0] = '\0';
+        return false;
+    }
+
+    message[MAX_BUFFER_SIZE - 1] = '\0';
+
+    return true;
+}
+
+/**
+ * Sends a control message and the payload it announces with a single writev().
+ *
+ * The header is padded to a MAX_BUFFER_SIZE frame exactly like send_message(),
+ * so the receiver reads it with recv_message() and then the payload with
+ * recv_exact(), but on the wire both share the same segments.
+ *
+ * @param socket The socket to send the frame to.
+ * @param header The NUL terminated message announcing the payload.
+ * @param payload The buffers making up the payload, in order.
+ * @param count The number of payload buffers.
+ * @param stats The statistics to account the payload against, may be NULL.
+ *
+ * @return Whether or not the header and the whole payload were sent.
+ */
+bool send_frame(int socket, char *header, struct iovec *payload, int count, TransferStats *stats) {
+    char frame[MAX_BUFFER_SIZE];
+    struct iovec iov[count + 1];
+    long header_size = sizeof(frame);
+
+    memset(frame, 0, sizeof(frame));
+    strncpy(frame, header, sizeof(frame) - 1);
+
+    iov[0].iov_base = frame;
+    iov[0].iov_len = sizeof(frame);
+
+    for (int i = 0; i < count; i++)
+        iov[i + 1] = payload[i];
+
+    TransferStats frame_stats = {0, 0};
+
+    if (!send_allv(socket, iov, count + 1, &frame_stats))
+        return false;
+
+    if (stats) {
+        stats->bytes += frame_stats.bytes - header_size;
+        stats->seconds += frame_stats.seconds;
+    }
+
+    return true;
+}
+
+/**
+ * Determines how many bytes to move per read/write on a given socket.
+ *
+ * The chunk is sized to the socket's receive buffer so that a single read can
+ * drain everything the kernel has queued, clamped to between MIN_CHUNK_SIZE and
+ * MAX_CHUNK_SIZE. The DLB_CHUNK_SIZE environment variable overrides it.
+ *
+ * @param socket The socket that will be read from or written to.
+ *
+ * @return The chunk size in bytes.
+ */
+long get_chunk_size(int socket) {
+    char *override = getenv("DLB_CHUNK_SIZE");
+
+    if (override && atol(override) > 0)
+        return atol(override);
+
+    int buffer_size = 0;
+    socklen_t len = sizeof(buffer_size);
+
+    if (getsockopt(socket, SOL_SOCKET, SO_RCVBUF, &buffer_size, &len) == -1)
+        buffer_size = 0;
+
+    if (buffer_size < MIN_CHUNK_SIZE)
+        return MIN_CHUNK_SIZE;
+
+    if (buffer_size > MAX_CHUNK_SIZE)
+        return MAX_CHUNK_SIZE;
+
+    return buffer_size;
+}
+
+/**
+ * Disables Nagle's algorithm on a connected TCP socket.
+ *
+ * Control messages are tiny and each one is waited on by the peer, so they
+ * must leave immediately. Bulk data is batched explicitly with set_cork().
+ *
+ * @param socket The connected TCP socket.
+ */
+void tune_socket(int socket) {
+    int opt = 1;
+
+    setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+}
+
+/**
+ * Corks or uncorks a TCP socket.
+ *
+ * While corked the kernel only sends full segments, so a control message and
+ * the file data that follows it are coalesced instead of going out as a tiny
+ * segment of their own. Uncorking flushes whatever is left.
+ *
+ * @param socket The connected TCP socket.
+ * @param corked Whether to cork (true) or uncork (false) the socket.
+ */
+void set_cork(int socket, bool corked) {
+    int opt = corked;
+
+    setsockopt(socket, IPPROTO_TCP, TCP_CORK, &opt, sizeof(opt));
+}
+
+/**
+ * Connects a TCP socket, giving up once a timeout passes.
+ *
+ * A blocking connect() to a host that is down waits for the kernel's SYN
+ * retries, which take minutes; the socket is made non-blocking for the
+ * handshake instead and polled for at most the timeout.
+ *
+ * @param socket The TCP socket to connect.
+ * @param address The address to connect to.
+ * @param timeout The longest to wait, in milliseconds.
+ *
+ * @return Whether or not the socket connected, with errno set if it did not.
+ */
+bool connect_timeout(int socket, struct sockaddr_in *address, int timeout) {
+    int flags = fcntl(socket, F_GETFL, 0);
+
+    fcntl(socket, F_SETFL, flags | O_NONBLOCK);
+
+    int error = connect(socket, (struct sockaddr *)address, sizeof(*address)) == 0 ? 0 : errno;
+
+    if (error == EINPROGRESS) {
+        struct pollfd pfd = { socket, POLLOUT, 0 };
+        socklen_t length = sizeof(error);
+        int ready;
+
+        while ((ready = poll(&pfd, 1, timeout)) == -1 && errno == EINTR);
+
+        if (ready == 0)
+            error = ETIMEDOUT;
+        else if (ready == -1 || getsockopt(socket, SOL_SOCKET, SO_ERROR, &error, &length) == -1)
+            error = errno;
+    }
+
+    fcntl(socket, F_SETFL, flags);
+    errno = error;
+
+    return error == 0;
+}
+
+/**
+ * Bounds how long each send() and recv() on a socket may block.
+ *
+ * A call that times out fails with EAGAIN, which the functions above treat as
+ * an error like any other, since none of the sockets they are given are
+ * non-blocking.
+ *
+ * @param socket The socket.
+ * @param timeout The longest a call may block, in milliseconds; 0 lets calls block indefinitely.
+ */
+void set_timeout(int socket, int timeout) {
+    struct timeval tv = { timeout / 1000, (timeout % 1000) * 1000 };
+
+    setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+#endif
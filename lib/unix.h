@@ -0,0 +1,380 @@
+#ifndef UNIX_H
+#define UNIX_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "utilities.h"
+#include "transfer.h"
+
+/*
+ * A master also listens for clients on its host on a Unix socket, named after
+ * its port for clients to find it by. A client that reaches the master on a
+ * loopback address connects there instead, and falls back to TCP if nothing
+ * listens.
+ *
+ * The socket is kept in a directory only its user may enter: $XDG_RUNTIME_DIR,
+ * or else UNIX_SOCKET_DIRECTORY, which the master creates. Either is used only
+ * if it is a directory of the user's that no one else has any access to, so no
+ * other user can put a socket where a client looks for the master's. A client
+ * also only talks to a socket served by its own user or root, going by the
+ * peer's credentials.
+ *
+ * Over a Unix socket a client proposes the FILE_DESCRIPTORS_CODEC for its job.
+ * Once the master accepts it, the client passes open descriptors of the
+ * executable and the input file in a {FILE_DESCRIPTORS} frame, in place of
+ * their bytes. The master keeps them with the job and has the kernel copy the
+ * files from them to the slaves, so it never holds their bytes. Everything
+ * else, the job's output included, goes over the connection as it would over
+ * TCP, uncompressed. Masters that do not know the codec answer with "none",
+ * and get the bytes.
+ *
+ * UNIX_SOCKET_ENV names the socket in place of UNIX_SOCKET; "0" disables it.
+ */
+#define UNIX_SOCKET "%s/dlb-master-%d.sock"
+#define UNIX_SOCKET_ENV "DLB_UNIX_SOCKET"
+
+/* Named after the user's id. */
+#define UNIX_SOCKET_DIRECTORY "/tmp/dlb-%d"
+
+#define FILE_DESCRIPTORS_CODEC "fd"
+
+/* The most descriptors a frame carries. */
+#define MAX_FILE_DESCRIPTORS 2
+
+bool is_private_directory(char *directory);
+bool get_unix_socket_directory(char *directory, bool create);
+bool get_unix_socket_path(int port, char *path, bool create);
+int listen_unix(char *path, int backlog);
+int connect_unix(char *path);
+bool is_unix_socket(int socket);
+bool get_peer_uid(int socket, uid_t *uid);
+bool is_trusted_peer(int socket);
+bool send_file_descriptors(int socket, char *message, int *fds, int count);
+bool recv_file_descriptors(int socket, char *message, int *fds, int count);
+bool is_passed_file(int fd, long size);
+
+/**
+ * Tells whether a directory belongs to the user and no one else may enter it.
+ *
+ * @param directory The path to the directory, which must not be a symbolic link.
+ *
+ * @return Whether or not the directory is the user's alone.
+ */
+bool is_private_directory(char *directory) {
+    struct stat status;
+
+    return lstat(directory, &status) == 0 && S_ISDIR(status.st_mode) && status.st_uid == geteuid() && (status.st_mode & 077) == 0;
+}
+
+/**
+ * Obtains the directory the user's masters keep their Unix sockets in.
+ *
+ * @param directory Receives the path, at least MAX_BUFFER_SIZE bytes long.
+ * @param create Whether or not to create UNIX_SOCKET_DIRECTORY if it is missing, as the master does.
+ *
+ * @return Whether or not the directory is the user's alone.
+ */
+bool get_unix_socket_directory(char *directory, bool create) {
+    char *runtime = getenv("XDG_RUNTIME_DIR");
+
+    if (runtime && *runtime) {
+        snprintf(directory, MAX_BUFFER_SIZE, "%s", runtime);
+
+        if (is_private_directory(directory))
+            return true;
+    }
+
+    snprintf(directory, MAX_BUFFER_SIZE, UNIX_SOCKET_DIRECTORY, (int)geteuid());
+
+    if (create && mkdir(directory, 0700) == -1 && errno != EEXIST) {
+        perror("[X] mkdir");
+        return false;
+    }
+
+    return is_private_directory(directory);
+}
+
+/**
+ * Obtains the path of the Unix socket of the master listening on a port, from UNIX_SOCKET_ENV or in the user's directory.
+ *
+ * @param port The port the master listens for clients on.
+ * @param path Receives the path, at least MAX_BUFFER_SIZE bytes long.
+ * @param create Whether or not to create the user's directory if it is missing, as the master does.
+ *
+ * @return Whether or not the master listens on a Unix socket at the path; false if the variable is "0", or there is
+ *         no directory for the socket that is the user's alone.
+ */
+bool get_unix_socket_path(int port, char *path, bool create) {
+    char *value = getenv(UNIX_SOCKET_ENV);
+    char directory[MAX_BUFFER_SIZE];
+
+    if (value && strcmp(value, "0") == 0)
+        return false;
+
+    if (value && *value)
+        snprintf(path, MAX_BUFFER_SIZE, "%s", value);
+    else if (get_unix_socket_directory(directory, create))
+        snprintf(path, MAX_BUFFER_SIZE, UNIX_SOCKET, directory, port);
+    else
+        return false;
+
+    return strlen(path) < sizeof(((struct sockaddr_un *)NULL)->sun_path);
+}
+
+/**
+ * Creates a Unix socket at a path and listens on it, replacing whatever socket a previous master left there.
+ *
+ * @param path The path of the socket.
+ * @param backlog The most connections to queue.
+ *
+ * @return The listening socket, or -1 if it could not be created.
+ */
+int listen_unix(char *path, int backlog) {
+    struct sockaddr_un address;
+    struct stat status;
+    int listening;
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    snprintf(address.sun_path, sizeof(address.sun_path), "%s", path);
+
+    if ((listening = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1) {
+        perror("[X] socket");
+        return -1;
+    }
+
+    /* Only ever a socket of the user's is removed, never a file that happens to have its name. */
+    if (lstat(path, &status) == 0 && S_ISSOCK(status.st_mode) && status.st_uid == geteuid())
+        unlink(path);
+
+    if (bind(listening, (struct sockaddr *)&address, sizeof(address)) == -1 || listen(listening, backlog) == -1) {
+        perror("[X] bind");
+        close(listening);
+        return -1;
+    }
+
+    return listening;
+}
+
+/**
+ * Connects to a Unix socket.
+ *
+ * @param path The path of the socket.
+ *
+ * @return The connected socket, or -1 if nothing listens at the path.
+ */
+int connect_unix(char *path) {
+    struct sockaddr_un address;
+    int connected;
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    snprintf(address.sun_path, sizeof(address.sun_path), "%s", path);
+
+    if ((connected = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1) {
+        perror("[X] socket");
+        return -1;
+    }
+
+    if (connect(connected, (struct sockaddr *)&address, sizeof(address)) == -1) {
+        close(connected);
+        return -1;
+    }
+
+    return connected;
+}
+
+/**
+ * Tells whether a socket is a Unix socket.
+ *
+ * @param socket The socket.
+ *
+ * @return Whether or not descriptors may be passed over the socket.
+ */
+bool is_unix_socket(int socket) {
+    int domain;
+    socklen_t length = sizeof(domain);
+
+    return getsockopt(socket, SOL_SOCKET, SO_DOMAIN, &domain, &length) == 0 && domain == AF_UNIX;
+}
+
+/**
+ * Obtains the user the process at the other end of a Unix socket runs as, which the kernel vouches for.
+ *
+ * @param socket The connected Unix socket.
+ * @param uid Receives the peer's user id.
+ *
+ * @return Whether or not the peer's credentials could be read.
+ */
+bool get_peer_uid(int socket, uid_t *uid) {
+    /* The layout of struct ucred, which <sys/socket.h> only declares with _GNU_SOURCE. */
+    struct {
+        pid_t pid;
+        uid_t uid;
+        gid_t gid;
+    } peer;
+    socklen_t length = sizeof(peer);
+
+    if (getsockopt(socket, SOL_SOCKET, SO_PEERCRED, &peer, &length) == -1 || length != sizeof(peer))
+        return false;
+
+    *uid = peer.uid;
+
+    return true;
+}
+
+/**
+ * Tells whether the process at the other end of a Unix socket runs as the user or as root.
+ *
+ * @param socket The connected Unix socket.
+ *
+ * @return Whether or not the peer may be handed the user's files.
+ */
+bool is_trusted_peer(int socket) {
+    uid_t uid;
+
+    return get_peer_uid(socket, &uid) && (uid == geteuid() || uid == 0);
+}
+
+/**
+ * Sends a frame along with open descriptors over a Unix socket.
+ *
+ * @param socket The connected Unix socket.
+ * @param message The message, sent as a MAX_BUFFER_SIZE frame.
+ * @param fds The descriptors, which stay open on the sender.
+ * @param count The number of descriptors, at most MAX_FILE_DESCRIPTORS.
+ *
+ * @return Whether or not the frame and the descriptors were sent.
+ */
+bool send_file_descriptors(int socket, char *message, int *fds, int count) {
+    char frame[MAX_BUFFER_SIZE];
+    union {
+        char buffer[CMSG_SPACE(sizeof(int) * MAX_FILE_DESCRIPTORS)];
+        struct cmsghdr align;
+    } control;
+
+    memset(frame, 0, sizeof(frame));
+    strncpy(frame, message, sizeof(frame) - 1);
+    memset(&control, 0, sizeof(control));
+
+    struct iovec iov = { frame, sizeof(frame) };
+    struct msghdr header = { 0 };
+
+    header.msg_iov = &iov;
+    header.msg_iovlen = 1;
+    header.msg_control = control.buffer;
+    header.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+
+    struct cmsghdr *rights = CMSG_FIRSTHDR(&header);
+
+    rights->cmsg_level = SOL_SOCKET;
+    rights->cmsg_type = SCM_RIGHTS;
+    rights->cmsg_len = CMSG_LEN(sizeof(int) * count);
+    memcpy(CMSG_DATA(rights), fds, sizeof(int) * count);
+
+    ssize_t sent;
+
+    while ((sent = sendmsg(socket, &header, MSG_NOSIGNAL)) == -1 && errno == EINTR);
+
+    if (sent == -1) {
+        perror("[X] sendmsg");
+        return false;
+    }
+
+    /* The descriptors went with the first byte; the rest of the frame follows as any other. */
+    return sent == sizeof(frame) || send_all(socket, frame + sent, sizeof(frame) - sent, NULL);
+}
+
+/**
+ * Receives a frame along with the open descriptors passed with it over a Unix socket.
+ *
+ * @param socket The connected Unix socket.
+ * @param message Receives the message, at least MAX_BUFFER_SIZE bytes long.
+ * @param fds Receives the descriptors, which the caller must close.
+ * @param count The number of descriptors expected, at most MAX_FILE_DESCRIPTORS.
+ *
+ * @return Whether or not the frame came with exactly that many descriptors; any others that came with it are closed.
+ */
+bool recv_file_descriptors(int socket, char *message, int *fds, int count) {
+    union {
+        char buffer[CMSG_SPACE(sizeof(int) * MAX_FILE_DESCRIPTORS)];
+        struct cmsghdr align;
+    } control;
+
+    struct iovec iov = { message, MAX_BUFFER_SIZE };
+    struct msghdr header = { 0 };
+
+    header.msg_iov = &iov;
+    header.msg_iovlen = 1;
+    header.msg_control = control.buffer;
+    header.msg_controllen = sizeof(control.buffer);
+
+    ssize_t received;
+
+    while ((received = recvmsg(socket, &header, MSG_CMSG_CLOEXEC)) == -1 && errno == EINTR);
+
+    if (received <= 0)
+        return false;
+
+    int passed = 0;
+
+    for (struct cmsghdr *rights = CMSG_FIRSTHDR(&header); rights; rights = CMSG_NXTHDR(&header, rights)) {
+        if (rights->cmsg_level != SOL_SOCKET || rights->cmsg_type != SCM_RIGHTS)
+            continue;
+
+        int n = (int)((rights->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+        int *received_fds = (int *)CMSG_DATA(rights);
+
+        for (int i = 0; i < n; i++) {
+            if (passed < count)
+                fds[passed] = received_fds[i];
+            else
+                close(received_fds[i]);
+
+            passed++;
+        }
+    }
+
+    /* Descriptors that did not fit are closed by the kernel, and a frame missing some is of no use either. */
+    bool complete = passed == count && !(header.msg_flags & MSG_CTRUNC);
+
+    if (!complete)
+        for (int i = 0; i < passed && i < count; i++)
+            close(fds[i]);
+
+    bool framed = received == MAX_BUFFER_SIZE || recv_exact(socket, message + received, MAX_BUFFER_SIZE - received, NULL);
+
+    message[MAX_BUFFER_SIZE - 1] = '\0';
+
+    if (!framed && complete)
+        for (int i = 0; i < count; i++)
+            close(fds[i]);
+
+    return framed && complete;
+}
+
+/**
+ * Tells whether a descriptor a client passed can stand in for a file announced in its job request.
+ *
+ * @param fd The descriptor.
+ * @param size The announced size of the file.
+ *
+ * @return Whether or not the descriptor is of a regular file holding at least that many bytes; pipes and devices
+ *         could keep the master waiting.
+ */
+bool is_passed_file(int fd, long size) {
+    struct stat status;
+
+    return fstat(fd, &status) == 0 && S_ISREG(status.st_mode) && status.st_size >= size;
+}
+
+#endif
@@ -1,6 +1,10 @@
+#ifndef UTILITIES_H
+#define UTILITIES_H
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 #include <unistd.h>
 #include <netdb.h>
@@ -11,50 +15,186 @@
 #include <asm/errno.h>
 #include <errno.h>
 #include <sys/stat.h>
+#include <fcntl.h>
 #include <limits.h>
 #include <libgen.h>
 
 #define MAX_BUFFER_SIZE 100
 #define MAX_BACKLOG 100
+#define MAX_SLAVES 1024
+#define TRACE_ID_LENGTH 32
 #define MAX_SLEEP_TIME 10
-#define MAX_FILE_BUFFER_SIZE 1000
+#define MIN_CHUNK_SIZE (64 * 1024)
+#define MAX_CHUNK_SIZE (1024 * 1024)
 
 #define LISTEN_FOR_SLAVES_PORT 8081
 #define LISTEN_FOR_CLIENTS_PORT 8082
 #define SEND_CPU_UTILIZATION_PORT 8083
 #define SEND_JOB_PORT 8084
+#define METRICS_PORT 8085
+
+/* Every port can be overridden at runtime, e.g. to run several slaves on one host. */
+#define LISTEN_FOR_SLAVES_PORT_ENV "DLB_SLAVES_PORT"
+#define LISTEN_FOR_CLIENTS_PORT_ENV "DLB_CLIENTS_PORT"
+#define SEND_CPU_UTILIZATION_PORT_ENV "DLB_CPU_UTILIZATION_PORT"
+#define SEND_JOB_PORT_ENV "DLB_JOB_PORT"
+#define METRICS_PORT_ENV "DLB_METRICS_PORT"
+#define SLAVE_ADDRESS_ENV "DLB_SLAVE_ADDRESS"
+
+/* How many slaves a job is tried on, and how long each may take to accept it, before the job fails. */
+#define MAX_ATTEMPTS 4
+#define ATTEMPT_TIMEOUT 5000
+#define MAX_ATTEMPTS_ENV "DLB_MAX_ATTEMPTS"
+#define ATTEMPT_TIMEOUT_ENV "DLB_ATTEMPT_TIMEOUT_MS"
+
+/* How long the master waits for a slave's next heartbeat before evicting it. */
+#define HEARTBEAT_TIMEOUT 30000
+#define HEARTBEAT_TIMEOUT_ENV "DLB_HEARTBEAT_TIMEOUT_MS"
+
+/*
+ * A job's deadline travels to the slave as an assignment of this variable in
+ * front of its command, holding the milliseconds the job has left. Slaves that
+ * predate deadlines run the command unchanged, and the job can read it too.
+ */
+#define DEADLINE_ENV "DLB_DEADLINE_MS"
+
+/* The priority class of a job, which decides how soon it gets a slave when jobs are waiting. */
+#define PRIORITY_INTERACTIVE 0
+#define PRIORITY_NORMAL 1
+#define PRIORITY_BATCH 2
+#define PRIORITY_COUNT 3
+
+const char *PRIORITY_NAMES[PRIORITY_COUNT] = {
+    "interactive", "normal", "batch"
+};
+
+/* Jobs waiting for a slave take turns by client, and a client's jobs by the tenant it names with this variable. */
+#define TENANT_ENV "DLB_TENANT"
+#define TENANT_LENGTH 32
 
 typedef struct Buffer Buffer;
 
 struct Buffer {
     char *file_name;
     char *data;
-    int size;
+    long size;
+    long encoded_size;
 };
 
 struct Job {
     Buffer *executable;
     Buffer *input_file;
     char *command;
+    int codec;
+    char trace_id[TRACE_ID_LENGTH + 1];
+
+    /* A hash of the executable as it came on the wire, taken once it was received; jobs of the same executable share runtimes and batches by it. */
+    uint64_t key;
+
+    /* When the job must be done by, as returned by now_nanoseconds(); 0 if it has no deadline. */
+    unsigned long deadline;
+
+    /* The PRIORITY_* class of the job, and the tenant it takes its client's turns as; empty if it names none. */
+    int priority;
+    char tenant[TENANT_LENGTH + 1];
+
+    /* The bytes of the master's memory budget held for the job's files; 0 until it is admitted. */
+    long reserved;
+
+    /* The descriptors of the executable and input file a client on the master's host passed in place of their bytes, or -1. */
+    int fds[2];
 };
 
 char *get_address();
+int get_port(char *variable, int default_port);
+int get_setting(char *variable, int default_value);
+int get_priority(char *name);
+char *get_tenant();
 float calc_cpu_util();
 char *execute(char *command);
 Buffer *createBuffer();
 Buffer *read_file(char *file_path, char *mode);
+Buffer *stat_file(char *file_path);
 void write_file(char *file_path, Buffer *file, char *mode);
 bool does_file_exist(char *file_path);
 char* get_user_input(char *message);
 char **split(char *str, const char separator);
 
 /**
- * Obtains the IPv4 address of this given machine.
+ * Obtains the IPv4 address of this given machine, unless SLAVE_ADDRESS_ENV names another one.
+ *
+ * WARNING: 'get_address' malloc()s memory to '*address' which must be freed by
+ * the caller.
  *
  * @return the IPv4 address of this given machine.
  */
 char *get_address() {
-    return execute("hostname -I |  awk '{print $1}'");
+    char *address = getenv(SLAVE_ADDRESS_ENV);
+
+    return address ? strdup(address) : execute("hostname -I |  awk '{print $1}'");
+}
+
+/**
+ * Obtains a port, letting an environment variable override its compile-time default.
+ *
+ * @param variable The name of the environment variable, e.g. SEND_JOB_PORT_ENV.
+ * @param default_port The port to use when the variable is unset or not a valid port.
+ *
+ * @return The port to use.
+ */
+int get_port(char *variable, int default_port) {
+    char *value = getenv(variable);
+    int port = value ? atoi(value) : 0;
+
+    return port > 0 && port <= 65535 ? port : default_port;
+}
+
+/**
+ * Obtains a positive setting from an environment variable.
+ *
+ * @param variable The environment variable that overrides the setting.
+ * @param default_value The setting to use when the variable is unset or not a positive number.
+ *
+ * @return The setting.
+ */
+int get_setting(char *variable, int default_value) {
+    char *value = getenv(variable);
+    int setting = value ? atoi(value) : 0;
+
+    return setting > 0 ? setting : default_value;
+}
+
+/**
+ * Looks up a priority class by the name used on the wire.
+ *
+ * @param name "interactive", "normal" or "batch"; NULL selects PRIORITY_NORMAL.
+ *
+ * @return The PRIORITY_*, or -1 if the name is unknown.
+ */
+int get_priority(char *name) {
+    if (!name)
+        return PRIORITY_NORMAL;
+
+    for (int priority = 0; priority < PRIORITY_COUNT; priority++) {
+        if (strcmp(name, PRIORITY_NAMES[priority]) == 0)
+            return priority;
+    }
+
+    return -1;
+}
+
+/**
+ * Obtains the tenant this client submits jobs as from TENANT_ENV.
+ *
+ * @return The tenant, or NULL if the variable is unset or not a single word of at most TENANT_LENGTH characters.
+ */
+char *get_tenant() {
+    char *tenant = getenv(TENANT_ENV);
+
+    if (!tenant || strlen(tenant) == 0 || strlen(tenant) > TENANT_LENGTH || strpbrk(tenant, " \t\n"))
+        return NULL;
+
+    return tenant;
 }
 
 /**
@@ -114,7 +254,7 @@ char *execute(char *command) {
             exit(1);
         }
 
-        size_t n;
+        size_t n = MAX_BUFFER_SIZE;
 
         while ((getline(&response, &n, file) > 0) && response) {
             // remove trailing new line character
@@ -124,9 +264,10 @@ char *execute(char *command) {
             pclose(file);
             return response;
         }
-    }
 
-    pclose(file);
+        free(response);
+        pclose(file);
+    }
 
     return NULL;
 }
@@ -145,6 +286,7 @@ Buffer *createBuffer() {
     buf->file_name = NULL;
     buf->data = NULL;
     buf->size = -1;
+    buf->encoded_size = -1;
 
     return buf;
 }
@@ -203,6 +345,43 @@ Buffer *read_file(char *file_path, char *mode) {
     buf->file_name = basename(file_path);
     buf->data = data;
     buf->size = result;
+    buf->encoded_size = -1;
+
+    return buf;
+}
+
+/**
+ * Obtains the name and size of a file without reading its contents into memory.
+ *
+ * WARNING: 'stat_file' malloc()s memory to '*buf' which must be freed by
+ * the caller. The returned buffer's 'data' is always NULL.
+ *
+ * @param file_path The path to the file.
+ *
+ * @return The file buffer structure representation of the file, or NULL if it could not be stat()ed.
+ */
+Buffer *stat_file(char *file_path) {
+    int fd = open(file_path, O_RDONLY);
+
+    if (fd == -1) {
+        perror("[X] open");
+        return NULL;
+    }
+
+    struct stat st;
+
+    if (fstat(fd, &st) == -1) {
+        perror("[X] fstat");
+        close(fd);
+        return NULL;
+    }
+
+    close(fd);
+
+    Buffer *buf = createBuffer();
+
+    buf->file_name = basename(file_path);
+    buf->size = st.st_size;
 
     return buf;
 }
@@ -336,4 +515,6 @@ char **split(char *str, const char separator) {
     }
 
     return result;
-}
\ No newline at end of file
+}
+
+#endif
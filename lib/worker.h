@@ -0,0 +1,83 @@
+#ifndef WORKER_H
+#define WORKER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * The persistent-job ABI. Starting a process for every job costs more than a
+ * tiny job takes to run, so an executable may instead stay resident on a slave
+ * and run job after job. Executables opt in by including this header and
+ * handing their job to serve_jobs(), which embeds WORKER_ABI_MARKER in them.
+ *
+ * A slave starts such an executable as a worker, with WORKER_ENV set, and
+ * writes it one request per line on stdin: the directory to run the job in,
+ * then the job's arguments from argv[0] on, all separated by tabs. The worker
+ * runs the job there, writing to stdout and stderr as a job of its own would,
+ * then writes the job's exit status as a line to WORKER_REPLY_FD. A worker
+ * exits once its stdin closes.
+ */
+#define WORKER_ABI_MARKER "DLB_PERSISTENT_WORKER_ABI_1"
+#define WORKER_ENV "DLB_WORKER"
+#define WORKER_REPLY_FD 3
+
+#define MAX_WORKER_REQUEST 4096
+#define MAX_WORKER_ARGUMENTS 64
+
+/* Runs one job, given its arguments as main() would be, and returns its exit status. */
+typedef int (*JobHandler)(int argc, char **argv);
+
+/* What a slave looks for in an executable before starting it as a worker. */
+const char worker_abi_marker[] = WORKER_ABI_MARKER;
+
+bool is_worker();
+int serve_jobs(JobHandler handler);
+
+/**
+ * Tells whether the executable was started as a worker by a slave.
+ *
+ * @return Whether or not requests for jobs arrive on stdin.
+ */
+bool is_worker() {
+    return getenv(WORKER_ENV) != NULL && worker_abi_marker[0] != '\0';
+}
+
+/**
+ * Runs the jobs a slave sends a worker until the slave closes its stdin.
+ *
+ * @param handler Runs each job.
+ *
+ * @return The worker's exit status: 0 once the slave closed stdin, or 1 if the slave stopped reading replies.
+ */
+int serve_jobs(JobHandler handler) {
+    char request[MAX_WORKER_REQUEST];
+    char *arguments[MAX_WORKER_ARGUMENTS + 1];
+
+    while (fgets(request, sizeof(request), stdin)) {
+        int count = 0;
+
+        request[strcspn(request, "\n")] = '\0';
+
+        for (char *field = strtok(request, "\t"); field && count < MAX_WORKER_ARGUMENTS; field = strtok(NULL, "\t"))
+            arguments[count++] = field;
+
+        arguments[count] = NULL;
+
+        /* The first field is the directory; the job only sees its arguments, as it would when run on its own. */
+        int status = count > 1 && chdir(arguments[0]) == 0 ? handler(count - 1, arguments + 1) : 127;
+
+        /* What the job wrote must reach the slave before its reply does. */
+        fflush(stdout);
+        fflush(stderr);
+
+        if (dprintf(WORKER_REPLY_FD, "%d\n", status) < 0)
+            return 1;
+    }
+
+    return 0;
+}
+
+#endif
@@ -0,0 +1,543 @@
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+
+#include "utilities.h"
+#include "sha256.h"
+#include "worker.h"
+
+extern char **environ;
+
+/*
+ * A slave keeps the workers of executables that follow the persistent-job ABI
+ * (see worker.h) warm between jobs, up to WARM_WORKERS idle ones for each
+ * executable, told apart by the SHA-256 digest of its bytes, and
+ * MAX_WARM_WORKERS in all. A job is handed to whichever worker has its key, so
+ * keys must not be collided on purpose by whoever submits executables.
+ * A worker runs one job at a time. One that dies, or whose job is cancelled or
+ * misses its deadline, is stopped rather than put back, so no job sees what a
+ * stopped one left behind. Workers exit with the slave, as their stdin closes.
+ *
+ * WARM_WORKERS 0 runs every job in a process of its own.
+ */
+#define WARM_WORKERS 2
+#define WARM_WORKERS_ENV "DLB_WARM_WORKERS"
+#define MAX_WARM_WORKERS 16
+
+/* Where workers' executables are kept, named by their key in hex, once their jobs' copies are removed. */
+#define WORKERS_DIRECTORY "workers"
+
+#define WORKER_KEY_SIZE SHA256_SIZE
+
+/*
+ * How many files the keys of are remembered, by their device, inode, size and
+ * modification time, so none is read twice. A file modified less than a second
+ * before it was read is not remembered: another could take its inode within
+ * the same clock tick, and look the same.
+ */
+#define WORKER_KEY_CACHE 64
+
+typedef struct Worker Worker;
+typedef struct WorkerKey WorkerKey;
+typedef struct WorkerPool WorkerPool;
+
+struct Worker {
+    unsigned char key[WORKER_KEY_SIZE];
+    pid_t pid;
+
+    /* The slave's ends of the worker's stdin, its reply channel and its stdout and stderr. */
+    int requests;
+    int replies;
+    int output;
+
+    Worker *next;
+};
+
+/* What a file was found to be when it was last read. */
+struct WorkerKey {
+    dev_t device;
+    ino_t inode;
+    off_t size;
+    struct timespec modified;
+
+    bool persistent;
+    unsigned char key[WORKER_KEY_SIZE];
+};
+
+struct WorkerPool {
+    int size;
+
+    /* Idle workers, the most recently used first. */
+    Worker *idle;
+    int count;
+
+    /* The keys of the files read last, replaced in turn. */
+    WorkerKey keys[WORKER_KEY_CACHE];
+    int next_key;
+
+    pthread_mutex_t lock;
+};
+
+int get_warm_workers();
+WorkerPool *createWorkerPool(int size);
+bool get_worker_key(WorkerPool *pool, char *executable, unsigned char *key);
+void get_worker_path(const unsigned char *key, char *path, size_t size);
+bool is_same_file(char *path, char *other);
+Worker *start_worker(char *executable, const unsigned char *key);
+Worker *acquire_worker(WorkerPool *pool, char *executable, const unsigned char *key, bool *warm);
+bool send_worker_request(Worker *worker, char *directory, char *command);
+void release_worker(WorkerPool *pool, Worker *worker);
+void stop_worker(Worker *worker);
+void stop_workers(WorkerPool *pool);
+
+/**
+ * Obtains the number of idle workers kept for each executable from WARM_WORKERS_ENV.
+ *
+ * @return The number of workers, 0 if persistent workers are disabled, or WARM_WORKERS if the variable is unset or out of range.
+ */
+int get_warm_workers() {
+    char *value = getenv(WARM_WORKERS_ENV);
+    int workers = value ? atoi(value) : WARM_WORKERS;
+
+    return workers >= 0 && workers <= MAX_WARM_WORKERS ? workers : WARM_WORKERS;
+}
+
+/**
+ * Creates the pool of a slave's workers.
+ *
+ * WARNING: 'createWorkerPool' malloc()s memory to '*pool' which must be freed by
+ * the caller.
+ *
+ * @param size The most idle workers kept for each executable; 0 starts none.
+ *
+ * @return The pool, with no workers.
+ */
+WorkerPool *createWorkerPool(int size) {
+    WorkerPool *pool = (WorkerPool *)calloc(1, sizeof(WorkerPool));
+
+    if (!pool) {
+        perror("[X] calloc");
+        exit(1);
+    }
+
+    pool->size = size < 0 ? 0 : size > MAX_WARM_WORKERS ? MAX_WARM_WORKERS : size;
+    pthread_mutex_init(&pool->lock, NULL);
+
+    return pool;
+}
+
+/**
+ * Tells whether a job's executable follows the persistent-job ABI.
+ *
+ * The file is read in place through a mapping, once; a file whose device,
+ * inode, size and modification time are remembered is not read again.
+ *
+ * @param pool The pool.
+ * @param executable The path to the executable.
+ * @param key Receives the WORKER_KEY_SIZE byte digest of the executable's bytes, which its workers are kept under.
+ *
+ * @return Whether or not the executable may run as a worker.
+ */
+bool get_worker_key(WorkerPool *pool, char *executable, unsigned char *key) {
+    struct stat status;
+
+    if (pool->size == 0)
+        return false;
+
+    int fd = open(executable, O_RDONLY | O_CLOEXEC);
+
+    if (fd == -1 || fstat(fd, &status) == -1 || !S_ISREG(status.st_mode)) {
+        if (fd != -1)
+            close(fd);
+
+        return false;
+    }
+
+    WorkerKey found = { status.st_dev, status.st_ino, status.st_size, status.st_mtim, false, { 0 } };
+    bool cached = false;
+
+    pthread_mutex_lock(&pool->lock);
+
+    for (int i = 0; i < WORKER_KEY_CACHE && !cached; i++) {
+        WorkerKey *entry = &pool->keys[i];
+
+        if (entry->device == found.device && entry->inode == found.inode && entry->size == found.size
+            && entry->modified.tv_sec == found.modified.tv_sec && entry->modified.tv_nsec == found.modified.tv_nsec) {
+            found = *entry;
+            cached = true;
+        }
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+
+    if (!cached) {
+        char *data = status.st_size > 0 ? (char *)mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+
+        if (data == MAP_FAILED) {
+            perror("[X] mmap");
+            close(fd);
+            return false;
+        }
+
+        found.persistent = data && memmem(data, status.st_size, WORKER_ABI_MARKER, strlen(WORKER_ABI_MARKER)) != NULL;
+
+        if (found.persistent)
+            sha256(data, status.st_size, found.key);
+
+        if (data)
+            munmap(data, status.st_size);
+
+        struct timespec now;
+
+        if (clock_gettime(CLOCK_REALTIME, &now) == 0 && now.tv_sec - found.modified.tv_sec > 1) {
+            pthread_mutex_lock(&pool->lock);
+            pool->keys[pool->next_key] = found;
+            pool->next_key = (pool->next_key + 1) % WORKER_KEY_CACHE;
+            pthread_mutex_unlock(&pool->lock);
+        }
+    }
+
+    close(fd);
+
+    memcpy(key, found.key, WORKER_KEY_SIZE);
+
+    return found.persistent;
+}
+
+/**
+ * Obtains the path a worker's executable is kept at.
+ *
+ * @param key The worker's key.
+ * @param path Receives the path.
+ * @param size The size of 'path'.
+ */
+void get_worker_path(const unsigned char *key, char *path, size_t size) {
+    int length = snprintf(path, size, "%s/", WORKERS_DIRECTORY);
+
+    for (int i = 0; i < WORKER_KEY_SIZE && length + 2 < (int)size; i++)
+        length += snprintf(path + length, size - length, "%02x", key[i]);
+}
+
+/**
+ * Tells whether two paths hold the same bytes.
+ *
+ * @param path The path to a file.
+ * @param other The path to the other file.
+ *
+ * @return Whether or not both are links to one file, or regular files with the same contents.
+ */
+bool is_same_file(char *path, char *other) {
+    struct stat status, other_status;
+    int fd = open(path, O_RDONLY | O_CLOEXEC), other_fd = open(other, O_RDONLY | O_CLOEXEC);
+    bool same = fd != -1 && other_fd != -1 && fstat(fd, &status) == 0 && fstat(other_fd, &other_status) == 0
+        && S_ISREG(status.st_mode) && S_ISREG(other_status.st_mode) && status.st_size == other_status.st_size;
+
+    if (same && (status.st_dev != other_status.st_dev || status.st_ino != other_status.st_ino) && status.st_size > 0) {
+        char *data = (char *)mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        char *other_data = (char *)mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, other_fd, 0);
+
+        same = data != MAP_FAILED && other_data != MAP_FAILED && memcmp(data, other_data, status.st_size) == 0;
+
+        if (data != MAP_FAILED)
+            munmap(data, status.st_size);
+
+        if (other_data != MAP_FAILED)
+            munmap(other_data, status.st_size);
+    }
+
+    if (fd != -1)
+        close(fd);
+
+    if (other_fd != -1)
+        close(other_fd);
+
+    return same;
+}
+
+/**
+ * Starts a worker in a process group of its own, from a copy of its executable that outlives the job.
+ *
+ * @param executable The path to the executable.
+ * @param key The digest of the executable's bytes.
+ *
+ * @return The worker, or NULL if it could not be started.
+ */
+Worker *start_worker(char *executable, const unsigned char *key) {
+    char path[MAX_BUFFER_SIZE], replacement[MAX_BUFFER_SIZE];
+    int requests[2], replies[2], output[2];
+
+    get_worker_path(key, path, sizeof(path));
+
+    if ((mkdir(WORKERS_DIRECTORY, 0755) == -1 && errno != EEXIST) || (link(executable, path) == -1 && errno != EEXIST)) {
+        perror("[X] link");
+        return NULL;
+    }
+
+    /* A copy kept under the key is only reused if it holds the executable's bytes; any other is replaced in one step. */
+    if (!is_same_file(executable, path)) {
+        snprintf(replacement, sizeof(replacement), "%s.%d", path, (int)getpid());
+        unlink(replacement);
+
+        if (link(executable, replacement) == -1 || rename(replacement, path) == -1) {
+            perror("[X] rename");
+            unlink(replacement);
+            return NULL;
+        }
+    }
+
+    /* The slave's ends must not leak into the jobs and workers it starts later, or a worker would never see its stdin close. */
+    if (pipe2(requests, O_CLOEXEC) == -1) {
+        perror("[X] pipe2");
+        return NULL;
+    }
+
+    if (pipe2(replies, O_CLOEXEC) == -1) {
+        perror("[X] pipe2");
+        close(requests[0]);
+        close(requests[1]);
+        return NULL;
+    }
+
+    if (pipe2(output, O_CLOEXEC) == -1) {
+        perror("[X] pipe2");
+        close(requests[0]);
+        close(requests[1]);
+        close(replies[0]);
+        close(replies[1]);
+        return NULL;
+    }
+
+    /* The child may only make async-signal-safe calls, so its environment is put together beforehand. */
+    int variables = 0;
+
+    while (environ[variables])
+        variables++;
+
+    char **environment = (char **)malloc(sizeof(char *) * (variables + 2));
+    char *arguments[] = { basename(executable), NULL };
+
+    if (!environment) {
+        perror("[X] malloc");
+        exit(1);
+    }
+
+    memcpy(environment, environ, sizeof(char *) * variables);
+    environment[variables] = WORKER_ENV "=1";
+    environment[variables + 1] = NULL;
+
+    pid_t pid = fork();
+
+    if (pid == 0) {
+        setpgid(0, 0);
+
+        dup2(requests[0], STDIN_FILENO);
+        dup2(output[1], STDOUT_FILENO);
+        dup2(output[1], STDERR_FILENO);
+
+        if (replies[1] == WORKER_REPLY_FD)
+            fcntl(WORKER_REPLY_FD, F_SETFD, 0);
+        else
+            dup2(replies[1], WORKER_REPLY_FD);
+
+        /* A worker outlives the connection of the job that started it, so it must not hold the slave's sockets open. */
+#ifdef SYS_close_range
+        if (syscall(SYS_close_range, WORKER_REPLY_FD + 1, ~0U, 0) == -1)
+#endif
+            for (long fd = WORKER_REPLY_FD + 1; fd < sysconf(_SC_OPEN_MAX); fd++)
+                close((int)fd);
+
+        execve(path, arguments, environment);
+        _exit(127);
+    }
+
+    free(environment);
+
+    close(requests[0]);
+    close(replies[1]);
+    close(output[1]);
+
+    if (pid == -1) {
+        perror("[X] fork");
+        close(requests[1]);
+        close(replies[0]);
+        close(output[0]);
+        return NULL;
+    }
+
+    /* Both sides set the group, so it exists whichever of them runs first. */
+    setpgid(pid, pid);
+
+    /* Once a job's reply is in, what it wrote before is read without waiting for more. */
+    fcntl(output[0], F_SETFL, fcntl(output[0], F_GETFL) | O_NONBLOCK);
+
+    Worker *worker = (Worker *)malloc(sizeof(Worker));
+
+    if (!worker) {
+        perror("[X] malloc");
+        exit(1);
+    }
+
+    memcpy(worker->key, key, WORKER_KEY_SIZE);
+    worker->pid = pid;
+    worker->requests = requests[1];
+    worker->replies = replies[0];
+    worker->output = output[0];
+    worker->next = NULL;
+
+    return worker;
+}
+
+/**
+ * Takes an idle worker for an executable out of the pool, or starts one.
+ *
+ * @param pool The pool.
+ * @param executable The path to the executable.
+ * @param key The digest of the executable's bytes.
+ * @param warm Receives whether or not the worker ran a job before.
+ *
+ * @return The worker, which must be handed back with release_worker() or stopped, or NULL if none could be started.
+ */
+Worker *acquire_worker(WorkerPool *pool, char *executable, const unsigned char *key, bool *warm) {
+    pthread_mutex_lock(&pool->lock);
+
+    Worker **link = &pool->idle;
+
+    while (*link && memcmp((*link)->key, key, WORKER_KEY_SIZE) != 0)
+        link = &(*link)->next;
+
+    Worker *worker = *link;
+
+    if (worker) {
+        *link = worker->next;
+        pool->count--;
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+
+    *warm = worker != NULL;
+
+    return worker ? worker : start_worker(executable, key);
+}
+
+/**
+ * Sends a worker the request for a job.
+ *
+ * @param worker The worker.
+ * @param directory The absolute path to the directory the job's files are in.
+ * @param command The job's command, e.g. "./countwords in.txt", after any variable assignments.
+ *
+ * @return Whether or not the request was sent; a worker that cannot be sent to must be stopped.
+ */
+bool send_worker_request(Worker *worker, char *directory, char *command) {
+    char request[MAX_WORKER_REQUEST];
+    int length = snprintf(request, sizeof(request), "%s\t", directory);
+
+    /* The master separates arguments with spaces and quotes none of them, so tabs separate the same ones. */
+    for (char *c = command; *c && length < (int)sizeof(request) - 1; c++)
+        request[length++] = *c == ' ' ? '\t' : *c;
+
+    if (length >= (int)sizeof(request) - 1)
+        return false;
+
+    request[length++] = '\n';
+
+    return write(worker->requests, request, length) == length;
+}
+
+/**
+ * Hands a worker that finished its job back to the pool, stopping it if the pool is full.
+ *
+ * @param pool The pool.
+ * @param worker The worker.
+ */
+void release_worker(WorkerPool *pool, Worker *worker) {
+    Worker *stopped = NULL;
+    int idle = 0;
+
+    pthread_mutex_lock(&pool->lock);
+
+    for (Worker *other = pool->idle; other; other = other->next)
+        idle += memcmp(other->key, worker->key, WORKER_KEY_SIZE) == 0;
+
+    if (idle >= pool->size) {
+        stopped = worker;
+    } else {
+        worker->next = pool->idle;
+        pool->idle = worker;
+        pool->count++;
+
+        /* Past the pool's limit the least recently used worker, of any executable, goes. */
+        if (pool->count > MAX_WARM_WORKERS) {
+            Worker **link = &pool->idle;
+
+            while ((*link)->next)
+                link = &(*link)->next;
+
+            stopped = *link;
+            *link = NULL;
+            pool->count--;
+        }
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+
+    if (stopped)
+        stop_worker(stopped);
+}
+
+/**
+ * Stops a worker, with everything it started, and frees it.
+ *
+ * @param worker The worker.
+ */
+void stop_worker(Worker *worker) {
+    kill(-worker->pid, SIGKILL);
+
+    close(worker->requests);
+    close(worker->replies);
+    close(worker->output);
+
+    while (waitpid(worker->pid, NULL, 0) == -1 && errno == EINTR);
+
+    free(worker);
+}
+
+/**
+ * Stops every idle worker in a pool.
+ *
+ * @param pool The pool.
+ */
+void stop_workers(WorkerPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+
+    Worker *worker = pool->idle;
+
+    pool->idle = NULL;
+    pool->count = 0;
+
+    pthread_mutex_unlock(&pool->lock);
+
+    while (worker) {
+        Worker *next = worker->next;
+
+        stop_worker(worker);
+        worker = next;
+    }
+}
+
+#endif
@@ -15,6 +15,9 @@
  * @date 12/13/2019
  */
 
+/* For POLLRDHUP, which tells a client that hung up apart from one that sent more. */
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <pthread.h>
 #include <stdbool.h>
@@ -24,32 +27,200 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <signal.h>
 
 #include "lib/slavelist.h"
+#include "lib/scheduler.h"
 #include "lib/utilities.h"
+#include "lib/transfer.h"
+#include "lib/compress.h"
+#include "lib/dedup.h"
+#include "lib/metrics.h"
+#include "lib/log.h"
+#include "lib/trace.h"
+#include "lib/stream.h"
+#include "lib/speculate.h"
+#include "lib/fairqueue.h"
+#include "lib/admission.h"
+#include "lib/steal.h"
+#include "lib/batch.h"
+#include "lib/shm.h"
+#include "lib/unix.h"
 
 typedef struct thread_attr thread_attr;
 typedef struct Client Client;
 typedef struct Job Job;
+typedef struct Session Session;
+typedef struct SessionJob SessionJob;
+typedef struct OutputSink OutputSink;
+typedef struct Attempt Attempt;
+typedef struct Outrun Outrun;
+
+#define SINK_BUFFER 0
+#define SINK_STREAM 1
+#define SINK_SESSION 2
 
 struct thread_attr {
     SlaveList *list;
-    Slave *optimal_slave;
+    Scheduler *scheduler;
+    ChunkStore *store;
+    Metrics *metrics;
+    RuntimeTable *runtimes;
+    FairQueue *queue;
+    Admission *admission;
+    StealBoard *board;
+    Batcher *batcher;
+
+    /* Whether the files of jobs go through shared memory to slaves on the master's host, and the least bytes worth it. */
+    bool shared_memory;
+    long shared_memory_min_size;
+
+    int max_attempts;
+    int attempt_timeout;
+    int heartbeat_timeout;
     bool terminated;
 };
 
 struct Client {
     int socket;
-    struct sockaddr_in *address;
+    struct sockaddr_in address;
+    unsigned long started;
+
+    thread_attr *attr;
+};
+
+/*
+ * A client connection that pipelines many jobs. Jobs are uploaded one after
+ * another without acknowledgements, each runs in its own thread, and their
+ * outputs are sent back tagged as they complete, in any order.
+ */
+struct Session {
+    Client *client;
+    int codec;
+
+    /* Serializes frames to the client, and guards the references held by the reader and running jobs. */
+    pthread_mutex_t lock;
+    int references;
+};
+
+struct SessionJob {
+    Session *session;
+    Job *job;
+    long tag;
+    unsigned long started;
+};
+
+/*
+ * Where the output of a job goes as its blocks arrive from the slave: collected
+ * whole for clients that predate streaming (SINK_BUFFER), forwarded to the
+ * client as is (SINK_STREAM), or forwarded tagged to a session (SINK_SESSION).
+ */
+struct OutputSink {
+    int mode;
+    Client *client;
+    Session *session;
+    long tag;
+    int codec;
+
+    char name[MAX_BUFFER_SIZE];
+    long blocks;
+    TransferStats stats;
+
+    /* The status a job that failed ends with, when it is more telling than {FAILED_TO_EXECUTE_JOB}. */
+    char *failure;
+
+    /* SINK_BUFFER only: the output so far, as it goes on the wire. */
+    Buffer *output;
+    long length;
+    long capacity;
+};
+
+#define ATTEMPT_RUNNING 0
+#define ATTEMPT_STREAMING 1
+#define ATTEMPT_OUTPUT 2
+#define ATTEMPT_FAILED 3
+#define ATTEMPT_ABANDONED 4
+
+/* What await_greeting() returns. */
+#define GREETING_RECEIVED 0
+#define GREETING_STOLEN 1
+#define GREETING_ABANDONED 2
+#define GREETING_FAILED 3
+
+/* What await_output() returns when no attempt has output yet. */
+#define AWAIT_TIMED_OUT -1
+#define AWAIT_HUNG_UP -2
+
+/* How often a job waiting for its turn, or for its slave, checks whether its client hung up, in milliseconds. */
+#define QUEUE_CHECK_INTERVAL 100
+
+/*
+ * One copy of a job on a slave. A job normally has a single attempt, and a
+ * straggler gets a second, backup, attempt that races the first. An attempt
+ * is running until the slave has sent anything, streaming once a streaming
+ * slave has named its output, and has output once the first of it arrives.
+ */
+struct Attempt {
+    Slave *slave;
+    int socket;
+    struct sockaddr_in address;
+    int state;
+
+    /* The first message the slave sent after taking the job. */
+    char response[MAX_BUFFER_SIZE];
+
+    /* When the slave took the job, as returned by now_nanoseconds(). */
+    unsigned long accepted;
+};
 
+/* A primary a backup beat, watched until it has output or its window closes. */
+struct Outrun {
+    Attempt attempt;
     thread_attr *attr;
+
+    /* When the backup had output, as returned by now_nanoseconds(), and how long to watch past it, in milliseconds. */
+    unsigned long output_at;
+    int window;
 };
 
 void *listen_for_slaves(void *argv);
 void *load_balance(void *argv);
-Buffer *pass_job_to_optimal_slave(Job *job, Client *client);
+bool pass_job_to_optimal_slave(Job *job, Client *client, OutputSink *sink);
+bool wait_for_turn(Job *job, Client *client, OutputSink *sink);
+bool try_slaves(Job *job, Client *client, OutputSink *sink, unsigned long *started);
+bool run_batched(Job *job, Client *client, OutputSink *sink, unsigned long *started, bool *ran);
+void dispatch_batch(Batch *batch, Client *client);
+int collect_batch(Batch *batch, int slave_socket, int *indices, int count, Metrics *metrics);
+bool dispatch_job(Job *job, Client *client, Slave *optimal_slave, OutputSink *sink, unsigned long *started, bool *failed);
+bool start_attempt(Job *job, Client *client, Attempt *attempt, unsigned long *started);
+int await_greeting(Job *job, Client *client, Attempt *attempt, int slave_socket, bool parkable);
+void leave_slave(Client *client, Slave *slave);
+void advance_attempt(Attempt *attempt);
+void *watch_outrun(void *argv);
+int await_output(Attempt **attempts, int count, int timeout, int client_socket);
+void cancel_attempt(Attempt *attempt);
+void suspect_slave(Client *client, Slave *slave);
+bool deliver_block(OutputSink *sink, uint32_t *header, char *payload);
+bool deliver_buffer(OutputSink *sink, Buffer *output);
+bool finish_output(OutputSink *sink, bool executed);
+unsigned long end_phase(Job *job, Metrics *metrics, int phase, unsigned long started);
+int get_time_left(Job *job);
+bool admit(Job *job, Client *client, bool passed, int *retry_after);
+Job *createJob();
+void free_job(Job *job);
+void disconnect_client(Client *client, Job *job, char *status);
+void release_session(Session *session);
+void *run_session_job(void *argv);
+void handle_session(Client *client, char *request);
+bool receive_client_file(Client *client, Buffer *file, int codec);
+bool discard_client_file(Client *client, Buffer *file, int codec);
+bool receive_passed_files(Client *client, Job *job);
 void *handle_client(void *argv);
+void accept_clients(thread_attr *attr, int master_socket);
 void *listen_for_clients(void *argv);
+void *listen_for_local_clients(void *argv);
+void *listen_for_metrics(void *argv);
+void *watch_slaves(void *argv);
 
 /**
  * Add a Slave to the network of Slave nodes.
@@ -61,7 +232,8 @@ void *listen_for_slaves(void *argv) {
     SlaveList *list = attr->list;
 
     int opt = 1;
-    int master_socket, slave_socket, bytes;
+    int port = get_port(LISTEN_FOR_SLAVES_PORT_ENV, LISTEN_FOR_SLAVES_PORT);
+    int master_socket, slave_socket;
     struct sockaddr_in slave_address, master_address;
 
     /* Create TCP socket. */
@@ -79,7 +251,7 @@ void *listen_for_slaves(void *argv) {
 
     /* Initialise IPv4 address. */
     master_address.sin_family = AF_INET;
-    master_address.sin_port = htons(LISTEN_FOR_SLAVES_PORT);
+    master_address.sin_port = htons(port);
     master_address.sin_addr.s_addr = INADDR_ANY;
 
     /* Bind address to socket. */
@@ -95,7 +267,7 @@ void *listen_for_slaves(void *argv) {
         exit(1);
     }
 
-    printf("[*] Master is listening on ('%s', %d) for Slaves.\n", "127.0.0.1", LISTEN_FOR_SLAVES_PORT);
+    log_info("[*] Master is listening on ('%s', %d) for Slaves.\n", "127.0.0.1", port);
 
     while(!attr->terminated) {
         /* Accept connection from slave. */
@@ -107,31 +279,73 @@ void *listen_for_slaves(void *argv) {
             continue;
         }
 
-        printf("[+] Slave ('%s', %d): has connected to {LISTEN_FOR_SLAVES} socket.\n", inet_ntoa(slave_address.sin_addr), ntohs(slave_address.sin_port));
+        log_debug("[+] Slave (%I): has connected to {LISTEN_FOR_SLAVES} socket.\n", &slave_address);
 
         char response[MAX_BUFFER_SIZE];
-        bytes = recv(slave_socket, response, sizeof(response), 0);
-        printf("[Master]: Received: [%s] from Slave ('%s', %d).\n", response, inet_ntoa(slave_address.sin_addr), ntohs(slave_address.sin_port));
-
-        int id = add(list, response);
-        printf("[Master] Added: [%s] to linked list of Slaves.\n", response);
+        recv_message(slave_socket, response);
+        log_debug("[Master]: Received: [%s] from Slave (%I).\n", response, &slave_address);
 
         char payload[MAX_BUFFER_SIZE];
-        char *key = response;
+        int id, generation;
+
+        if (sscanf(response, "{DRAIN_SLAVE} %d %d", &id, &generation) == 2) {
+            /* A slave shutting down asks again until its outstanding jobs are done, and may exit once they are. */
+            Slave *slave = get_slave(list, id, generation);
+
+            if (!slave || !drain(list, slave, generation)) {
+                snprintf(payload, sizeof(payload), "{FAILED_TO_DRAIN_SLAVE} %d", id);
+            } else if (__atomic_load_n(&slave->outstanding, __ATOMIC_RELAXED) > 0) {
+                snprintf(payload, sizeof(payload), "{DRAINING_SLAVE} %lu", __atomic_load_n(&slave->outstanding, __ATOMIC_RELAXED));
+            } else {
+                if (evict(list, slave, generation))
+                    log_info("[Master]: Removed drained Slave (%s:%d).\n", slave->address, slave->port);
+
+                snprintf(payload, sizeof(payload), "{SUCCESSFULLY_DRAINED_SLAVE} %d", id);
+            }
+
+            send_message(slave_socket, payload);
+            log_debug("[Master]: Sending: [%s] to Slave (%I).\n", payload, &slave_address);
+
+            close(slave_socket);
+
+            continue;
+        }
+
+        /* Slaves that predate configurable ports only send their address, and those that predate greetings do not offer them. */
+        char address[MAX_BUFFER_SIZE], feature[MAX_BUFFER_SIZE] = "", second_feature[MAX_BUFFER_SIZE] = "", third_feature[MAX_BUFFER_SIZE] = "";
+        int job_port = SEND_JOB_PORT;
+
+        sscanf(response, "%s %d %s %s %s", address, &job_port, feature, second_feature, third_feature);
+
+        bool ready = strcmp(feature, "ready") == 0;
+        bool batching = strcmp(feature, "batch") == 0 || strcmp(second_feature, "batch") == 0;
+
+        /* A slave on the master's host names a probe in shared memory, which the master can only open if it is. */
+        bool shared_memory = attr->shared_memory && strncmp(third_feature, "shm:", 4) == 0 && is_co_located(third_feature + 4);
+
+        id = add(list, address, job_port, ready, batching, shared_memory);
+        log_info("[Master] Added: [%s] to linked list of Slaves.\n", response);
+
+        /* The slave brings turns for the jobs waiting, and may take one queued on a busy slave. */
+        offer_turns(attr->queue);
 
-        if (searchList(list, key)) {
-            snprintf(payload, sizeof(payload), "{SUCCESSFULLY_ADDED_SLAVE} %d", id);
+        if (id != -1)
+            steal_job(attr->board, list->slaves[id]);
+
+        /* Slaves that predate generations ignore the second number, and the master accepting greetings is only ever told to slaves that offer them. */
+        if (id != -1 && searchList(list, address, job_port)) {
+            snprintf(payload, sizeof(payload), "{SUCCESSFULLY_ADDED_SLAVE} %d %u%s", id, list->slaves[id]->generation, ready ? " ready" : "");
         } else {
             snprintf(payload, sizeof(payload), "{FAILED_TO_ADD_SLAVE} %d", id);
         }
 
-        bytes = send(slave_socket, payload, sizeof(payload), 0);
-        printf("[Master]: Sending: [%s] to Slave ('%s', %d).\n", payload, inet_ntoa(slave_address.sin_addr), ntohs(slave_address.sin_port));
+        send_message(slave_socket, payload);
+        log_debug("[Master]: Sending: [%s] to Slave (%I).\n", payload, &slave_address);
 
         close(slave_socket);
-        printf("[-] Slave ('%s', %d): has disconnected from {LISTEN_FOR_SLAVES} socket.\n", inet_ntoa(slave_address.sin_addr), ntohs(slave_address.sin_port));
+        log_debug("[-] Slave (%I): has disconnected from {LISTEN_FOR_SLAVES} socket.\n", &slave_address);
 
-        printf("\n");
+        log_debug("\n");
     }
 
     close(master_socket);
@@ -146,11 +360,11 @@ void *listen_for_slaves(void *argv) {
  */
 void *listen_for_clients(void *argv) {
     thread_attr *attr = (thread_attr *)argv;
-    SlaveList *list = attr->list;
 
     int opt = 1;
-    int master_socket, client_socket, bytes;
-    struct sockaddr_in client_address, master_address;
+    int port = get_port(LISTEN_FOR_CLIENTS_PORT_ENV, LISTEN_FOR_CLIENTS_PORT);
+    int master_socket;
+    struct sockaddr_in master_address;
 
     /* Create TCP socket. */
     if ((master_socket = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
@@ -166,7 +380,7 @@ void *listen_for_clients(void *argv) {
 
     /* Initialise IPv4 address. */
     master_address.sin_family = AF_INET;
-    master_address.sin_port = htons(LISTEN_FOR_CLIENTS_PORT);
+    master_address.sin_port = htons(port);
     master_address.sin_addr.s_addr = INADDR_ANY;
 
     /* Bind address to socket. */
@@ -182,7 +396,56 @@ void *listen_for_clients(void *argv) {
         exit(1);
     }
 
-    printf("[*] Master is listening on ('%s', %d) for Clients.\n", "127.0.0.1", LISTEN_FOR_CLIENTS_PORT);
+    log_info("[*] Master is listening on ('%s', %d) for Clients.\n", "127.0.0.1", port);
+
+    accept_clients(attr, master_socket);
+
+    close(master_socket);
+
+    pthread_exit(NULL);
+}
+
+/**
+ * Listens for Clients on the master's host on a Unix socket, over which they may pass their files' descriptors.
+ *
+ * @param argv The arguments passed to the listen_for_local_clients thread.
+ */
+void *listen_for_local_clients(void *argv) {
+    thread_attr *attr = (thread_attr *)argv;
+
+    char path[MAX_BUFFER_SIZE], *setting = getenv(UNIX_SOCKET_ENV);
+    int master_socket;
+
+    if (setting && strcmp(setting, "0") == 0)
+        pthread_exit(NULL);
+
+    /* Clients on the host still reach the master over TCP, only without passing descriptors, so it runs on. */
+    if (!get_unix_socket_path(get_port(LISTEN_FOR_CLIENTS_PORT_ENV, LISTEN_FOR_CLIENTS_PORT), path, true)
+        || (master_socket = listen_unix(path, MAX_BACKLOG)) == -1) {
+        log_error("[X] Master could not listen on a Unix socket for Clients on its host, which are served over TCP only; "
+                  "$XDG_RUNTIME_DIR or " UNIX_SOCKET_DIRECTORY " must be a directory of the user's that no one else may enter.\n", (int)geteuid());
+        pthread_exit(NULL);
+    }
+
+    log_info("[*] Master is listening on ('%s') for Clients on its host.\n", path);
+
+    accept_clients(attr, master_socket);
+
+    close(master_socket);
+    unlink(path);
+
+    pthread_exit(NULL);
+}
+
+/**
+ * Accepts Clients on a listening socket, handling each in a thread of its own, until the master terminates.
+ *
+ * @param attr The arguments passed to the listening thread.
+ * @param master_socket The listening socket, TCP or Unix.
+ */
+void accept_clients(thread_attr *attr, int master_socket) {
+    int client_socket;
+    struct sockaddr_in client_address;
 
     while(!attr->terminated) {
         /* Accept connection from client. */
@@ -194,540 +457,2080 @@ void *listen_for_clients(void *argv) {
             continue;
         }
 
+        /* Clients on a Unix socket have no address of their own; they are on the loopback one. */
+        if (client_address.sin_family != AF_INET) {
+            memset(&client_address, 0, sizeof client_address);
+            client_address.sin_family = AF_INET;
+            client_address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        }
+
+        /* Clients past the limit wait in the backlog rather than in a thread each. */
+        admit_client(attr->admission);
+
+        tune_socket(client_socket);
+
         Client *client = (Client *)malloc(sizeof(Client));
 
         client->socket = client_socket;
-        client->address = &client_address;
+        client->address = client_address;
+        client->started = now_nanoseconds();
         client->attr = attr;
 
         pthread_t handle_client_thread;
 
         pthread_create(&handle_client_thread, NULL, handle_client, (void *)client);
 
-        printf("\n");
+        log_debug("\n");
     }
-
-    close(master_socket);
-
-    pthread_exit(NULL);
 }
 
 /**
- * Handles / processes a given client connection.
+ * Serves the master's metrics to local scrapers in the Prometheus text exposition format.
  *
- * @param argv The arguments passed to the handle_client thread.
+ * @param argv The arguments passed to the listen_for_metrics thread.
  */
-void *handle_client(void *argv) {
-    Client *client = (Client *)argv;
-
-    Job *job = (Job *)malloc(sizeof(Job));
-    job->input_file = createBuffer();
-    job->executable = createBuffer();
-
-    int bytes;
-    char *response;
-    char file_buffer[MAX_FILE_BUFFER_SIZE];
-
-    printf("[+] Client ('%s', %d): has connected to {LISTEN_FOR_CLIENTS} socket.\n", inet_ntoa(client->address->sin_addr), ntohs(client->address->sin_port));
+void *listen_for_metrics(void *argv) {
+    thread_attr *attr = (thread_attr *)argv;
+    SlaveList *list = attr->list;
 
-    char request[MAX_BUFFER_SIZE];
-    bytes = recv(client->socket, request, sizeof(request), 0);
-    printf("[Master]: Received Job Request: [%s] from Client ('%s', %d).\n", request, inet_ntoa(client->address->sin_addr), ntohs(client->address->sin_port));
+    int opt = 1;
+    int port = get_port(METRICS_PORT_ENV, METRICS_PORT);
+    int master_socket, scraper_socket;
+    struct sockaddr_in master_address;
 
-    if (bytes > 0) {
-        response = "{SUCCESSFULLY_RECEIVED_JOB_REQUEST}";
-        bytes = send(client->socket, response, strlen(response), 0);
-        printf("[Master]: Sending: [%s] to Client ('%s', %d).\n", response, inet_ntoa(client->address->sin_addr), htons(client->address->sin_port));
+    /* Create TCP socket. */
+    if ((master_socket = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
+        perror("[X] socket");
+        exit(1);
+    }
 
-        char **data = split(request, ' ');
+    /* Forcefully attaching socket to the desired port  */
+    if (setsockopt(master_socket, SOL_SOCKET, SO_REUSEADDR | SO_REUSEPORT, &opt, sizeof(opt))) {
+        perror("[X] setsockopt");
+        exit(1);
+    }
 
-        job->executable->file_name = data[0];
-        job->executable->size = atoi(data[1]);
+    /* Initialise IPv4 address; metrics are only served on the loopback interface. */
+    memset(&master_address, 0, sizeof master_address);
+    master_address.sin_family = AF_INET;
+    master_address.sin_port = htons(port);
+    master_address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
 
-        job->input_file->file_name = data[2];
-        job->input_file->size = atoi(data[3]);
+    /* Bind address to socket. */
+    while (bind(master_socket, (struct sockaddr *)&master_address, sizeof master_address) < 0) {
+        perror("[X] bind");
 
-        sprintf(job->command, "./%s %s", job->executable->file_name, job->input_file->file_name);
+        sleep(rand() % 5);
+    }
 
-        free(data);
+    /* Listen for connections via the socket. */
+    if (listen(master_socket, MAX_BACKLOG) == -1) {
+        perror("[X] listen");
+        exit(1);
+    }
 
-        char executable_file[job->executable->size];
+    log_info("[*] Master is serving metrics on ('%s', %d).\n", "127.0.0.1", port);
 
-        for (int i = 0; i < job->executable->size; i += MAX_FILE_BUFFER_SIZE) {
-            bytes = recv(client->socket, file_buffer, MAX_FILE_BUFFER_SIZE, 0);
-            strcat(executable_file, file_buffer);
-            printf("[Master]: Received %d bytes for file %s.\n", i, job->executable->file_name);
-        }
+    while(!attr->terminated) {
+        scraper_socket = accept(master_socket, NULL, NULL);
 
-        if (job->executable->size % MAX_FILE_BUFFER_SIZE != 0) {
-            bytes = recv(client->socket, file_buffer, job->executable->size % MAX_FILE_BUFFER_SIZE, 0);
-            strcat(executable_file, file_buffer);
+        if (scraper_socket == -1) {
+            perror("[X] accept");
+            continue;
         }
 
-        job->executable->data = executable_file;
-
-        if (bytes > 0) {
-            response = "{SUCCESSFULLY_RECEIVED_BUFFER}";
-            bytes = send(client->socket, response, strlen(response), 0);
-            printf("[Master]: Sending: [%s] to Client ('%s', %d).\n", response, inet_ntoa(client->address->sin_addr), htons(client->address->sin_port));
+        /* Any request gets the metrics; only its first segment is drained. */
+        char request[1024];
+        recv(scraper_socket, request, sizeof(request), 0);
 
-            char input_file[job->input_file->size];
+        char *body;
+        size_t body_size;
+        FILE *out = open_memstream(&body, &body_size);
 
-            for (int i = 0; i < job->input_file->size; i += MAX_FILE_BUFFER_SIZE) {
-                bytes = recv(client->socket, file_buffer, MAX_FILE_BUFFER_SIZE, 0);
-                strcat(input_file, file_buffer);
-                printf("[Master]: Received %d bytes for file %s.\n", i, job->input_file->file_name);
-            }
-
-            if (job->input_file->size % MAX_FILE_BUFFER_SIZE != 0) {
-                bytes = recv(client->socket, file_buffer, job->input_file->size % MAX_FILE_BUFFER_SIZE, 0);
-                strcat(input_file, file_buffer);
-            }
+        write_metrics(out, attr->metrics);
 
-            job->input_file->data = input_file;
+        int states[3] = {0, 0, 0};
 
-            if (bytes > 0) {
-                response = "{SUCCESSFULLY_RECEIVED_BUFFER}";
-                bytes = send(client->socket, response, strlen(response), 0);
-                printf("[Master]: Sending: [%s] to Client ('%s', %d).\n", response, inet_ntoa(client->address->sin_addr), htons(client->address->sin_port));
+        for (int i = 0; i < list->size; i++)
+            states[__atomic_load_n(&list->slaves[i]->state, __ATOMIC_RELAXED)]++;
 
-                bytes = recv(client->socket, request, sizeof(request), 0);
-                printf("[Master]: Received: [%s] from Client ('%s', %d).\n", request, inet_ntoa(client->address->sin_addr), ntohs(client->address->sin_port));
+        fputs("# HELP dlb_slaves Slaves known to the master by state.\n", out);
+        fputs("# TYPE dlb_slaves gauge\n", out);
+        fprintf(out, "dlb_slaves{state=\"alive\"} %d\n", states[SLAVE_ALIVE]);
+        fprintf(out, "dlb_slaves{state=\"draining\"} %d\n", states[SLAVE_DRAINING]);
+        fprintf(out, "dlb_slaves{state=\"evicted\"} %d\n", states[SLAVE_EVICTED]);
 
-                if (bytes > 0 && strcmp(request, "{REQUEST_JOB_OUTPUT}\0") == 0) {
-                    Buffer *output = pass_job_to_optimal_slave(job, client);
+        fputs("# HELP dlb_queued_jobs Jobs waiting for a turn on the slaves, by priority class.\n", out);
+        fputs("# TYPE dlb_queued_jobs gauge\n", out);
 
-                    char output_request[MAX_BUFFER_SIZE];
-                    sprintf(output_request, "%s %d", basename(output->file_name), output->size);
+        for (int priority = 0; priority < PRIORITY_COUNT; priority++)
+            fprintf(out, "dlb_queued_jobs{class=\"%s\"} %d\n", PRIORITY_NAMES[priority], __atomic_load_n(&attr->queue->waiting[priority], __ATOMIC_RELAXED));
 
-                    bytes = send(client->socket, output_request, sizeof(output_request), 0);
-                    printf("[Master]: Sending Job Output Request: [%s] to Client ('%s', %d).\n",
-                           output_request,
-                           inet_ntoa(client->address->sin_addr),
-                           htons(client->address->sin_port)
-                    );
+        fputs("# HELP dlb_clients Client connections being handled.\n", out);
+        fputs("# TYPE dlb_clients gauge\n", out);
+        fprintf(out, "dlb_clients %d\n", __atomic_load_n(&attr->admission->clients, __ATOMIC_RELAXED));
 
-                    bytes = recv(client->socket, response, sizeof(response), 0);
-                    printf("[Master]: Received: [%s] from Client ('%s', %d).\n",
-                           response,
-                           inet_ntoa(client->address->sin_addr),
-                           ntohs(client->address->sin_port)
-                    );
+        fputs("# HELP dlb_inflight_bytes Bytes of the memory budget held for the files of admitted jobs.\n", out);
+        fputs("# TYPE dlb_inflight_bytes gauge\n", out);
+        fprintf(out, "dlb_inflight_bytes %ld\n", __atomic_load_n(&attr->admission->in_flight, __ATOMIC_RELAXED));
 
-                    if (bytes > 0 && strcmp(response, "{SUCCESSFULLY_RECEIVED_JOB_OUTPUT}\0") == 0) {
-                        char buffer[MAX_FILE_BUFFER_SIZE];
-                        FILE *stream;
+        fputs("# HELP dlb_slave_dispatches_total Jobs passed to each slave.\n", out);
+        fputs("# TYPE dlb_slave_dispatches_total counter\n", out);
 
-                        printf("[Master]: Sending: [%s] to Client ('%s', %d).\n",
-                               output->file_name,
-                               inet_ntoa(client->address->sin_addr),
-                               htons(client->address->sin_port)
-                        );
+        for (int i = 0; i < list->size; i++)
+            fprintf(out, "dlb_slave_dispatches_total{slave=\"%s:%d\",id=\"%d\"} %lu\n",
+                    list->slaves[i]->address, list->slaves[i]->port, list->slaves[i]->id, read_counter(&list->slaves[i]->dispatches));
 
-                        stream = fmemopen(output->data, output->size, "r");
-                        for (int i = 0; i < output->size; i += MAX_FILE_BUFFER_SIZE) {
-                            fread(buffer, sizeof(char), MAX_FILE_BUFFER_SIZE, stream);
-                            bytes = send(client->socket, buffer, MAX_FILE_BUFFER_SIZE, 0);
-                        }
+        fputs("# HELP dlb_slave_failures Attempts that failed on each slave since its last success.\n", out);
+        fputs("# TYPE dlb_slave_failures gauge\n", out);
 
-                        if (output->size % MAX_FILE_BUFFER_SIZE != 0) {
-                            fread(buffer, sizeof(char), output->size % MAX_FILE_BUFFER_SIZE, stream);
-                            bytes = send(client->socket, buffer, output->size % MAX_FILE_BUFFER_SIZE, 0);
-                        }
+        for (int i = 0; i < list->size; i++)
+            fprintf(out, "dlb_slave_failures{slave=\"%s:%d\",id=\"%d\"} %u\n",
+                    list->slaves[i]->address, list->slaves[i]->port, list->slaves[i]->id, __atomic_load_n(&list->slaves[i]->failures, __ATOMIC_RELAXED));
 
-                        fclose(stream);
+        fclose(out);
 
-                        bytes = recv(client->socket, request, sizeof(request), 0);
-                        printf("[Master]: Received: [%s] from Client ('%s', %d).\n", request,
-                               inet_ntoa(client->address->sin_addr), ntohs(client->address->sin_port));
+        char header[MAX_BUFFER_SIZE * 2];
+        int header_size = snprintf(header, sizeof(header),
+                                   "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n\r\n",
+                                   body_size);
 
-                        if (bytes > 0 && strcmp(response, "{SUCCESSFULLY_RECEIVED_BUFFER}\0") == 0) {
-                            close(client->socket);
-                            printf("[-] Client ('%s', %d): has disconnected from {LISTEN_FOR_CLIENTS} socket.\n", inet_ntoa(client->address->sin_addr), htons(client->address->sin_port));
+        struct iovec response[2] = { { header, header_size }, { body, body_size } };
+        send_allv(scraper_socket, response, 2, NULL);
 
-                            printf("\n");
+        free(body);
+        close(scraper_socket);
+    }
 
-                            free(job);
-                            free(client);
+    close(master_socket);
 
-                            pthread_exit(NULL);
-                        } else {
-                            response = "{FAILED_TO_RECEIVE_BUFFER}";
+    pthread_exit(NULL);
+}
 
-                            fputs("{FAILED_TO_RECEIVE_BUFFER}\n", stderr);
+/**
+ * Records the end of a phase of a job, both in the metrics and as a span of the job's trace.
+ *
+ * @param job The job.
+ * @param metrics The metrics to record the phase's latency in.
+ * @param phase The PHASE_* that ended.
+ * @param started When the phase started, as returned by now_nanoseconds().
+ *
+ * @return The time the phase ended, which is when the next phase starts.
+ */
+unsigned long end_phase(Job *job, Metrics *metrics, int phase, unsigned long started) {
+    unsigned long now = record_phase(metrics, phase, started);
+    record_span(job->trace_id, PHASE_NAMES[phase], started, now);
 
-                            bytes = send(client->socket, response, strlen(response), 0);
-                            printf("[Master]: Sending: [%s] to Client ('%s', %d).\n", response, inet_ntoa(client->address->sin_addr), htons(client->address->sin_port));
+    return now;
+}
 
-                            close(client->socket);
-                            printf("[-] Client ('%s', %d): has disconnected from {LISTEN_FOR_CLIENTS} socket.\n", inet_ntoa(client->address->sin_addr), htons(client->address->sin_port));
+/**
+ * Obtains how long a job has left until its deadline.
+ *
+ * @param job The job.
+ *
+ * @return The milliseconds left, rounded up, 0 once the deadline passed, or -1 if the job has no deadline.
+ */
+int get_time_left(Job *job) {
+    unsigned long now = now_nanoseconds();
 
-                            printf("\n");
+    if (job->deadline == 0)
+        return -1;
 
-                            free(job);
-                            free(client);
+    return now >= job->deadline ? 0 : (int)((job->deadline - now + 999999) / 1000000);
+}
 
-                            pthread_exit(NULL);
-                        }
-                    } else {
-                        response = "{FAILED_TO_RECEIVE_BUFFER}";
+/**
+ * Decides from its request alone whether the master can take on a job, before any of its files are received.
+ *
+ * @param job The job, whose files' sizes were announced.
+ * @param client The client that submitted the job.
+ * @param passed Whether or not the client passes the files' descriptors, which the master never holds the bytes of.
+ * @param retry_after Set to how long the client should wait before trying again, if the job is rejected.
+ *
+ * @return Whether or not the job was admitted, in which case its files' bytes are reserved until it is freed.
+ */
+bool admit(Job *job, Client *client, bool passed, int *retry_after) {
+    thread_attr *attr = client->attr;
+    long budget = attr->admission->budget, size = 0;
+    int reason;
+
+    /* The sizes are the client's to choose, so each is bounded before they are added, which then cannot overflow. */
+    if (passed) {
+        reason = admit_job(attr->admission, attr->queue, 0, get_time_left(job), retry_after);
+    } else if (job->executable->size < 0 || job->input_file->size < 0 || job->executable->size > budget || job->input_file->size > budget - job->executable->size) {
+        *retry_after = get_retry_after(attr->admission, estimate_wait(attr->admission, attr->queue));
+        reason = REJECT_MEMORY;
+    } else {
+        size = job->executable->size + job->input_file->size;
+        reason = admit_job(attr->admission, attr->queue, size, get_time_left(job), retry_after);
+    }
 
-                        fputs("{FAILED_TO_RECEIVE_BUFFER}\n", stderr);
+    if (reason != ADMITTED) {
+        add_counter(&attr->metrics->rejections[reason], 1);
+        log_warn("[Master]: Rejecting Job from Client (%I) at its %s limit; retry after %d ms.\n", &client->address, REJECT_NAMES[reason], *retry_after);
 
-                        bytes = send(client->socket, response, strlen(response), 0);
-                        printf("[Master]: Sending: [%s] to Client ('%s', %d).\n", response, inet_ntoa(client->address->sin_addr), htons(client->address->sin_port));
+        return false;
+    }
 
-                        close(client->socket);
-                        printf("[-] Client ('%s', %d): has disconnected from {LISTEN_FOR_CLIENTS} socket.\n", inet_ntoa(client->address->sin_addr), htons(client->address->sin_port));
+    job->reserved = size;
 
-                        printf("\n");
+    return true;
+}
 
-                        free(job);
-                        free(client);
+/**
+ * Creates an empty job.
+ *
+ * WARNING: 'createJob' malloc()s memory to '*job' which must be freed by
+ * the caller with free_job().
+ *
+ * @return The job, with a freshly minted trace id.
+ */
+Job *createJob() {
+    Job *job = (Job *)malloc(sizeof(Job));
+    job->input_file = createBuffer();
+    job->executable = createBuffer();
+    job->command = (char *)malloc(sizeof(char) * MAX_BUFFER_SIZE);
+    job->deadline = 0;
+    job->priority = PRIORITY_NORMAL;
+    job->tenant[0] = '\0';
+    job->reserved = 0;
+    job->fds[0] = -1;
+    job->fds[1] = -1;
+    job->key = 0;
+    mint_trace_id(job->trace_id);
+
+    return job;
+}
 
-                        pthread_exit(NULL);
-                    }
-                } else {
-                    response = "{FAILED_TO_RECEIVE_JOB_OUTPUT}";
+/**
+ * Frees a job created by createJob() and the files received for it.
+ *
+ * @param job The job to free.
+ */
+void free_job(Job *job) {
+    free(job->executable->file_name);
+    free(job->executable->data);
+    free(job->input_file->file_name);
+    free(job->input_file->data);
+    free(job->executable);
+    free(job->input_file);
+    free(job->command);
+
+    for (int i = 0; i < 2; i++) {
+        if (job->fds[i] != -1)
+            close(job->fds[i]);
+    }
 
-                    fputs("{FAILED_TO_RECEIVE_JOB_OUTPUT}\n", stderr);
+    free(job);
+}
 
-                    bytes = send(client->socket, response, strlen(response), 0);
-                    printf("[Slave]: Sending: [%s] to Master ('%s', %d).\n",
-                           response,
-                           inet_ntoa(client->address->sin_addr),
-                           htons(client->address->sin_port)
-                    );
+/**
+ * Sends a final status to a client, disconnects it and ends its handle_client thread.
+ *
+ * @param client The client to disconnect.
+ * @param job The job received from the client so far.
+ * @param status The status to send before disconnecting, or NULL to send none.
+ */
+void disconnect_client(Client *client, Job *job, char *status) {
+    Metrics *metrics = client->attr->metrics;
 
-                    close(client->socket);
-                    printf("[-] Client ('%s', %d): has disconnected from {LISTEN_FOR_CLIENTS} socket.\n", inet_ntoa(client->address->sin_addr), htons(client->address->sin_port));
+    end_phase(job, metrics, PHASE_TOTAL, client->started);
+    add_counter(status ? &metrics->jobs_failed : &metrics->jobs_completed, 1);
 
-                    printf("\n");
+    if (status) {
+        fprintf(stderr, "%s\n", status);
 
-                    free(job);
-                    free(client);
+        send_message(client->socket, status);
+        log_debug("[Master]: Sending: [%s] to Client (%I).\n", status, &client->address);
+    }
 
-                    pthread_exit(NULL);
-                }
-            } else {
-                response = "{FAILED_TO_RECEIVE_BUFFER}";
+    close(client->socket);
+    log_debug("[-] Client (%I): has disconnected from {LISTEN_FOR_CLIENTS} socket.\n", &client->address);
 
-                fputs("{FAILED_TO_RECEIVE_BUFFER}\n", stderr);
+    log_debug("\n");
 
-                bytes = send(client->socket, response, strlen(response), 0);
-                printf("[Master]: Sending: [%s] to Client ('%s', %d).\n", response, inet_ntoa(client->address->sin_addr), htons(client->address->sin_port));
+    release_job(client->attr->admission, job->reserved);
+    release_client(client->attr->admission);
 
-                close(client->socket);
-                printf("[-] Client ('%s', %d): has disconnected from {LISTEN_FOR_CLIENTS} socket.\n", inet_ntoa(client->address->sin_addr), htons(client->address->sin_port));
+    free_job(job);
+    free(client);
 
-                printf("\n");
+    pthread_exit(NULL);
+}
 
-                free(job);
-                free(client);
+/**
+ * Drops a reference to a session, disconnecting its client once the last one is gone.
+ *
+ * @param session The session.
+ */
+void release_session(Session *session) {
+    pthread_mutex_lock(&session->lock);
+    bool last = --session->references == 0;
+    pthread_mutex_unlock(&session->lock);
 
-                pthread_exit(NULL);
-            }
-        } else {
-            response = "{FAILED_TO_RECEIVE_BUFFER}";
+    if (!last)
+        return;
 
-            fputs("{FAILED_TO_RECEIVE_BUFFER}\n", stderr);
+    close(session->client->socket);
+    log_debug("[-] Client (%I): has closed its session on {LISTEN_FOR_CLIENTS} socket.\n", &session->client->address);
 
-            bytes = send(client->socket, response, strlen(response), 0);
-            printf("[Master]: Sending: [%s] to Client ('%s', %d).\n", response, inet_ntoa(client->address->sin_addr), htons(client->address->sin_port));
+    release_client(session->client->attr->admission);
 
-            close(client->socket);
-            printf("[-] Client ('%s', %d): has disconnected from {LISTEN_FOR_CLIENTS} socket.\n", inet_ntoa(client->address->sin_addr), htons(client->address->sin_port));
+    pthread_mutex_destroy(&session->lock);
+    free(session->client);
+    free(session);
+}
 
-            printf("\n");
+/**
+ * Runs a job received in a session, streaming its output back tagged as it is produced.
+ *
+ * @param argv The SessionJob to run.
+ */
+void *run_session_job(void *argv) {
+    SessionJob *session_job = (SessionJob *)argv;
+    Session *session = session_job->session;
+    Client *client = session->client;
+    Metrics *metrics = client->attr->metrics;
+    Job *job = session_job->job;
 
-            free(job);
-            free(client);
+    OutputSink sink = { SINK_SESSION, client, session, session_job->tag, job->codec };
 
-            pthread_exit(NULL);
-        }
-    } else {
-        response = "{FAILED_TO_RECEIVE_JOB_REQUEST}";
+    bool executed = pass_job_to_optimal_slave(job, client, &sink);
 
-        fputs("{FAILED_TO_RECEIVE_JOB_REQUEST}\n", stderr);
+    unsigned long started = now_nanoseconds();
+    bool delivered = finish_output(&sink, executed);
 
-        bytes = send(client->socket, response, strlen(response), 0);
-        printf("[Slave]: Sending: [%s] to Master ('%s', %d).\n",
-               response,
-               inet_ntoa(client->address->sin_addr),
-               htons(client->address->sin_port)
-        );
+    end_phase(job, metrics, PHASE_DOWNLOAD, started);
+    add_counter(&metrics->bytes[BYTES_TO_CLIENTS], sink.stats.bytes);
 
-        close(client->socket);
-        printf("[-] Client ('%s', %d): has disconnected from {LISTEN_FOR_CLIENTS} socket.\n", inet_ntoa(client->address->sin_addr), htons(client->address->sin_port));
+    end_phase(job, metrics, PHASE_TOTAL, session_job->started);
+    add_counter(delivered ? &metrics->jobs_completed : &metrics->jobs_failed, 1);
 
-        printf("\n");
+    release_job(client->attr->admission, job->reserved);
 
-        free(job);
-        free(client);
+    free_job(job);
+    free(session_job);
+    release_session(session);
 
-        pthread_exit(NULL);
-    }
+    pthread_exit(NULL);
 }
 
 /**
- * Passes a job to the optimal slave node and receives its output.
- *
- * WARNING: 'pass_job_to_optimal_slave' malloc()s memory to '*output' which must be freed by
- * the caller.
+ * Receives the jobs of a session until the client closes it, starting each as soon as its files arrive.
  *
- * @param job The job to pass to the optimal slave.
+ * Every job is announced as "{SUBMIT_JOB} <tag> <executable> <size> <input_file> <size> [trace_id] [deadline] [priority] [tenant]"
+ * and its files follow at once. Since the stream cannot be resynchronized, a malformed request
+ * or a failed upload ends the session; jobs already running still send their outputs.
  *
- * @return The output of the job to send back to the source client.
+ * @param client The client that opened the session.
+ * @param request The request opening it: "{OPEN_SESSION} <codec>".
  */
-Buffer *pass_job_to_optimal_slave(Job *job, Client *client) {
-    int slave_socket, bytes;
-    struct sockaddr_in slave_address;
+void handle_session(Client *client, char *request) {
+    Metrics *metrics = client->attr->metrics;
+    char codec_name[MAX_BUFFER_SIZE] = "none";
 
-    /* Initialise IPv4 address. */
-    slave_address.sin_family = AF_INET;
-    slave_address.sin_port = htons(SEND_JOB_PORT);
+    sscanf(request, "%*s %s", codec_name);
 
-    while (client->attr->list->size <= 0);
+    Session *session = (Session *)malloc(sizeof(Session));
+    session->client = client;
+    session->codec = get_codec(codec_name) == -1 ? CODEC_NONE : get_codec(codec_name);
+    session->references = 1;
+    pthread_mutex_init(&session->lock, NULL);
 
-    while(!client->attr->terminated) {
-        Slave *optimal_slave = client->attr->optimal_slave;
+    /* Deduplication waits on a reply to every manifest, which would stall the pipeline, so sessions compress instead. */
+    if (session->codec == CODEC_CDC)
+        session->codec = CODEC_LZ;
 
-        /* Create TCP socket. */
-        if ((slave_socket = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
-            perror("[X] socket");
-            printf("\n");
-            continue;
-        }
+    char accepted[MAX_BUFFER_SIZE];
+    snprintf(accepted, sizeof(accepted), "{SUCCESSFULLY_OPENED_SESSION} %s", get_codec_name(session->codec));
 
-        /* Make sure optimal slave's address is a valid address */
-        if (inet_pton(AF_INET, optimal_slave->address, &slave_address.sin_addr) <= 0) {
-            fputs("\nInvalid address / Address not supported.\n", stderr);
-            close(slave_socket);
-            continue;
-        }
+    send_message(client->socket, accepted);
+    log_debug("[Master]: Sending: [%s] to Client (%I).\n", accepted, &client->address);
 
-        /* Connect to socket with optimal slaves's address. */
-        if (connect(slave_socket, (struct sockaddr *)&slave_address, sizeof slave_address) < 0) {
-            perror("[X] connect");
-            printf("\n");
-            close(slave_socket);
+    while (!client->attr->terminated && recv_message(client->socket, request)) {
+        log_info("[Master]: Received Job Request: [%s] from Client (%I).\n", request, &client->address);
 
-            sleep(10);
+        SessionJob *session_job = (SessionJob *)malloc(sizeof(SessionJob));
+        Job *job = createJob();
 
-            continue;
-        }
+        session_job->session = session;
+        session_job->job = job;
+        session_job->started = now_nanoseconds();
+        job->codec = session->codec;
 
-        printf("[+] Master: has connected to the {SEND_JOB} socket on Slave ('%s', %d).\n", inet_ntoa(slave_address.sin_addr), htons(slave_address.sin_port));
+        char executable_name[MAX_BUFFER_SIZE], input_file_name[MAX_BUFFER_SIZE], trace_id[MAX_BUFFER_SIZE] = "", priority_name[MAX_BUFFER_SIZE] = "normal";
+        long deadline = 0;
 
-        char buffer[MAX_FILE_BUFFER_SIZE];
-        char request[MAX_BUFFER_SIZE];
-        char response[MAX_BUFFER_SIZE];
-        char *status;
-        FILE *stream;
-
-        char job_request[MAX_BUFFER_SIZE];
-        sprintf(job_request, "%s %d %s %d %s", basename(job->executable->file_name), job->executable->size, basename(job->input_file->file_name), job->input_file->size, job->command);
-
-        bytes = send(slave_socket, job_request, sizeof(job_request), 0);
-        printf("[Master]: Sending Job Request: [%s] to Optimal Slave ('%s', %d).\n",
-               job_request,
-               inet_ntoa(slave_address.sin_addr),
-               htons(slave_address.sin_port)
-        );
-
-        bytes = recv(slave_socket, response, sizeof(response), 0);
-        printf("[Master]: Received: [%s] from Optimal Slave ('%s', %d).\n",
-               response,
-               inet_ntoa(slave_address.sin_addr),
-               ntohs(slave_address.sin_port)
-        );
-
-        if (bytes > 0 && strcmp(response, "{SUCCESSFULLY_RECEIVED_JOB_REQUEST}\0") == 0) {
-            printf("[Master]: Sending: [%s] to Optimal Slave ('%s', %d).\n",
-                   job->executable->file_name,
-                   inet_ntoa(slave_address.sin_addr),
-                   htons(slave_address.sin_port)
-            );
-
-            stream = fmemopen(job->executable->data, job->executable->size, "rb");
-            for (int i = 0; i < job->executable->size; i += MAX_FILE_BUFFER_SIZE) {
-                fread(buffer, sizeof(char), MAX_FILE_BUFFER_SIZE, stream);
-                bytes = send(slave_socket, buffer, MAX_FILE_BUFFER_SIZE, 0);
-            }
+        bool received = sscanf(request, "{SUBMIT_JOB} %ld %s %ld %s %ld %s %ld %s %32s", &session_job->tag, executable_name, &job->executable->size, input_file_name, &job->input_file->size, trace_id, &deadline, priority_name, job->tenant) >= 5
+            && job->executable->size >= 0 && job->input_file->size >= 0;
 
-            if (job->executable->size % MAX_FILE_BUFFER_SIZE != 0) {
-                fread(buffer, sizeof(char), job->executable->size % MAX_FILE_BUFFER_SIZE, stream);
-                bytes = send(slave_socket, buffer, job->executable->size % MAX_FILE_BUFFER_SIZE, 0);
-            }
+        if (received) {
+            if (is_trace_id(trace_id))
+                memcpy(job->trace_id, trace_id, sizeof(job->trace_id));
 
-            fclose(stream);
+            /* The deadline counts from when the request arrived. */
+            if (deadline > 0 && deadline <= INT_MAX)
+                job->deadline = session_job->started + deadline * 1000000UL;
 
-            bytes = recv(slave_socket, request, sizeof(request), 0);
-            printf("[Master]: Received: [%s] from Optimal Slave ('%s', %d).\n", request, inet_ntoa(slave_address.sin_addr), ntohs(slave_address.sin_port));
+            if (get_priority(priority_name) != -1)
+                job->priority = get_priority(priority_name);
 
-            if (bytes > 0 && strcmp(response, "{SUCCESSFULLY_RECEIVED_BUFFER}\0") == 0) {
-                printf("[Master]: Sending: [%s] to Optimal Slave ('%s', %d).\n",
-                       job->input_file->file_name,
-                       inet_ntoa(slave_address.sin_addr),
-                       htons(slave_address.sin_port)
-                );
+            job->executable->file_name = strdup(basename(executable_name));
+            job->input_file->file_name = strdup(basename(input_file_name));
 
-                stream = fmemopen(job->input_file->data, job->input_file->size, "r");
-                for (int i = 0; i < job->executable->size; i += MAX_FILE_BUFFER_SIZE) {
-                    fread(buffer, sizeof(char), MAX_FILE_BUFFER_SIZE, stream);
-                    bytes = send(slave_socket, buffer, MAX_FILE_BUFFER_SIZE, 0);
-                }
+            snprintf(job->command, MAX_BUFFER_SIZE, "./%s %s", job->executable->file_name, job->input_file->file_name);
 
-                if (job->input_file->size % MAX_FILE_BUFFER_SIZE != 0) {
-                    fread(buffer, sizeof(char), job->input_file->size % MAX_FILE_BUFFER_SIZE, stream);
-                    bytes = send(slave_socket, buffer, job->input_file->size % MAX_FILE_BUFFER_SIZE, 0);
-                }
+            int retry_after;
 
-                fclose(stream);
+            /* The files of a rejected job are already on their way, so they are read past without being kept. */
+            if (!admit(job, client, false, &retry_after)) {
+                received = discard_client_file(client, job->executable, job->codec) && discard_client_file(client, job->input_file, job->codec);
 
-                bytes = recv(slave_socket, request, sizeof(request), 0);
-                printf("[Master]: Received: [%s] from Optimal Slave ('%s', %d).\n", request, inet_ntoa(slave_address.sin_addr), ntohs(slave_address.sin_port));
+                char frame[MAX_BUFFER_SIZE];
+                snprintf(frame, sizeof(frame), "{JOB_END} %ld {REJECTED_JOB} %d", session_job->tag, retry_after);
 
-                if (bytes > 0 && strcmp(response, "{SUCCESSFULLY_RECEIVED_BUFFER}\0") == 0) {
-                    bytes = recv(slave_socket, request, sizeof(request), 0);
-                    printf("[Master]: Received Job Output: [%s] from Optimal Slave ('%s', %d).\n", request, inet_ntoa(slave_address.sin_addr), ntohs(slave_address.sin_port));
+                pthread_mutex_lock(&session->lock);
+                received = received && send_message(client->socket, frame);
+                pthread_mutex_unlock(&session->lock);
 
-                    if (bytes > 0) {
-                        status = "{SUCCESSFULLY_RECEIVED_JOB_OUTPUT}";
-                        bytes = send(slave_socket, status, strlen(status), 0);
-                        printf("[Master]: Sending: [%s] to Optimal Slave ('%s', %d).\n", status, inet_ntoa(slave_address.sin_addr), htons(slave_address.sin_port));
+                log_debug("[Master]: Sending: [%s] to Client (%I).\n", frame, &client->address);
 
-                        Buffer *output = createBuffer();
+                end_phase(job, metrics, PHASE_TOTAL, session_job->started);
+                add_counter(&metrics->jobs_failed, 1);
 
-                        char **data = split(request, ' ');
+                free_job(job);
+                free(session_job);
 
-                        output->file_name = data[0];
-                        output->size = atoi(data[1]);
+                if (received)
+                    continue;
 
-                        free(data);
+                break;
+            }
 
-                        char output_file[job->executable->size];
+            received = receive_client_file(client, job->executable, job->codec) && receive_client_file(client, job->input_file, job->codec);
+        }
 
-                        for (int i = 0; i < job->executable->size; i += MAX_FILE_BUFFER_SIZE) {
-                            bytes = recv(slave_socket, buffer, MAX_FILE_BUFFER_SIZE, 0);
-                            strcat(output_file, buffer);
-                            printf("[Master]: Received %d bytes for file %s.\n", i, job->executable->file_name);
-                        }
+        if (!received) {
+            fputs("{FAILED_TO_RECEIVE_JOB_REQUEST}\n", stderr);
 
-                        if (job->executable->size % MAX_FILE_BUFFER_SIZE != 0) {
-                            bytes = recv(slave_socket, buffer, job->executable->size % MAX_FILE_BUFFER_SIZE, 0);
-                            strcat(output_file, buffer);
-                        }
+            end_phase(job, metrics, PHASE_TOTAL, session_job->started);
+            add_counter(&metrics->jobs_failed, 1);
 
-                        if (bytes > 0) {
-                            status = "{SUCCESSFULLY_RECEIVED_BUFFER}";
-                            bytes = send(slave_socket, status, strlen(status), 0);
-                            printf("[Master]: Sending: [%s] to Optimal Slave ('%s', %d).\n", status, inet_ntoa(slave_address.sin_addr), htons(slave_address.sin_port));
+            release_job(client->attr->admission, job->reserved);
 
-                            output->data = output_file;
+            free_job(job);
+            free(session_job);
+            break;
+        }
 
-                            return output;
-                        } else {
-                            status = "{FAILED_TO_RECEIVE_BUFFER}";
+        job->key = hash_bytes(job->executable->data, get_wire_size(job->executable));
 
-                            fputs("{FAILED_TO_RECEIVE_BUFFER}\n", stderr);
+        end_phase(job, metrics, PHASE_UPLOAD, session_job->started);
 
-                            bytes = send(slave_socket, status, strlen(status), 0);
-                            printf("[Master]: Sending: [%s] to Optimal Slave ('%s', %d).\n", status, inet_ntoa(slave_address.sin_addr), htons(slave_address.sin_port));
+        pthread_mutex_lock(&session->lock);
+        session->references++;
+        pthread_mutex_unlock(&session->lock);
 
-                            close(slave_socket);
-                            printf("[-] Master: has disconnected from {SEND_JOB} socket on Optimal Slave ('%s', %d).\n", inet_ntoa(slave_address.sin_addr), ntohs(slave_address.sin_port));
+        pthread_t run_session_job_thread;
 
-                            continue;
-                        }
-                    } else {
-                        status = "{FAILED_TO_RECEIVE_JOB_OUTPUT}";
+        pthread_create(&run_session_job_thread, NULL, run_session_job, (void *)session_job);
+        pthread_detach(run_session_job_thread);
+    }
 
-                        fputs("{FAILED_TO_RECEIVE_JOB_OUTPUT}\n", stderr);
+    release_session(session);
 
-                        bytes = send(slave_socket, status, strlen(status), 0);
-                        printf("[Master]: Sending: [%s] to Optimal Slave ('%s', %d).\n", status, inet_ntoa(slave_address.sin_addr), htons(slave_address.sin_port));
+    pthread_exit(NULL);
+}
 
-                        close(slave_socket);
-                        printf("[-] Master: has disconnected from {SEND_JOB} socket on Optimal Slave ('%s', %d).\n", inet_ntoa(slave_address.sin_addr), ntohs(slave_address.sin_port));
+/**
+ * Receives a file announced in a job request from a client into memory.
+ *
+ * @param client The client sending the file.
+ * @param file The buffer whose name and size were announced; its data is allocated here.
+ * @param codec The codec negotiated for the job. Compressed files are kept compressed and
+ * deduplicated files are kept in the chunk store.
+ *
+ * @return Whether or not the whole file was received.
+ */
+bool receive_client_file(Client *client, Buffer *file, int codec) {
+    TransferStats stats = {0, 0};
 
-                        continue;
-                    }
-                } else {
-                    status = "{FAILED_TO_RECEIVE_BUFFER}";
+    if (codec == CODEC_CDC) {
+        long saved = 0;
 
-                    fputs("{FAILED_TO_RECEIVE_BUFFER}\n", stderr);
+        if (!recv_deduplicated(client->socket, client->attr->store, file, &stats, &saved))
+            return false;
 
-                    bytes = send(slave_socket, status, strlen(status), 0);
-                    printf("[Master]: Sending: [%s] to Optimal Slave ('%s', %d).\n", status, inet_ntoa(slave_address.sin_addr), htons(slave_address.sin_port));
+        log_info("[Master]: Deduplicated %ld of %ld bytes for file %s.\n", saved, file->size, file->file_name);
+    } else if (!recv_encoded(client->socket, file, codec, &stats)) {
+        return false;
+    }
 
-                    close(slave_socket);
-                    printf("[-] Master: has disconnected from {SEND_JOB} socket on Optimal Slave ('%s', %d).\n", inet_ntoa(slave_address.sin_addr), ntohs(slave_address.sin_port));
+    log_info("[Master]: Received %ld bytes for file %s (%.2f MB/s).\n", stats.bytes, file->file_name, get_throughput(&stats));
 
-                    continue;
-                }
-            } else {
-                status = "{FAILED_TO_RECEIVE_BUFFER}";
+    add_counter(&client->attr->metrics->bytes[BYTES_FROM_CLIENTS], stats.bytes);
 
-                fputs("{FAILED_TO_RECEIVE_BUFFER}\n", stderr);
+    return true;
+}
 
-                bytes = send(slave_socket, status, strlen(status), 0);
-                printf("[Master]: Sending: [%s] to Optimal Slave ('%s', %d).\n", status, inet_ntoa(slave_address.sin_addr), htons(slave_address.sin_port));
+/**
+ * Takes the descriptors a client on the master's host passed in place of its job's files, which stay open with the job.
+ *
+ * @param client The client passing the descriptors, over a Unix socket.
+ * @param job The job whose files' names and sizes were announced; its descriptors are set here.
+ *
+ * @return Whether or not both descriptors are of regular files holding all the bytes announced.
+ */
+bool receive_passed_files(Client *client, Job *job) {
+    char message[MAX_BUFFER_SIZE];
+    int fds[2];
 
-                close(slave_socket);
-                printf("[-] Master: has disconnected from {SEND_JOB} socket on Optimal Slave ('%s', %d).\n", inet_ntoa(slave_address.sin_addr), ntohs(slave_address.sin_port));
+    if (!recv_file_descriptors(client->socket, message, fds, 2))
+        return false;
 
-                continue;
-            }
-        } else {
-            status = "{FAILED_TO_RECEIVE_JOB_REQUEST}";
+    if (strcmp(message, "{FILE_DESCRIPTORS}\0") != 0 || !is_passed_file(fds[0], job->executable->size) || !is_passed_file(fds[1], job->input_file->size)) {
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
 
-            fputs("{FAILED_TO_RECEIVE_JOB_REQUEST}\n", stderr);
+    job->fds[0] = fds[0];
+    job->fds[1] = fds[1];
 
-            bytes = send(slave_socket, status, strlen(status), 0);
-            printf("[Master]: Sending: [%s] to Optimal Slave ('%s', %d).\n", status, inet_ntoa(slave_address.sin_addr), htons(slave_address.sin_port));
+    log_info("[Master]: Took the descriptors of files %s and %s from Client (%I), %ld bytes.\n", job->executable->file_name, job->input_file->file_name, &client->address, job->executable->size + job->input_file->size);
 
-            close(slave_socket);
-            printf("[-] Master: has disconnected from {SEND_JOB} socket on Optimal Slave ('%s', %d).\n", inet_ntoa(slave_address.sin_addr), ntohs(slave_address.sin_port));
+    add_counter(&client->attr->metrics->passed_bytes, job->executable->size + job->input_file->size);
 
-            continue;
-        }
-    }
+    return true;
 }
 
 /**
- * Listens for CPU Utilization values of each slave in the cluster.
+ * Reads past a file announced in a job request from a client without keeping it.
  *
- * Determines the "most optimal" slave based on its CPU Utilization.
- * If the CPU Utilization of the current slave is the smallest out of all the slaves in the cluster
- * then, it is the "most optimal" slave and has the highest priority of getting delegated a job.
+ * @param client The client sending the file.
+ * @param file The buffer whose size was announced.
+ * @param codec The codec negotiated for the job; never CODEC_CDC, whose chunks would be asked for.
  *
- * @param argv The arguments passed to the load_balance thread.
+ * @return Whether or not the whole file was read.
  */
-void *load_balance(void *argv) {
-    thread_attr *attr = (thread_attr *)argv;
-    SlaveList *list = attr->list;
-
-    int opt = 1;
-    int master_socket, slave_socket, bytes;
-    struct sockaddr_in slave_address, master_address;
+bool discard_client_file(Client *client, Buffer *file, int codec) {
+    TransferStats stats = {0, 0};
+    bool received = recv_decoded_file(client->socket, "/dev/null", file->size, 0, codec, &stats);
 
-    /* Create TCP socket. */
-    if ((master_socket = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
-        perror("[X] socket");
-        exit(1);
-    }
+    add_counter(&client->attr->metrics->bytes[BYTES_FROM_CLIENTS], stats.bytes);
 
-    /* Forcefully attaching socket to the desired port  */
-    if (setsockopt(master_socket, SOL_SOCKET, SO_REUSEADDR | SO_REUSEPORT, &opt, sizeof(opt))) {
-        perror("[X] setsockopt");
-        exit(1);
-    }
+    return received;
+}
 
-    /* Initialise IPv4 address. */
-    memset(&master_address, 0, sizeof master_address);
-    master_address.sin_family = AF_INET;
-    master_address.sin_port = htons(SEND_CPU_UTILIZATION_PORT);
+/**
+ * Passes a block of a job's output on to where the output goes.
+ *
+ * @param sink Where the output goes.
+ * @param header The block's header, in network byte order.
+ * @param payload The block's encoded bytes.
+ *
+ * @return Whether or not the block was passed on.
+ */
+bool deliver_block(OutputSink *sink, uint32_t *header, char *payload) {
+    long raw_size = ntohl(header[0]), encoded_size = ntohl(header[1]);
+    struct iovec block[2] = {
+        { header, LZ_BLOCK_HEADER_SIZE },
+        { payload, encoded_size }
+    };
+    char frame[MAX_BUFFER_SIZE];
+    bool delivered;
+
+    if (sink->mode == SINK_BUFFER) {
+        /* Only compressed outputs keep their block headers; uncompressed ones go on the wire bare. */
+        bool bare = sink->codec != CODEC_LZ;
+        long needed = sink->length + encoded_size + (bare ? 0 : 2 * LZ_BLOCK_HEADER_SIZE);
+
+        if (bare && encoded_size != raw_size)
+            return false;
+
+        if (!sink->output) {
+            sink->output = createBuffer();
+            sink->output->size = 0;
+        }
+
+        if (needed > sink->capacity) {
+            long capacity = sink->capacity > 0 ? sink->capacity : LZ_BLOCK_SIZE;
+
+            while (needed > capacity)
+                capacity *= 2;
+
+            char *grown = (char *)realloc(sink->output->data, capacity);
+
+            if (!grown) {
+                perror("[X] realloc");
+                return false;
+            }
+
+            sink->output->data = grown;
+            sink->capacity = capacity;
+        }
+
+        if (!bare) {
+            memcpy(sink->output->data + sink->length, header, LZ_BLOCK_HEADER_SIZE);
+            sink->length += LZ_BLOCK_HEADER_SIZE;
+        }
+
+        memcpy(sink->output->data + sink->length, payload, encoded_size);
+        sink->length += encoded_size;
+        sink->output->size += raw_size;
+
+        return true;
+    }
+
+    if (sink->mode == SINK_SESSION) {
+        snprintf(frame, sizeof(frame), "{JOB_BLOCK} %ld", sink->tag);
+
+        pthread_mutex_lock(&sink->session->lock);
+        delivered = send_frame(sink->client->socket, frame, block, 2, &sink->stats);
+        pthread_mutex_unlock(&sink->session->lock);
+    } else if (sink->blocks == 0) {
+        /* The output is only announced with its first block, so that until then a failed attempt can be retried. */
+        snprintf(frame, sizeof(frame), "{STREAMING_OUTPUT} %s", sink->name);
+        delivered = send_frame(sink->client->socket, frame, block, 2, &sink->stats);
+    } else {
+        delivered = send_allv(sink->client->socket, block, 2, &sink->stats);
+    }
+
+    sink->blocks++;
+
+    return delivered;
+}
+
+/**
+ * Passes an output received whole from a slave that predates streaming on, block by block.
+ *
+ * @param sink Where the output goes.
+ * @param output The output, as it came off the wire.
+ *
+ * @return Whether or not every block was passed on.
+ */
+bool deliver_buffer(OutputSink *sink, Buffer *output) {
+    long offset = 0;
+
+    while (offset < get_wire_size(output)) {
+        uint32_t header[2];
+        char *payload;
+
+        /* Compressed outputs already are a block stream; uncompressed ones are cut into stored blocks. */
+        if (sink->codec == CODEC_LZ) {
+            memcpy(header, output->data + offset, LZ_BLOCK_HEADER_SIZE);
+            payload = output->data + offset + LZ_BLOCK_HEADER_SIZE;
+
+            if (header[0] == 0)
+                break;
+
+            offset += LZ_BLOCK_HEADER_SIZE + ntohl(header[1]);
+        } else {
+            long size = output->size - offset < LZ_BLOCK_SIZE ? output->size - offset : LZ_BLOCK_SIZE;
+
+            header[0] = header[1] = htonl(size);
+            payload = output->data + offset;
+
+            offset += size;
+        }
+
+        if (!deliver_block(sink, header, payload))
+            return false;
+    }
+
+    return true;
+}
+
+/**
+ * Ends the output of a job where it goes, with whether or not the job executed.
+ *
+ * @param sink Where the output went.
+ * @param executed Whether or not the job executed and all of its output was passed on.
+ *
+ * @return Whether or not the client received the whole output of a job that executed.
+ */
+bool finish_output(OutputSink *sink, bool executed) {
+    Client *client = sink->client;
+    char *status = executed ? "{SUCCESSFULLY_EXECUTED_JOB}" : sink->failure ? sink->failure : "{FAILED_TO_EXECUTE_JOB}";
+    char frame[MAX_BUFFER_SIZE], response[MAX_BUFFER_SIZE] = "";
+    bool delivered = false;
+
+    if (sink->mode == SINK_SESSION) {
+        snprintf(frame, sizeof(frame), "{JOB_END} %ld %s", sink->tag, status);
+
+        pthread_mutex_lock(&sink->session->lock);
+        delivered = send_message(client->socket, frame) && executed;
+        pthread_mutex_unlock(&sink->session->lock);
+
+        log_info("[Master]: Sending: [%s] to Client (%I) (%.2f MB/s).\n", frame, &client->address, get_throughput(&sink->stats));
+
+        return delivered;
+    }
+
+    if (sink->mode == SINK_BUFFER) {
+        Buffer *output = sink->output;
+        uint32_t terminator[2] = { 0, 0 };
+
+        /* A compressed output is only complete with its terminator. */
+        struct iovec iov[2] = {
+            { output ? output->data : NULL, sink->length },
+            { terminator, sink->codec == CODEC_LZ ? LZ_BLOCK_HEADER_SIZE : 0 }
+        };
+
+        snprintf(frame, sizeof(frame), "%s %ld", sink->name, output ? output->size : 0);
+        delivered = send_frame(client->socket, frame, iov, 2, &sink->stats);
+
+        if (output) {
+            free(output->data);
+            free(output);
+            sink->output = NULL;
+        }
+    } else {
+        char *header = sink->blocks == 0 ? frame : NULL;
+
+        /* An empty output is announced along with its end. */
+        if (header)
+            snprintf(frame, sizeof(frame), "{STREAMING_OUTPUT} %s", sink->name);
+
+        delivered = (!header || send_message(client->socket, header))
+            && send_block(client->socket, NULL, 0, sink->codec, NULL, &sink->stats)
+            && send_message(client->socket, status);
+    }
+
+    log_info("[Master]: Sending Job Output: [%s] to Client (%I) (%.2f MB/s).\n", sink->name, &client->address, get_throughput(&sink->stats));
+
+    if (delivered) {
+        recv_message(client->socket, response);
+        log_debug("[Master]: Received: [%s] from Client (%I).\n", response, &client->address);
+    }
+
+    return delivered && executed && strcmp(response, "{SUCCESSFULLY_RECEIVED_BUFFER}\0") == 0;
+}
+
+/**
+ * Handles / processes a given client connection.
+ *
+ * @param argv The arguments passed to the handle_client thread.
+ */
+void *handle_client(void *argv) {
+    Client *client = (Client *)argv;
+    Metrics *metrics = client->attr->metrics;
+
+    char *response;
+    char request[MAX_BUFFER_SIZE];
+
+    log_debug("[+] Client (%I): has connected to {LISTEN_FOR_CLIENTS} socket.\n", &client->address);
+
+    recv_message(client->socket, request);
+
+    /* Clients pipelining many jobs open a session in place of their first job request. */
+    if (strncmp(request, "{OPEN_SESSION}", 14) == 0)
+        handle_session(client, request);
+
+    Job *job = createJob();
+
+    log_info("[Master]: Received Job Request: [%s] from Client (%I).\n", request, &client->address);
+
+    char executable_name[MAX_BUFFER_SIZE], input_file_name[MAX_BUFFER_SIZE], codec_name[MAX_BUFFER_SIZE] = "none", trace_id[MAX_BUFFER_SIZE] = "";
+    char priority_name[MAX_BUFFER_SIZE] = "normal";
+    long deadline = 0;
+
+    if (sscanf(request, "%s %ld %s %ld %s %s %ld %s %32s", executable_name, &job->executable->size, input_file_name, &job->input_file->size, codec_name, trace_id, &deadline, priority_name, job->tenant) < 4
+        || job->executable->size < 0 || job->input_file->size < 0)
+        disconnect_client(client, job, "{FAILED_TO_RECEIVE_JOB_REQUEST}");
+
+    /* Clients that predate tracing send no trace id, so the job keeps the one minted for it here. */
+    if (is_trace_id(trace_id))
+        memcpy(job->trace_id, trace_id, sizeof(job->trace_id));
+
+    /* The deadline counts from when the client connected; clients that predate deadlines send none. */
+    if (deadline > 0 && deadline <= INT_MAX)
+        job->deadline = client->started + deadline * 1000000UL;
+
+    /* Jobs of unknown classes, and of clients that predate them, are normal. */
+    if (get_priority(priority_name) != -1)
+        job->priority = get_priority(priority_name);
+
+    unsigned long started = end_phase(job, metrics, PHASE_REQUEST, client->started);
+
+    /* Fall back to no encoding for codecs this master does not know. */
+    job->codec = get_codec(codec_name) == -1 ? CODEC_NONE : get_codec(codec_name);
+
+    /* Clients on the master's host may pass the descriptors of their files in place of their bytes, which are then kept uncompressed. */
+    bool passed = strcmp(codec_name, FILE_DESCRIPTORS_CODEC) == 0 && is_unix_socket(client->socket);
+
+    job->executable->file_name = strdup(basename(executable_name));
+    job->input_file->file_name = strdup(basename(input_file_name));
+
+    snprintf(job->command, MAX_BUFFER_SIZE, "./%s %s", job->executable->file_name, job->input_file->file_name);
+
+    char accepted[MAX_BUFFER_SIZE];
+    int retry_after;
+
+    /* Turning the job away in place of accepting it spares the client sending its files. */
+    if (!admit(job, client, passed, &retry_after)) {
+        snprintf(accepted, sizeof(accepted), "{REJECTED_JOB} %d", retry_after);
+        disconnect_client(client, job, accepted);
+    }
+
+    snprintf(accepted, sizeof(accepted), "{SUCCESSFULLY_RECEIVED_JOB_REQUEST} %s stream", passed ? FILE_DESCRIPTORS_CODEC : get_codec_name(job->codec));
+
+    send_message(client->socket, accepted);
+    log_debug("[Master]: Sending: [%s] to Client (%I).\n", accepted, &client->address);
+
+    /* The executable and input file follow each other without an acknowledgement in between. */
+    if (passed ? !receive_passed_files(client, job) || !hash_open_file(job->fds[0], job->executable->size, &job->key)
+        : !receive_client_file(client, job->executable, job->codec) || !receive_client_file(client, job->input_file, job->codec))
+        disconnect_client(client, job, "{FAILED_TO_RECEIVE_BUFFER}");
+
+    if (!passed)
+        job->key = hash_bytes(job->executable->data, get_wire_size(job->executable));
+
+    end_phase(job, metrics, PHASE_UPLOAD, started);
+
+    response = "{SUCCESSFULLY_RECEIVED_BUFFER}";
+    send_message(client->socket, response);
+    log_debug("[Master]: Sending: [%s] to Client (%I).\n", response, &client->address);
+
+    recv_message(client->socket, request);
+    log_debug("[Master]: Received: [%s] from Client (%I).\n", request, &client->address);
+
+    /* Clients that stream output ask for it; older ones take it whole once the job is done. */
+    bool stream = strcmp(request, "{REQUEST_JOB_OUTPUT} stream\0") == 0;
+
+    if (!stream && strcmp(request, "{REQUEST_JOB_OUTPUT}\0") != 0)
+        disconnect_client(client, job, "{FAILED_TO_RECEIVE_JOB_OUTPUT}");
+
+    OutputSink sink = { stream ? SINK_STREAM : SINK_BUFFER, client, NULL, 0, job->codec };
+
+    bool executed = pass_job_to_optimal_slave(job, client, &sink);
+
+    /* Nothing reached the client yet, so the failure can still take the place of the output. */
+    if (!executed && sink.blocks == 0) {
+        if (sink.output) {
+            free(sink.output->data);
+            free(sink.output);
+        }
+
+        disconnect_client(client, job, sink.failure ? sink.failure : "{FAILED_TO_EXECUTE_JOB}");
+    }
+
+    started = now_nanoseconds();
+
+    bool delivered = finish_output(&sink, executed);
+
+    end_phase(job, metrics, PHASE_DOWNLOAD, started);
+    add_counter(&metrics->bytes[BYTES_TO_CLIENTS], sink.stats.bytes);
+
+    disconnect_client(client, job, delivered ? NULL : executed ? "{FAILED_TO_RECEIVE_BUFFER}" : sink.failure ? sink.failure : "{FAILED_TO_EXECUTE_JOB}");
+
+    return NULL;
+}
+
+/**
+ * Passes a job to the optimal slave node once it is the job's turn, and passes its output on as it arrives.
+ *
+ * @param job The job to pass to the optimal slave.
+ * @param client The client that submitted the job.
+ * @param sink Where the job's output goes.
+ *
+ * @return Whether or not the job executed and all of its output was passed on.
+ */
+bool pass_job_to_optimal_slave(Job *job, Client *client, OutputSink *sink) {
+    Metrics *metrics = client->attr->metrics;
+
+    unsigned long queued = now_nanoseconds();
+    bool turn = wait_for_turn(job, client, sink);
+    unsigned long started = end_phase(job, metrics, PHASE_QUEUE, queued);
+
+    record_value(&metrics->queueing[job->priority], started - queued);
+
+    if (!turn)
+        return false;
+
+    unsigned long granted = started;
+    bool executed = try_slaves(job, client, sink, &started);
+
+    record_turn(client->attr->admission, now_nanoseconds() - granted);
+    end_turn(client->attr->queue);
+
+    return executed;
+}
+
+/**
+ * Waits in the fair queue until the job may be given to a slave.
+ *
+ * @param job The job.
+ * @param client The client that submitted the job, whose identity the job takes turns as.
+ * @param sink Where the job's output goes, told why the job failed if it gives up.
+ *
+ * @return Whether or not the job got its turn, which must be ended with end_turn(); a job
+ *         gives up once its deadline passes or its client hangs up.
+ */
+bool wait_for_turn(Job *job, Client *client, OutputSink *sink) {
+    FairQueue *queue = client->attr->queue;
+    char identity[INET6_ADDRSTRLEN];
+    Ticket ticket;
+    uid_t uid;
+
+    /* Turns follow what the master can vouch for: the user on its Unix socket, the address otherwise; not the tenant a job names. */
+    if (is_unix_socket(client->socket) && get_peer_uid(client->socket, &uid))
+        snprintf(identity, sizeof(identity), "uid:%u", (unsigned int)uid);
+    else
+        inet_ntop(AF_INET, &client->address.sin_addr, identity, sizeof(identity));
+
+    enqueue_job(queue, &ticket, identity, job->tenant, job->priority);
+
+    while (true) {
+        int left = get_time_left(job);
+
+        if (await_turn(queue, &ticket, left >= 0 && left < QUEUE_CHECK_INTERVAL ? left : QUEUE_CHECK_INTERVAL))
+            return true;
+
+        struct pollfd pfd = { .fd = client->socket, .events = POLLRDHUP };
+        bool hung_up = poll(&pfd, 1, 0) > 0;
+
+        if (!hung_up && get_time_left(job) != 0 && !client->attr->terminated)
+            continue;
+
+        /* A turn granted while giving up goes straight to the next job. */
+        if (leave_queue(queue, &ticket))
+            end_turn(queue);
+
+        if (hung_up) {
+            log_warn("[Master]: Client (%I) hung up while its Job was queued.\n", &client->address);
+        } else if (get_time_left(job) == 0) {
+            log_warn("[Master]: Job missed its deadline while queued.\n");
+            sink->failure = "{FAILED_TO_MEET_DEADLINE}";
+        }
+
+        return false;
+    }
+}
+
+/**
+ * Tries a job on the best available slaves in turn until one runs it.
+ *
+ * @param job The job to pass to the optimal slave.
+ * @param client The client that submitted the job.
+ * @param sink Where the job's output goes.
+ * @param started When the job's current phase started; advanced as each phase completes.
+ *
+ * @return Whether or not the job executed and all of its output was passed on.
+ */
+bool try_slaves(Job *job, Client *client, OutputSink *sink, unsigned long *started) {
+    Metrics *metrics = client->attr->metrics;
+
+    /* Tiny jobs go to a slave in batches; one whose batch could not run goes on its own. */
+    if (is_batchable(client->attr->batcher, job)) {
+        bool ran = false;
+        bool executed = run_batched(job, client, sink, started, &ran);
+
+        if (ran)
+            return executed;
+    }
+
+    for (int attempt = 0; attempt < client->attr->max_attempts && !client->attr->terminated; attempt++) {
+        /* Jobs sharing an executable share an affinity key, which keeps a slave's chunk store warm for them. */
+        Slave *optimal_slave = select_slave(client->attr->scheduler, job->executable->file_name);
+        bool failed = false;
+        int left = get_time_left(job);
+
+        if (attempt > 0)
+            add_counter(&metrics->retries, 1);
+
+        /* A job past its deadline is not worth another slave. */
+        if (left == 0) {
+            if (optimal_slave)
+                leave_slave(client, optimal_slave);
+
+            log_warn("[Master]: Job missed its deadline before a Slave took it.\n");
+            sink->failure = "{FAILED_TO_MEET_DEADLINE}";
+
+            return false;
+        }
+
+        /* With no slave available, the job backs off rather than waiting for one, though never past its deadline. */
+        if (!optimal_slave) {
+            unsigned long backoff = get_backoff(client->attr->scheduler, attempt + 1);
+
+            log_warn("[Master]: No Slave is available, backing off.\n");
+            usleep((left > 0 && backoff > left * 1000000UL ? left * 1000000UL : backoff) / 1000);
+            continue;
+        }
+
+        /* Output collected for a client that takes it whole starts over with every attempt. */
+        sink->length = 0;
+
+        if (sink->output)
+            sink->output->size = 0;
+
+        bool executed = dispatch_job(job, client, optimal_slave, sink, started, &failed);
+
+        /* Once output reached the client, another attempt would repeat it. */
+        if (executed || failed || sink->blocks > 0)
+            return executed;
+    }
+
+    log_error("[Master]: Giving up on Job after %d attempts.\n", client->attr->max_attempts);
+
+    if (get_time_left(job) == 0)
+        sink->failure = "{FAILED_TO_MEET_DEADLINE}";
+
+    return false;
+}
+
+/**
+ * Runs a job on a slave as part of a batch of tiny jobs for the same executable, and passes its output on.
+ *
+ * @param job The job, which must be batchable.
+ * @param client The client that submitted the job.
+ * @param sink Where the job's output goes.
+ * @param started When the job's current phase started; advanced as each phase completes.
+ * @param ran Set if the job's result came back, whether or not the job executed.
+ *
+ * @return Whether or not the job executed and all of its output was passed on.
+ */
+bool run_batched(Job *job, Client *client, OutputSink *sink, unsigned long *started, bool *ran) {
+    Batcher *batcher = client->attr->batcher;
+    Metrics *metrics = client->attr->metrics;
+    int index;
+    Batch *batch = join_batch(batcher, job, job->key, &index);
+
+    /* The first job runs the batch for all of them. */
+    if (index == 0) {
+        dispatch_batch(batch, client);
+        finish_batch(batcher, batch);
+    } else {
+        await_batch(batcher, batch);
+    }
+
+    BatchEntry *entry = &batch->entries[index];
+    bool executed = false;
+
+    *ran = entry->received;
+
+    if (entry->received) {
+        *started = end_phase(job, metrics, PHASE_EXECUTE, *started);
+
+        snprintf(sink->name, sizeof(sink->name), "%s_output.txt", job->executable->file_name);
+        executed = strcmp(entry->status, "{SUCCESSFULLY_EXECUTED_JOB}\0") == 0;
+
+        /* The output was kept as it came off the wire, so it is passed on block by block as if it came from the slave. */
+        for (long offset = 0; entry->output && offset < entry->output->size; ) {
+            uint32_t header[2];
+
+            memcpy(header, entry->output->data + offset, LZ_BLOCK_HEADER_SIZE);
+
+            if (!deliver_block(sink, header, entry->output->data + offset + LZ_BLOCK_HEADER_SIZE)) {
+                executed = false;
+                break;
+            }
+
+            offset += LZ_BLOCK_HEADER_SIZE + ntohl(header[1]);
+        }
+
+        /* The job ran out of time before the batch went out, or on the slave, which stopped it. */
+        if (strcmp(entry->status, "{FAILED_TO_MEET_DEADLINE}\0") == 0) {
+            sink->failure = "{FAILED_TO_MEET_DEADLINE}";
+            add_counter(&metrics->cancellations[CANCEL_DEADLINE], 1);
+        }
+
+        *started = end_phase(job, metrics, PHASE_COLLECT, *started);
+    }
+
+    leave_batch(batcher, batch);
+
+    return executed;
+}
+
+/**
+ * Runs a batch of tiny jobs on a slave, filling in the result of each job that comes back.
+ *
+ * The batch takes jobs until its slave greets it and its window has passed, or
+ * it is full. It then goes out in one frame: the executable, then each job's
+ * request and input file. The slave counts as running every job of the batch
+ * until its results are in.
+ *
+ * @param batch The batch, led by the calling job.
+ * @param client The client that submitted the job leading the batch.
+ */
+void dispatch_batch(Batch *batch, Client *client) {
+    thread_attr *attr = client->attr;
+    Batcher *batcher = attr->batcher;
+    Metrics *metrics = attr->metrics;
+    Job *leader = batch->entries[0].job;
+    Slave *slave = select_slave(attr->scheduler, batch->executable);
+
+    /* Slaves that predate batches take the jobs one at a time, as do jobs with no slave to go to. */
+    if (!slave || !__atomic_load_n(&slave->batching, __ATOMIC_RELAXED)) {
+        close_batch(batcher, batch, 0);
+
+        if (slave)
+            leave_slave(client, slave);
+
+        return;
+    }
+
+    struct sockaddr_in slave_address;
+
+    memset(&slave_address, 0, sizeof slave_address);
+    slave_address.sin_family = AF_INET;
+    slave_address.sin_port = htons(slave->port);
+
+    int slave_socket = socket(AF_INET, SOCK_STREAM, 0);
+    char message[MAX_BUFFER_SIZE] = "";
+
+    if (slave_socket == -1)
+        perror("[X] socket");
+
+    bool sent = slave_socket != -1 && inet_pton(AF_INET, slave->address, &slave_address.sin_addr) > 0
+        && connect_timeout(slave_socket, &slave_address, attr->attempt_timeout);
+
+    if (sent) {
+        tune_socket(slave_socket);
+        set_timeout(slave_socket, attr->attempt_timeout);
+
+        /* The batch waits for its slave's greeting like any job, but is never stolen; the busier the slave, the more jobs join meanwhile. */
+        sent = !slave->ready || (recv_message(slave_socket, message) && strcmp(message, "{READY_FOR_JOB}\0") == 0);
+    }
+
+    /* The leader's deadline bounds the window, and a failed slave takes no more jobs. */
+    unsigned long until = batch->opened + (unsigned long)batcher->window * 1000UL;
+
+    close_batch(batcher, batch, !sent ? 0 : leader->deadline && leader->deadline < until ? leader->deadline : until);
+
+    __atomic_add_fetch(&slave->outstanding, batch->count - 1, __ATOMIC_RELAXED);
+
+    int count = 0, indices[batch->count], received = 0;
+    char header[MAX_BUFFER_SIZE], requests[batch->count][MAX_BUFFER_SIZE];
+    struct iovec frame[1 + 2 * batch->count];
+    TransferStats stats = {0, 0};
+
+    for (int i = 0; sent && i < batch->count; i++) {
+        Job *job = batch->entries[i].job;
+        char deadline[MAX_BUFFER_SIZE] = "";
+        int left = get_time_left(job);
+
+        /* A job that ran out of time while the batch filled up is not sent. */
+        if (left == 0) {
+            snprintf(batch->entries[i].status, sizeof(batch->entries[i].status), "{FAILED_TO_MEET_DEADLINE}");
+            batch->entries[i].received = true;
+            received++;
+            continue;
+        }
+
+        if (left > 0)
+            snprintf(deadline, sizeof(deadline), "%s=%d ", DEADLINE_ENV, left);
+
+        memset(requests[count], 0, MAX_BUFFER_SIZE);
+
+        /* As with a job on its own, what does not fit is left off: first the trace id, then the deadline. */
+        if (snprintf(requests[count], MAX_BUFFER_SIZE, "%s %ld %s %s%s", job->input_file->file_name, job->input_file->size, job->trace_id, deadline, job->command) >= MAX_BUFFER_SIZE
+            && snprintf(requests[count], MAX_BUFFER_SIZE, "%s %ld %s%s", job->input_file->file_name, job->input_file->size, deadline, job->command) >= MAX_BUFFER_SIZE)
+            snprintf(requests[count], MAX_BUFFER_SIZE, "%s %ld %s", job->input_file->file_name, job->input_file->size, job->command);
+
+        frame[1 + 2 * count].iov_base = requests[count];
+        frame[1 + 2 * count].iov_len = MAX_BUFFER_SIZE;
+        frame[2 + 2 * count].iov_base = job->input_file->data;
+        frame[2 + 2 * count].iov_len = get_wire_size(job->input_file);
+
+        indices[count++] = i;
+    }
+
+    if (sent && count > 0) {
+        snprintf(header, sizeof(header), "{RUN_BATCH} %d %d %s %ld %s", count, attr->queue->slots, batch->executable, leader->executable->size, get_codec_name(batch->codec));
+
+        frame[0].iov_base = leader->executable->data;
+        frame[0].iov_len = get_wire_size(leader->executable);
+
+        sent = send_frame(slave_socket, header, frame, 1 + 2 * count, &stats)
+            && recv_message(slave_socket, message) && strcmp(message, "{SUCCESSFULLY_RECEIVED_BUFFER}\0") == 0;
+
+        add_counter(&metrics->bytes[BYTES_TO_SLAVES], stats.bytes);
+    }
+
+    if (sent && count > 0) {
+        add_counter(&metrics->batches, 1);
+        add_counter(&metrics->batched_jobs, count);
+
+        log_info("[Master]: Sent a batch of %d Jobs for %s to Slave (%s:%d) (%.2f MB/s).\n", count, batch->executable, slave->address, slave->port, get_throughput(&stats));
+
+        received += collect_batch(batch, slave_socket, indices, count, metrics);
+    }
+
+    if (slave_socket != -1)
+        close(slave_socket);
+
+    /* The jobs without a result go to a slave on their own. */
+    if (received == batch->count) {
+        report_success(slave);
+    } else {
+        log_warn("[Master]: Slave (%s:%d) sent %d of the %d results of a batch.\n", slave->address, slave->port, received, batch->count);
+        suspect_slave(client, slave);
+    }
+
+    for (int i = 0; i < batch->count; i++)
+        leave_slave(client, slave);
+}
+
+/**
+ * Receives the results of a batch that a slave took.
+ *
+ * Results come in the order the jobs finished, each a status followed by the
+ * job's output as a stream of blocks, and are acknowledged together.
+ *
+ * @param batch The batch.
+ * @param slave_socket The connection to the slave.
+ * @param indices The place in the batch of each job sent, in the order they were sent.
+ * @param count The number of jobs sent.
+ * @param metrics The metrics to count the bytes received in.
+ *
+ * @return The number of results received.
+ */
+int collect_batch(Batch *batch, int slave_socket, int *indices, int count, Metrics *metrics) {
+    char message[MAX_BUFFER_SIZE], status[MAX_BUFFER_SIZE];
+    char *payload = (char *)malloc(sizeof(char) * LZ_BLOCK_SIZE);
+    TransferStats stats = {0, 0};
+    uint32_t block[2];
+    int received = 0, index;
+
+    /* The jobs run for as long as they need; the slave enforces their deadlines. */
+    set_timeout(slave_socket, 0);
+
+    while (payload && received < count && recv_message(slave_socket, message)) {
+        long raw_size = -1;
+
+        if (sscanf(message, "{BATCH_JOB_OUTPUT} %d %s", &index, status) != 2 || index < 0 || index >= count || batch->entries[indices[index]].received)
+            break;
+
+        BatchEntry *entry = &batch->entries[indices[index]];
+
+        while ((raw_size = recv_block(slave_socket, block, payload, &stats)) > 0
+               && append_output(entry, block, LZ_BLOCK_HEADER_SIZE) && append_output(entry, payload, ntohl(block[1])));
+
+        if (raw_size != 0)
+            break;
+
+        snprintf(entry->status, sizeof(entry->status), "%s", status);
+        entry->received = true;
+        received++;
+    }
+
+    free(payload);
+
+    add_counter(&metrics->bytes[BYTES_FROM_SLAVES], stats.bytes);
+
+    char *acknowledgement = received == count ? "{SUCCESSFULLY_RECEIVED_BUFFER}" : "{FAILED_TO_RECEIVE_BUFFER}";
+
+    send_message(slave_socket, acknowledgement);
+    log_debug("[Master]: Sending: [%s] to Slave.\n", acknowledgement);
+
+    return received;
+}
+
+/**
+ * Suspects a slave that a job failed to reach or run on.
+ *
+ * @param client The client that submitted the job.
+ * @param slave The slave.
+ */
+void suspect_slave(Client *client, Slave *slave) {
+    if (report_failure(client->attr->scheduler, slave))
+        log_warn("[Master]: Opened the circuit of Slave (%s:%d) after %u failures in a row.\n", slave->address, slave->port, slave->failures);
+    else
+        log_warn("[Master]: Suspecting Slave (%s:%d) after %u failures in a row.\n", slave->address, slave->port, slave->failures);
+}
+
+/**
+ * Connects to a slave and hands it a job once the slave is ready for it.
+ *
+ * @param job The job to run.
+ * @param client The client that submitted the job.
+ * @param attempt The attempt, naming the slave to run the job on; receives the connection, and the slave
+ *                that stole the job if one did. Marked ATTEMPT_ABANDONED if the job gave up waiting for its slave.
+ * @param started When the job's current phase started, advanced as each phase completes; NULL for a backup,
+ *                whose phases overlap the job's own.
+ *
+ * @return Whether or not the slave took the job.
+ */
+bool start_attempt(Job *job, Client *client, Attempt *attempt, unsigned long *started) {
+    Metrics *metrics = client->attr->metrics;
+    Slave *optimal_slave;
+
+    int slave_socket;
+    struct sockaddr_in slave_address;
+
+    /* A job stolen while it waits for its slave starts over with the thief. */
+    while (true) {
+        optimal_slave = attempt->slave;
+
+        /* Initialise IPv4 address. */
+        memset(&slave_address, 0, sizeof slave_address);
+        slave_address.sin_family = AF_INET;
+        slave_address.sin_port = htons(optimal_slave->port);
+
+        /* Create TCP socket. */
+        if ((slave_socket = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
+            perror("[X] socket");
+            log_debug("\n");
+            return false;
+        }
+
+        /* Make sure optimal slave's address is a valid address */
+        if (inet_pton(AF_INET, optimal_slave->address, &slave_address.sin_addr) <= 0) {
+            fputs("\nInvalid address / Address not supported.\n", stderr);
+            close(slave_socket);
+            suspect_slave(client, optimal_slave);
+            return false;
+        }
+
+        /* Connect to socket with optimal slaves's address; a slave that does not answer in time is passed over for the next one. */
+        if (!connect_timeout(slave_socket, &slave_address, client->attr->attempt_timeout)) {
+            perror("[X] connect");
+            log_debug("\n");
+            close(slave_socket);
+            suspect_slave(client, optimal_slave);
+
+            return false;
+        }
+
+        tune_socket(slave_socket);
+
+        /* Until the slave has the job, no step of the handshake may take longer than an attempt. */
+        set_timeout(slave_socket, client->attr->attempt_timeout);
+
+        /* Slaves that predate greetings take the job's files straight away. */
+        if (!optimal_slave->ready)
+            break;
+
+        int greeting = await_greeting(job, client, attempt, slave_socket, started != NULL);
+
+        if (greeting == GREETING_RECEIVED)
+            break;
+
+        close(slave_socket);
+
+        if (greeting == GREETING_STOLEN) {
+            add_counter(&metrics->steals, 1);
+            log_info("[Master]: Idle Slave (%s:%d) stole a Job queued on busy Slave (%s:%d).\n",
+                     attempt->slave->address, attempt->slave->port, optimal_slave->address, optimal_slave->port);
+
+            leave_slave(client, optimal_slave);
+            continue;
+        }
+
+        if (greeting == GREETING_ABANDONED)
+            attempt->state = ATTEMPT_ABANDONED;
+        else
+            suspect_slave(client, optimal_slave);
+
+        return false;
+    }
+
+    if (started)
+        *started = end_phase(job, metrics, PHASE_SELECT, *started);
+
+    add_counter(&optimal_slave->dispatches, 1);
+
+    log_debug("[+] Master: has connected to the {SEND_JOB} socket on Slave (%I).\n", &slave_address);
+
+    char response[MAX_BUFFER_SIZE];
+    TransferStats stats = {0, 0};
+
+    char job_request[MAX_BUFFER_SIZE], deadline[MAX_BUFFER_SIZE] = "";
+    int left = get_time_left(job);
+
+    /* The slave is told how long the job has left, which leaves out however long it took to get there. */
+    if (left > 0)
+        snprintf(deadline, sizeof(deadline), "%s=%d ", DEADLINE_ENV, left);
+
+    /*
+     * The trace id goes before the command, and the deadline in front of it. What does not fit is left off:
+     * first the trace id, as the slave mints its own, then the deadline, as the master cancels the job at it anyway.
+     */
+    if (snprintf(job_request, sizeof(job_request), "%s %ld %s %ld %s %s %s%s", job->executable->file_name, job->executable->size, job->input_file->file_name, job->input_file->size, get_codec_name(job->codec), job->trace_id, deadline, job->command) >= (int)sizeof(job_request)
+        && snprintf(job_request, sizeof(job_request), "%s %ld %s %ld %s %s%s", job->executable->file_name, job->executable->size, job->input_file->file_name, job->input_file->size, get_codec_name(job->codec), deadline, job->command) >= (int)sizeof(job_request))
+        snprintf(job_request, sizeof(job_request), "%s %ld %s %ld %s %s", job->executable->file_name, job->executable->size, job->input_file->file_name, job->input_file->size, get_codec_name(job->codec), job->command);
+
+    struct iovec payload[2] = {
+        { job->executable->data, get_wire_size(job->executable) },
+        { job->input_file->data, get_wire_size(job->input_file) }
+    };
+
+    /* Files a client passed the descriptors of are copied from its page cache by the kernel, never through the master. */
+    bool passed = job->fds[0] != -1;
+    long sizes[2] = { job->executable->size, job->input_file->size };
+
+    /* A slave on the master's host reads the files from shared memory; the job request follows the object's name. */
+    char shared_memory[MAX_BUFFER_SIZE];
+    int shared_payload = -1;
+
+    if (job->codec != CODEC_CDC && client->attr->shared_memory && __atomic_load_n(&optimal_slave->shared_memory, __ATOMIC_RELAXED)
+        && (long)(payload[0].iov_len + payload[1].iov_len) >= client->attr->shared_memory_min_size
+        && (shared_payload = passed ? create_payload_from_files(shared_memory, job->fds, sizes, 2, &stats) : create_payload(shared_memory, payload, 2, &stats)) != -1) {
+        char header[MAX_BUFFER_SIZE];
+
+        snprintf(header, sizeof(header), "{SHARED_MEMORY} %s", shared_memory);
+        send_message(slave_socket, header);
+        send_message(slave_socket, job_request);
+
+        add_counter(&metrics->shared_memory_bytes, stats.bytes);
+    } else if (job->codec == CODEC_CDC) {
+        long saved = 0;
+
+        /* The slave answers each manifest with the chunks it is missing, which are sent from the store. */
+        send_message(slave_socket, job_request);
+        forward_deduplicated(slave_socket, client->attr->store, job->executable, &stats, &saved);
+        forward_deduplicated(slave_socket, client->attr->store, job->input_file, &stats, &saved);
+
+        log_info("[Master]: Optimal Slave already had %ld of %ld bytes.\n", saved, job->executable->size + job->input_file->size);
+    } else if (passed) {
+        /* The slave's answer tells whether the files arrived, as it does after send_frame(). */
+        if (send_message(slave_socket, job_request) && send_open_file(slave_socket, job->fds[0], sizes[0], &stats))
+            send_open_file(slave_socket, job->fds[1], sizes[1], &stats);
+    } else {
+        /* The job request, executable and input file go out in the same writev(). */
+        send_frame(slave_socket, job_request, payload, 2, &stats);
+    }
+
+    log_info("[Master]: Sending Job Request: [%s] to Optimal Slave (%I) (%.2f MB/s).\n",
+             job_request,
+             &slave_address,
+             get_throughput(&stats)
+    );
+
+    add_counter(&metrics->bytes[BYTES_TO_SLAVES], stats.bytes);
+
+    recv_message(slave_socket, response);
+    log_debug("[Master]: Received: [%s] from Optimal Slave (%I).\n", response, &slave_address);
+
+    if (shared_payload != -1)
+        close_payload(shared_payload, shared_memory);
+
+    if (started)
+        *started = end_phase(job, metrics, PHASE_DISPATCH, *started);
+
+    if (strcmp(response, "{SUCCESSFULLY_RECEIVED_BUFFER}\0") != 0) {
+        close(slave_socket);
+        log_debug("[-] Master: has disconnected from {SEND_JOB} socket on Optimal Slave (%I).\n", &slave_address);
+        suspect_slave(client, optimal_slave);
+
+        return false;
+    }
+
+    /* The job itself may run for as long as it needs. */
+    set_timeout(slave_socket, 0);
+
+    attempt->socket = slave_socket;
+    attempt->address = slave_address;
+    attempt->state = ATTEMPT_RUNNING;
+    attempt->accepted = now_nanoseconds();
+
+    return true;
+}
+
+/**
+ * Waits for a slave to greet a job, which it does once it is done with the jobs ahead of it.
+ *
+ * While it waits, the job is parked where an idle slave can steal it. The job gives up
+ * once its deadline passes or its client hangs up, but not because the wait is long.
+ *
+ * @param job The job.
+ * @param client The client that submitted the job.
+ * @param attempt The attempt, whose slave is replaced by the thief if the job is stolen.
+ * @param slave_socket The connection to the attempt's slave.
+ * @param parkable Whether or not the job may be stolen; a job that may not waits no longer than an attempt.
+ *
+ * @return The GREETING_*.
+ */
+int await_greeting(Job *job, Client *client, Attempt *attempt, int slave_socket, bool parkable) {
+    StealBoard *board = client->attr->board;
+    Parked parked;
+    bool stealable = parkable && park_job(board, &parked, attempt->slave);
+    int result = GREETING_FAILED, timeout = client->attr->attempt_timeout;
+
+    while (true) {
+        int left = get_time_left(job);
+        int wait = !stealable ? (left >= 0 && left < timeout ? left : timeout) : left >= 0 && left < QUEUE_CHECK_INTERVAL ? left : QUEUE_CHECK_INTERVAL;
+
+        struct pollfd pfds[3] = {
+            { .fd = slave_socket, .events = POLLIN },
+            { .fd = client->socket, .events = POLLRDHUP },
+            { .fd = stealable ? parked.wakeup : -1, .events = POLLIN }
+        };
+        int ready = left == 0 ? 0 : poll(pfds, 3, wait);
+
+        if (ready == -1 && errno == EINTR)
+            continue;
+
+        if (ready == -1) {
+            perror("[X] poll");
+            break;
+        }
+
+        /* A greeting that crosses a steal wins, and the thief is handed back. */
+        if (ready > 0 && pfds[0].revents) {
+            char greeting[MAX_BUFFER_SIZE];
+
+            if (recv_message(slave_socket, greeting) && strcmp(greeting, "{READY_FOR_JOB}\0") == 0)
+                result = GREETING_RECEIVED;
+
+            break;
+        }
+
+        if (ready > 0 && pfds[2].revents) {
+            result = GREETING_STOLEN;
+            break;
+        }
+
+        if ((ready > 0 && pfds[1].revents) || get_time_left(job) == 0) {
+            result = GREETING_ABANDONED;
+            break;
+        }
+
+        /* A parked job waits for as long as its slave is still around. */
+        if (ready == 0 && (!stealable || __atomic_load_n(&attempt->slave->state, __ATOMIC_ACQUIRE) == SLAVE_EVICTED))
+            break;
+    }
+
+    if (!stealable)
+        return result;
+
+    Slave *thief = unpark_job(board, &parked);
+
+    if (thief && result == GREETING_STOLEN)
+        attempt->slave = thief;
+    else if (thief)
+        leave_slave(client, thief);
+
+    return result;
+}
+
+/**
+ * Hands back a slave a job left, which steals a waiting job if that left it idle.
+ *
+ * @param client The client that submitted the job.
+ * @param slave The slave.
+ */
+void leave_slave(Client *client, Slave *slave) {
+    release_slave(slave);
+
+    if (__atomic_load_n(&slave->outstanding, __ATOMIC_RELAXED) == 0)
+        steal_job(client->attr->board, slave);
+}
+
+/**
+ * Takes in whatever a running attempt sent, once its connection is readable.
+ *
+ * @param attempt The attempt.
+ */
+void advance_attempt(Attempt *attempt) {
+    /* A streaming slave names its output straight away, so only the first block that follows counts as output. */
+    if (attempt->state == ATTEMPT_STREAMING) {
+        attempt->state = ATTEMPT_OUTPUT;
+        return;
+    }
+
+    if (!recv_message(attempt->socket, attempt->response)) {
+        attempt->response[0] = '\0';
+        attempt->state = ATTEMPT_FAILED;
+    }
+    else if (strncmp(attempt->response, "{STREAMING_OUTPUT}", 18) == 0)
+        attempt->state = ATTEMPT_STREAMING;
+    else
+        attempt->state = ATTEMPT_OUTPUT;
+}
+
+/**
+ * Waits for the first of a job's attempts to have output or a result.
+ *
+ * @param attempts The attempts.
+ * @param count The number of attempts.
+ * @param timeout The longest to wait, in milliseconds, or -1 to wait for as long as it takes.
+ * @param client_socket The socket of the client waiting for the output, watched for it hanging up.
+ *
+ * @return The index of the attempt, of a failed one if every attempt failed, AWAIT_TIMED_OUT if the
+ *         timeout passed, or AWAIT_HUNG_UP if the client hung up.
+ */
+int await_output(Attempt **attempts, int count, int timeout, int client_socket) {
+    unsigned long deadline = now_nanoseconds() + (unsigned long)(timeout > 0 ? timeout : 0) * 1000000UL;
+
+    while (true) {
+        /* The client is last; only a hang up counts, as a session's client keeps sending jobs meanwhile. */
+        struct pollfd pfds[count + 1];
+        int watching[count], n = 0, failed = -1;
+
+        for (int i = 0; i < count; i++) {
+            if (attempts[i]->state == ATTEMPT_OUTPUT)
+                return i;
+
+            if (attempts[i]->state == ATTEMPT_FAILED) {
+                failed = failed == -1 ? i : failed;
+                continue;
+            }
+
+            pfds[n].fd = attempts[i]->socket;
+            pfds[n].events = POLLIN;
+            pfds[n].revents = 0;
+            watching[n++] = i;
+        }
+
+        if (n == 0)
+            return failed;
+
+        pfds[n].fd = client_socket;
+        pfds[n].events = POLLRDHUP;
+        pfds[n].revents = 0;
+
+        unsigned long now = now_nanoseconds();
+        int wait = timeout < 0 ? -1 : now >= deadline ? 0 : (int)((deadline - now + 999999) / 1000000);
+        int ready = poll(pfds, n + 1, wait);
+
+        /* poll() left revents alone when it failed, so there is nothing to advance. */
+        if (ready == -1 && errno == EINTR)
+            continue;
+
+        if (ready == -1) {
+            perror("[X] poll");
+
+            for (int i = 0; i < n; i++)
+                attempts[watching[i]]->state = ATTEMPT_FAILED;
+
+            return failed == -1 ? watching[0] : failed;
+        }
+
+        if (ready == 0)
+            return AWAIT_TIMED_OUT;
+
+        if (ready > 0 && pfds[n].revents)
+            return AWAIT_HUNG_UP;
+
+        for (int i = 0; i < n; i++) {
+            if (pfds[i].revents)
+                advance_attempt(attempts[watching[i]]);
+        }
+    }
+}
+
+/**
+ * Cancels an attempt, which stops the job on its slave and frees the slave for the next one.
+ *
+ * Slaves that predate cancellation find the connection closed when they next send.
+ *
+ * @param attempt The attempt.
+ */
+void cancel_attempt(Attempt *attempt) {
+    send_message(attempt->socket, "{CANCEL_JOB}");
+    log_debug("[Master]: Sending: [%s] to Slave (%I).\n", "{CANCEL_JOB}", &attempt->address);
+
+    close(attempt->socket);
+    log_debug("[-] Master: has disconnected from {SEND_JOB} socket on Slave (%I).\n", &attempt->address);
+}
+
+/**
+ * Makes one attempt at running a job on a slave node.
+ *
+ * A job that goes past the straggler threshold of its executable without any
+ * output gets a backup copy on an idle slave. Whichever copy has output first
+ * is kept, and the other is cancelled. Every copy is cancelled once the client
+ * hangs up or the job's deadline passes.
+ *
+ * @param job The job to run.
+ * @param client The client that submitted the job.
+ * @param optimal_slave The slave to run the job on, which is handed back once the job leaves it, as is any slave that stole the job.
+ * @param sink Where the job's output goes, block by block as the slave streams it.
+ * @param started When the job's current phase started; advanced as each phase completes.
+ * @param failed Set if the slave failed to execute the job, which another attempt would not fix.
+ *
+ * @return Whether or not the job executed and all of its output was passed on.
+ */
+bool dispatch_job(Job *job, Client *client, Slave *optimal_slave, OutputSink *sink, unsigned long *started, bool *failed) {
+    Metrics *metrics = client->attr->metrics;
+    uint64_t key = job->key;
+
+    Attempt primary = { .slave = optimal_slave }, backup = { .slave = NULL };
+    Attempt *attempts[2] = { &primary, &backup };
+    int count = 1;
+
+    if (!start_attempt(job, client, &primary, started)) {
+        leave_slave(client, primary.slave);
+
+        if (primary.state != ATTEMPT_ABANDONED)
+            return false;
+
+        /* Neither reason has anything to do with the slave, and another attempt would not help. */
+        *started = end_phase(job, metrics, PHASE_SELECT, *started);
+        *failed = true;
+
+        if (get_time_left(job) == 0) {
+            log_warn("[Master]: Job missed its deadline while queued on Slave (%s:%d).\n", primary.slave->address, primary.slave->port);
+            sink->failure = "{FAILED_TO_MEET_DEADLINE}";
+        } else {
+            log_warn("[Master]: Client (%I) hung up while its Job was queued on Slave (%s:%d).\n", &client->address, primary.slave->address, primary.slave->port);
+        }
+
+        return false;
+    }
+
+    unsigned long threshold = get_straggler_threshold(client->attr->runtimes, key);
+    int timeout = threshold > 0 ? (int)((threshold + 999999) / 1000000) : -1, left = get_time_left(job);
+    int winner = await_output(attempts, count, left >= 0 && (timeout < 0 || left < timeout) ? left : timeout, client->socket);
+
+    if (winner == AWAIT_TIMED_OUT && get_time_left(job) != 0) {
+        backup.slave = select_idle_slave(client->attr->scheduler, primary.slave);
+
+        if (backup.slave && start_attempt(job, client, &backup, NULL)) {
+            count = 2;
+            add_counter(&metrics->speculations, 1);
+
+            log_info("[Master]: Job has gone %.3f s without output on Optimal Slave (%I), past its expected %.3f s; starting a backup on Slave (%I).\n",
+                     (now_nanoseconds() - primary.accepted) / 1e9, &primary.address, threshold / 1e9, &backup.address);
+        } else if (backup.slave) {
+            leave_slave(client, backup.slave);
+            backup.slave = NULL;
+        }
+
+        winner = await_output(attempts, count, get_time_left(job), client->socket);
+    }
+
+    if (winner < 0) {
+        int reason = winner == AWAIT_HUNG_UP ? CANCEL_CLIENT : CANCEL_DEADLINE;
+
+        for (int i = 0; i < count; i++) {
+            cancel_attempt(attempts[i]);
+            leave_slave(client, attempts[i]->slave);
+        }
+
+        *started = end_phase(job, metrics, PHASE_EXECUTE, *started);
+        add_counter(&metrics->cancellations[reason], 1);
+
+        if (reason == CANCEL_CLIENT) {
+            log_warn("[Master]: Client (%I) hung up; cancelled its Job on Optimal Slave (%I).\n", &client->address, &primary.address);
+        } else {
+            log_warn("[Master]: Job missed its deadline; cancelled it on Optimal Slave (%I).\n", &primary.address);
+            sink->failure = "{FAILED_TO_MEET_DEADLINE}";
+        }
+
+        /* Neither reason has anything to do with the slave, and another attempt would not help. */
+        *failed = true;
+
+        return false;
+    }
+
+    /* A primary that lost is watched a while longer, to tell at least how much sooner the backup had output. */
+    Attempt *outrun = NULL;
+    unsigned long output_at = now_nanoseconds();
+
+    if (count == 2) {
+        Attempt *loser = attempts[1 - winner];
+
+        if (winner == 1 && loser->state != ATTEMPT_FAILED)
+            outrun = loser;
+        else
+            cancel_attempt(loser);
+
+        if (loser->state == ATTEMPT_FAILED)
+            suspect_slave(client, loser->slave);
+
+        if (winner == 1)
+            add_counter(&metrics->speculations_won, 1);
+
+        log_info("[Master]: Kept the %s copy of the Job from Slave (%I) over the one on Slave (%I).\n",
+                 winner == 1 ? "backup" : "original", &attempts[winner]->address, &loser->address);
+    }
+
+    Attempt *attempt = attempts[winner];
+
+    if (attempt->state == ATTEMPT_OUTPUT)
+        record_runtime(client->attr->runtimes, key, now_nanoseconds() - attempt->accepted);
+
+    /* The rest of the job is collected from whichever copy was kept. */
+    optimal_slave = attempt->slave;
+    int slave_socket = attempt->socket;
+    struct sockaddr_in slave_address = attempt->address;
+    char *response = attempt->response;
+    char *status;
+    TransferStats stats = {0, 0};
+
+    log_info("[Master]: Received Job Output: [%s] from Optimal Slave (%I).\n", response, &slave_address);
+
+    Buffer *output = createBuffer();
+    char output_file_name[MAX_BUFFER_SIZE];
+    bool received = false, executed = false, relayed = true;
+
+    stats.bytes = 0;
+    stats.seconds = 0;
+
+    if (sscanf(response, "{STREAMING_OUTPUT} %s", output_file_name) == 1) {
+        snprintf(sink->name, sizeof(sink->name), "%s", basename(output_file_name));
+
+        char *payload = (char *)malloc(sizeof(char) * LZ_BLOCK_SIZE);
+        uint32_t header[2];
+        long raw_size = -1;
+
+        /* Each block is passed on as soon as it arrives, so the client sees output while the job still runs. */
+        while (payload) {
+            int left = get_time_left(job);
+
+            /* Waiting for a block never goes past the deadline, in case the slave does not enforce it, and stops once the client hangs up. */
+            struct pollfd pfds[2] = { { .fd = slave_socket, .events = POLLIN }, { .fd = client->socket, .events = POLLRDHUP } };
+            int ready = left == 0 ? 0 : poll(pfds, 2, left);
+
+            if (ready == -1 && errno == EINTR)
+                continue;
+
+            if (ready > 0 && pfds[1].revents) {
+                relayed = false;
+                break;
+            }
+
+            if (ready == -1)
+                perror("[X] poll");
+
+            if (ready <= 0)
+                break;
+
+            if (left > 0)
+                set_timeout(slave_socket, left);
+
+            if ((raw_size = recv_block(slave_socket, header, payload, &stats)) <= 0)
+                break;
+
+            if (!deliver_block(sink, header, payload)) {
+                raw_size = -1;
+                relayed = false;
+                break;
+            }
+        }
+
+        free(payload);
+
+        *started = end_phase(job, metrics, PHASE_EXECUTE, *started);
+
+        if (raw_size == 0) {
+            recv_message(slave_socket, response);
+            log_info("[Master]: Received: [%s] from Optimal Slave (%I).\n", response, &slave_address);
+
+            received = strncmp(response, "{", 1) == 0;
+            executed = strcmp(response, "{SUCCESSFULLY_EXECUTED_JOB}\0") == 0;
+
+            /* The slave stopped the job itself once its deadline passed. */
+            if (strcmp(response, "{FAILED_TO_MEET_DEADLINE}\0") == 0) {
+                sink->failure = "{FAILED_TO_MEET_DEADLINE}";
+                add_counter(&metrics->cancellations[CANCEL_DEADLINE], 1);
+            }
+        }
+    } else if (strcmp(response, "{FAILED_TO_EXECUTE_JOB}\0") == 0) {
+        /* Slaves that predate streaming report a failed job in place of its output. */
+        *started = end_phase(job, metrics, PHASE_EXECUTE, *started);
+        received = true;
+    } else if (sscanf(response, "%s %ld", output_file_name, &output->size) == 2 && output->size >= 0) {
+        /* Slaves that predate streaming send the output whole once the job is done. */
+        snprintf(sink->name, sizeof(sink->name), "%s", basename(output_file_name));
+
+        *started = end_phase(job, metrics, PHASE_EXECUTE, *started);
+
+        received = recv_encoded(slave_socket, output, job->codec, &stats);
+        executed = received && deliver_buffer(sink, output);
+    } else {
+        fputs("{FAILED_TO_RECEIVE_JOB_OUTPUT}\n", stderr);
+    }
+
+    free(output->data);
+    free(output);
+
+    *started = end_phase(job, metrics, PHASE_COLLECT, *started);
+    add_counter(&metrics->bytes[BYTES_FROM_SLAVES], stats.bytes);
+
+    log_info("[Master]: Received %ld bytes for file %s (%.2f MB/s).\n", stats.bytes, sink->name, get_throughput(&stats));
+
+    /* The output of a job past its deadline, or of one whose client went away, is of no use to anyone. */
+    bool expired = !received && relayed && get_time_left(job) == 0;
+
+    /* A job that ran but failed would fail again elsewhere. */
+    *failed = (received && !executed) || expired;
+
+    status = received ? "{SUCCESSFULLY_RECEIVED_BUFFER}" : "{FAILED_TO_RECEIVE_BUFFER}";
+
+    if (!received)
+        fputs("{FAILED_TO_RECEIVE_BUFFER}\n", stderr);
+
+    if (expired || !relayed) {
+        status = "{CANCEL_JOB}";
+        add_counter(&metrics->cancellations[expired ? CANCEL_DEADLINE : CANCEL_CLIENT], 1);
+
+        if (expired)
+            log_warn("[Master]: Job missed its deadline; cancelled it on Optimal Slave (%I).\n", &slave_address);
+        else
+            log_warn("[Master]: Client (%I) hung up; cancelled its Job on Optimal Slave (%I).\n", &client->address, &slave_address);
+    }
+
+    if (expired)
+        sink->failure = "{FAILED_TO_MEET_DEADLINE}";
+
+    /* Losing the client, or running out of time, says nothing about the slave. */
+    if (received)
+        report_success(optimal_slave);
+    else if (relayed && !expired)
+        suspect_slave(client, optimal_slave);
+
+    send_message(slave_socket, status);
+    log_debug("[Master]: Sending: [%s] to Optimal Slave (%I).\n", status, &slave_address);
+
+    close(slave_socket);
+    log_debug("[-] Master: has disconnected from {SEND_JOB} socket on Optimal Slave (%I).\n", &slave_address);
+
+    if (outrun) {
+        Outrun *watched = (Outrun *)malloc(sizeof(Outrun));
+        unsigned long window = (output_at - attempts[winner]->accepted) / 1000000;
+        pthread_t watch_outrun_thread;
+
+        if (!watched) {
+            perror("[X] malloc");
+            exit(1);
+        }
+
+        watched->attempt = *outrun;
+        watched->attr = client->attr;
+        watched->output_at = output_at;
+        watched->window = window < 1 ? 1 : window > OUTRUN_WINDOW ? OUTRUN_WINDOW : (int)window;
+
+        /* The watch keeps the primary's slot, and hands it back once it cancelled the primary. */
+        pthread_create(&watch_outrun_thread, NULL, watch_outrun, (void *)watched);
+        pthread_detach(watch_outrun_thread);
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (attempts[i] != outrun)
+            leave_slave(client, attempts[i]->slave);
+    }
+
+    return executed;
+}
+
+/**
+ * Watches a primary a backup beat until it has output or its window closes, records at least how much sooner the
+ * backup had output, then cancels the primary and hands its slave back.
+ *
+ * @param argv The Outrun to watch, which is freed here.
+ */
+void *watch_outrun(void *argv) {
+    Outrun *outrun = (Outrun *)argv;
+    Attempt *attempt = &outrun->attempt;
+    unsigned long closes = outrun->output_at + (unsigned long)outrun->window * 1000000UL;
+
+    /* A primary that fails would never have had output, so it saved the backup at least as long as it was watched. */
+    while (attempt->state != ATTEMPT_OUTPUT && attempt->state != ATTEMPT_FAILED) {
+        unsigned long now = now_nanoseconds();
+        struct pollfd pfd = { .fd = attempt->socket, .events = POLLIN, .revents = 0 };
+        int ready = now >= closes ? 0 : poll(&pfd, 1, (int)((closes - now + 999999) / 1000000));
+
+        if (ready == -1 && errno == EINTR)
+            continue;
+
+        if (ready <= 0)
+            break;
+
+        advance_attempt(attempt);
+    }
+
+    unsigned long now = now_nanoseconds();
+
+    record_value(&outrun->attr->metrics->speculation_saved, now - outrun->output_at);
+
+    cancel_attempt(attempt);
+
+    release_slave(attempt->slave);
+
+    if (__atomic_load_n(&attempt->slave->outstanding, __ATOMIC_RELAXED) == 0)
+        steal_job(outrun->attr->board, attempt->slave);
+
+    free(outrun);
+
+    pthread_exit(NULL);
+}
+
+/**
+ * Evicts the slaves whose heartbeats stopped, and the draining slaves whose jobs are done.
+ *
+ * Eviction only changes a slave's state, so dispatch carries on while it happens.
+ *
+ * @param argv The arguments passed to the watch_slaves thread.
+ */
+void *watch_slaves(void *argv) {
+    thread_attr *attr = (thread_attr *)argv;
+    SlaveList *list = attr->list;
+    unsigned long timeout = attr->heartbeat_timeout * 1000000UL;
+
+    /* Checking a few times per timeout, and at least every second, bounds how late an eviction can be. */
+    unsigned long period = timeout / 4 < 1000000000UL ? timeout / 4 : 1000000000UL;
+    struct timespec interval = { period / 1000000000UL, period % 1000000000UL };
+
+    while (!attr->terminated) {
+        nanosleep(&interval, NULL);
+
+        unsigned long now = now_nanoseconds();
+        int size = __atomic_load_n(&list->size, __ATOMIC_ACQUIRE);
+
+        for (int i = 0; i < size; i++) {
+            Slave *slave = list->slaves[i];
+            unsigned int generation = __atomic_load_n(&slave->generation, __ATOMIC_RELAXED);
+            int state = __atomic_load_n(&slave->state, __ATOMIC_ACQUIRE);
+            unsigned long last_heartbeat = __atomic_load_n(&slave->last_heartbeat, __ATOMIC_RELAXED);
+            unsigned long silence = now > last_heartbeat ? now - last_heartbeat : 0;
+
+            if (state == SLAVE_EVICTED)
+                continue;
+
+            if (silence > timeout) {
+                if (evict(list, slave, generation))
+                    log_warn("[Master]: Evicted Slave (%s:%d) after %.1f s without a heartbeat.\n", slave->address, slave->port, silence / 1e9);
+            } else if (state == SLAVE_DRAINING && __atomic_load_n(&slave->outstanding, __ATOMIC_RELAXED) == 0) {
+                if (evict(list, slave, generation))
+                    log_info("[Master]: Removed drained Slave (%s:%d).\n", slave->address, slave->port);
+            }
+        }
+    }
+
+    pthread_exit(NULL);
+}
+
+/**
+ * Listens for CPU Utilization values of each slave in the cluster.
+ *
+ * Determines the "most optimal" slave based on its CPU Utilization.
+ * If the CPU Utilization of the current slave is the smallest out of all the slaves in the cluster
+ * then, it is the "most optimal" slave and has the highest priority of getting delegated a job.
+ *
+ * @param argv The arguments passed to the load_balance thread.
+ */
+void *load_balance(void *argv) {
+    thread_attr *attr = (thread_attr *)argv;
+    SlaveList *list = attr->list;
+
+    int opt = 1;
+    int port = get_port(SEND_CPU_UTILIZATION_PORT_ENV, SEND_CPU_UTILIZATION_PORT);
+    int master_socket, slave_socket;
+    struct sockaddr_in slave_address, master_address;
+
+    /* Create TCP socket. */
+    if ((master_socket = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
+        perror("[X] socket");
+        exit(1);
+    }
+
+    /* Forcefully attaching socket to the desired port  */
+    if (setsockopt(master_socket, SOL_SOCKET, SO_REUSEADDR | SO_REUSEPORT, &opt, sizeof(opt))) {
+        perror("[X] setsockopt");
+        exit(1);
+    }
+
+    /* Initialise IPv4 address. */
+    memset(&master_address, 0, sizeof master_address);
+    master_address.sin_family = AF_INET;
+    master_address.sin_port = htons(port);
     master_address.sin_addr.s_addr = INADDR_ANY;
 
     /* Bind address to socket. */
@@ -745,7 +2548,7 @@ void *load_balance(void *argv) {
 
     while(list->size <= 0);
 
-    printf("[*] Master is listening on ('%s', %d) for CPU Utilization.\n", "127.0.0.1", SEND_CPU_UTILIZATION_PORT);
+    log_info("[*] Master is listening on ('%s', %d) for CPU Utilization.\n", "127.0.0.1", port);
 
     while(!attr->terminated) {
         /* Accept connection from slave. */
@@ -757,43 +2560,45 @@ void *load_balance(void *argv) {
             continue;
         }
 
-        printf("[+] Slave ('%s', %d): has connected to {LISTEN_FOR_CPU_UTILIZATION} socket.\n", inet_ntoa(slave_address.sin_addr), ntohs(slave_address.sin_port));
+        log_debug("[+] Slave (%I): has connected to {LISTEN_FOR_CPU_UTILIZATION} socket.\n", &slave_address);
 
         char response[MAX_BUFFER_SIZE];
-        bytes = recv(slave_socket, response, sizeof(response), 0);
-        printf("[Master]: Received: [%s] from Slave ('%s', %d).\n", response, inet_ntoa(slave_address.sin_addr), ntohs(slave_address.sin_port));
+        recv_message(slave_socket, response);
+        log_debug("[Master]: Received: [%s] from Slave (%I).\n", response, &slave_address);
 
-        int slave_id;
+        int slave_id, generation = -1;
         float slave_utilization;
-        sscanf(response, "%d %f", &slave_id, &slave_utilization);
-
         char *payload;
+        Slave *slave = NULL;
 
-        if (slave_id > list->size || slave_id < 0 || slave_utilization < 0) {
+        /* Slaves that predate generations leave it off, and their heartbeats are taken for whichever slave holds their id. */
+        if (sscanf(response, "%d %f %d", &slave_id, &slave_utilization, &generation) >= 2 && slave_utilization >= 0)
+            slave = get_slave(list, slave_id, generation);
+
+        /* An evicted slave is told to register again. */
+        if (!slave) {
             payload = "{FAILED_TO_UPDATE_CPU_UTILIZATION}";
-            bytes = send(slave_socket, payload, strlen(payload), 0);
-            printf("[Master]: Sending: [%s] to Slave ('%s', %d).\n", payload, inet_ntoa(slave_address.sin_addr), htons(slave_address.sin_port));
+            send_message(slave_socket, payload);
+            log_debug("[Master]: Sending: [%s] to Slave (%I).\n", payload, &slave_address);
             close(slave_socket);
 
             continue;
         }
 
         payload = "{SUCCESSFULLY_UPDATED_CPU_UTILIZATION}";
-        bytes = send(slave_socket, payload, strlen(payload), 0);
-        printf("[Master]: Sending: [%s] to Slave ('%s', %d).\n", payload, inet_ntoa(slave_address.sin_addr), htons(slave_address.sin_port));
+        send_message(slave_socket, payload);
+        log_debug("[Master]: Sending: [%s] to Slave (%I).\n", payload, &slave_address);
 
-        Slave *current_slave = list->slaves[slave_id];
-        current_slave->utilization = slave_utilization;
+        __atomic_store_n(&slave->last_heartbeat, now_nanoseconds(), __ATOMIC_RELAXED);
 
-        if (attr->optimal_slave->utilization >= slave_utilization) {
-            attr->optimal_slave = current_slave;
-            printf("[Master]: Selected Slave ('%s', %d) as new optimal slave.\n", inet_ntoa(slave_address.sin_addr), htons(slave_address.sin_port));
+        if (report_utilization(attr->scheduler, slave, slave_utilization)) {
+            log_info("[Master]: Selected Slave (%I) as new optimal slave.\n", &slave_address);
         }
 
         close(slave_socket);
-        printf("[-] Slave ('%s', %d): has disconnected from the {LISTEN_FOR_CPU_UTILIZATION} socket.\n", inet_ntoa(slave_address.sin_addr), htons(slave_address.sin_port));
+        log_debug("[-] Slave (%I): has disconnected from the {LISTEN_FOR_CPU_UTILIZATION} socket.\n", &slave_address);
 
-        printf("\n");
+        log_debug("\n");
     }
 
     pthread_exit(NULL);
@@ -802,7 +2607,57 @@ void *load_balance(void *argv) {
 int main() {
     srand(time(0));
 
-    SlaveList *slave_list = createSlaveList(MAX_BACKLOG);
+    /* A peer that hangs up mid-transfer must fail the send, not kill the master. */
+    signal(SIGPIPE, SIG_IGN);
+
+    /* Logging is formatted and written by a background thread, off the request path. */
+    log_init(stdout);
+    trace_init("master");
+
+    int policy = get_policy(getenv(POLICY_ENV));
+
+    if (policy == -1) {
+        fprintf(stderr, "[X] Unknown %s: %s.\n", POLICY_ENV, getenv(POLICY_ENV));
+        exit(1);
+    }
+
+    log_info("[*] Master is placing jobs with the %s policy.\n", get_policy_name(policy));
+
+    int percentile = get_speculation_percentile();
+
+    if (percentile > 0)
+        log_info("[*] Master is backing up jobs slower than the p%d of their executable.\n", percentile);
+
+    int slots = get_setting(SLAVE_SLOTS_ENV, SLAVE_SLOTS);
+
+    log_info("[*] Master is giving each Slave %d Job(s) at a time; the rest wait their turn.\n", slots);
+
+    bool stealing = get_stealing();
+
+    if (stealing)
+        log_info("[*] Master is letting idle Slaves steal Jobs queued on busy ones.\n");
+
+    int batch_size = get_setting(BATCH_SIZE_ENV, BATCH_SIZE);
+    int batch_window = get_setting(BATCH_WINDOW_ENV, BATCH_WINDOW);
+    int batch_max_size = get_setting(BATCH_MAX_SIZE_ENV, BATCH_MAX_SIZE);
+
+    if (batch_size > 1)
+        log_info("[*] Master is batching up to %d Jobs of at most %d KiB within %d us.\n", batch_size, batch_max_size, batch_window);
+
+    bool shared_memory = get_shared_memory();
+    int shared_memory_min_size = get_setting(SHARED_MEMORY_MIN_SIZE_ENV, SHARED_MEMORY_MIN_SIZE);
+
+    if (shared_memory)
+        log_info("[*] Master is sending files of at least %d KiB through shared memory to Slaves on its host.\n", shared_memory_min_size);
+
+    int max_clients = get_setting(MAX_CLIENTS_ENV, MAX_CLIENTS);
+    int max_queued = get_setting(MAX_QUEUED_JOBS_ENV, MAX_QUEUED_JOBS);
+    int budget = get_setting(MEMORY_BUDGET_ENV, MEMORY_BUDGET);
+    int max_wait = get_setting(MAX_QUEUE_WAIT_ENV, MAX_QUEUE_WAIT);
+
+    log_info("[*] Master is handling up to %d Clients and %d queued Jobs, within %d MiB of files and %d ms of waiting.\n", max_clients, max_queued, budget, max_wait);
+
+    SlaveList *slave_list = createSlaveList(MAX_SLAVES);
 
     if (!slave_list) {
         perror("[X] malloc");
@@ -810,8 +2665,11 @@ int main() {
     }
 
     pthread_t listen_for_clients_thread;
+    pthread_t listen_for_local_clients_thread;
     pthread_t listen_for_slaves_thread;
     pthread_t load_balance_thread;
+    pthread_t listen_for_metrics_thread;
+    pthread_t watch_slaves_thread;
 
     thread_attr *argv = (thread_attr *)malloc(sizeof(thread_attr));
 
@@ -821,11 +2679,28 @@ int main() {
     }
 
     argv->list = slave_list;
-    argv->optimal_slave = createSlave("0.0.0.0", -1);
+    argv->scheduler = createScheduler(slave_list, policy, time(0));
+    argv->store = createChunkStore("chunks", (long)get_setting(CHUNK_STORE_SIZE_ENV, CHUNK_STORE_SIZE) * 1024 * 1024);
+    argv->metrics = createMetrics();
+    argv->runtimes = createRuntimeTable(percentile);
+    argv->queue = createFairQueue(slave_list, slots);
+    argv->scheduler->slots = slots;
+    argv->board = createStealBoard(stealing);
+    argv->batcher = createBatcher(batch_size, batch_window, (long)batch_max_size * 1024);
+    argv->shared_memory = shared_memory;
+    argv->shared_memory_min_size = (long)shared_memory_min_size * 1024;
+    argv->admission = createAdmission(max_clients, max_queued, (long)budget * 1024 * 1024, max_wait);
+    argv->max_attempts = get_setting(MAX_ATTEMPTS_ENV, MAX_ATTEMPTS);
+    argv->attempt_timeout = get_setting(ATTEMPT_TIMEOUT_ENV, ATTEMPT_TIMEOUT);
+    argv->heartbeat_timeout = get_setting(HEARTBEAT_TIMEOUT_ENV, HEARTBEAT_TIMEOUT);
+    argv->terminated = false;
 
     pthread_create(&listen_for_clients_thread, NULL, listen_for_clients, (void *) argv);
+    pthread_create(&listen_for_local_clients_thread, NULL, listen_for_local_clients, (void *) argv);
     pthread_create(&listen_for_slaves_thread, NULL, listen_for_slaves, (void *) argv);
     pthread_create(&load_balance_thread, NULL, load_balance, (void *) argv);
+    pthread_create(&listen_for_metrics_thread, NULL, listen_for_metrics, (void *) argv);
+    pthread_create(&watch_slaves_thread, NULL, watch_slaves, (void *) argv);
 
     while(!argv->terminated);
 
@@ -834,9 +2709,17 @@ int main() {
     pthread_join(listen_for_clients_thread, NULL);
     pthread_join(listen_for_slaves_thread, NULL);
     pthread_join(load_balance_thread, NULL);
+    pthread_join(listen_for_metrics_thread, NULL);
+    pthread_join(watch_slaves_thread, NULL);
 
     cleanupList(argv->list);
     cleanupList(slave_list);
+    free(argv->scheduler);
+    free(argv->metrics);
+    free(argv->queue);
+    free(argv->admission);
+    free(argv->board);
+    free(argv->batcher);
     free(argv);
 
     return 0;
@@ -16,6 +16,9 @@
  * @date 12/9/2019
  */
 
+/* For pipe2(), which keeps the slave's ends of a worker's pipes out of the processes it starts. */
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -26,32 +29,88 @@
 #include <arpa/inet.h>
 #include <stdbool.h>
 #include <pthread.h>
+#include <signal.h>
+#include <libgen.h>
+#include <sys/wait.h>
 
 #include "lib/utilities.h"
+#include "lib/transfer.h"
+#include "lib/compress.h"
+#include "lib/dedup.h"
+#include "lib/log.h"
+#include "lib/trace.h"
+#include "lib/stream.h"
+#include "lib/batch.h"
+#include "lib/workerpool.h"
+#include "lib/shm.h"
 
 typedef struct thread_attr thread_attr;
 typedef struct Job Job;
+typedef struct BatchedJob BatchedJob;
+
+/* How a job's run ended, as far as streaming its output goes. */
+#define RUN_FINISHED 0
+#define RUN_CANCELLED 1
+#define RUN_EXPIRED 2
 
 struct thread_attr {
     char *master_address;
     int slave_id;
+    unsigned int generation;
+    int job_port;
+    ChunkStore *store;
+    WorkerPool *workers;
+
+    /* Whether the master waits for the slave to greet each job, once it gets to it, before sending its files. */
+    bool ready;
 
     bool terminated;
 };
 
-int connect_to_master(char *address);
+/* A job of a batch, run in a directory of its own so that jobs given files of the same names keep apart. */
+struct BatchedJob {
+    char directory[MAX_BUFFER_SIZE];
+    char input_file[MAX_BUFFER_SIZE];
+    char command[2 * MAX_BUFFER_SIZE];
+    char trace_id[TRACE_ID_LENGTH + 1];
+    unsigned long deadline;
+
+    /* While the job runs: its process group and the read end of its output pipe; -1 otherwise. */
+    pid_t pid;
+    int output;
+
+    /* The job's status and its output so far. */
+    BatchEntry result;
+};
+
+/* Set by SIGINT or SIGTERM, which drain the slave before it shuts down. */
+volatile sig_atomic_t draining = 0;
+
+int connect_to_master(char *address, int job_port, unsigned int *generation, bool *ready);
 void *send_cpu_utilization(void *argv);
+void drain_slave(thread_attr *attr);
+void start_draining(int signal_number);
+void send_status(int master_socket, struct sockaddr_in *master_address, char *status);
+pid_t start_job(char *command, int *output);
+int stream_job(int master_socket, int output, int replies, int codec, unsigned long deadline, TransferStats *stats, int *status);
+void execute_job(int master_socket, struct sockaddr_in *master_address, char *request, ChunkStore *store, WorkerPool *workers, int payload);
+bool receive_batch(int master_socket, char *directory, char *executable, long executable_size, int codec, BatchedJob *jobs, int count);
+void finish_batched_job(BatchedJob *job, char *executable, bool expired);
+void execute_batch(int master_socket, struct sockaddr_in *master_address, char *request);
 void *listen_for_job_request(void * argv);
 
 /**
  * Connects to the master node via a web socket connection.
  *
  * @param address The IPv4 address of the Master node.
+ * @param job_port The port this slave listens for jobs on.
+ * @param generation Receives the generation the master registered the slave with.
+ * @param ready Receives whether or not the master waits for the slave to greet each job before sending its files.
  *
  * @return The id of the slave.
  */
-int connect_to_master(char *address) {
-    int master_socket, bytes, id;
+int connect_to_master(char *address, int job_port, unsigned int *generation, bool *ready) {
+    int master_socket, id;
     struct hostent *server_host;
     struct sockaddr_in master_address;
 
@@ -61,7 +120,7 @@ int connect_to_master(char *address) {
     /* Initialise IPv4 server address with master host. */
     memset(&master_address, 0, sizeof address);
     master_address.sin_family = AF_INET;
-    master_address.sin_port = htons(LISTEN_FOR_SLAVES_PORT);
+    master_address.sin_port = htons(get_port(LISTEN_FOR_SLAVES_PORT_ENV, LISTEN_FOR_SLAVES_PORT));
     memcpy(&master_address.sin_addr.s_addr, server_host->h_addr, server_host->h_length);
 
     /* Create TCP socket. */
@@ -77,23 +136,38 @@ int connect_to_master(char *address) {
         exit(1);
     }
 
-    printf("[+] Slave: has connected to the {LISTEN_FOR_SLAVES} socket on Master ('%s', %d).\n", inet_ntoa(master_address.sin_addr), htons(master_address.sin_port));
+    log_debug("[+] Slave: has connected to the {LISTEN_FOR_SLAVES} socket on Master (%I).\n", &master_address);
 
     char *slave_address = get_address();
-    bytes = send(master_socket, slave_address, strlen(slave_address), 0);
-    printf("[Slave]: Sending: [%s] to Master ('%s', %d).\n", slave_address, inet_ntoa(master_address.sin_addr), htons(master_address.sin_port));
+    char registration[MAX_BUFFER_SIZE], probe[MAX_BUFFER_SIZE] = "";
+
+    /* The master sends the files of jobs through shared memory if it can open the probe, i.e. it is on the same host. */
+    bool probing = get_shared_memory() && create_probe(job_port, probe);
+
+    snprintf(registration, sizeof(registration), "%s %d ready batch%s%s", slave_address, job_port, probing ? " shm:" : "", probe);
+    free(slave_address);
+
+    send_message(master_socket, registration);
+    log_debug("[Slave]: Sending: [%s] to Master (%I).\n", registration, &master_address);
 
     char response[MAX_BUFFER_SIZE];
-    bytes = recv(master_socket, response, sizeof(response), 0);
-    printf("[Slave]: Received: [%s] from Master ('%s', %d).\n", response, inet_ntoa(master_address.sin_addr), htons(master_address.sin_port));
+    recv_message(master_socket, response);
+    log_debug("[Slave]: Received: [%s] from Master (%I).\n", response, &master_address);
+
+    char message[MAX_BUFFER_SIZE], feature[MAX_BUFFER_SIZE] = "";
+
+    /* Masters that predate generations only send the id, and those that predate greetings do not accept them. */
+    *generation = 0;
+    sscanf(response, "%s %d %u %s", message, &id, generation, feature);
+    *ready = strcmp(feature, "ready") == 0;
 
-    char message[MAX_BUFFER_SIZE];
-    sscanf(response, "%s %d", message, &id);
+    if (probing)
+        shm_unlink(probe);
 
     close(master_socket);
-    printf("[-] Slave: has disconnected from the {LISTEN_FOR_SLAVES} socket on Master ('%s', %d).\n", inet_ntoa(master_address.sin_addr), htons(master_address.sin_port));
+    log_debug("[-] Slave: has disconnected from the {LISTEN_FOR_SLAVES} socket on Master (%I).\n", &master_address);
 
-    printf("\n");
+    log_debug("\n");
 
     return strcmp(message, "{SUCCESSFULLY_ADDED_SLAVE}") != 0 ? id = -1 : id;
 }
@@ -106,7 +180,7 @@ int connect_to_master(char *address) {
 void *send_cpu_utilization(void *argv) {
     thread_attr *attr = (thread_attr *)argv;
 
-    int master_socket, bytes;
+    int master_socket;
     struct hostent *server_host;
     struct sockaddr_in master_address;
 
@@ -117,7 +191,7 @@ void *send_cpu_utilization(void *argv) {
         /* Initialise IPv4 server address with master host. */
         memset(&master_address, 0, sizeof attr->master_address);
         master_address.sin_family = AF_INET;
-        master_address.sin_port = htons(SEND_CPU_UTILIZATION_PORT);
+        master_address.sin_port = htons(get_port(SEND_CPU_UTILIZATION_PORT_ENV, SEND_CPU_UTILIZATION_PORT));
         memcpy(&master_address.sin_addr.s_addr, server_host->h_addr, server_host->h_length);
 
         /* Create TCP socket. */
@@ -144,21 +218,34 @@ void *send_cpu_utilization(void *argv) {
             continue;
         }
 
-        printf("[+] Slave: has connected to the {SEND_CPU_UTILIZATION} socket on Master ('%s', %d).\n", inet_ntoa(master_address.sin_addr), htons(master_address.sin_port));
+        log_debug("[+] Slave: has connected to the {SEND_CPU_UTILIZATION} socket on Master (%I).\n", &master_address);
 
         char payload[MAX_BUFFER_SIZE];
-        snprintf(payload, sizeof(payload),"%d %f", attr->slave_id, calc_cpu_util());
-        bytes = send(master_socket, payload, sizeof(payload), 0);
-        printf("[Slave]: Sending: [%s] to Master ('%s', %d).\n", payload, inet_ntoa(master_address.sin_addr), htons(master_address.sin_port));
+        snprintf(payload, sizeof(payload),"%d %f %u", attr->slave_id, calc_cpu_util(), attr->generation);
+        send_message(master_socket, payload);
+        log_debug("[Slave]: Sending: [%s] to Master (%I).\n", payload, &master_address);
 
         char response[MAX_BUFFER_SIZE];
-        bytes = recv(master_socket, response, sizeof(response), 0);
-        printf("[Slave]: Received: [%s] from Master ('%s', %d).\n", response, inet_ntoa(master_address.sin_addr), htons(master_address.sin_port));
+        recv_message(master_socket, response);
+        log_debug("[Slave]: Received: [%s] from Master (%I).\n", response, &master_address);
 
         close(master_socket);
-        printf("[-] Slave: has disconnected from the {SEND_CPU_UTILIZATION} socket on Master ('%s', %d).\n", inet_ntoa(master_address.sin_addr), htons(master_address.sin_port));
+        log_debug("[-] Slave: has disconnected from the {SEND_CPU_UTILIZATION} socket on Master (%I).\n", &master_address);
+
+        /* A master that evicted the slave, e.g. after missing its heartbeats, or that restarted takes it back as a new registration. */
+        if (strcmp(response, "{FAILED_TO_UPDATE_CPU_UTILIZATION}") == 0 && !draining) {
+            log_info("[Slave]: Master no longer knows this Slave, registering again.\n");
+
+            bool ready;
+            int slave_id = connect_to_master(attr->master_address, attr->job_port, &attr->generation, &ready);
+
+            __atomic_store_n(&attr->ready, ready, __ATOMIC_RELAXED);
+
+            if (slave_id != -1)
+                attr->slave_id = slave_id;
+        }
 
-        printf("\n");
+        log_debug("\n");
 
         sleep(rand() % MAX_SLEEP_TIME);
     }
@@ -166,6 +253,697 @@ void *send_cpu_utilization(void *argv) {
     pthread_exit(NULL);
 }
 
+/**
+ * Drains the slave before it shuts down.
+ *
+ * The master stops placing jobs on the slave as soon as it is told, and is
+ * asked again every second until none of its jobs are outstanding.
+ *
+ * @param attr The slave's thread attributes.
+ */
+void drain_slave(thread_attr *attr) {
+    struct sockaddr_in master_address;
+    char response[MAX_BUFFER_SIZE] = "";
+
+    memset(&master_address, 0, sizeof master_address);
+    master_address.sin_family = AF_INET;
+    master_address.sin_port = htons(get_port(LISTEN_FOR_SLAVES_PORT_ENV, LISTEN_FOR_SLAVES_PORT));
+
+    if (inet_pton(AF_INET, attr->master_address, &master_address.sin_addr) <= 0) {
+        fputs("\nInvalid address / Address not supported.\n", stderr);
+        return;
+    }
+
+    log_info("[Slave]: Draining before shutting down.\n");
+
+    do {
+        if (response[0])
+            sleep(1);
+
+        int master_socket = socket(AF_INET, SOCK_STREAM, 0);
+
+        if (master_socket == -1 || connect(master_socket, (struct sockaddr *)&master_address, sizeof master_address) < 0) {
+            perror("[X] connect");
+
+            if (master_socket != -1)
+                close(master_socket);
+
+            return;
+        }
+
+        char payload[MAX_BUFFER_SIZE];
+        snprintf(payload, sizeof(payload), "{DRAIN_SLAVE} %d %u", attr->slave_id, attr->generation);
+
+        send_message(master_socket, payload);
+        log_debug("[Slave]: Sending: [%s] to Master (%I).\n", payload, &master_address);
+
+        recv_message(master_socket, response);
+        log_debug("[Slave]: Received: [%s] from Master (%I).\n", response, &master_address);
+
+        close(master_socket);
+    } while (strncmp(response, "{DRAINING_SLAVE}", 16) == 0);
+
+    log_info("[Slave]: Received: [%s] from Master (%I).\n", response, &master_address);
+}
+
+/**
+ * Starts draining the slave; a second signal shuts it down at once.
+ *
+ * @param signal_number The signal that was received.
+ */
+void start_draining(int signal_number) {
+    draining = 1;
+    signal(signal_number, SIG_DFL);
+}
+
+/**
+ * Sends a status message to the master node.
+ *
+ * @param master_socket The socket connected to the master node.
+ * @param master_address The address of the master node.
+ * @param status The status message to send.
+ */
+void send_status(int master_socket, struct sockaddr_in *master_address, char *status) {
+    send_message(master_socket, status);
+    log_debug("[Slave]: Sending: [%s] to Master (%I).\n",
+              status,
+              master_address
+    );
+}
+
+/**
+ * Starts a job's command in a process group of its own, so that stopping the job reaches every process it started.
+ *
+ * @param command The command to run with /bin/sh.
+ * @param output Receives the read end of a pipe carrying the job's stdout and stderr.
+ *
+ * @return The process id of the job, which is also its process group id, or -1 if it could not be started.
+ */
+pid_t start_job(char *command, int *output) {
+    int fds[2];
+
+    if (pipe(fds) == -1) {
+        perror("[X] pipe");
+        return -1;
+    }
+
+    pid_t pid = fork();
+
+    if (pid == -1) {
+        perror("[X] fork");
+        close(fds[0]);
+        close(fds[1]);
+
+        return -1;
+    }
+
+    if (pid == 0) {
+        setpgid(0, 0);
+
+        dup2(fds[1], STDOUT_FILENO);
+        dup2(fds[1], STDERR_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+
+        execl("/bin/sh", "sh", "-c", command, (char *)NULL);
+        _exit(127);
+    }
+
+    /* Both sides set the group, so it exists whichever of them runs first. */
+    setpgid(pid, pid);
+    close(fds[1]);
+
+    *output = fds[0];
+
+    return pid;
+}
+
+/**
+ * Streams a running job's output to the master node until the job closes it, or replies if it runs in a
+ * worker, the master cancels the job or its deadline passes.
+ *
+ * The master sends nothing while a job runs, so anything it does send, or it hanging up, cancels the job.
+ *
+ * @param master_socket The socket connected to the master node.
+ * @param output The read end of the job's output pipe.
+ * @param replies The read end of the worker's reply channel, or -1 if the job runs in a process of its own.
+ * @param codec The codec negotiated for the job.
+ * @param deadline When the job must be done by, as returned by now_nanoseconds(), or 0 if it has no deadline.
+ * @param stats The statistics to account the wire bytes against.
+ * @param status Receives the exit status a worker replied with; left alone otherwise.
+ *
+ * @return RUN_FINISHED once all of the output was sent, RUN_CANCELLED if the master cancelled the job or
+ *         could no longer be sent to, or RUN_EXPIRED if the deadline passed first.
+ */
+int stream_job(int master_socket, int output, int replies, int codec, unsigned long deadline, TransferStats *stats, int *status) {
+    char *block = (char *)malloc(sizeof(char) * LZ_BLOCK_SIZE);
+    char *encoded = (char *)malloc(sizeof(char) * LZ_BLOCK_SIZE);
+    struct pollfd pfds[3] = { { output, POLLIN, 0 }, { master_socket, POLLIN, 0 }, { replies, POLLIN, 0 } };
+    int run = block && encoded ? -1 : RUN_CANCELLED;
+
+    while (run == -1) {
+        unsigned long now = now_nanoseconds();
+
+        if (deadline && now >= deadline) {
+            run = RUN_EXPIRED;
+            break;
+        }
+
+        int ready = poll(pfds, 3, deadline ? (int)((deadline - now + 999999) / 1000000) : -1);
+
+        if (ready == -1 && errno != EINTR) {
+            perror("[X] poll");
+            run = RUN_CANCELLED;
+        }
+
+        if (ready <= 0)
+            continue;
+
+        if (pfds[1].revents) {
+            char request[MAX_BUFFER_SIZE] = "";
+
+            recv_message(master_socket, request);
+            log_debug("[Slave]: Received: [%s] from Master.\n", request);
+
+            run = RUN_CANCELLED;
+            break;
+        }
+
+        /* A worker writes everything of the job's before its reply, so what is left in the pipe is the rest of the output. */
+        if (pfds[2].revents) {
+            char reply[MAX_BUFFER_SIZE] = "";
+            ssize_t n = read(replies, reply, sizeof(reply) - 1);
+
+            if (n > 0)
+                sscanf(reply, "%d", status);
+
+            while ((n = read(output, block, LZ_BLOCK_SIZE)) > 0 && send_block(master_socket, block, n, codec, encoded, stats));
+
+            run = n > 0 ? RUN_CANCELLED : RUN_FINISHED;
+            break;
+        }
+
+        ssize_t n = read(output, block, LZ_BLOCK_SIZE);
+
+        if (n == -1 && errno != EINTR && errno != EAGAIN) {
+            perror("[X] read");
+            run = RUN_CANCELLED;
+        } else if (n == 0) {
+            run = RUN_FINISHED;
+        } else if (n > 0 && !send_block(master_socket, block, n, codec, encoded, stats)) {
+            run = RUN_CANCELLED;
+        }
+    }
+
+    free(block);
+    free(encoded);
+
+    return run;
+}
+
+/**
+ * Receives the files of a job, executes it and sends its output back to the master node.
+ *
+ * @param master_socket The socket connected to the master node.
+ * @param master_address The address of the master node.
+ * @param request The job request: "<executable> <size> <input_file> <size> <codec> [trace_id] [DLB_DEADLINE_MS=<ms>] <command>".
+ * @param store The chunk store used for deduplicated files.
+ * @param workers The pool of warm workers for executables that follow the persistent-job ABI.
+ * @param payload The shared memory object the master wrote the job's files into, or -1 if they follow the request.
+ */
+void execute_job(int master_socket, struct sockaddr_in *master_address, char *request, ChunkStore *store, WorkerPool *workers, int payload) {
+    unsigned long started = now_nanoseconds();
+    char executable_name[MAX_BUFFER_SIZE], input_file_name[MAX_BUFFER_SIZE], codec_name[MAX_BUFFER_SIZE], response[MAX_BUFFER_SIZE];
+    long executable_size, input_file_size;
+    int command_offset = 0;
+    TransferStats stats = {0, 0};
+
+    int codec;
+
+    if (sscanf(request, "%s %ld %s %ld %s %n", executable_name, &executable_size, input_file_name, &input_file_size, codec_name, &command_offset) != 5
+        || command_offset == 0 || executable_size < 0 || input_file_size < 0 || (codec = get_codec(codec_name)) == -1) {
+        fputs("{FAILED_TO_RECEIVE_JOB_REQUEST}\n", stderr);
+        send_status(master_socket, master_address, "{FAILED_TO_RECEIVE_JOB_REQUEST}");
+        return;
+    }
+
+    char *executable = basename(executable_name);
+    char *input_file = basename(input_file_name);
+    char *command = request + command_offset;
+
+    /* Masters that predate tracing send no trace id, so the job gets one of its own. */
+    char trace_id[TRACE_ID_LENGTH + 1];
+    int trace_id_offset = 0;
+
+    if (sscanf(command, "%32s %n", trace_id, &trace_id_offset) == 1 && trace_id_offset > 0 && is_trace_id(trace_id))
+        command += trace_id_offset;
+    else
+        mint_trace_id(trace_id);
+
+    /* The deadline counts from now; its assignment stays in the command, so the job sees it too. */
+    unsigned long deadline = 0;
+    long time_left;
+
+    if (strncmp(command, DEADLINE_ENV "=", strlen(DEADLINE_ENV) + 1) == 0 && sscanf(command + strlen(DEADLINE_ENV) + 1, "%ld", &time_left) == 1 && time_left > 0)
+        deadline = started + time_left * 1000000UL;
+
+    /* The executable and input file follow the job request without an acknowledgement in between. */
+    bool received;
+    long saved = 0;
+
+    /* Compressed files are decompressed block by block straight into place; deduplicated ones are reassembled from the store. */
+    if (payload != -1)
+        received = codec != CODEC_CDC && recv_shared_file(payload, executable, executable_size, 0755, codec, &stats)
+            && recv_shared_file(payload, input_file, input_file_size, 0644, codec, &stats);
+    else if (codec == CODEC_CDC)
+        received = recv_deduplicated_file(master_socket, store, executable, executable_size, 0755, &stats, &saved)
+            && recv_deduplicated_file(master_socket, store, input_file, input_file_size, 0644, &stats, &saved);
+    else
+        received = recv_decoded_file(master_socket, executable, executable_size, 0755, codec, &stats)
+            && recv_decoded_file(master_socket, input_file, input_file_size, 0644, codec, &stats);
+
+    if (!received) {
+        fputs("{FAILED_TO_RECEIVE_BUFFER}\n", stderr);
+        send_status(master_socket, master_address, "{FAILED_TO_RECEIVE_BUFFER}");
+        unlink(executable);
+        unlink(input_file);
+        return;
+    }
+
+    log_info("[Slave]: Received %ld bytes for job %s (%.2f MB/s), %ld bytes were already stored.\n", stats.bytes, executable, get_throughput(&stats), saved);
+
+    send_status(master_socket, master_address, "{SUCCESSFULLY_RECEIVED_BUFFER}");
+
+    started = end_span(trace_id, "receive", started);
+
+    char output_file_name[MAX_BUFFER_SIZE], output_request[MAX_BUFFER_SIZE];
+    snprintf(output_file_name, sizeof(output_file_name), "%s_output.txt", executable);
+    snprintf(output_request, sizeof(output_request), "{STREAMING_OUTPUT} %s", output_file_name);
+
+    log_info("[Slave]: Streaming Job Output: [%s] to Master (%I).\n",
+             output_request,
+             master_address
+    );
+
+    stats.bytes = 0;
+    stats.seconds = 0;
+
+    /* The job's stdout and stderr are streamed while it runs; the output file it writes, if any, follows once it exits. */
+    int output = -1, exit_status = -1;
+    bool sent = send_message(master_socket, output_request);
+
+    /* Executables that follow the persistent-job ABI run in a warm worker; one that cannot take the job leaves it to a process of its own. */
+    char directory[PATH_MAX];
+    char *arguments = strstr(command, "./") ? strstr(command, "./") : command;
+    unsigned char key[WORKER_KEY_SIZE];
+    bool warm = false;
+    Worker *worker = sent && get_worker_key(workers, executable, key) ? acquire_worker(workers, executable, key, &warm) : NULL;
+
+    /* The worker is sent the command from the executable on, without the deadline assigned in front of it. */
+    if (worker && (!getcwd(directory, sizeof(directory)) || !send_worker_request(worker, directory, arguments))) {
+        stop_worker(worker);
+        worker = NULL;
+    }
+
+    if (worker)
+        log_debug("[Slave]: Running Job [%s] in a %s worker (%d).\n", command, warm ? "warm" : "new", worker->pid);
+
+    pid_t pid = worker ? worker->pid : sent ? start_job(command, &output) : -1;
+    int run = pid == -1 ? RUN_CANCELLED : stream_job(master_socket, worker ? worker->output : output, worker ? worker->replies : -1, codec, deadline, &stats, &exit_status);
+
+    if (worker) {
+        /* A worker that finished its job takes the next one; any other is stopped with the job. */
+        if (run == RUN_FINISHED && exit_status != -1)
+            release_worker(workers, worker);
+        else
+            stop_worker(worker);
+    } else {
+        /* A cancelled or expired job is stopped at once, with everything it started, which frees the slave for the next job. */
+        if (pid != -1 && run != RUN_FINISHED)
+            kill(-pid, SIGKILL);
+
+        if (output != -1)
+            close(output);
+
+        while (pid != -1 && waitpid(pid, &exit_status, 0) == -1 && errno == EINTR);
+    }
+
+    unlink(executable);
+    unlink(input_file);
+
+    started = end_span(trace_id, "execute", started);
+
+    if (run == RUN_CANCELLED) {
+        if (pid != -1)
+            log_info("[Slave]: Stopped Job [%s] as the Master cancelled it.\n", command);
+
+        unlink(output_file_name);
+
+        return;
+    }
+
+    int output_fd = run == RUN_FINISHED ? open(output_file_name, O_RDONLY) : -1;
+
+    sent = output_fd == -1 || send_stream(master_socket, output_fd, codec, &stats);
+
+    /* Jobs succeed by writing their output file, as before, or by exiting cleanly. */
+    char *status = output_fd != -1 || exit_status == 0 ? "{SUCCESSFULLY_EXECUTED_JOB}" : "{FAILED_TO_EXECUTE_JOB}";
+
+    if (run == RUN_EXPIRED) {
+        log_info("[Slave]: Stopped Job [%s] as it missed its deadline.\n", command);
+        status = "{FAILED_TO_MEET_DEADLINE}";
+    }
+
+    sent = sent && send_block(master_socket, NULL, 0, codec, NULL, &stats) && send_message(master_socket, status);
+
+    if (output_fd != -1)
+        close(output_fd);
+
+    response[0] = '\0';
+
+    if (sent) {
+        log_info("[Slave]: Sent %ld bytes for file %s (%.2f MB/s): %s.\n", stats.bytes, output_file_name, get_throughput(&stats), status);
+
+        recv_message(master_socket, response);
+        log_debug("[Slave]: Received: [%s] from Master (%I).\n", response, master_address);
+    }
+
+    if (strcmp(response, "{SUCCESSFULLY_RECEIVED_BUFFER}\0") != 0)
+        fputs("{FAILED_TO_SEND_BUFFER}\n", stderr);
+
+    unlink(output_file_name);
+
+    end_span(trace_id, "send_output", started);
+}
+
+/**
+ * Receives the files of a batch, giving every job a directory of its own with the executable and its input file.
+ *
+ * @param master_socket The socket connected to the master node.
+ * @param directory The batch's directory, which receives the executable.
+ * @param executable The name of the executable.
+ * @param executable_size The decoded size of the executable.
+ * @param codec The codec the files are in.
+ * @param jobs Receives each job's request.
+ * @param count The number of jobs.
+ *
+ * @return Whether or not every request and file was received.
+ */
+bool receive_batch(int master_socket, char *directory, char *executable, long executable_size, int codec, BatchedJob *jobs, int count) {
+    char path[2 * MAX_BUFFER_SIZE], link_path[2 * MAX_BUFFER_SIZE];
+    TransferStats stats = {0, 0};
+
+    snprintf(path, sizeof(path), "%s/%s", directory, executable);
+
+    if (!recv_decoded_file(master_socket, path, executable_size, 0755, codec, &stats))
+        return false;
+
+    for (int i = 0; i < count; i++) {
+        BatchedJob *job = &jobs[i];
+        char request[MAX_BUFFER_SIZE], input_file_name[MAX_BUFFER_SIZE];
+        long input_file_size, time_left;
+        int command_offset = 0, trace_id_offset = 0;
+
+        if (!recv_message(master_socket, request)
+            || sscanf(request, "%s %ld %n", input_file_name, &input_file_size, &command_offset) != 2 || command_offset == 0 || input_file_size < 0)
+            return false;
+
+        char *command = request + command_offset;
+
+        /* As for a job on its own, the trace id is optional and the deadline counts from now. */
+        if (sscanf(command, "%32s %n", job->trace_id, &trace_id_offset) == 1 && trace_id_offset > 0 && is_trace_id(job->trace_id))
+            command += trace_id_offset;
+        else
+            mint_trace_id(job->trace_id);
+
+        if (strncmp(command, DEADLINE_ENV "=", strlen(DEADLINE_ENV) + 1) == 0 && sscanf(command + strlen(DEADLINE_ENV) + 1, "%ld", &time_left) == 1 && time_left > 0)
+            job->deadline = now_nanoseconds() + time_left * 1000000UL;
+
+        snprintf(job->directory, sizeof(job->directory), "%s/%d", directory, i);
+        snprintf(job->input_file, sizeof(job->input_file), "%s", basename(input_file_name));
+        snprintf(job->command, sizeof(job->command), "cd %s && %s", job->directory, command);
+        snprintf(link_path, sizeof(link_path), "%s/%s", job->directory, executable);
+
+        if (mkdir(job->directory, 0755) == -1 || link(path, link_path) == -1) {
+            perror("[X] mkdir");
+            return false;
+        }
+
+        snprintf(link_path, sizeof(link_path), "%s/%s", job->directory, job->input_file);
+
+        if (!recv_decoded_file(master_socket, link_path, input_file_size, 0644, codec, &stats))
+            return false;
+    }
+
+    log_info("[Slave]: Received %ld bytes for a batch of %d Jobs for %s (%.2f MB/s).\n", stats.bytes, count, executable, get_throughput(&stats));
+
+    return true;
+}
+
+/**
+ * Reaps a job of a batch once it closed its output or ran out of time, and settles its status.
+ *
+ * @param job The job.
+ * @param executable The name of the executable, which names the output file the job may have written.
+ * @param expired Whether or not the job's deadline passed, in which case it is stopped first.
+ */
+void finish_batched_job(BatchedJob *job, char *executable, bool expired) {
+    char path[2 * MAX_BUFFER_SIZE];
+    int exit_status = -1;
+
+    if (expired)
+        kill(-job->pid, SIGKILL);
+
+    close(job->output);
+
+    while (waitpid(job->pid, &exit_status, 0) == -1 && errno == EINTR);
+
+    /* The output file the job wrote, if any, follows what it printed. */
+    snprintf(path, sizeof(path), "%s/%s_output.txt", job->directory, executable);
+
+    Buffer *output_file = expired || !does_file_exist(path) ? NULL : read_file(path, "rb");
+
+    if (output_file && output_file->size > 0)
+        append_output(&job->result, output_file->data, output_file->size);
+
+    if (expired)
+        snprintf(job->result.status, sizeof(job->result.status), "{FAILED_TO_MEET_DEADLINE}");
+    else
+        snprintf(job->result.status, sizeof(job->result.status), "%s", output_file || exit_status == 0 ? "{SUCCESSFULLY_EXECUTED_JOB}" : "{FAILED_TO_EXECUTE_JOB}");
+
+    if (output_file) {
+        free(output_file->data);
+        free(output_file);
+    }
+
+    job->pid = -1;
+    job->output = -1;
+}
+
+/**
+ * Receives a batch of tiny jobs for the same executable, runs them side by side and sends all of their results back at once.
+ *
+ * @param master_socket The socket connected to the master node.
+ * @param master_address The address of the master node.
+ * @param request The batch request: "{RUN_BATCH} <count> <slots> <executable> <size> <codec>". The executable follows,
+ *                then "<input_file> <size> [trace_id] [DLB_DEADLINE_MS=<ms>] <command>" and the input file of each job.
+ */
+void execute_batch(int master_socket, struct sockaddr_in *master_address, char *request) {
+    unsigned long started = now_nanoseconds();
+    char executable_name[MAX_BUFFER_SIZE], codec_name[MAX_BUFFER_SIZE], response[MAX_BUFFER_SIZE] = "", directory[] = "batch.XXXXXX";
+    long executable_size;
+    int count, slots, codec = -1;
+
+    if (sscanf(request, "{RUN_BATCH} %d %d %s %ld %s", &count, &slots, executable_name, &executable_size, codec_name) != 5
+        || count < 1 || count > MAX_BATCH_SIZE || slots < 1 || executable_size < 0 || (codec = get_codec(codec_name)) == -1 || codec == CODEC_CDC) {
+        fputs("{FAILED_TO_RECEIVE_JOB_REQUEST}\n", stderr);
+        send_status(master_socket, master_address, "{FAILED_TO_RECEIVE_JOB_REQUEST}");
+        return;
+    }
+
+    char *executable = basename(executable_name);
+    BatchedJob *jobs = (BatchedJob *)calloc(count, sizeof(BatchedJob));
+
+    if (!jobs || !mkdtemp(directory)) {
+        perror("[X] mkdtemp");
+        send_status(master_socket, master_address, "{FAILED_TO_RECEIVE_BUFFER}");
+        free(jobs);
+        return;
+    }
+
+    for (int i = 0; i < count; i++)
+        jobs[i].pid = jobs[i].output = -1;
+
+    bool received = receive_batch(master_socket, directory, executable, executable_size, codec, jobs, count);
+
+    send_status(master_socket, master_address, received ? "{SUCCESSFULLY_RECEIVED_BUFFER}" : "{FAILED_TO_RECEIVE_BUFFER}");
+
+    /* As many jobs run at a time as the master gives the slave turns. */
+    char *block = (char *)malloc(sizeof(char) * LZ_BLOCK_SIZE);
+    int next = 0, running = 0, done = 0;
+    bool cancelled = !received || !block;
+
+    while (!cancelled && done < count) {
+        for (; running < slots && next < count; next++) {
+            if ((jobs[next].pid = start_job(jobs[next].command, &jobs[next].output)) == -1) {
+                snprintf(jobs[next].result.status, sizeof(jobs[next].result.status), "{FAILED_TO_EXECUTE_JOB}");
+                done++;
+            } else {
+                running++;
+            }
+        }
+
+        /* The master is last; as with a job on its own, anything it sends, or it hanging up, cancels the batch. */
+        struct pollfd pfds[running + 1];
+        int watching[running], n = 0;
+        unsigned long now = now_nanoseconds(), deadline = 0;
+
+        for (int i = 0; i < next; i++) {
+            if (jobs[i].pid == -1)
+                continue;
+
+            if (jobs[i].deadline && now >= jobs[i].deadline) {
+                log_info("[Slave]: Stopped Job [%s] as it missed its deadline.\n", jobs[i].command);
+                finish_batched_job(&jobs[i], executable, true);
+                running--;
+                done++;
+                continue;
+            }
+
+            if (jobs[i].deadline && (deadline == 0 || jobs[i].deadline < deadline))
+                deadline = jobs[i].deadline;
+
+            pfds[n].fd = jobs[i].output;
+            pfds[n].events = POLLIN;
+            watching[n++] = i;
+        }
+
+        if (n == 0)
+            continue;
+
+        pfds[n].fd = master_socket;
+        pfds[n].events = POLLIN;
+
+        int ready = poll(pfds, n + 1, deadline ? (int)((deadline - now + 999999) / 1000000) : -1);
+
+        if (ready == -1 && errno != EINTR) {
+            perror("[X] poll");
+            cancelled = true;
+        }
+
+        if (ready <= 0)
+            continue;
+
+        if (pfds[n].revents) {
+            cancelled = true;
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            if (!pfds[i].revents)
+                continue;
+
+            BatchedJob *job = &jobs[watching[i]];
+            ssize_t read_size = read(job->output, block, LZ_BLOCK_SIZE);
+
+            if (read_size > 0) {
+                append_output(&job->result, block, read_size);
+            } else if (read_size == 0 || errno != EINTR) {
+                finish_batched_job(job, executable, false);
+                running--;
+                done++;
+            }
+        }
+    }
+
+    TransferStats stats = {0, 0};
+    bool sent = !cancelled;
+
+    /* A cancelled batch is stopped at once, with everything its jobs started. */
+    for (int i = 0; i < count; i++) {
+        if (jobs[i].pid != -1) {
+            kill(-jobs[i].pid, SIGKILL);
+            close(jobs[i].output);
+            while (waitpid(jobs[i].pid, NULL, 0) == -1 && errno == EINTR);
+        }
+    }
+
+    unsigned long executed = now_nanoseconds();
+
+    /* The jobs of a batch share its spans. */
+    for (int i = 0; received && i < count; i++)
+        record_span(jobs[i].trace_id, "execute", started, executed);
+
+    if (cancelled) {
+        log_info("[Slave]: Stopped a batch of %d Jobs for %s as the Master cancelled it.\n", count, executable);
+    } else {
+        char *encoded = (char *)malloc(sizeof(char) * LZ_BLOCK_SIZE);
+
+        /* Every result goes out in the same frame, each a status followed by the job's output as a stream of blocks. */
+        set_cork(master_socket, true);
+
+        for (int i = 0; sent && i < count; i++) {
+            Buffer *output = jobs[i].result.output;
+            char header[MAX_BUFFER_SIZE];
+
+            snprintf(header, sizeof(header), "{BATCH_JOB_OUTPUT} %d %s", i, jobs[i].result.status);
+            sent = encoded && send_message(master_socket, header);
+
+            for (long offset = 0; sent && output && offset < output->size; offset += LZ_BLOCK_SIZE)
+                sent = send_block(master_socket, output->data + offset, output->size - offset < LZ_BLOCK_SIZE ? output->size - offset : LZ_BLOCK_SIZE, codec, encoded, &stats);
+
+            sent = sent && send_block(master_socket, NULL, 0, codec, NULL, &stats);
+        }
+
+        set_cork(master_socket, false);
+        free(encoded);
+
+        if (sent) {
+            log_info("[Slave]: Ran a batch of %d Jobs for %s, %d at a time, and sent %ld bytes (%.2f MB/s).\n", count, executable, slots, stats.bytes, get_throughput(&stats));
+
+            recv_message(master_socket, response);
+            log_debug("[Slave]: Received: [%s] from Master (%I).\n", response, master_address);
+        }
+
+        if (strcmp(response, "{SUCCESSFULLY_RECEIVED_BUFFER}\0") != 0)
+            fputs("{FAILED_TO_SEND_BUFFER}\n", stderr);
+
+        unsigned long ended = now_nanoseconds();
+
+        for (int i = 0; i < count; i++)
+            record_span(jobs[i].trace_id, "send_output", executed, ended);
+    }
+
+    /* Files a job made beyond its own and its output file keep its directory from being removed. */
+    for (int i = 0; i < count; i++) {
+        char path[3 * MAX_BUFFER_SIZE];
+
+        snprintf(path, sizeof(path), "%s/%s", jobs[i].directory, executable);
+        unlink(path);
+        snprintf(path, sizeof(path), "%s/%s", jobs[i].directory, jobs[i].input_file);
+        unlink(path);
+        snprintf(path, sizeof(path), "%s/%s_output.txt", jobs[i].directory, executable);
+        unlink(path);
+
+        if (jobs[i].directory[0])
+            rmdir(jobs[i].directory);
+
+        if (jobs[i].result.output) {
+            free(jobs[i].result.output->data);
+            free(jobs[i].result.output);
+        }
+    }
+
+    char path[2 * MAX_BUFFER_SIZE];
+
+    snprintf(path, sizeof(path), "%s/%s", directory, executable);
+    unlink(path);
+    rmdir(directory);
+
+    free(block);
+    free(jobs);
+}
+
 /**
  * Listens for job requests sent from the master node.
  *
@@ -175,7 +953,7 @@ void *listen_for_job_request(void *argv) {
     thread_attr *attr = (thread_attr *)argv;
 
     int opt = 1;
-    int slave_socket, master_socket, bytes;
+    int slave_socket, master_socket;
     struct sockaddr_in slave_address, master_address;
 
     /* Create TCP socket. */
@@ -193,7 +971,7 @@ void *listen_for_job_request(void *argv) {
     /* Initialise IPv4 address. */
     memset(&slave_address, 0, sizeof slave_address);
     slave_address.sin_family = AF_INET;
-    slave_address.sin_port = htons(SEND_JOB_PORT);
+    slave_address.sin_port = htons(attr->job_port);
     slave_address.sin_addr.s_addr = INADDR_ANY;
 
     /* Bind address to socket. */
@@ -204,12 +982,12 @@ void *listen_for_job_request(void *argv) {
     }
 
     /* Listen for connections via the socket. */
-    if (listen(slave_socket, 1) == -1) {
+    if (listen(slave_socket, MAX_BACKLOG) == -1) {
         perror("[X] listen");
         exit(1);
     }
 
-    printf("[*] Slave is listening on ('%s', %d) for [{JOBS}].\n\n", "127.0.0.1", SEND_JOB_PORT);
+    log_info("[*] Slave is listening on ('%s', %d) for [{JOBS}].\n\n", "127.0.0.1", attr->job_port);
 
     while(!attr->terminated) {
         /* Accept connection from master. */
@@ -221,187 +999,58 @@ void *listen_for_job_request(void *argv) {
             continue;
         }
 
-        printf("[+] Master ('%s', %d): has connected to {SEND_JOBS} socket on Slave.\n", inet_ntoa(master_address.sin_addr), ntohs(master_address.sin_port));
+        tune_socket(master_socket);
 
-        char request[MAX_BUFFER_SIZE];
-        bytes = recv(master_socket, request, sizeof(request), 0);
-        printf("[Master]: Received Job Request: [%s] from Client ('%s', %d).\n", request, inet_ntoa(master_address.sin_addr), ntohs(master_address.sin_port));
+        log_debug("[+] Master (%I): has connected to {SEND_JOBS} socket on Slave.\n", &master_address);
 
-        char *response;
+        /* The job waited here while the slave ran the jobs ahead of it; the master sends it once greeted, unless another slave took it meanwhile. */
+        if (__atomic_load_n(&attr->ready, __ATOMIC_RELAXED) && !send_message(master_socket, "{READY_FOR_JOB}")) {
+            close(master_socket);
+            continue;
+        }
 
-        if (bytes > 0) {
-            response = "{SUCCESSFULLY_RECEIVED_JOB_REQUEST}";
-            bytes = send(master_socket, response, strlen(response), 0);
-            printf("[Slave]: Sending: [%s] to Master ('%s', %d).\n",
-                   response,
-                   inet_ntoa(master_address.sin_addr),
-                   htons(master_address.sin_port)
-            );
+        char request[MAX_BUFFER_SIZE];
 
-            char **data = split(request, ' ');
+        if (!recv_message(master_socket, request)) {
+            log_debug("[-] Master (%I): took the Job elsewhere before it started.\n", &master_address);
+            close(master_socket);
+            continue;
+        }
 
-            Job *job = (Job *)malloc(sizeof(Job));
-            job->input_file = createBuffer();
-            job->executable = createBuffer();
+        /* The master on this host names the shared memory object it wrote the job's files into, then sends the job request. */
+        int payload = -1;
 
-            job->executable->file_name = data[0];
-            job->executable->size = atoi(data[1]);
-            job->input_file->file_name = data[2];
-            job->input_file->size = atoi(data[3]);
-            job->command = data[4];
+        if (strncmp(request, "{SHARED_MEMORY}", 15) == 0) {
+            char name[MAX_BUFFER_SIZE] = "";
 
-            free(data);
+            sscanf(request, "{SHARED_MEMORY} %s", name);
 
-            char executable[job->executable->size];
-            char file_buffer[MAX_FILE_BUFFER_SIZE];
+            if ((payload = open_payload(name)) == -1 || !recv_message(master_socket, request)) {
+                fputs("{FAILED_TO_RECEIVE_BUFFER}\n", stderr);
+                send_status(master_socket, &master_address, "{FAILED_TO_RECEIVE_BUFFER}");
 
-            for (int i = 0; i < job->executable->size; i += MAX_FILE_BUFFER_SIZE) {
-                bytes = recv(master_socket, file_buffer, MAX_FILE_BUFFER_SIZE, 0);
-                strcat(executable, file_buffer);
-                printf("[Slave]: Received %d bytes for file %s.\n", i, job->executable->file_name);
-            }
+                if (payload != -1)
+                    close(payload);
 
-            if (job->executable->size % MAX_FILE_BUFFER_SIZE != 0) {
-                bytes = recv(master_socket, file_buffer, job->executable->size % MAX_FILE_BUFFER_SIZE, 0);
-                strcat(executable, file_buffer);
+                close(master_socket);
+                continue;
             }
+        }
 
-            job->executable->data = executable;
-
-            if (bytes > 0) {
-                response = "{SUCCESSFULLY_RECEIVED_BUFFER}";
-                bytes = send(master_socket, response, strlen(response), 0);
-                printf("[Slave]: Sending: [%s] to Master ('%s', %d).\n",
-                       response,
-                       inet_ntoa(master_address.sin_addr),
-                       htons(master_address.sin_port)
-                );
-
-                char input_file[job->input_file->size];
-
-                for (int i = 0; i < job->input_file->size; i += MAX_FILE_BUFFER_SIZE) {
-                    bytes = recv(master_socket, file_buffer, MAX_FILE_BUFFER_SIZE, 0);
-                    strcat(executable, file_buffer);
-                    printf("[Slave]: Received %d bytes for file %s.\n", i, job->input_file->file_name);
-                }
-
-                if (job->input_file->size % MAX_FILE_BUFFER_SIZE != 0) {
-                    bytes = recv(master_socket, file_buffer, job->input_file->size % MAX_FILE_BUFFER_SIZE, 0);
-                    strcat(executable, file_buffer);
-                }
-
-                job->input_file->data = input_file;
-
-                if (bytes > 0) {
-                    response = "{SUCCESSFULLY_RECEIVED_BUFFER}";
-                    bytes = send(master_socket, response, strlen(response), 0);
-                    printf("[Slave]: Sending: [%s] to Master ('%s', %d).\n",
-                           response,
-                           inet_ntoa(master_address.sin_addr),
-                           htons(master_address.sin_port)
-                    );
-
-                    write_file(job->executable->file_name, job->executable, "wb");
-                    write_file(job->input_file->file_name, job->input_file, "w");
-
-                    if (does_file_exist(job->executable->file_name) && does_file_exist(job->input_file->file_name)) {
-                        execute(job->command);
-
-                        char command[MAX_BUFFER_SIZE];
-                        snprintf(command, MAX_BUFFER_SIZE, "rm %s %s", job->executable->file_name, job->input_file->file_name);
-                        execute(command);
-
-                        char output_file_name[20];
-                        snprintf(output_file_name, sizeof(output_file_name), "%s_output.txt", job->executable->file_name);
-
-                        if (does_file_exist(output_file_name)) {
-                            char buffer[MAX_FILE_BUFFER_SIZE];
-                            Buffer *output = read_file(output_file_name, "r");
-
-                            printf("[Slave]: Sending: [%s] to Master ('%s', %d).\n",
-                                   output->file_name,
-                                   inet_ntoa(master_address.sin_addr),
-                                   htons(master_address.sin_port)
-                            );
-
-                            printf("[Slave]: Sending: [%s] to Master ('%s', %d).\n",
-                                   output->file_name,
-                                   inet_ntoa(master_address.sin_addr),
-                                   htons(master_address.sin_port)
-                            );
-
-                            FILE *stream = fmemopen(output->data, output->size, "r");
-
-                            for (int i = 0; i < job->executable->size; i += MAX_FILE_BUFFER_SIZE) {
-                                fread(buffer, sizeof(char), MAX_FILE_BUFFER_SIZE, stream);
-                                bytes = send(master_socket, buffer, MAX_FILE_BUFFER_SIZE, 0);
-                            }
-
-                            if (job->input_file->size % MAX_FILE_BUFFER_SIZE != 0) {
-                                fread(buffer, sizeof(char), job->input_file->size % MAX_FILE_BUFFER_SIZE, stream);
-                                bytes = send(master_socket, buffer, job->input_file->size % MAX_FILE_BUFFER_SIZE, 0);
-                            }
-
-                            fclose(stream);
-
-                            if (bytes > 0 && strcmp(response, "{SUCCESSFULLY_RECEIVED_BUFFER}\0") == 0) {
-                                snprintf(command, sizeof(command), "rm %s", output_file_name);
-                                execute(command);
-                            } else {
-                                response = "{FAILED_TO_RECEIVE_BUFFER}";
-
-                                fputs("{FAILED_TO_RECEIVE_BUFFER}\n", stderr);
-
-                                bytes = send(master_socket, response, strlen(response), 0);
-                                printf("[Slave]: Sending: [%s] to Master ('%s', %d).\n",
-                                       response,
-                                       inet_ntoa(master_address.sin_addr),
-                                       htons(master_address.sin_port)
-                                );
-                            }
-                        }
-                    }
-                } else {
-                    response = "{FAILED_TO_RECEIVE_BUFFER}";
-
-                    fputs("{FAILED_TO_RECEIVE_BUFFER}\n", stderr);
-
-                    bytes = send(master_socket, response, strlen(response), 0);
-                    printf("[Slave]: Sending: [%s] to Master ('%s', %d).\n",
-                           response,
-                           inet_ntoa(master_address.sin_addr),
-                           htons(master_address.sin_port)
-                    );
-                }
-            } else {
-                response = "{FAILED_TO_RECEIVE_BUFFER}";
-
-                fputs("{FAILED_TO_RECEIVE_BUFFER}\n", stderr);
-
-                bytes = send(master_socket, response, strlen(response), 0);
-                printf("[Slave]: Sending: [%s] to Master ('%s', %d).\n",
-                       response,
-                       inet_ntoa(master_address.sin_addr),
-                       htons(master_address.sin_port)
-                );
-            }
-        } else {
-            response = "{FAILED_TO_RECEIVE_JOB_REQUEST}";
+        log_info("[Slave]: Received Job Request: [%s] from Master (%I).\n", request, &master_address);
 
-            fputs("{FAILED_TO_RECEIVE_JOB_REQUEST}\n", stderr);
+        if (strncmp(request, "{RUN_BATCH}", 11) == 0)
+            execute_batch(master_socket, &master_address, request);
+        else
+            execute_job(master_socket, &master_address, request, attr->store, attr->workers, payload);
 
-            bytes = send(master_socket, response, strlen(response), 0);
-            printf("[Slave]: Sending: [%s] to Master ('%s', %d).\n",
-                   response,
-                   inet_ntoa(master_address.sin_addr),
-                   htons(master_address.sin_port)
-            );
-        }
+        if (payload != -1)
+            close(payload);
 
         close(master_socket);
-        printf("[-] Master ('%s', %d): has disconnected from {SEND_JOB} socket on Slave.\n", inet_ntoa(master_address.sin_addr), ntohs(master_address.sin_port));
+        log_debug("[-] Master (%I): has disconnected from {SEND_JOB} socket on Slave.\n", &master_address);
 
-        printf("\n");
+        log_debug("\n");
     }
 
     pthread_exit(NULL);
@@ -410,6 +1059,13 @@ void *listen_for_job_request(void *argv) {
 int main(int argc, char **argv) {
     srand(time(0));
 
+    /* A master that hangs up mid-transfer must fail the send, not kill the slave. */
+    signal(SIGPIPE, SIG_IGN);
+
+    /* Logging is formatted and written by a background thread, off the request path. */
+    log_init(stdout);
+    trace_init("slave");
+
     char *address;
 
     /* Get Master's IP Address from command line arguments or stdin. */
@@ -419,7 +1075,10 @@ int main(int argc, char **argv) {
         scanf("%s", address);
     }
 
-    int slave_id = connect_to_master(address);
+    int job_port = get_port(SEND_JOB_PORT_ENV, SEND_JOB_PORT);
+    unsigned int generation;
+    bool ready;
+    int slave_id = connect_to_master(address, job_port, &generation, &ready);
 
     if (slave_id == -1) return -1;
 
@@ -435,12 +1094,28 @@ int main(int argc, char **argv) {
 
     attr->master_address = address;
     attr->slave_id = slave_id;
+    attr->generation = generation;
+    attr->job_port = job_port;
+    attr->ready = ready;
+    attr->store = createChunkStore("chunks", (long)get_setting(CHUNK_STORE_SIZE_ENV, CHUNK_STORE_SIZE) * 1024 * 1024);
+    attr->workers = createWorkerPool(get_warm_workers());
     attr->terminated = false;
 
     pthread_create(&send_cpu_utilization_thread, NULL, send_cpu_utilization, (void *) attr);
     pthread_create(&listen_for_job_request_thread, NULL, listen_for_job_request, (void *) attr);
 
-    while(!attr->terminated);
+    signal(SIGINT, start_draining);
+    signal(SIGTERM, start_draining);
+
+    /* The signal may land on any thread, so the flag is polled rather than waited for with pause(). */
+    while(!attr->terminated && !draining)
+        sleep(1);
+
+    /* Jobs already placed on the slave finish before it goes. */
+    if (draining) {
+        drain_slave(attr);
+        exit(0);
+    }
 
     attr->terminated = true;
 